@@ -0,0 +1,205 @@
+/*****************************************************************************
+ *
+ * FILE: shamecast.h
+ *
+ *   Shamecast blocks and the shared memory table in which shamecheck keeps
+ *   the latest block for each name. Clients map the table read-only
+ *   (shame_shm_open()) and read blocks with shame_shm_read() without locks
+ *   or system calls: every slot has a sequence count (seqlock) that is odd
+ *   while shamecheck writes the slot, so a reader copies the slot and
+ *   retries if the count was odd or changed meanwhile.
+ *   A restarted shamecheck unlinks the table and creates a new one; clients
+ *   open it again when shame_shm_alive() returns 0 for the old one.
+ *   Python clients: see shamecast_shm.py.
+ *
+ *   shamecheck -r also records the blocks to an append-only log with a time
+ *   index (SHAME_LOG_*), which shamereplay sends out again.
+ *
+ *****************************************************************************/
+
+#ifndef SHAMECAST_H
+#define SHAMECAST_H
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+#define SHAME_NAME_LEN         16
+#define SHAME_DATA_MAX      10000
+
+#define SHAME_SHM_NAME      "/shamecast"
+#define SHAME_SHM_MAGIC     0x454d4853      /*  "SHME"  */
+#define SHAME_SHM_VERSION   1
+#define SHAME_SHM_SPIN      1024            /*  tries between alive checks  */
+
+
+/*  A shamecast block as it is sent  */
+
+struct GEN_SHAME_BLOCK {
+  char name[SHAME_NAME_LEN];
+  int size;
+  int version;
+  int timestamp;
+  int flag;
+  char data[SHAME_DATA_MAX];
+};
+
+#define SHAME_HEAD_LEN  (sizeof(struct GEN_SHAME_BLOCK) - SHAME_DATA_MAX)
+
+
+/*  Start of the table, the slots follow (slot_size bytes each). Slots are
+    taken in order of the first arrival of a name, nused of them; the name
+    of a slot does not change once it is taken  */
+
+struct SHAME_SHM_HEAD {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t nslots;
+  uint32_t slot_size;
+  uint32_t nused;
+  int32_t pid;                /*  of shamecheck, 0 when it stopped  */
+  uint64_t received;          /*  blocks  */
+  uint64_t dropped;           /*  blocks too short or without free slot  */
+} __attribute__((aligned(64)));
+
+/*  The latest block of one name  */
+
+struct SHAME_SHM_SLOT {
+  uint32_t seq;               /*  odd while being written  */
+  uint32_t length;            /*  bytes of data received  */
+  char name[SHAME_NAME_LEN];  /*  NUL padded  */
+  int32_t size;               /*  header of the block  */
+  int32_t version;
+  int32_t timestamp;
+  int32_t flag;
+  int64_t received_ns;        /*  reception time (CLOCK_REALTIME)  */
+  uint64_t count;             /*  blocks received with this name  */
+  uint32_t group;             /*  multicast address (host order) and port  */
+  uint32_t port;
+  char data[SHAME_DATA_MAX];
+} __attribute__((aligned(64)));
+
+#define SHAME_SHM_SLOT(head, i) \
+  ((struct SHAME_SHM_SLOT *) ((char *) (head) + sizeof(struct SHAME_SHM_HEAD) \
+                              + (size_t) (i) * (head)->slot_size))
+
+
+/*  Map the table read-only, NULL if there is none  */
+
+static inline const struct SHAME_SHM_HEAD *shame_shm_open(const char *name) {
+
+  struct stat st;
+  const struct SHAME_SHM_HEAD *head;
+  int fd;
+
+  fd = shm_open(name ? name : SHAME_SHM_NAME, O_RDONLY, 0);
+  if ( fd < 0 )
+    return NULL;
+  if ( fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(*head) ) {
+    close(fd);
+    return NULL;
+  }
+  head = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if ( head == MAP_FAILED )
+    return NULL;
+  if ( head->magic != SHAME_SHM_MAGIC || head->version != SHAME_SHM_VERSION ) {
+    munmap((void *) head, st.st_size);
+    return NULL;
+  }
+  return head;
+}
+
+
+/*  1 while the shamecheck of this table runs, 0 when it stopped or died
+    (then a new table may have replaced this one: open it again)  */
+
+static inline int shame_shm_alive(const struct SHAME_SHM_HEAD *head) {
+
+  int32_t pid = __atomic_load_n(&head->pid, __ATOMIC_RELAXED);
+
+  return pid > 0 && ( kill(pid, 0) == 0 || errno == EPERM );
+}
+
+
+/*  Copy slot i consistently to out, 0 if done, -1 if the slot stays odd or
+    changing while shamecheck is gone (it died while writing the slot)  */
+
+static inline int shame_shm_copy(const struct SHAME_SHM_HEAD *head,
+                                 uint32_t i, struct SHAME_SHM_SLOT *out) {
+
+  const struct SHAME_SHM_SLOT *slot = SHAME_SHM_SLOT(head, i);
+  uint32_t seq, tries;
+
+  for ( tries = 1; ; tries++ ) {
+    seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if ( !(seq & 1) ) {
+      memcpy(out, slot, sizeof(*out));
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      if ( __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq )
+        return 0;
+    }
+    if ( tries % SHAME_SHM_SPIN == 0 ) {
+      if ( !shame_shm_alive(head) )
+        return -1;
+      sched_yield();
+    }
+  }
+}
+
+
+/*  Latest block with the given name, 0 if found, -1 if not (yet), -2 if
+    its slot cannot be read (see shame_shm_copy())  */
+
+static inline int shame_shm_read(const struct SHAME_SHM_HEAD *head,
+                                 const char *name,
+                                 struct SHAME_SHM_SLOT *out) {
+
+  uint32_t i, nused = __atomic_load_n(&head->nused, __ATOMIC_ACQUIRE);
+
+  for ( i = 0; i < nused; i++ )
+    if ( strncmp(SHAME_SHM_SLOT(head, i)->name, name, SHAME_NAME_LEN) == 0 ) {
+      return shame_shm_copy(head, i, out) < 0 ? -2 : 0;
+    }
+  return -1;
+}
+
+
+/*  Log of shamecheck -r: SHAME_LOG_HEAD, then for every datagram received a
+    SHAME_LOG_REC followed by the datagram as it was (block header and data),
+    padded to 8 bytes. The index (log name + ".idx") has a SHAME_LOG_IDX for
+    the first record of every second with traffic  */
+
+#define SHAME_LOG_MAGIC     "SHLG"
+#define SHAME_LOG_VERSION   1
+#define SHAME_LOG_ALIGN     8
+
+struct SHAME_LOG_HEAD {
+  char magic[4];
+  uint32_t version;
+};
+
+struct SHAME_LOG_REC {
+  int64_t received_ns;        /*  reception time (CLOCK_REALTIME)  */
+  uint32_t group;             /*  multicast address (host order) and port  */
+  uint16_t port;
+  uint16_t length;            /*  bytes of the datagram  */
+};
+
+struct SHAME_LOG_IDX {
+  int64_t received_ns;
+  int64_t offset;             /*  of the SHAME_LOG_REC in the log  */
+};
+
+#define SHAME_LOG_RECLEN(length) \
+  ((sizeof(struct SHAME_LOG_REC) + (length) + SHAME_LOG_ALIGN - 1) \
+   & ~(size_t) (SHAME_LOG_ALIGN - 1))
+
+#endif
@@ -0,0 +1,124 @@
+"""Read the latest shamecast blocks from the shared memory table of shamecheck
+
+shamecheck (run e.g. as 'shamecheck -q') keeps the latest block of each
+name in a shared memory table, see shamecast.h for the layout. Reading is
+lock-free: a slot whose sequence count is odd or changes while copying is
+read again. If shamecheck died while writing a slot, reading it raises
+ShameTableStale; a restarted shamecheck makes a new table, so open it again.
+
+    table = ShameTable()
+    block = table.read('LOFAR_SE607')
+    if block:
+        cab3temp, cab3hum = struct.unpack('<ff', block['data'][:8])
+"""
+import mmap
+import os
+import struct
+import time
+
+SHAME_SHM_NAME = '/shamecast'
+SHAME_SHM_MAGIC = 0x454d4853
+SHAME_SHM_VERSION = 1
+SHAME_NAME_LEN = 16
+SHAME_SHM_SPIN = 1024  # tries between alive checks
+
+# magic, version, nslots, slot_size, nused, pid, received, dropped
+SHAME_SHM_HEAD_fmt = '<IIIIIiQQ'
+SHAME_SHM_HEAD_len = 64  # aligned
+# seq, length, name, size, version, timestamp, flag, received_ns, count,
+# group, port (then the data)
+SHAME_SHM_SLOT_fmt = '<II16siiiiqQII'
+SHAME_SHM_SLOT_len = struct.calcsize(SHAME_SHM_SLOT_fmt)
+
+
+class ShameTableStale(RuntimeError):
+    """The shamecheck of the table is gone while a slot was being written"""
+
+
+class ShameTable:
+    """Read-only mapping of the table (POSIX shm, i.e. in /dev/shm)"""
+
+    def __init__(self, shm_name=SHAME_SHM_NAME):
+        with open('/dev/shm/' + shm_name.lstrip('/'), 'rb') as f:
+            self._map = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        (magic, version, self.nslots, self.slot_size
+         ) = struct.unpack_from('<IIII', self._map)
+        if magic != SHAME_SHM_MAGIC or version != SHAME_SHM_VERSION:
+            raise ValueError("Not a shamecast table: " + shm_name)
+
+    def close(self):
+        self._map.close()
+
+    def status(self):
+        """Names in use, pid of shamecheck (0 if stopped), blocks
+        received and dropped"""
+        (_magic, _version, _nslots, _slot_size, nused, pid, received,
+         dropped) = struct.unpack_from(SHAME_SHM_HEAD_fmt, self._map)
+        return {'nused': nused, 'pid': pid, 'received': received,
+                'dropped': dropped}
+
+    def alive(self):
+        """True while the shamecheck of this table runs; when False a new
+        table may have replaced it, open it again"""
+        pid = self.status()['pid']
+        if pid <= 0:
+            return False
+        try:
+            os.kill(pid, 0)
+        except ProcessLookupError:
+            return False
+        except PermissionError:
+            pass
+        return True
+
+    def _offset(self, i):
+        return SHAME_SHM_HEAD_len + i * self.slot_size
+
+    def _copy(self, i):
+        offset = self._offset(i)
+        tries = 0
+        while True:
+            seq = struct.unpack_from('<I', self._map, offset)[0]
+            if not seq & 1:
+                fields = struct.unpack_from(SHAME_SHM_SLOT_fmt, self._map,
+                                            offset)
+                data = self._map[offset + SHAME_SHM_SLOT_len:
+                                 offset + SHAME_SHM_SLOT_len + fields[1]]
+                if struct.unpack_from('<I', self._map, offset)[0] == seq:
+                    break
+            tries += 1
+            if tries % SHAME_SHM_SPIN == 0 and not self.alive():
+                raise ShameTableStale("shamecheck stopped while writing slot "
+                                      "%d, open the table again" % i)
+            time.sleep(0)
+        (_seq, length, name, size, version, timestamp, flag, received_ns,
+         count, group, port) = fields
+        return {'name': name.rstrip(b'\0').decode('utf-8', 'replace'),
+                'size': size, 'version': version, 'timestamp': timestamp,
+                'flag': flag, 'received': received_ns / 1e9, 'count': count,
+                'group': '.'.join(str(group >> s & 255)
+                                  for s in (24, 16, 8, 0)),
+                'port': port, 'data': data}
+
+    def names(self):
+        """Names of the blocks received so far"""
+        return [self._map[self._offset(i) + 8:
+                          self._offset(i) + 8 + SHAME_NAME_LEN]
+                .rstrip(b'\0').decode('utf-8', 'replace')
+                for i in range(self.status()['nused'])]
+
+    def read(self, name):
+        """Latest block with this name as a dict, None if none yet"""
+        ename = name.encode('utf-8')[:SHAME_NAME_LEN]
+        for i in range(self.status()['nused']):
+            offset = self._offset(i) + 8
+            if (self._map[offset:offset + SHAME_NAME_LEN].rstrip(b'\0')
+                    == ename):
+                return self._copy(i)
+        return None
+
+    def read_all(self):
+        """Latest block of every name, as {name: block}"""
+        return {block['name']: block
+                for block in (self._copy(i)
+                              for i in range(self.status()['nused']))}
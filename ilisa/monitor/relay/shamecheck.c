@@ -6,6 +6,27 @@
  *   connect to the shamecast socket and then print out the names, sizes,
  *   version numbers and time stamps of all shamecast packages arriving.
  *
+ *   It also keeps the latest block of each name in a shared memory table
+ *   (see shamecast.h) from which clients, e.g. stnMonitorRelay.py through
+ *   shamecast_shm.py, read without parsing the output. With -q nothing is
+ *   printed and it runs as a receiver daemon. With -r every datagram is
+ *   appended to a log with a time index, for shamereplay.
+ *
+ *   Usage: shamecheck [-q] [-g group[:port]]... [-p port] [-i interface]
+ *                     [-s shm_name] [-n slots] [-b batch] [-r log]
+ *
+ *     -g  multicast group to join, may be repeated (default 224.1.1.4)
+ *     -p  port of groups given without one (default 4242)
+ *     -i  address of the interface to join on (default any)
+ *     -s  name of the shared memory table (default /shamecast), "" for none
+ *     -n  number of names the table can hold (default 256)
+ *     -b  datagrams received per system call (default 32)
+ *     -r  append the datagrams to this log (index in log.idx, see
+ *         shamecast.h)
+ *     -q  quiet
+ *
+ *   Build:  gcc -Wall -O2 -o shamecheck shamecheck.c -lrt
+ *
  * HISTORY
  *
  * who          when           what
@@ -14,50 +35,104 @@
  *
  *****************************************************************************/
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "shamecast.h"
 
 
 #define MULTICAST_ADDRESS   0xe0010104
 #define MULTICAST_PORT            4242
 
+#define MAX_GROUPS                  16
+#define MAX_BATCH                  256
 
-/*  Define a general shamecast block that we can use for reading arbitrary
-    shamecast blocks  */
 
-struct GEN_SHAME_BLOCK {
-  char name[16];
-  int size;
-  int version;
-  int timestamp;
-  int flag;
-  char data[10000];
-} gen_block;
+const int ttl = 1;
 
 
-const int ttl = 1;
+/*  The groups we listen to, one socket each  */
 
+struct GROUP {
+  uint32_t address;
+  uint16_t port;
+  int sock;
+} groups[MAX_GROUPS];
+int ngroups = 0;
 
 
-int main(int argc, char *argv[]) {
+/*  Buffers for one batch of datagrams  */
+
+struct GEN_SHAME_BLOCK blocks[MAX_BATCH];
+struct mmsghdr msgs[MAX_BATCH];
+struct iovec iovecs[MAX_BATCH];
+
+
+/*  The shared memory table, and the slot of each name (open addressing on
+    a hash of the name, only used here; readers search the table)  */
+
+struct SHAME_SHM_HEAD *table = NULL;
+int *name_slot;
+uint32_t name_slots;
+
+
+/*  The log of -r, written through large stdio buffers and flushed once a
+    second  */
+
+#define LOG_BUFFER  (1 << 20)
+
+FILE *log_file = NULL, *log_index;
+int64_t log_offset;
+int64_t log_second = -1;
+
+
+/*  Set by SIGINT and SIGTERM, to stop cleanly  */
+
+volatile sig_atomic_t stopping = 0;
+
+
+
+void usage(const char *prog) {
+
+  fprintf(stderr, "Usage: %s [-q] [-g group[:port]]... [-p port] "
+          "[-i interface]\n"
+          "       [-s shm_name] [-n slots] [-b batch] [-r log]\n", prog);
+  exit(1);
+}
+
+
+void stop(int sig) {
+
+  stopping = 1;
+}
+
+
+/*  Join a group and bind a socket to it  */
+
+int open_group(struct GROUP *group, uint32_t interface) {
 
   struct sockaddr_in from;
   struct ip_mreq multiaddr;
-  socklen_t fromlen;
   int sock;
   int itmp;
-  char origin[20];
-  time_t now;
-  char timestring[80];
-
-/*  Set up the socket where we will listen for shamecasts  */
 
   sock = socket(AF_INET, SOCK_DGRAM, 0);
+  if ( sock < 0 ) {
+    perror("socket failed");
+    exit(1);
+  }
 
   itmp = 1;
   if ( setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &itmp,
@@ -66,8 +141,8 @@ int main(int argc, char *argv[]) {
     exit(1);
   }
 
-  multiaddr.imr_multiaddr.s_addr = htonl(MULTICAST_ADDRESS);
-  multiaddr.imr_interface.s_addr = htonl(INADDR_ANY);
+  multiaddr.imr_multiaddr.s_addr = htonl(group->address);
+  multiaddr.imr_interface.s_addr = interface;
 
   if ( setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &multiaddr,
                   sizeof(multiaddr)) < 0 ) {
@@ -84,29 +159,389 @@ int main(int argc, char *argv[]) {
 /*  Set up the source address and UDP port  */
 
   from.sin_family = AF_INET;
-  from.sin_addr.s_addr = htonl(MULTICAST_ADDRESS);
-  from.sin_port = htons(MULTICAST_PORT);
+  from.sin_addr.s_addr = htonl(group->address);
+  from.sin_port = htons(group->port);
 
   if ( bind(sock, (struct sockaddr *) &from,
             sizeof(struct sockaddr_in) ) < 0 ) {
     perror("bind socket failed");
     exit(1);
   }
+  return sock;
+}
 
-/*  Start the eternal shamechecking loop --- we read in the shamecast blocks
-    into the general block 'gen_block' and then print out information from
-    the headers  */
 
-  while ( 1 ) {
-    fromlen = sizeof(struct sockaddr_in);
-    if ( ( recvfrom(sock, &gen_block, sizeof(gen_block),
-                    MSG_WAITALL, (struct sockaddr*) &from, &fromlen)) < 0 )
-      continue;
-    now = time(NULL);
-    strcpy(timestring, ctime(&now));
-    strncpy(origin, gen_block.name, 16);
-    printf("Received block '%-16s' (%4d) ver. %d  -  %s", origin,
-           gen_block.size, gen_block.version, timestring);
+/*  Create the shared memory table. An old one is unlinked, not resized:
+    clients that still map it keep their pages (and see pid 0 or a dead
+    pid there) and open the new one  */
+
+void open_table(const char *shm_name, uint32_t nslots) {
+
+  size_t size;
+  int fd;
+
+  size = sizeof(struct SHAME_SHM_HEAD)
+         + (size_t) nslots * sizeof(struct SHAME_SHM_SLOT);
+  if ( shm_unlink(shm_name) < 0 && errno != ENOENT ) {
+    perror("shm_unlink failed");
+    exit(1);
   }
+  fd = shm_open(shm_name, O_CREAT | O_EXCL | O_RDWR, 0644);
+  if ( fd < 0 ) {
+    perror("shm_open failed");
+    exit(1);
+  }
+  if ( ftruncate(fd, size) < 0 ) {
+    perror("ftruncate of shared memory failed");
+    exit(1);
+  }
+  table = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if ( table == MAP_FAILED ) {
+    perror("mmap of shared memory failed");
+    exit(1);
+  }
+  close(fd);
+
+  table->version = SHAME_SHM_VERSION;
+  table->nslots = nslots;
+  table->slot_size = sizeof(struct SHAME_SHM_SLOT);
+  table->pid = getpid();
+  __atomic_store_n(&table->magic, SHAME_SHM_MAGIC, __ATOMIC_RELEASE);
+
+  for ( name_slots = 1; name_slots < 2 * nslots; name_slots *= 2 )
+    ;
+  name_slot = malloc(name_slots * sizeof(int));
+  if ( name_slot == NULL ) {
+    perror("malloc failed");
+    exit(1);
+  }
+  memset(name_slot, -1, name_slots * sizeof(int));
 }
 
+
+/*  The slot of a name (NUL padded), a new one for a new name, NULL if the
+    table is full  */
+
+struct SHAME_SHM_SLOT *find_slot(const char *name) {
+
+  struct SHAME_SHM_SLOT *slot;
+  uint32_t hash = 2166136261u;
+  int i;
+
+  for ( i = 0; i < SHAME_NAME_LEN; i++ )
+    hash = (hash ^ (unsigned char) name[i]) * 16777619u;
+  for ( hash &= name_slots - 1; name_slot[hash] >= 0;
+        hash = (hash + 1) & (name_slots - 1) ) {
+    slot = SHAME_SHM_SLOT(table, name_slot[hash]);
+    if ( memcmp(slot->name, name, SHAME_NAME_LEN) == 0 )
+      return slot;
+  }
+  if ( table->nused == table->nslots )
+    return NULL;
+
+  name_slot[hash] = table->nused;
+  slot = SHAME_SHM_SLOT(table, table->nused);
+  memcpy(slot->name, name, SHAME_NAME_LEN);
+  __atomic_store_n(&table->nused, table->nused + 1, __ATOMIC_RELEASE);
+  return slot;
+}
+
+
+/*  Keep a received block as the latest of its name  */
+
+void store_block(const struct GEN_SHAME_BLOCK *block, int len,
+                 const struct GROUP *group, int64_t now_ns) {
+
+  struct SHAME_SHM_SLOT *slot;
+  char name[SHAME_NAME_LEN];
+  uint32_t seq;
+
+  table->received++;
+  if ( len < (int) SHAME_HEAD_LEN ) {
+    table->dropped++;
+    return;
+  }
+  strncpy(name, block->name, SHAME_NAME_LEN);
+  slot = find_slot(name);
+  if ( slot == NULL ) {
+    table->dropped++;
+    return;
+  }
+
+/*  Odd sequence count while the slot is inconsistent  */
+
+  seq = slot->seq;
+  __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  slot->length = len - SHAME_HEAD_LEN;
+  slot->size = block->size;
+  slot->version = block->version;
+  slot->timestamp = block->timestamp;
+  slot->flag = block->flag;
+  slot->received_ns = now_ns;
+  slot->count++;
+  slot->group = group->address;
+  slot->port = group->port;
+  memcpy(slot->data, block->data, slot->length);
+  __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+
+
+/*  Open the log and its index for appending, a new log gets a header. Of
+    an existing log a record cut off at the end (when shamecheck was killed)
+    is dropped, looking for it from the last index entry on  */
+
+void open_log(const char *name) {
+
+  struct SHAME_LOG_HEAD head;
+  struct SHAME_LOG_REC rec;
+  struct SHAME_LOG_IDX idx;
+  char index_name[4096];
+  int64_t size;
+
+  snprintf(index_name, sizeof(index_name), "%s.idx", name);
+  log_index = fopen(index_name, "ab");
+  log_file = fopen(name, "r+b");
+  if ( log_file == NULL && errno == ENOENT )
+    log_file = fopen(name, "w+b");
+  if ( log_file == NULL || log_index == NULL ) {
+    perror("opening log failed");
+    exit(1);
+  }
+  setvbuf(log_file, NULL, _IOFBF, LOG_BUFFER);
+  fseeko(log_file, 0, SEEK_END);
+  size = ftello(log_file);
+
+  if ( size == 0 ) {
+    memcpy(head.magic, SHAME_LOG_MAGIC, 4);
+    head.version = SHAME_LOG_VERSION;
+    if ( fwrite(&head, sizeof(head), 1, log_file) != 1 ) {
+      perror("writing log failed");
+      exit(1);
+    }
+    log_offset = sizeof(head);
+  } else {
+    rewind(log_file);
+    if ( fread(&head, sizeof(head), 1, log_file) != 1 ||
+         memcmp(head.magic, SHAME_LOG_MAGIC, 4) != 0 ||
+         head.version != SHAME_LOG_VERSION ) {
+      fprintf(stderr, "%s is not a shamecast log\n", name);
+      exit(1);
+    }
+    log_offset = sizeof(head);
+    fseeko(log_index, 0, SEEK_END);
+    if ( ftello(log_index) >= (off_t) sizeof(idx) ) {
+      FILE *f = fopen(index_name, "rb");
+
+      if ( f && fseeko(f, (ftello(log_index) / sizeof(idx) - 1)
+                          * sizeof(idx), SEEK_SET) == 0 &&
+           fread(&idx, sizeof(idx), 1, f) == 1 && idx.offset <= size )
+        log_offset = idx.offset;
+      if ( f )
+        fclose(f);
+    }
+    while ( fseeko(log_file, log_offset, SEEK_SET) == 0 &&
+            fread(&rec, sizeof(rec), 1, log_file) == 1 &&
+            log_offset + (int64_t) SHAME_LOG_RECLEN(rec.length) <= size )
+      log_offset += SHAME_LOG_RECLEN(rec.length);
+    if ( log_offset < size && ftruncate(fileno(log_file), log_offset) < 0 ) {
+      perror("truncating log failed");
+      exit(1);
+    }
+    fseeko(log_file, log_offset, SEEK_SET);
+  }
+}
+
+
+/*  Append a datagram to the log, and to the index if it is the first of
+    a second  */
+
+void record_block(const struct GEN_SHAME_BLOCK *block, int len,
+                  const struct GROUP *group, int64_t now_ns) {
+
+  static const char pad[SHAME_LOG_ALIGN];
+  struct SHAME_LOG_REC rec;
+  struct SHAME_LOG_IDX idx;
+  size_t reclen = SHAME_LOG_RECLEN(len);
+  size_t padlen = reclen - sizeof(rec) - len;
+
+  rec.received_ns = now_ns;
+  rec.group = group->address;
+  rec.port = group->port;
+  rec.length = len;
+  if ( now_ns / 1000000000 != log_second ) {
+    log_second = now_ns / 1000000000;
+    idx.received_ns = now_ns;
+    idx.offset = log_offset;
+    fflush(log_file);
+    if ( fwrite(&idx, sizeof(idx), 1, log_index) != 1 ||
+         fflush(log_index) != 0 ) {
+      perror("writing log index failed");
+      exit(1);
+    }
+  }
+  if ( fwrite(&rec, sizeof(rec), 1, log_file) != 1 ||
+       ( len > 0 && fwrite(block, len, 1, log_file) != 1 ) ||
+       ( padlen > 0 && fwrite(pad, padlen, 1, log_file) != 1 ) ) {
+    perror("writing log failed");
+    exit(1);
+  }
+  log_offset += reclen;
+}
+
+
+
+int main(int argc, char *argv[]) {
+
+  struct pollfd pollfds[MAX_GROUPS];
+  struct in_addr addr;
+  struct timespec ts;
+  uint32_t interface = htonl(INADDR_ANY);
+  uint32_t nslots = 256;
+  int port = MULTICAST_PORT;
+  int batch = 32;
+  int quiet = 0;
+  const char *shm_name = SHAME_SHM_NAME;
+  const char *log_name = NULL;
+  char *colon;
+  char origin[20];
+  time_t now, printed = 0;
+  char timestring[80];
+  int64_t now_ns;
+  int c, g, i, n;
+
+  while ( (c = getopt(argc, argv, "g:p:i:s:n:b:r:q")) != -1 ) {
+    switch ( c ) {
+    case 'g':
+      if ( ngroups == MAX_GROUPS ) {
+        fprintf(stderr, "at most %d groups\n", MAX_GROUPS);
+        exit(1);
+      }
+      colon = strchr(optarg, ':');
+      if ( colon )
+        *colon = '\0';
+      if ( inet_aton(optarg, &addr) == 0 ||
+           !IN_MULTICAST(ntohl(addr.s_addr)) ) {
+        fprintf(stderr, "problem with group %s\n", optarg);
+        exit(1);
+      }
+      groups[ngroups].address = ntohl(addr.s_addr);
+      groups[ngroups].port = colon ? atoi(colon + 1) : 0;
+      ngroups++;
+      break;
+    case 'p':
+      port = atoi(optarg);
+      break;
+    case 'i':
+      if ( inet_aton(optarg, &addr) == 0 ) {
+        fprintf(stderr, "problem with interface %s\n", optarg);
+        exit(1);
+      }
+      interface = addr.s_addr;
+      break;
+    case 's':
+      shm_name = optarg;
+      break;
+    case 'n':
+      nslots = atoi(optarg);
+      break;
+    case 'b':
+      batch = atoi(optarg);
+      break;
+    case 'r':
+      log_name = optarg;
+      break;
+    case 'q':
+      quiet = 1;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if ( optind < argc || port <= 0 || port > 65535 || nslots < 1 ||
+       batch < 1 || batch > MAX_BATCH )
+    usage(argv[0]);
+  if ( ngroups == 0 ) {
+    groups[0].address = MULTICAST_ADDRESS;
+    ngroups = 1;
+  }
+
+/*  Set up the sockets where we will listen for shamecasts  */
+
+  for ( g = 0; g < ngroups; g++ ) {
+    if ( groups[g].port == 0 )
+      groups[g].port = port;
+    groups[g].sock = open_group(&groups[g], interface);
+    pollfds[g].fd = groups[g].sock;
+    pollfds[g].events = POLLIN;
+  }
+  if ( shm_name[0] )
+    open_table(shm_name, nslots);
+  if ( log_name )
+    open_log(log_name);
+
+  signal(SIGINT, stop);
+  signal(SIGTERM, stop);
+
+  for ( i = 0; i < batch; i++ ) {
+    iovecs[i].iov_base = &blocks[i];
+    iovecs[i].iov_len = sizeof(blocks[i]);
+    msgs[i].msg_hdr.msg_iov = &iovecs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+/*  Start the eternal shamechecking loop --- we read in batches of shamecast
+    blocks from every group that has some, keep them in the table and then
+    print out information from the headers  */
+
+  while ( !stopping ) {
+    n = poll(pollfds, ngroups, log_file ? 1000 : -1);
+    if ( n < 0 ) {
+      if ( errno == EINTR )
+        continue;
+      perror("poll failed");
+      exit(1);
+    }
+    if ( n == 0 ) {
+      fflush(log_file);  /*  quiet for a second  */
+      continue;
+    }
+    for ( g = 0; g < ngroups; g++ ) {
+      if ( !(pollfds[g].revents & POLLIN) )
+        continue;
+      n = recvmmsg(groups[g].sock, msgs, batch, MSG_DONTWAIT, NULL);
+      if ( n <= 0 )
+        continue;
+      clock_gettime(CLOCK_REALTIME, &ts);
+      now_ns = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+      for ( i = 0; i < n; i++ ) {
+        if ( table )
+          store_block(&blocks[i], msgs[i].msg_len, &groups[g], now_ns);
+        if ( log_file )
+          record_block(&blocks[i], msgs[i].msg_len, &groups[g], now_ns);
+        if ( quiet )
+          continue;
+        now = ts.tv_sec;
+        if ( now != printed ) {
+          strcpy(timestring, ctime(&now));
+          printed = now;
+        }
+        strncpy(origin, blocks[i].name, 16);
+        origin[16] = '\0';
+        printf("Received block '%-16s' (%4d) ver. %d  -  %s", origin,
+               blocks[i].size, blocks[i].version, timestring);
+      }
+      if ( !quiet )
+        fflush(stdout);
+    }
+  }
+
+  if ( log_file ) {
+    fclose(log_file);
+    fclose(log_index);
+  }
+  if ( table )
+    table->pid = 0;
+  return 0;
+}
@@ -0,0 +1,320 @@
+/*****************************************************************************
+ *
+ * FILE: shamereplay.c
+ *
+ *   This program sends the shamecasts recorded by shamecheck -r out again,
+ *   keeping the time between them or faster, e.g. to test stnMonitorRelay.py
+ *   with a day of station traffic in minutes. The blocks go to the groups
+ *   and ports they were received on unless -g is given.
+ *
+ *   Usage: shamereplay [-q] [-t start] [-d duration] [-x speed]
+ *                      [-g group[:port]] [-i interface] [-T ttl] [-b batch]
+ *                      log
+ *
+ *     -t  start at this time (unix seconds), or +seconds from the start of
+ *         the log (default the start), found through the index log.idx
+ *     -d  replay this many seconds (of the log, default all)
+ *     -x  speed, 2 is twice as fast, 0 as fast as possible (default 1)
+ *     -g  send everything to this group, port as recorded if not given
+ *     -i  address of the interface to send on (default by route)
+ *     -T  multicast time to live (default 1)
+ *     -b  datagrams sent per system call (default 32)
+ *     -q  no summary at the end
+ *
+ *   Build:  gcc -Wall -O2 -o shamereplay shamereplay.c
+ *
+ *****************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "shamecast.h"
+
+
+#define MAX_BATCH                  256
+
+
+/*  The batch of datagrams to be sent  */
+
+struct mmsghdr msgs[MAX_BATCH];
+struct iovec iovecs[MAX_BATCH];
+struct sockaddr_in dests[MAX_BATCH];
+int nbatch = 0;
+
+int sock;
+uint64_t sent = 0;
+
+
+
+void usage(const char *prog) {
+
+  fprintf(stderr, "Usage: %s [-q] [-t start] [-d duration] [-x speed]\n"
+          "       [-g group[:port]] [-i interface] [-T ttl] [-b batch] log\n",
+          prog);
+  exit(1);
+}
+
+
+int64_t now_ns(void) {
+
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+/*  Send the batch  */
+
+void flush_batch(void) {
+
+  int i = 0, n;
+
+  while ( i < nbatch ) {
+    n = sendmmsg(sock, msgs + i, nbatch - i, 0);
+    if ( n < 0 ) {
+      if ( errno == EINTR )
+        continue;
+      perror("sendmmsg failed");
+      exit(1);
+    }
+    i += n;
+  }
+  sent += nbatch;
+  nbatch = 0;
+}
+
+
+/*  Offset of the first record at or after start_ns: the last index entry
+    before it, then record by record  */
+
+int64_t find_start(const char *map, int64_t size, const char *index_name,
+                   int64_t start_ns) {
+
+  struct SHAME_LOG_IDX *idx = NULL;
+  const struct SHAME_LOG_REC *rec;
+  int64_t offset = sizeof(struct SHAME_LOG_HEAD);
+  long nidx = 0, lo, hi, mid;
+  FILE *f;
+
+  f = fopen(index_name, "rb");
+  if ( f ) {
+    fseeko(f, 0, SEEK_END);
+    nidx = ftello(f) / sizeof(*idx);
+    rewind(f);
+    idx = malloc(nidx * sizeof(*idx) + 1);
+    if ( idx == NULL || fread(idx, sizeof(*idx), nidx, f) != (size_t) nidx )
+      nidx = 0;
+    fclose(f);
+  } else
+    fprintf(stderr, "no index %s, searching the log\n", index_name);
+
+  for ( lo = 0, hi = nidx; lo < hi; ) {
+    mid = lo + (hi - lo) / 2;
+    if ( idx[mid].received_ns <= start_ns )
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if ( lo > 0 && idx[lo - 1].offset < size )
+    offset = idx[lo - 1].offset;
+  free(idx);
+
+  while ( offset + (int64_t) sizeof(*rec) <= size ) {
+    rec = (const struct SHAME_LOG_REC *) (map + offset);
+    if ( rec->received_ns >= start_ns )
+      break;
+    offset += SHAME_LOG_RECLEN(rec->length);
+  }
+  return offset;
+}
+
+
+
+int main(int argc, char *argv[]) {
+
+  const struct SHAME_LOG_HEAD *head;
+  const struct SHAME_LOG_REC *rec;
+  struct in_addr addr;
+  struct timespec ts;
+  uint32_t group = 0;
+  int port = 0;
+  uint32_t interface = htonl(INADDR_ANY);
+  int ttl = 1;
+  int batch = 32;
+  int quiet = 0;
+  double start = 0, duration = 0, speed = 1;
+  int relative = 1;
+  char index_name[4096];
+  char *colon;
+  const char *map;
+  int64_t size, offset, log0, wall0, end_ns, due, first_ns, last_ns;
+  int c, fd;
+
+  while ( (c = getopt(argc, argv, "t:d:x:g:i:T:b:q")) != -1 ) {
+    switch ( c ) {
+    case 't':
+      relative = optarg[0] == '+';
+      start = atof(optarg + relative);
+      break;
+    case 'd':
+      duration = atof(optarg);
+      break;
+    case 'x':
+      speed = atof(optarg);
+      break;
+    case 'g':
+      colon = strchr(optarg, ':');
+      if ( colon )
+        *colon = '\0';
+      if ( inet_aton(optarg, &addr) == 0 ) {
+        fprintf(stderr, "problem with group %s\n", optarg);
+        exit(1);
+      }
+      group = ntohl(addr.s_addr);
+      port = colon ? atoi(colon + 1) : 0;
+      break;
+    case 'i':
+      if ( inet_aton(optarg, &addr) == 0 ) {
+        fprintf(stderr, "problem with interface %s\n", optarg);
+        exit(1);
+      }
+      interface = addr.s_addr;
+      break;
+    case 'T':
+      ttl = atoi(optarg);
+      break;
+    case 'b':
+      batch = atoi(optarg);
+      break;
+    case 'q':
+      quiet = 1;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if ( optind != argc - 1 || speed < 0 || duration < 0 || batch < 1 ||
+       batch > MAX_BATCH )
+    usage(argv[0]);
+
+/*  Map the log  */
+
+  fd = open(argv[optind], O_RDONLY);
+  if ( fd < 0 ) {
+    perror("opening log failed");
+    exit(1);
+  }
+  size = lseek(fd, 0, SEEK_END);
+  if ( size < (int64_t) sizeof(*head) ) {
+    fprintf(stderr, "%s is not a shamecast log\n", argv[optind]);
+    exit(1);
+  }
+  map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  if ( map == MAP_FAILED ) {
+    perror("mmap of log failed");
+    exit(1);
+  }
+  close(fd);
+  madvise((void *) map, size, MADV_SEQUENTIAL);
+  head = (const struct SHAME_LOG_HEAD *) map;
+  if ( memcmp(head->magic, SHAME_LOG_MAGIC, 4) != 0 ||
+       head->version != SHAME_LOG_VERSION ) {
+    fprintf(stderr, "%s is not a shamecast log\n", argv[optind]);
+    exit(1);
+  }
+  if ( size < (int64_t) (sizeof(*head) + sizeof(*rec)) ) {
+    if ( !quiet )
+      printf("Log is empty\n");
+    return 0;
+  }
+
+/*  Set up the socket to send from  */
+
+  sock = socket(AF_INET, SOCK_DGRAM, 0);
+  if ( sock < 0 ) {
+    perror("socket failed");
+    exit(1);
+  }
+  if ( setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl,
+                  sizeof(ttl)) < 0 ) {
+    perror("setsockopt IP_MULTICAST_TTL failed");
+    exit(1);
+  }
+  if ( interface != htonl(INADDR_ANY) ) {
+    addr.s_addr = interface;
+    if ( setsockopt(sock, IPPROTO_IP, IP_MULTICAST_IF, &addr,
+                    sizeof(addr)) < 0 ) {
+      perror("setsockopt IP_MULTICAST_IF failed");
+      exit(1);
+    }
+  }
+
+/*  Find where to start  */
+
+  log0 = ((const struct SHAME_LOG_REC *) (map + sizeof(*head)))->received_ns;
+  if ( relative )
+    log0 += start * 1e9;
+  else
+    log0 = start * 1e9;
+  snprintf(index_name, sizeof(index_name), "%s.idx", argv[optind]);
+  offset = find_start(map, size, index_name, log0);
+  end_ns = duration > 0 ? log0 + (int64_t) (duration * 1e9) : INT64_MAX;
+
+/*  Send every record when it is due: as long after the start as when it
+    was recorded, divided by the speed  */
+
+  wall0 = now_ns();
+  first_ns = last_ns = 0;
+  for ( ; offset + (int64_t) sizeof(*rec) <= size;
+        offset += SHAME_LOG_RECLEN(rec->length) ) {
+    rec = (const struct SHAME_LOG_REC *) (map + offset);
+    if ( offset + (int64_t) SHAME_LOG_RECLEN(rec->length) > size ||
+         rec->received_ns >= end_ns )
+      break;
+    if ( first_ns == 0 )
+      first_ns = rec->received_ns;
+    last_ns = rec->received_ns;
+
+    if ( speed > 0 ) {
+      due = wall0 + (rec->received_ns - log0) / speed;
+      if ( due > now_ns() ) {
+        flush_batch();
+        ts.tv_sec = due / 1000000000;
+        ts.tv_nsec = due % 1000000000;
+        while ( clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &ts, NULL)
+                == EINTR )
+          ;
+      }
+    }
+
+    dests[nbatch].sin_family = AF_INET;
+    dests[nbatch].sin_addr.s_addr = htonl(group ? group : rec->group);
+    dests[nbatch].sin_port = htons(port ? port : rec->port);
+    iovecs[nbatch].iov_base = (void *) (rec + 1);
+    iovecs[nbatch].iov_len = rec->length;
+    msgs[nbatch].msg_hdr.msg_name = &dests[nbatch];
+    msgs[nbatch].msg_hdr.msg_namelen = sizeof(dests[nbatch]);
+    msgs[nbatch].msg_hdr.msg_iov = &iovecs[nbatch];
+    msgs[nbatch].msg_hdr.msg_iovlen = 1;
+    if ( ++nbatch == batch )
+      flush_batch();
+  }
+  flush_batch();
+
+  if ( !quiet )
+    printf("Replayed %lu blocks, %.3f s of the log in %.3f s\n",
+           (unsigned long) sent, (last_ns - first_ns) / 1e9,
+           (now_ns() - wall0) / 1e9);
+  return 0;
+}
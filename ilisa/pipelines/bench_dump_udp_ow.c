@@ -0,0 +1,502 @@
+/*
+
+gcc -Wall -O -o bench_dump_udp_ow bench_dump_udp_ow.c -lpthread -lm
+
+or for another version (with the DUMP_UDP_OW_NOMAIN guard around main()):
+
+gcc -Wall -O '-DDUMP_SRC="dump_udp_ow_18.c"' -o bench_dump_udp_ow bench_dump_udp_ow.c -lpthread -lm
+
+microbenchmarks of the parts of dump_udp_ow_17 that every packet passes,
+without threads (loopback UDP only for the receive loops): the ring buffer
+operations, the header decoding of --check, the receive loops, the writer
+paths (fwrite() to a file, popen() pipe) and all of them together as in
+producer() and consumer(). The recorder is included as source, so that the
+functions are measured as they are compiled there (with the same -O).
+
+./bench_dump_udp_ow --len 7824,1000 --maxwrite 65536,1048576 --bufsize 1e7,1e8
+
+Parameters are lists, every combination that matters for a benchmark is
+run. Results are JSON, one object per line on stdout: source, benchmark,
+len, maxwrite, bufsize, packets, ns per packet and GB/s, to be kept and
+compared between versions (e.g. with jq or pandas.read_json(lines=True)).
+
+*/
+
+#define  DUMP_UDP_OW_NOMAIN
+#ifndef  DUMP_SRC
+#define  DUMP_SRC  "dump_udp_ow_17.c"
+#endif
+#include  DUMP_SRC
+
+#define  BENCH_MAXLIST  16
+#define  BENCH_NHEADERS  4096  /* different headers, cycled */
+#define  BENCH_BATCH  32  /* packets per recvmmsg() in bench_rx() */
+
+long  bench_lens[BENCH_MAXLIST]= { 7824 }, bench_maxwrites[BENCH_MAXLIST]= {
+  1024*1024 }, bench_bufsizes[BENCH_MAXLIST]= { 104857600 };
+int  bench_nlens= 1, bench_nmaxwrites= 1, bench_nbufsizes= 1;
+long  bench_packets= 1000000;
+char  *bench_out= "/dev/null", *bench_pipe= "cat > /dev/null";
+char  *bench_only;  /* run only this benchmark */
+volatile long  bench_sink;  /* keep results alive */
+
+
+/* "7824,1000" or "1e8" into list, returns number of values or -1 */
+int  bench_parse_list (char  *arg, long  *list)
+{
+  char  *p= arg, *end;
+  int  n= 0;
+
+  while (*p)
+    {
+      if (n==BENCH_MAXLIST)
+	return -1;
+      list[n++]= strtod (p, &end);
+      if (end==p || list[n-1]<=0)
+	return -1;
+      p= end;
+      if (*p==',')
+	p++;
+      else if (*p)
+	return -1;
+    }
+  return n ? n : -1;
+}
+
+
+void  bench_result (char  *name, long  len, long  maxwrite, long  bufsize,
+		    long  packets, long  ns)
+{
+  printf ("{\"source\": \"%s\", \"bench\": \"%s\", \"len\": %ld, "
+	  "\"maxwrite\": %ld, \"bufsize\": %ld, \"packets\": %ld, "
+	  "\"ns_per_packet\": %.3f, \"gb_per_s\": %.4f}\n",
+	  DUMP_SRC, name, len, maxwrite, bufsize, packets,
+	  ns/(double)packets, packets*(double)len/ns);
+  fflush (stdout);
+}
+
+
+int  bench_wanted (char  *name)
+{
+  return bench_only==NULL || strcmp (bench_only, name)==0;
+}
+
+
+/* headers as from a station, packet numbers counting up */
+void  bench_headers (char  *packets, long  len)
+{
+  struct header_lofar  *h;
+  long  k, block, t;
+
+  memset (packets, 0, BENCH_NHEADERS*len);
+  for (k= 0; k<BENCH_NHEADERS; k++)
+    {
+      h= (struct header_lofar*)(packets+k*len);
+      h->version= 3;
+      h->source.is200mhz= 1;
+      h->num_beamlets= 122;
+      h->num_slices= 16;
+      block= (1700000000l*200000000l+512)/1024+16*k;
+      t= 1700000000l+(long) (16*k*1024/200e6);
+      while ((t*200000000l+512)/1024>block)
+	t--;
+      while (((t+1)*200000000l+512)/1024<=block)
+	t++;
+      h->timestamp= t;
+      h->sequence= block-(t*200000000l+512)/1024;
+    }
+}
+
+
+/* vrb_poi_new() and vrb_advance_new() per packet, the ring is emptied
+   (not timed) when full */
+void  bench_vrb_new (long  len, long  bufsize)
+{
+  struct vrb  vrb;
+  long  k, n, total= 0, t0;
+  char  *p;
+
+  init_vrb (&vrb, bufsize);
+  for (n= 0; n<bench_packets; )
+    {
+      t0= monotonic_ns ();
+      for (k= 0; n<bench_packets && (p= vrb_poi_new (&vrb, len)); k++, n++)
+	{
+	  bench_sink+= (long) p;
+	  vrb_advance_new (&vrb, len);
+	}
+      total+= monotonic_ns ()-t0;
+      vrb_advance_old (&vrb, vrb_fillsize (&vrb));
+    }
+  bench_result ("vrb_new", len, 0, vrb.totsize, n, total);
+  free_vrb (&vrb);
+}
+
+
+/* vrb_poi_old() and vrb_advance_old() per packet, the ring is filled (not
+   timed) when empty */
+void  bench_vrb_old (long  len, long  bufsize)
+{
+  struct vrb  vrb;
+  long  n, total= 0, t0;
+  char  *p;
+
+  init_vrb (&vrb, bufsize);
+  for (n= 0; n<bench_packets; )
+    {
+      while (vrb_poi_new (&vrb, len))
+	vrb_advance_new (&vrb, len);
+      t0= monotonic_ns ();
+      for (; n<bench_packets && (p= vrb_poi_old (&vrb)); n++)
+	{
+	  bench_sink+= (long) p;
+	  vrb_advance_old (&vrb, len);
+	}
+      total+= monotonic_ns ()-t0;
+    }
+  bench_result ("vrb_old", len, 0, vrb.totsize, n, total);
+  free_vrb (&vrb);
+}
+
+
+/* beamformed_packno() and beamformed_checkpack() (--check) */
+void  bench_header (long  len)
+{
+  char  *packets;
+  long  k, t0, sum= 0;
+
+  packets= malloc (BENCH_NHEADERS*len);
+  bench_headers (packets, len);
+  if (bench_wanted ("packno"))
+    {
+      t0= monotonic_ns ();
+      for (k= 0; k<bench_packets; k++)
+	sum+= beamformed_packno ((struct header_lofar*)(
+	  packets+(k%BENCH_NHEADERS)*len));
+      bench_sink+= sum;
+      bench_result ("packno", len, 0, 0, bench_packets, monotonic_ns ()-t0);
+    }
+  if (bench_wanted ("packno_200"))  /* the clock as a constant instead */
+    {
+      struct header_lofar  *h;
+
+      t0= monotonic_ns ();
+      for (k= 0; k<bench_packets; k++)
+	{
+	  h= (struct header_lofar*)(packets+(k%BENCH_NHEADERS)*len);
+	  sum+= ((h->timestamp*(200000000l/512)+1)/2+h->sequence)/16;
+	}
+      bench_sink+= sum;
+      bench_result ("packno_200", len, 0, 0, bench_packets,
+		    monotonic_ns ()-t0);
+    }
+  if (bench_wanted ("checkpack"))
+    {
+      t0= monotonic_ns ();
+      for (k= 0; k<bench_packets; k++)
+	sum+= beamformed_checkpack ((struct header_lofar*)(
+	  packets+(k%BENCH_NHEADERS)*len));
+      bench_sink+= sum;
+      bench_result ("checkpack", len, 0, 0, bench_packets,
+		    monotonic_ns ()-t0);
+    }
+  free (packets);
+}
+
+
+/* the receive loops of producer() with --check (7824 bytes) or --len:
+   receive_batch_any() and receive_zerocopy_any(), which check all options
+   per packet, and the fast loops with the settings as constants (see
+   RX_LOOPS, only for 7824 bytes). Batches of BENCH_BATCH packets are sent
+   over loopback UDP (not timed), then one call of the loop takes them
+   (timed); the ring is emptied (not timed) when it could not take a batch */
+void  bench_rx (long  len, long  bufsize)
+{
+  struct rxthread  rx;
+  struct vrb  vrb;
+  struct sockaddr_in  addr;
+  struct mmsghdr  msgs[BENCH_BATCH];
+  struct iovec  iovs[BENCH_BATCH];
+  socklen_t  alen= sizeof (addr);
+  char  *packets, name[20];
+  long  n, seen, t0, total;
+  int  out, j, k, z, size= 1<<24;
+
+  packets= malloc (BENCH_NHEADERS*len);
+  bench_headers (packets, len);
+  memset (&addr, 0, sizeof (addr));
+  addr.sin_family= AF_INET;
+  addr.sin_addr.s_addr= htonl (INADDR_LOOPBACK);
+  sock[0]= socket (AF_INET, SOCK_DGRAM, 0);
+  out= socket (AF_INET, SOCK_DGRAM, 0);
+  if (sock[0]<0 || out<0 ||
+      bind (sock[0], (struct sockaddr *)&addr, sizeof (addr)) ||
+      getsockname (sock[0], (struct sockaddr *)&addr, &alen) ||
+      connect (out, (struct sockaddr *)&addr, sizeof (addr)))
+    {
+      perror ("loopback socket in bench_rx()");
+      exit (1);
+    }
+  if (setsockopt (sock[0], SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof (size)))
+    setsockopt (sock[0], SOL_SOCKET, SO_RCVBUF, &size, sizeof (size));
+
+  packlen= len;
+  beamformed_check= len==LOFAR_PACKLEN;
+  nbatch= BENCH_BATCH;
+  nsock= 1;
+  memset (&rx, 0, sizeof (rx));
+  init_batch (&rx);
+  init_vrb (&vrb, bufsize);
+  sockring[0]= &vrb;
+  rx_fast= len==LOFAR_PACKLEN ? &rx_loops_lofar[0][1] : NULL;
+  for (k= 0; k<BENCH_BATCH; k++)
+    {
+      msgs[k].msg_hdr= (struct msghdr) { .msg_iov= &iovs[k], .msg_iovlen= 1 };
+      iovs[k].iov_len= len;
+    }
+
+  for (z= 0; z<2; z++)
+    for (j= 0; j<(rx_fast ? 2 : 1); j++)
+      {
+	snprintf (name, sizeof (name), "%s_%s", z ? "zerocopy" : "rx",
+		  j ? "fast" : "any");
+	if (!bench_wanted (name))
+	  continue;
+	total= 0;
+	seen= sockstat[0].packs_seen;
+	for (n= 0; n<bench_packets; n+= BENCH_BATCH)
+	  {
+	    for (k= 0; k<BENCH_BATCH; k++)
+	      iovs[k].iov_base= packets+((n+k)%BENCH_NHEADERS)*len;
+	    if (sendmmsg (out, msgs, BENCH_BATCH, 0)!=BENCH_BATCH)
+	      {
+		perror ("sendmmsg() in bench_rx()");
+		exit (1);
+	      }
+	    if (vrb.totsize-vrb_fillsize (&vrb)<BENCH_BATCH*(len+2))
+	      vrb_advance_old (&vrb, vrb_fillsize (&vrb));
+	    t0= monotonic_ns ();
+	    if (z)
+	      (j ? rx_fast->zerocopy : receive_zerocopy_any) (&rx, 0);
+	    else
+	      (j ? rx_fast->batch : receive_batch_any) (&rx, 0);
+	    total+= monotonic_ns ()-t0;
+	  }
+	/* those taken (loopback may drop some) */
+	bench_result (name, len, 0, vrb.totsize, sockstat[0].packs_seen-seen,
+		      total);
+	vrb_advance_old (&vrb, vrb_fillsize (&vrb));
+	while (recv (sock[0], packets, len, MSG_DONTWAIT)>0)
+	  ;
+      }
+  close (out);
+  close (sock[0]);
+  free_vrb (&vrb);
+  free (packets);
+}
+
+
+/* write_output() in chunks of maxwrite (whole packets, as the consumer
+   does with --len) to bench_out or through a pipe (--compress) */
+void  bench_writer (char  *name, long  len, long  maxwrite, int  pipe)
+{
+  char  *data;
+  long  chunk, n, t0;
+
+  chunk= maxwrite/len*len;
+  if (chunk==0)
+    chunk= len;
+  data= malloc (chunk);
+  memset (data, 1, chunk);
+  outf= pipe ? popen (bench_pipe, "w") : fopen (bench_out, "w");
+  if (outf==NULL)
+    {
+      perror (pipe ? "popen() in bench_writer()" : "fopen() in bench_writer()");
+      exit (1);
+    }
+  t0= monotonic_ns ();
+  for (n= 0; n<bench_packets; n+= chunk/len)
+    write_output (data, chunk);
+  if (pipe ? pclose (outf) : fclose (outf))
+    {
+      perror ("closing in bench_writer()");
+      exit (1);
+    }
+  bench_result (name, len, maxwrite, 0, n, monotonic_ns ()-t0);
+  outf= NULL;
+  free (data);
+}
+
+
+/* all per packet, single threaded: copy into the ring (as recvfrom()),
+   the checks of --check, and writing maxwrite at a time */
+void  bench_pipeline (long  len, long  maxwrite, long  bufsize)
+{
+  struct vrb  vrb;
+  struct header_lofar  *h;
+  char  *packets, *p;
+  long  n, t0, fill, size, ringlen;
+
+  packets= malloc (BENCH_NHEADERS*len);
+  bench_headers (packets, len);
+  init_vrb (&vrb, bufsize);
+  outf= fopen (bench_out, "w");
+  if (outf==NULL)
+    {
+      perror ("fopen() in bench_pipeline()");
+      exit (1);
+    }
+  ringlen= len;
+  t0= monotonic_ns ();
+  for (n= 0; n<bench_packets; n++)
+    {
+      p= vrb_poi_new (&vrb, len);
+      if (p==NULL)  /* consumer too slow: the producer would drop */
+	abort ();
+      memcpy (p, packets+(n%BENCH_NHEADERS)*len, len);
+      h= (struct header_lofar*)p;
+      if (beamformed_checkpack (h))
+	bench_sink+= beamformed_packno (h);
+      vrb_advance_new (&vrb, len);
+      fill= vrb_fillsize (&vrb);
+      if (fill>=maxwrite || fill+len>vrb.totsize || n==bench_packets-1)
+	{
+	  size= fill>maxwrite ? maxwrite : fill;
+	  size= size/ringlen*ringlen;
+	  if (size==0)
+	    size= fill;
+	  write_output (vrb_poi_old (&vrb), size);
+	  vrb_advance_old (&vrb, size);
+	}
+    }
+  while ((fill= vrb_fillsize (&vrb)))
+    {
+      write_output (vrb_poi_old (&vrb), fill);
+      vrb_advance_old (&vrb, fill);
+    }
+  if (fclose (outf))
+    {
+      perror ("closing in bench_pipeline()");
+      exit (1);
+    }
+  bench_result ("pipeline", len, maxwrite, vrb.totsize, n,
+		monotonic_ns ()-t0);
+  outf= NULL;
+  free_vrb (&vrb);
+  free (packets);
+}
+
+
+int  main (int  argc, char  **argv)
+{
+  int  c, i, j, k;
+  static struct option  long_options[]=
+    {
+      {"len",      required_argument, 0, 'l'},
+      {"maxwrite", required_argument, 0, 'm'},
+      {"bufsize",  required_argument, 0, 'b'},
+      {"packets",  required_argument, 0, 'n'},
+      {"out",      required_argument, 0, 'o'},
+      {"pipe",     required_argument, 0, 'P'},
+      {"only",     required_argument, 0, 'O'},
+      {"help",     no_argument, 0, 'h'},
+      {0, 0, 0, 0}
+    };
+
+  while ((c= getopt_long (argc, argv, "l:m:b:n:o:P:O:h", long_options,
+			  NULL))!=-1)
+    {
+      switch (c)
+	{
+	case 'l':
+	  bench_nlens= bench_parse_list (optarg, bench_lens);
+	  for (i= 0; i<bench_nlens; i++)
+	    if (bench_lens[i]<(long) sizeof (struct header_lofar) ||
+		bench_lens[i]>MMAXLEN)
+	      bench_nlens= -1;
+	  if (bench_nlens<0)
+	    {
+	      fprintf (stderr, "problem with len\n");
+	      c= '?';
+	    }
+	  break;
+	case 'm':
+	  bench_nmaxwrites= bench_parse_list (optarg, bench_maxwrites);
+	  if (bench_nmaxwrites<0)
+	    {
+	      fprintf (stderr, "problem with maxwrite\n");
+	      c= '?';
+	    }
+	  break;
+	case 'b':
+	  bench_nbufsizes= bench_parse_list (optarg, bench_bufsizes);
+	  if (bench_nbufsizes<0)
+	    {
+	      fprintf (stderr, "problem with bufsize\n");
+	      c= '?';
+	    }
+	  break;
+	case 'n':
+	  if (sscanf (optarg, "%ld", &bench_packets)!=1 || bench_packets<=0)
+	    {
+	      fprintf (stderr, "problem with packets\n");
+	      c= '?';
+	    }
+	  break;
+	case 'o':
+	  bench_out= optarg;
+	  break;
+	case 'P':
+	  bench_pipe= optarg;
+	  break;
+	case 'O':
+	  bench_only= optarg;
+	  break;
+	}
+      if (c=='h' || c=='?')
+	{
+	  fprintf (stderr,
+		   "usage: %s  (lists separated by commas)\n"
+		   "    [--len/-l list]          packet sizes, current: %ld\n"
+		   "    [--maxwrite/-m list]     bytes per write, current: %ld\n"
+		   "    [--bufsize/-b list]      ring buffer sizes, current: %ld\n"
+		   "    [--packets/-n n]         per benchmark, current: %ld\n"
+		   "    [--out/-o file]          for the writers, current: %s\n"
+		   "    [--pipe/-P command]      for popen(), current: %s\n"
+		   "    [--only/-O name]         vrb_new, vrb_old, packno, packno_200,\n"
+		   "                             checkpack,\n"
+		   "                             rx_any, rx_fast, zerocopy_any,\n"
+		   "                             zerocopy_fast, fwrite, popen or pipeline\n"
+		   "    [--help/-h]\n",
+		   argv[0], bench_lens[0], bench_maxwrites[0], bench_bufsizes[0],
+		   bench_packets, bench_out, bench_pipe);
+	  exit (c=='?');
+	}
+    }
+
+  for (i= 0; i<bench_nlens; i++)
+    {
+      bench_header (bench_lens[i]);
+      for (k= 0; k<bench_nbufsizes; k++)
+	{
+	  bench_rx (bench_lens[i], bench_bufsizes[k]);
+	  if (bench_wanted ("vrb_new"))
+	    bench_vrb_new (bench_lens[i], bench_bufsizes[k]);
+	  if (bench_wanted ("vrb_old"))
+	    bench_vrb_old (bench_lens[i], bench_bufsizes[k]);
+	}
+      for (j= 0; j<bench_nmaxwrites; j++)
+	{
+	  if (bench_wanted ("fwrite"))
+	    bench_writer ("fwrite", bench_lens[i], bench_maxwrites[j], 0);
+	  if (bench_wanted ("popen"))
+	    bench_writer ("popen", bench_lens[i], bench_maxwrites[j], 1);
+	  for (k= 0; k<bench_nbufsizes; k++)
+	    if (bench_wanted ("pipeline") &&
+		bench_maxwrites[j]<=bench_bufsizes[k])
+	      bench_pipeline (bench_lens[i], bench_maxwrites[j],
+			      bench_bufsizes[k]);
+	}
+    }
+  return 0;
+}
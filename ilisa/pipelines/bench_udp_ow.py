@@ -0,0 +1,147 @@
+#!/usr/bin/python3
+"""End-to-end capture benchmark of dump_udp_ow_17 with gen_udp_ow.
+
+For each configuration (extra options of dump_udp_ow_17) the recorder is
+started, gen_udp_ow sends the same synthetic packets to it, and the
+sustained throughput, missed and dropped packets and the CPU time of the
+recorder per GB received are reported, e.g.:
+
+    ./bench_udp_ow.py --lanes 4 --rate 0 --count 200000 \\
+        --config '' --config '--batch 64' --config '--batch 64 --zerocopy'
+
+Use --out on the file system to test or /dev/null (default) for the
+receive path only.
+"""
+import argparse
+import os
+import re
+import shlex
+import subprocess
+import sys
+import time
+
+PIPELINES_DIR = os.path.dirname(os.path.abspath(__file__))
+
+# Lines of "total per socket" in the final statistics of dump_udp_ow_17
+STAT_RE = {
+    'expected': re.compile(r'expected packets\s+(\d+)'),
+    'missed': re.compile(r'missed packets\s+(\d+)'),
+    'seen': re.compile(r'seen packets\s+(\d+)'),
+    'dropped': re.compile(r'^\s+dropped packets\s+(\d+)', re.M),
+    'written': re.compile(r'written packets\s+(\d+)'),
+    'kernel': re.compile(r'dropped by kernel\s+(-?\d+)'),
+}
+GEN_RE = re.compile(r'sent (\d+) packets\s+(\d+) bytes\s+in ([\d.]+) s')
+
+
+def dumper_stats(log):
+    """Sums over the ports of the final statistics of dump_udp_ow_17"""
+    final = log[log.rfind('total per socket'):]
+    return {key: sum(int(v) for v in regex.findall(final))
+            for key, regex in STAT_RE.items()}
+
+
+def run_config(config, args):
+    """Run recorder and generator once, returns a dict of results"""
+    ports = '{}x{}'.format(args.port, args.lanes)
+    dumper_cmd = ([args.dumper, '--ports', ports, '--out', args.out,
+                   '--len', str(args.len), '--check', '--timeout',
+                   str(-abs(args.timeout)),
+                   '--sock_bufsize', str(args.sock_bufsize)]
+                  + shlex.split(config))
+    gen_cmd = [args.gen, '--ports', ports, '--len', str(args.len),
+               '--bitmode', str(args.bitmode), '--count', str(args.count),
+               '--batch', str(args.batch)]
+    if args.rate is not None:
+        gen_cmd += ['--rate', str(args.rate)]
+    if args.loss:
+        gen_cmd += ['--loss', str(args.loss)]
+    if args.reorder:
+        gen_cmd += ['--reorder', str(args.reorder)]
+
+    dumper = subprocess.Popen(dumper_cmd, stdout=subprocess.PIPE,
+                              stderr=subprocess.STDOUT,
+                              universal_newlines=True)
+    time.sleep(args.startup)
+    gen_out = subprocess.run(gen_cmd, stdout=subprocess.PIPE, check=True,
+                             universal_newlines=True).stdout
+    # The recorder exits after --timeout without packets
+    log = dumper.stdout.read()
+    _pid, status, rusage = os.wait4(dumper.pid, 0)
+    dumper.returncode = status
+    if status:
+        print(log, file=sys.stderr)
+        raise RuntimeError("dump_udp_ow_17 failed: " + ' '.join(dumper_cmd))
+
+    sent, sent_bytes, elapsed = GEN_RE.search(gen_out).groups()
+    sent, elapsed = int(sent), float(elapsed)
+    stats = dumper_stats(log)
+    received_gb = stats['seen'] * args.len / 1e9
+    cpu = rusage.ru_utime + rusage.ru_stime
+    return {
+        'config': config or '(default)',
+        'sent': sent,
+        'gen_gbit': int(sent_bytes) * 8 / elapsed / 1e9,
+        'rx_gbit': received_gb * 8 / elapsed,
+        'missed': stats['expected'] - stats['seen'],
+        'dropped': stats['dropped'],
+        'kernel': stats['kernel'],
+        'written': stats['written'],
+        'cpu': cpu,
+        'cpu_per_gb': cpu / received_gb if received_gb else float('nan'),
+    }
+
+
+def main_cli():
+    prsr = argparse.ArgumentParser(description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    prsr.add_argument('-c', '--config', action='append',
+                      help="dump_udp_ow_17 options to compare (repeatable)")
+    prsr.add_argument('--lanes', type=int, default=1,
+                      help="number of lanes (ports)")
+    prsr.add_argument('--port', type=int, default=16011,
+                      help="first port")
+    prsr.add_argument('--rate', type=float, default=None,
+                      help="packets/s per lane, 0: as fast as possible, "
+                           "default: as a station")
+    prsr.add_argument('--count', type=int, default=100000,
+                      help="packets per lane")
+    prsr.add_argument('--len', type=int, default=7824, help="packet size")
+    prsr.add_argument('--bitmode', type=int, default=16)
+    prsr.add_argument('--batch', type=int, default=64,
+                      help="packets per sendmmsg() of the generator")
+    prsr.add_argument('--sock_bufsize', type=int, default=1 << 23,
+                      help="socket buffer of the recorder per lane (the "
+                           "kernel caps it at net.core.rmem_max)")
+    prsr.add_argument('--loss', type=float, default=0,
+                      help="generator drops packets with this probability")
+    prsr.add_argument('--reorder', type=float, default=0,
+                      help="generator swaps packets with this probability")
+    prsr.add_argument('--repeat', type=int, default=1,
+                      help="runs per configuration")
+    prsr.add_argument('--out', default='/dev/null',
+                      help="output of dump_udp_ow_17")
+    prsr.add_argument('--timeout', type=float, default=1.0,
+                      help="recorder stops after this long without packets")
+    prsr.add_argument('--startup', type=float, default=0.5,
+                      help="seconds for the recorder to start")
+    prsr.add_argument('--dumper',
+                      default=os.path.join(PIPELINES_DIR, 'dump_udp_ow_17'))
+    prsr.add_argument('--gen',
+                      default=os.path.join(PIPELINES_DIR, 'gen_udp_ow'))
+    args = prsr.parse_args()
+
+    print("{:40s} {:>9s} {:>8s} {:>8s} {:>8s} {:>8s} {:>8s} {:>7s} {:>8s}"
+          .format('config', 'sent', 'gen Gb/s', 'rx Gb/s', 'missed',
+                  'dropped', 'kernel', 'CPU s', 'CPU s/GB'))
+    for config in args.config or ['']:
+        for _ in range(args.repeat):
+            res = run_config(config, args)
+            print("{config:40.40s} {sent:9d} {gen_gbit:8.3f} {rx_gbit:8.3f} "
+                  "{missed:8d} {dropped:8d} {kernel:8d} {cpu:7.2f} "
+                  "{cpu_per_gb:8.3f}".format(**res))
+            sys.stdout.flush()
+
+
+if __name__ == "__main__":
+    main_cli()
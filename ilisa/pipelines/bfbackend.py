@@ -6,6 +6,9 @@ import multiprocessing
 import platform
 import argparse
 import datetime
+import struct
+import mmap
+import socket
 
 from . import __version__ as pipeline_version
 import ilisa.pipelines.rec_bf_streams_py as rec_bf_streams_py
@@ -104,8 +107,12 @@ def bfsfilepaths(lane, starttime, rcumode, bf_data_dir, port0, stnid,
 
 
 def _startlanerec(lane, starttime, duration, file_dur, rcumode, bf_data_dir,
-                  port0, stnid, compress=True, threadqueue=None):
+                  port0, stnid, compress=True, threadqueue=None,
+                  placement=''):
     """Start recording a lane using an external dumper process.
+
+    placement are extra dumper options for the threads of this lane,
+    e.g. ' --rx_cpus 2 --consumer_cpus 3 --rx_priority 50'.
     """
     if compress:
         # Compress stored data using zstd.
@@ -133,6 +140,7 @@ def _startlanerec(lane, starttime, duration, file_dur, rcumode, bf_data_dir,
                           + maxfilesz_arg
                           + ' --timeout 9999'
                           + compress_flag
+                          + placement
                           + ' --out ' + outarg
                           + ' > ' + dumplogname)
     print("Running: {}".format(cmdline_full_shell))
@@ -161,16 +169,63 @@ def bfsfileparse(filename):
     return dattim, port, stnid, compressed, bfs_recorder
 
 
+def lane_placement(lane, cpus_per_lane=2, first_cpu=0, rx_priority=0):
+    """Dumper options that give each lane its own CPUs.
+
+    The receiving thread gets the first of cpus_per_lane CPUs (counted
+    from first_cpu), the writing thread the others. Keep first_cpu off the
+    CPUs that take the interrupts of the network card.
+    """
+    cpu0 = first_cpu + lane * cpus_per_lane
+    opts = ' --rx_cpus {}'.format(cpu0)
+    if cpus_per_lane > 1:
+        opts += ' --consumer_cpus {}-{}'.format(cpu0 + 1,
+                                               cpu0 + cpus_per_lane - 1)
+    if rx_priority:
+        opts += ' --rx_priority {}'.format(rx_priority)
+    return opts
+
+
+def station_placement(lanes, cpus_per_lane=2, first_cpu=0, rx_priority=0):
+    """Dumper options as lane_placement() for one dumper of all lanes.
+
+    Lane i keeps the same CPUs as with lane_placement(): the receiving
+    thread of its socket (--rxthreads, one per socket) gets the first of
+    them, and the others all go to the writing threads (which in one
+    dumper are shared by the lanes).
+    """
+    rx_cpus = []
+    consumer_cpus = []
+    for lane in lanes:
+        cpu0 = first_cpu + lane * cpus_per_lane
+        rx_cpus.append(str(cpu0))
+        consumer_cpus += [str(cpu) for cpu in range(cpu0 + 1,
+                                                     cpu0 + cpus_per_lane)]
+    opts = ' --rxthreads --rx_cpus {}'.format(','.join(rx_cpus))
+    if consumer_cpus:
+        opts += ' --consumer_cpus {}'.format(','.join(consumer_cpus))
+    if rx_priority:
+        opts += ' --rx_priority {}'.format(rx_priority)
+    return opts
+
+
 def rec_bfs_lanes(starttime, duration, file_duration, lanes, rcumode,
-                  bf_data_dir, port0, stnid, compress):
+                  bf_data_dir, port0, stnid, compress, placements=None):
+    """Record the lanes with one dumper process each.
+
+    placements, if given, has extra dumper options per lane (see
+    lane_placement()).
+    """
     retvalq = multiprocessing.Queue()
     laneprocs = []
     for lane in lanes:
+        placement = placements[lane] if placements else ''
         laneproc = multiprocessing.Process(target=_startlanerec,
                                            args=(lane, starttime, duration,
                                                  file_duration, rcumode,
                                                  bf_data_dir, port0, stnid,
-                                                 compress, retvalq))
+                                                 compress, retvalq,
+                                                 placement))
         laneproc.start()
         laneprocs.append(laneproc)
     datafiles = []
@@ -183,6 +238,55 @@ def rec_bfs_lanes(starttime, duration, file_duration, lanes, rcumode,
     return datafiles, logfiles
 
 
+def rec_bfs_station(starttime, duration, file_duration, lanes, rcumode,
+                    bf_data_dir, port0, stnid, compress, placement=''):
+    """Record the lanes with one dumper process (dumper option --demux).
+
+    Each lane still gets its own file in its own directory (see
+    bfsfilepaths()), the log of the dumper is in the directory of the
+    first lane. placement has extra dumper options (see
+    station_placement()).
+    """
+    ports = []
+    outargs = []
+    datafiles = []
+    for lane in lanes:
+        outdumpdir, outarg, datafileguess, _dumplogname = \
+            bfsfilepaths(lane, starttime, rcumode, bf_data_dir,
+                         port0, stnid, compress)
+        if not os.path.exists(outdumpdir):
+            os.mkdir(outdumpdir)
+        ports.append(str(port0 + lane))
+        outargs.append(outarg)
+        datafiles.append(datafileguess)
+    pre_bf_dir, pst_bf_dir = bf_data_dir.split('?')
+    dumplogname = os.path.join(pre_bf_dir + str(lanes[0]) + pst_bf_dir,
+                               '{}_station_rcu{}.log'.format(DUMPERNAME,
+                                                             rcumode))
+    dur_flagarg = ''
+    if duration:
+        dur_flagarg = ' --duration ' + str(int(duration))
+    maxfilesz_arg = ''
+    if file_duration:
+        datarate_perlane = 95.5E6  # Bytes per second per lane approx
+        maxfilesz = int(file_duration * datarate_perlane)
+        maxfilesz_arg = ' --Maxfilesize ' + str(maxfilesz)
+    cmdline_full_shell = (DUMPERCMD + ' --ports ' + ','.join(ports)
+                          + ' --demux --len 7824 --check '
+                          + ' --Start ' +
+                          starttime.strftime("%Y-%m-%dT%H:%M:%S")
+                          + dur_flagarg
+                          + maxfilesz_arg
+                          + ' --timeout 9999'
+                          + (' --compress' if compress else '')
+                          + placement
+                          + ' --out ' + ','.join(outargs)
+                          + ' > ' + dumplogname)
+    print("Running: {}".format(cmdline_full_shell))
+    subprocess.run(cmdline_full_shell, shell=True)
+    return datafiles, [dumplogname] * len(datafiles)
+
+
 def rec_bf_streams(starttime, duration, file_duration, lanes, rcumode,
                    bf_data_dir, port0, stnid, compress):
     """
@@ -275,6 +379,13 @@ def bfsrec_main_cli():
                         )
     parser.add_argument('-c', '--compress', action="store_true",
                         help="Compress recorded data")
+    parser.add_argument('-P', '--cpus_per_lane',
+                        type=int, default=0,
+                        help="Pin each lane's dumper threads to this many CPUs"
+                             " (0: no placement)",
+                        )
+    parser.add_argument('-S', '--single', action="store_true",
+                        help="Record all lanes with one dumper process")
     parser.add_argument('-v', '--version', action="store_true",
                         help="Print version of module")
     args = parser.parse_args()
@@ -289,9 +400,22 @@ def bfsrec_main_cli():
                                    args.stnid)
         else:
             lanes = range(len(args.ports))
+            if args.single:
+                placement = ''
+                if args.cpus_per_lane:
+                    placement = station_placement(lanes, args.cpus_per_lane)
+                rec_bfs_station(starttime, args.duration, args.file_duration,
+                                lanes, args.rcumode, args.bfdatadir,
+                                args.ports[0], args.stnid, args.compress,
+                                placement)
+                return
+            placements = None
+            if args.cpus_per_lane:
+                placements = [lane_placement(lane, args.cpus_per_lane)
+                              for lane in lanes]
             rec_bfs_lanes(starttime, args.duration, args.file_duration, lanes,
                           args.rcumode, args.bfdatadir, args.ports[0],
-                          args.stnid, args.compress)
+                          args.stnid, args.compress, placements)
     else:
         print('MOCKRUN. Arguments:')
         print(args)
@@ -318,5 +442,118 @@ def rawfilesinfolder(bfsff):
     return udpfps
 
 
+# Layout of the shared memory page of dump_udp_ow_17 --metrics
+_METRICS_HEAD_FMT = '<8sqqqqdddqqqqdddd'
+_METRICS_HEAD_KEYS = ('magic', 'version', 'pid', 'nsock', 'seq',
+                      'start_time', 'update_time', 'interval',
+                      'ring_size', 'ring_fill', 'bytes_out', 'writes',
+                      'write_rate', 'write_time_mean', 'write_time_max',
+                      'ring_delay')
+_METRICS_SOCK_FMT = '<9q5d'
+_METRICS_SOCK_KEYS = ('port', 'packs_seen', 'packs_dropped',
+                      'dropped_kernel', 'bytes_written', 'packs_filled',
+                      'packs_late', 'ring_fill', 'maxsize', 'mean_filllevel',
+                      'packs_rate', 'drops_rate', 'kernel_drops_rate',
+                      'bytes_rate')
+
+
+def read_dumper_metrics(metricsfile):
+    """Read the live metrics of a running dumper
+
+    Parameters
+    ----------
+    metricsfile : str
+        Path given to the dumper's --metrics option, e.g. /dev/shm/dump_16011
+
+    Returns
+    -------
+    metrics : dict
+        Totals, rates and ring buffer fill of the dumper, with key 'sockets'
+        holding a list of dicts with the same per port.
+    """
+    headsz = struct.calcsize(_METRICS_HEAD_FMT)
+    socksz = struct.calcsize(_METRICS_SOCK_FMT)
+    with open(metricsfile, 'rb') as fin:
+        page = mmap.mmap(fin.fileno(), 0, access=mmap.ACCESS_READ)
+    try:
+        while True:
+            # Seqlock: retry if the page is being updated
+            seq0 = struct.unpack_from('<q', page, 32)[0]
+            buf = page[:]
+            seq1 = struct.unpack_from('<q', page, 32)[0]
+            if seq0 == seq1 and seq0 % 2 == 0:
+                break
+    finally:
+        page.close()
+    metrics = dict(zip(_METRICS_HEAD_KEYS,
+                       struct.unpack_from(_METRICS_HEAD_FMT, buf)))
+    if metrics['magic'] != b'DUMPMET\0' or metrics['version'] != 1:
+        raise RuntimeError("Not a dumper metrics page: " + metricsfile)
+    metrics['sockets'] = [
+        dict(zip(_METRICS_SOCK_KEYS,
+                 struct.unpack_from(_METRICS_SOCK_FMT, buf,
+                                    headsz + sockidx * socksz)))
+        for sockidx in range(metrics['nsock'])]
+    return metrics
+
+
+def dumper_command(control_socket, command):
+    """Send a command to a dumper running with --control
+
+    Parameters
+    ----------
+    control_socket : str
+        Path given to the dumper's --control option.
+    command : str
+        E.g. 'start packet 1700000000', 'stop', 'out /data/lane0/udp_SE607'
+        or 'status'.
+
+    Returns
+    -------
+    reply : str
+        The dumper's answer, starting with 'ok' or 'error'.
+    """
+    with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as sock:
+        sock.connect(control_socket)
+        sock.sendall((command + '\n').encode())
+        reply = b''
+        while not reply.endswith(b'\n'):
+            data = sock.recv(4096)
+            if not data:
+                break
+            reply += data
+    return reply.decode().strip()
+
+
+def rec_bfs_control(control_sockets, starttime, duration, outargs=None):
+    """Record an observation with dumpers that are already running
+
+    Every lane starts and stops at the same packet, so the files of the
+    lanes cover the same samples.
+
+    Parameters
+    ----------
+    control_sockets : list
+        Control socket of the dumper of each lane.
+    starttime : datetime.datetime
+        Start of the recording (UTC, packet time).
+    duration : float
+        Seconds to record.
+    outargs : list
+        Argument 'out' for the files of each lane, None keeps the dumper's.
+    """
+    t0 = (starttime - datetime.datetime(1970, 1, 1)).total_seconds()
+    for lane, control_socket in enumerate(control_sockets):
+        commands = ['start packet {:.6f}'.format(t0),
+                    'stop packet {:.6f}'.format(t0 + duration)]
+        if outargs:
+            commands.insert(0, 'out ' + outargs[lane])
+        for command in commands:
+            reply = dumper_command(control_socket, command)
+            if not reply.startswith('ok'):
+                raise RuntimeError("Dumper {}: {} -> {}".format(
+                    control_socket, command, reply))
+
+
 if __name__ == '__main__':
     bfsrec_main_cli()
@@ -4,6 +4,7 @@
 import os
 import sys
 import struct
+import subprocess
 import math
 from multiprocessing import Pool
 
@@ -14,6 +15,7 @@ import matplotlib.pyplot as plt
 
 import ilisa.operations.data_io as dio
 from ilisa.pipelines.bfbackend import rawfilesinfolder
+from ilisa.pipelines import bfsread
 
 # BF data/header format constants:
 NRTIMS_PACKET = 16  # Number of sample times in packet
@@ -33,6 +35,44 @@ BytesPcapFooter = 16
 BytesPcapFileHeader = 40  # 40
 BytesPerPcapPacket = BytesPcapHeader + BytesBFPacket + BytesPcapFooter
 
+# Packet index written by dump_udp_ow_17 --index (BFS filename + '.idx'):
+BFSIDX_header_fmt = '<4siii'  # magic b'BFIX', version, clock_mhz, sizehead
+BFSIDX_header2_fmt = '<i'  # version 2: frame_size (of seekable .zst)
+BFSIDX_RUN = 0  # consecutive packets, contiguous in file
+BFSIDX_GAP = 1  # missing packets before the next run
+BFSIDX_CHUNK = 2  # --stripe: bytes (npacks) at offset are in stripe (reclen)
+BFSIDX_dtype = np.dtype([('offset', '<i8'), ('packno', '<i8'),
+                         ('npacks', '<i8'), ('type', '<i4'),
+                         ('reclen', '<i4')])
+
+# Online Stokes file of dump_udp_ow_17 --stokes
+# magic b'BFST', version, mode, clock_mhz, nint, int_time
+BFSSTOKES_header_fmt = '<4siiiid'
+BFSSTOKES_record_fmt = '<dhhi'  # time, lane, nbeamlets, npacks
+BFSSTOKES_MODES = {0: ('I', 'Q', 'U', 'V'), 1: ('XX', 'YY', 'ReXY', 'ImXY')}
+
+# Seekable .zst of dump_udp_ow_17 --zstd_frame: seek table at the end in a
+# skippable frame (zstd seekable format), footer nframes, descriptor, magic
+ZSTD_SEEKTABLE_MAGIC = 0x184D2A5E
+ZSTD_SEEKABLE_MAGIC = 0x8F92EAB1
+ZSTD_SEEKTABLE_footer_fmt = '<IBI'
+BFSZST_dtype = np.dtype([('coffset', '<i8'), ('csize', '<i8'),
+                         ('doffset', '<i8'), ('dsize', '<i8')])
+
+# Headers apart from the payloads, dump_udp_ow_17 --sephead (BFS filename +
+# '.hdr'): header, then the headers that are not as predicted (exceptions)
+BFSSEPHEAD_header_fmt = '<4siii'  # magic b'BFHD', version, reclen, shuffle
+BFSSEPHEAD_exception_fmt = '<q16s'  # packet in the file, its header
+# version, source, config, station, num_beamlets, num_slices, timestamp,
+# sequence (as struct header_lofar of dump_udp_ow_17)
+PacketH_lofar_fmt = '<BHBHBBii'
+
+# Bits per value for the bitmode bm in the packet header
+BM_DRBITS = {0: 16, 1: 8, 2: 4}
+
+# Packets per chunk when reading with libbfsread.so (bfsread.py)
+BFSREAD_CHUNK = 4096
+
 
 def get_samprate(is200mhz):
     """Get samprate"""
@@ -47,32 +87,36 @@ def bffmtparams(header):
     if not hasattr(bffmtparams, 'drbits'):
         # Get size, in bits, of data samples
         # Seems like bitmode bm sometimes is not set,
-        # so use nrbeamlets instead
-        #if header['bm'] == 0:
-        if header['nrbeamlets'] == 1*61:
-            bffmtparams.drbits = 16
-        #elif header['bm'] == 1:
-        elif header['nrbeamlets'] == 2*61:
+        # so use nrbeamlets instead. Packets with a subset of the beamlets
+        # (dump_udp_ow_17 --beamlets, --requant) always have bm set.
+        if header['nrbeamlets'] == 2*61 and header['bm'] == 0:
             bffmtparams.drbits = 8
+        elif header['bm'] in BM_DRBITS:
+            bffmtparams.drbits = BM_DRBITS[header['bm']]
         else:
-            raise RuntimeError("Only 8 and 16 bit mode supported")
+            raise RuntimeError("Only 4, 8 and 16 bit mode supported")
         xrxiyryi16_dtype = np.dtype([('xr', '<i2'), ('xi', '<i2'),
                                         ('yr', '<i2'), ('yi', '<i2')])
         xrxiyryi8_dtype = np.dtype([('xr', '<i1'), ('xi', '<i1'),
                                        ('yr', '<i1'), ('yi', '<i1')])
+        # 4 bit: one byte per complex value, real part in low nibble
+        xy4_dtype = np.dtype([('x', 'u1'), ('y', 'u1')])
 
+        # Number of beamlets in packet (61, 122 or 244 unless a subset)
+        nrbeamletsperlane = header['nrbeamlets']
         if bffmtparams.drbits == 16:
-            nrbeamletsperlane = 61  # Number of beamlets in packet
             nrdatasampsBFpacket = NRTIMS_PACKET * header['nrbeamlets']
             # PacketD_struct_fmt = str(2 * 4 * nrdatasampsBFpacket) + 's'
             bffmtparams.cint_smp = cint16
             xrxiyryi_dtype = xrxiyryi16_dtype
         elif bffmtparams.drbits == 8:
-            nrbeamletsperlane = 2 * 61  # Number of beamlets in packet
             nrdatasampsBFpacket = NRTIMS_PACKET * header['nrbeamlets']
             # PacketD_struct_fmt = str(2 * 4 * nrdatasampsBFpacket) + 's'
             bffmtparams.cint_smp = cint8
             xrxiyryi_dtype = xrxiyryi8_dtype
+        elif bffmtparams.drbits == 4:
+            bffmtparams.cint_smp = cint8  # unpacked to 8 bit
+            xrxiyryi_dtype = xy4_dtype
         bffmtparams.packetData_dtype = np.dtype((xrxiyryi_dtype,
                                                     (nrbeamletsperlane,
                                                      NRTIMS_PACKET)))
@@ -141,10 +185,17 @@ def read_bf_packet(filepointer, keepstruct=False, pcapfile=False):
     else:
         buf = filepointer.read(packetData_dtype.itemsize)
         LofarElemSamps = np.frombuffer(buf, dtype=packetData_dtype)
-    xr = (LofarElemSamps[0, :, ]['xr']).squeeze()
-    xi = (LofarElemSamps[0, :, ]['xi']).squeeze()
-    yr = (LofarElemSamps[0, :, ]['yr']).squeeze()
-    yi = (LofarElemSamps[0, :, ]['yi']).squeeze()
+    if bffmtparams.drbits == 4:
+        # Sign extend the nibbles
+        x4 = LofarElemSamps[0, :, ]['x'].squeeze().view(np.int8)
+        y4 = LofarElemSamps[0, :, ]['y'].squeeze().view(np.int8)
+        xr, xi = (x4 << 4) >> 4, x4 >> 4
+        yr, yi = (y4 << 4) >> 4, y4 >> 4
+    else:
+        xr = (LofarElemSamps[0, :, ]['xr']).squeeze()
+        xi = (LofarElemSamps[0, :, ]['xi']).squeeze()
+        yr = (LofarElemSamps[0, :, ]['yr']).squeeze()
+        yi = (LofarElemSamps[0, :, ]['yi']).squeeze()
     if keepstruct:
         # Keep packet as integer values
         x = np.zeros((nrbeamlets, NRTIMS_PACKET), dtype=cint_smp)
@@ -211,6 +262,395 @@ def next_bfpacket(bfs_filename, keepstruct=True, padmissing=True):
     fin.close()
 
 
+def read_bfsindex(bfs_filename):
+    """\
+    Read the packet index of a BFS file
+
+    Returns the index header as a dict and the entries (runs and gaps) as
+    a numpy record array with fields offset, packno, npacks, type, reclen.
+    Offsets are in the uncompressed file, frame_size in the header is that
+    of the frames of a seekable .zst (0 if not, see read_bfszst()).
+    """
+    head = {'clock_mhz': None, 'sizehead': False, 'frame_size': 0}
+    with open(bfs_filename + '.idx', 'rb') as fin:
+        buf = fin.read(struct.calcsize(BFSIDX_header_fmt))
+        if buf == b'':
+            # No packets in file
+            return head, np.zeros(0, dtype=BFSIDX_dtype)
+        magic, version, clock_mhz, sizehead = struct.unpack(
+            BFSIDX_header_fmt, buf)
+        if magic != b'BFIX' or version not in (1, 2):
+            raise RuntimeError("Not a BFS packet index: " + bfs_filename)
+        head['clock_mhz'] = clock_mhz
+        head['sizehead'] = bool(sizehead)
+        if version >= 2:
+            head['frame_size'], = struct.unpack(
+                BFSIDX_header2_fmt,
+                fin.read(struct.calcsize(BFSIDX_header2_fmt)))
+        entries = np.fromfile(fin, dtype=BFSIDX_dtype)
+    return head, entries
+
+
+def read_bfsseektable(bfs_filename):
+    """\
+    Read the seek table of a seekable .zst BFS file (--zstd_frame)
+
+    Returns a numpy record array with fields coffset, csize (compressed)
+    and doffset, dsize (uncompressed) of each frame, or None if the file
+    has no seek table. The frames can be decompressed independently.
+    """
+    footlen = struct.calcsize(ZSTD_SEEKTABLE_footer_fmt)
+    with open(bfs_filename, 'rb') as fin:
+        fin.seek(0, os.SEEK_END)
+        size = fin.tell()
+        if size < 8 + footlen:
+            return None
+        fin.seek(size - footlen)
+        nframes, descriptor, magic = struct.unpack(
+            ZSTD_SEEKTABLE_footer_fmt, fin.read(footlen))
+        if magic != ZSTD_SEEKABLE_MAGIC:
+            return None
+        entrylen = 12 if descriptor & 0x80 else 8  # with checksums
+        fin.seek(size - footlen - nframes * entrylen - 8)
+        skipmagic, _tablelen = struct.unpack('<II', fin.read(8))
+        if skipmagic != ZSTD_SEEKTABLE_MAGIC:
+            raise RuntimeError("Bad zstd seek table: " + bfs_filename)
+        raw = np.fromfile(fin, dtype='<u4', count=nframes * entrylen // 4)
+    raw = raw.reshape(nframes, entrylen // 4)
+    table = np.zeros(nframes, dtype=BFSZST_dtype)
+    table['csize'] = raw[:, 0]
+    table['dsize'] = raw[:, 1]
+    table['coffset'][1:] = np.cumsum(table['csize'])[:-1]
+    table['doffset'][1:] = np.cumsum(table['dsize'])[:-1]
+    return table
+
+
+def _unzst_frame(frameargs):
+    """Decompress one frame (bfs_filename, coffset, csize) with zstd"""
+    bfs_filename, coffset, csize = frameargs
+    with open(bfs_filename, 'rb') as fin:
+        fin.seek(coffset)
+        frame = fin.read(csize)
+    return subprocess.run(['zstd', '-dcq'], input=frame,
+                          stdout=subprocess.PIPE, check=True).stdout
+
+
+def read_bfszst(bfs_filename, offset, size, processes=1):
+    """\
+    Read size bytes at (uncompressed) offset of a seekable .zst BFS file
+
+    Only the frames with these bytes are decompressed, with processes > 1
+    in parallel. Offsets are as in the packet index (see bfsindex_seek()).
+    """
+    table = read_bfsseektable(bfs_filename)
+    if table is None:
+        raise RuntimeError("Not a seekable .zst file: " + bfs_filename)
+    frames = table[(table['doffset'] < offset + size)
+                   & (table['doffset'] + table['dsize'] > offset)]
+    if len(frames) == 0:
+        return b''
+    frameargs = [(bfs_filename, int(frame['coffset']), int(frame['csize']))
+                 for frame in frames]
+    if processes > 1:
+        with Pool(processes) as pool:
+            parts = pool.map(_unzst_frame, frameargs)
+    else:
+        parts = map(_unzst_frame, frameargs)
+    start = offset - int(frames['doffset'][0])
+    return b''.join(parts)[start:start + size]
+
+
+def unzst_bfsfile(bfs_filename, processes=None):
+    """\
+    Decompress a seekable .zst BFS file on all CPUs (or processes)
+
+    The output is next to it, without .zst.
+    """
+    table = read_bfsseektable(bfs_filename)
+    if table is None:
+        raise RuntimeError("Not a seekable .zst file: " + bfs_filename)
+    frameargs = [(bfs_filename, int(frame['coffset']), int(frame['csize']))
+                 for frame in table]
+    with Pool(processes) as pool, open(bfs_filename[:-4], 'wb') as fout:
+        for part in pool.imap(_unzst_frame, frameargs):
+            fout.write(part)
+
+
+def read_bfssephead(bfs_filename):
+    """\
+    Read the header file of a BFS file of dump_udp_ow_17 --sephead
+
+    Returns the header as a dict ('reclen' the size of the original packets,
+    'shuffle') and a dict of the exceptions: packet number in the file to
+    its header (bytes), for the headers that are not as predicted.
+    """
+    exceptions = {}
+    with open(bfs_filename + '.hdr', 'rb') as fin:
+        buf = fin.read(struct.calcsize(BFSSEPHEAD_header_fmt))
+        magic, version, reclen, shuffle = struct.unpack(
+            BFSSEPHEAD_header_fmt, buf)
+        if magic != b'BFHD' or version != 1:
+            raise RuntimeError("Not a BFS header file: " + bfs_filename)
+        exlen = struct.calcsize(BFSSEPHEAD_exception_fmt)
+        while True:
+            buf = fin.read(exlen)
+            if len(buf) < exlen:
+                break
+            packet, header = struct.unpack(BFSSEPHEAD_exception_fmt, buf)
+            exceptions[packet] = header
+    return {'reclen': reclen, 'shuffle': bool(shuffle)}, exceptions
+
+
+def _cdiv(num, den):
+    """Integer division as in C (towards zero)"""
+    quot = abs(num) // abs(den)
+    return quot if (num >= 0) == (den > 0) else -quot
+
+
+def _sephead_predict(header):
+    """The header num_slices samples after header (as dump_udp_ow_17)"""
+    (version, source, config, station, nbeamlets, nslices, timestamp,
+     sequence) = struct.unpack(PacketH_lofar_fmt, header)
+    clock = 1000000 * (200 if source & 0x80 else 160)
+    block = _cdiv(timestamp * clock + 512, 1024) + sequence + nslices
+    while _cdiv((timestamp + 1) * clock + 512, 1024) <= block:
+        timestamp += 1
+    sequence = block - _cdiv(timestamp * clock + 512, 1024)
+    return struct.pack(PacketH_lofar_fmt, version, source, config, station,
+                       nbeamlets, nslices, timestamp, sequence)
+
+
+def bfssephead_packets(bfs_filename):
+    """\
+    Rebuild the original packets of a BFS file of dump_udp_ow_17 --sephead
+
+    Yields each packet (header and payload, as bytes) in turn. The file can
+    be compressed (.zst).
+    """
+    head, exceptions = read_bfssephead(bfs_filename)
+    paylen = head['reclen'] - PACKETHDRSZ
+    if bfs_filename.endswith('.zst'):
+        proc = subprocess.Popen(['zstd', '-dcq', bfs_filename],
+                                stdout=subprocess.PIPE)
+        fin = proc.stdout
+    else:
+        fin = open(bfs_filename, 'rb')
+    header = None
+    packet = 0
+    with fin:
+        while True:
+            payload = fin.read(paylen)
+            if len(payload) < paylen:
+                break
+            if packet in exceptions:
+                header = exceptions[packet]
+            else:
+                header = _sephead_predict(header)
+            if head['shuffle']:
+                # byte planes of the samples XrXiYrYi
+                bm = (struct.unpack_from('<H', header, 1)[0] >> 8) & 3
+                stride = (16 >> bm) // 2
+                nsamp = paylen // stride
+                planes = np.frombuffer(payload, dtype=np.uint8,
+                                       count=nsamp * stride)
+                payload = (planes.reshape(stride, nsamp).T.tobytes()
+                           + payload[nsamp * stride:])
+            yield header + payload
+            packet += 1
+
+
+def unsephead_bfsfile(bfs_filename, out_filename):
+    """Write the original packets of a --sephead BFS file to out_filename"""
+    with open(out_filename, 'wb') as fout:
+        for packet in bfssephead_packets(bfs_filename):
+            fout.write(packet)
+
+
+def unstripe_bfsfile(bfs_filename, stripe_dirs, out_filename):
+    """\
+    Join the stripes of a BFS file of dump_udp_ow_17 --stripe to out_filename
+
+    bfs_filename is the name given by --out (with its .idx), stripe_dirs the
+    directories of --stripe in the same order. The stripes are read in turn
+    as the chunk entries of the index say, compressed stripes (.zst) through
+    zstd, the output is uncompressed.
+    """
+    _head, entries = read_bfsindex(bfs_filename)
+    chunks = entries[entries['type'] == BFSIDX_CHUNK]
+    chunks = chunks[np.argsort(chunks['offset'], kind='stable')]
+    name = os.path.basename(bfs_filename)
+    procs, fins = [], []
+    for stripe_dir in stripe_dirs:
+        stripe_filename = os.path.join(stripe_dir, name)
+        if stripe_filename.endswith('.zst'):
+            procs.append(subprocess.Popen(['zstd', '-dcq', stripe_filename],
+                                          stdout=subprocess.PIPE))
+            fins.append(procs[-1].stdout)
+        else:
+            fins.append(open(stripe_filename, 'rb'))
+    positions = [0] * len(fins)
+    with open(out_filename, 'wb') as fout:
+        for chunk in chunks:
+            stripe = int(chunk['reclen'])
+            if positions[stripe] != chunk['packno']:
+                raise RuntimeError("Stripe {} out of order at {}".format(
+                    stripe, chunk['offset']))
+            data = fins[stripe].read(int(chunk['npacks']))
+            if len(data) < chunk['npacks']:
+                raise RuntimeError("Stripe {} ends early".format(stripe))
+            fout.write(data)
+            positions[stripe] += len(data)
+    for fin in fins:
+        fin.close()
+    for proc in procs:
+        proc.wait()
+
+
+def read_bfssel(bfs_filename):
+    """\
+    Read which beamlets dump_udp_ow_17 --beamlets/--requant kept
+
+    Returns a dict with 'bits' (in, out), 'beamlets' (the original beamlet
+    number of each beamlet in the packets) and 'scales', or None if the file
+    has all beamlets.
+    """
+    selfile = bfs_filename + '.sel'
+    if not os.path.exists(selfile):
+        return None
+    sel = {}
+    with open(selfile) as fin:
+        for line in fin:
+            key, *values = line.split()
+            if key == 'scales':
+                sel[key] = [float(v) for v in values]
+            else:
+                sel[key] = [int(v) for v in values]
+    sel['bits'] = tuple(sel['bits'])
+    return sel
+
+
+def read_bfsstokes(stokes_filename):
+    """\
+    Read the online Stokes file of dump_udp_ow_17 --stokes
+
+    Returns the header as a dict (with 'params', the names of the 4 values)
+    and a dict per lane of 'time' (start of each integration, unix time),
+    'npacks' (packets integrated) and 'data' (integration x beamlet x 4,
+    means per time sample). The file can still be growing, an incomplete
+    last record is skipped.
+    """
+    head = {}
+    lanes = {}
+    with open(stokes_filename, 'rb') as fin:
+        buf = fin.read(struct.calcsize(BFSSTOKES_header_fmt))
+        if len(buf) < struct.calcsize(BFSSTOKES_header_fmt):
+            # No packets yet
+            return head, lanes
+        magic, version, mode, clock_mhz, nint, int_time = struct.unpack(
+            BFSSTOKES_header_fmt, buf)
+        if magic != b'BFST' or version != 1:
+            raise RuntimeError("Not a BFS Stokes file: " + stokes_filename)
+        head = {'mode': mode, 'params': BFSSTOKES_MODES[mode],
+                'clock_mhz': clock_mhz, 'nint': nint, 'int_time': int_time}
+        reclen = struct.calcsize(BFSSTOKES_record_fmt)
+        while True:
+            buf = fin.read(reclen)
+            if len(buf) < reclen:
+                break
+            time, lane, nbeamlets, npacks = struct.unpack(
+                BFSSTOKES_record_fmt, buf)
+            data = np.fromfile(fin, dtype='<f4', count=4 * nbeamlets)
+            if len(data) < 4 * nbeamlets:
+                break
+            lanerecs = lanes.setdefault(lane, {'time': [], 'npacks': [],
+                                               'data': []})
+            lanerecs['time'].append(time)
+            lanerecs['npacks'].append(npacks)
+            lanerecs['data'].append(data.reshape(nbeamlets, 4))
+    for lanerecs in lanes.values():
+        for key in lanerecs:
+            lanerecs[key] = np.array(lanerecs[key])
+    return head, lanes
+
+
+def bfsindex_packno(head, unixtime):
+    """Packet number (as in the index) of the packet at unix time"""
+    return int(unixtime * head['clock_mhz'] * 1e6
+               / (FFTSIZE * NRTIMS_PACKET))
+
+
+def bfsindex_time(head, packno):
+    """Unix time of packet with packet number packno"""
+    return packno * FFTSIZE * NRTIMS_PACKET / (head['clock_mhz'] * 1e6)
+
+
+def bfsindex_seek(bfs_filename, unixtime):
+    """\
+    Find the first packet at or after unixtime using the packet index
+
+    Returns its byte offset in the file and its packet number,
+    or (None, None) if there is none.
+    """
+    head, entries = read_bfsindex(bfs_filename)
+    runs = entries[entries['type'] == BFSIDX_RUN]
+    if len(runs) == 0:
+        return None, None
+    packno = bfsindex_packno(head, unixtime)
+    inrun = (runs['packno'] <= packno) & (packno < runs['packno']
+                                           + runs['npacks'])
+    if inrun.any():
+        run = runs[np.argmax(inrun)]
+        return (int(run['offset'] + (packno - run['packno'])*run['reclen']),
+                packno)
+    later = runs[runs['packno'] > packno]
+    if len(later) == 0:
+        return None, None
+    run = later[np.argmin(later['packno'])]
+    return int(run['offset']), int(run['packno'])
+
+
+def print_bfsindex(bfs_filename):
+    """Print runs, gaps (and chunks) of the packet index of a BFS file"""
+    head, entries = read_bfsindex(bfs_filename)
+    for entry in entries:
+        if entry['type'] == BFSIDX_CHUNK:
+            print('chunk', entry['reclen'], entry['packno'], entry['npacks'],
+                  entry['offset'])
+            continue
+        time = datetime.datetime.utcfromtimestamp(
+            bfsindex_time(head, entry['packno']))
+        print('run' if entry['type'] == BFSIDX_RUN else 'gap',
+              time.isoformat(), entry['packno'], entry['npacks'],
+              entry['offset'])
+    gaps = entries[entries['type'] == BFSIDX_GAP]
+    print("Packets:", entries[entries['type'] == BFSIDX_RUN]['npacks'].sum(),
+          " missing:", gaps['npacks'].sum(), "in", len(gaps), "gaps")
+
+
+def plot_bfsstokes(stokes_filename):
+    """Plot the dynamic spectra of an online Stokes file, one row per lane"""
+    head, lanes = read_bfsstokes(stokes_filename)
+    if not lanes:
+        print("No integrations in", stokes_filename)
+        return
+    for row, lane in enumerate(sorted(lanes)):
+        lanerecs = lanes[lane]
+        reltime = lanerecs['time'] - lanerecs['time'][0]
+        for col, param in enumerate(head['params']):
+            plt.subplot(len(lanes), 4, 4 * row + col + 1)
+            plt.pcolormesh(reltime, np.arange(lanerecs['data'].shape[1]),
+                           lanerecs['data'][:, :, col].T, shading='auto')
+            plt.colorbar()
+            plt.title('{} lane {}'.format(param, lane))
+            if col == 0:
+                plt.ylabel('Beamlet [#]')
+            if row == len(lanes) - 1:
+                plt.xlabel('Time [s]')
+    plt.suptitle('{} ({} s integrations)'.format(
+        os.path.basename(stokes_filename), head['int_time']))
+    plt.show()
+
+
 class BFSmeta:
     lcufftlen = 1024
     lcusampfreq = 200e6
@@ -272,6 +712,21 @@ class BFSmeta:
         return ret
 
 
+def _bfsread_xy(bfs, first_packno, nslots):
+    """\
+    X and Y of packet numbers first_packno.. (nslots) with libbfsread.so,
+    packet x beamlet x slice x (re, im), zeros for missing packets
+    """
+    data, present = bfs.padded(first_packno, nslots)
+    if bfs.bits == 4:
+        data = bfsread.unpack4(data).reshape(data.shape[:-1] + (4,))
+    return data[..., 0:2], data[..., 2:4], present
+
+
+def _bfsread_usable(bfs_filename):
+    return not bfs_filename.endswith('.pcap') and bfsread.available()
+
+
 def readbfsfile(bfs_filename, bfsmeta, savenpy=True):
     """Read BFS file"""
     _paylodshp = (bfsmeta.nrbeamlets, NRTIMS_PACKET * (bfsmeta.nrpkts_nominal))
@@ -287,6 +742,25 @@ def readbfsfile(bfs_filename, bfsmeta, savenpy=True):
     else:
         x_strm = np.empty(shape=_paylodshp, dtype=complex)
         y_strm = np.empty_like(x_strm)
+    if _bfsread_usable(bfs_filename):
+        with bfsread.BFSFile(bfs_filename) as bfs:
+            first_packno = int(bfs.headers(0, 1)['packno'][0])
+            missed = 0
+            for pktnr in range(0, bfsmeta.nrpkts_nominal, BFSREAD_CHUNK):
+                nslots = min(BFSREAD_CHUNK, bfsmeta.nrpkts_nominal - pktnr)
+                x, y, present = _bfsread_xy(bfs, first_packno + pktnr,
+                                            nslots)
+                missed += nslots - present.sum()
+                _sl = slice(NRTIMS_PACKET*pktnr, NRTIMS_PACKET*(pktnr+nslots))
+                # packet x beamlet x slice -> beamlet x time
+                for strm, xy in ((x_strm, x), (y_strm, y)):
+                    strm[:, _sl] = (xy[..., 0] + 1j*xy[..., 1]).transpose(
+                        1, 0, 2).reshape(bfsmeta.nrbeamlets, -1)
+                print('\r' + str(round((pktnr+nslots)/bfsmeta.nrpkts_nominal
+                                        * 100)) + '% completed', end='')
+        print()
+        print('Missed packets total:', missed, bfs.npacks)
+        return x_strm, y_strm
     # Now read in all the packets
     pktnr = 0
     _leftpc_prev = 0
@@ -318,6 +792,19 @@ def convert2binary(bfs_filepath):
     ...
     """
     bin_file = bfs_filepath + ".bin"
+    if _bfsread_usable(bfs_filepath):
+        with bfsread.BFSFile(bfs_filepath) as bfs, open(bin_file, "wb") as fout:
+            packnos = bfs.headers(0, 1)['packno']
+            packnos = np.concatenate((packnos,
+                                      bfs.headers(bfs.npacks-1, 1)['packno']))
+            for packno in range(int(packnos[0]), int(packnos[-1]) + 1,
+                                BFSREAD_CHUNK):
+                x, y, _present = _bfsread_xy(
+                    bfs, packno, min(BFSREAD_CHUNK, int(packnos[-1])+1-packno))
+                # packet x beamlet x slice x XrXiYrYi -> packet x slice x ..
+                np.concatenate((x, y), axis=-1).transpose(0, 2, 1, 3).tofile(
+                    fout)
+        return
     fout = open(bin_file, "wb")
     xy = None
     for header, x, y in next_bfpacket(bfs_filepath, True):
@@ -738,9 +1225,41 @@ def main_cli():
     parser_meta.set_defaults(func=BFSmeta)
     parser_meta.add_argument('bfs_filename', help="BFS filename")
 
+    parser_index = subparsers.add_parser('index',
+                                         help='Show packet index of BFS file')
+    parser_index.set_defaults(func=print_bfsindex)
+    parser_index.add_argument('bfs_filename', help="BFS filename")
+
+    parser_unzst = subparsers.add_parser(
+        'unzst', help='Decompress seekable .zst BFS file in parallel')
+    parser_unzst.set_defaults(func=unzst_bfsfile)
+    parser_unzst.add_argument('bfs_filename', help="BFS filename")
+
+    parser_unsephead = subparsers.add_parser(
+        'unsephead', help='Rebuild packets of --sephead BFS file')
+    parser_unsephead.set_defaults(func=unsephead_bfsfile)
+    parser_unsephead.add_argument('bfs_filename', help="BFS filename")
+    parser_unsephead.add_argument('out_filename', help="Output filename")
+
+    parser_unstripe = subparsers.add_parser(
+        'unstripe', help='Join stripes of --stripe BFS file')
+    parser_unstripe.set_defaults(func=unstripe_bfsfile)
+    parser_unstripe.add_argument('bfs_filename', help="BFS filename (--out)")
+    parser_unstripe.add_argument('out_filename', help="Output filename")
+    parser_unstripe.add_argument('stripe_dirs', nargs='+',
+                                 help="Directories of --stripe, in order")
+
+    parser_stokes = subparsers.add_parser(
+        'stokes', help='Plot online Stokes file (dump_udp_ow_17 --stokes)')
+    parser_stokes.set_defaults(func=plot_bfsstokes)
+    parser_stokes.add_argument('bfs_filename', metavar='stokes_filename',
+                               help="Stokes filename")
+
     args = cmdln_prsr.parse_args()
 
-    if args.bfs_filename.endswith('zst'):
+    if (args.bfs_filename.endswith('zst')
+            and args.func not in (print_bfsindex, unzst_bfsfile,
+                                  unsephead_bfsfile, unstripe_bfsfile)):
         print("Please uncompress the BFS file first")
         sys.exit()
 
@@ -772,6 +1291,17 @@ def main_cli():
         convert2npy(args.bfs_filename)
     elif args.func == BFSmeta:
         print(BFSmeta(args.bfs_filename))
+    elif args.func == print_bfsindex:
+        print_bfsindex(args.bfs_filename)
+    elif args.func == plot_bfsstokes:
+        plot_bfsstokes(args.bfs_filename)
+    elif args.func == unzst_bfsfile:
+        unzst_bfsfile(args.bfs_filename)
+    elif args.func == unsephead_bfsfile:
+        unsephead_bfsfile(args.bfs_filename, args.out_filename)
+    elif args.func == unstripe_bfsfile:
+        unstripe_bfsfile(args.bfs_filename, args.stripe_dirs,
+                         args.out_filename)
 
 
 if __name__ == "__main__":
@@ -0,0 +1,247 @@
+/* bfsread.c  reading recorded beamformed (BFS) files at disk speed
+
+   A small library (libbfsread.so, see bfsread.py for the Python bindings)
+   for files written by dump_udp_ow_17: the file is mapped into memory, the
+   headers (struct header_lofar) are decoded in bulk, and the samples can be
+   used where they are: the payload of packet i starts at
+   bfs_payload (f, i), packets are reclen bytes apart, each is nbeamlets x
+   nslices (16) x XrXiYrYi (with 16 or 8 bits, with 4 bits one byte per
+   complex value, real part in the low nibble, see bfs_unpack4()). Missing
+   packets can be padded with zeros (bfs_slots(), bfs_padded()).
+   Only uncompressed files (zstd -d, or unzst in bfs_data.py for seekable
+   ones), without --sizehead and --sephead (see bfssephead_packets() in
+   bfs_data.py).
+*/
+
+#define  _GNU_SOURCE
+
+#include  <stdio.h>
+#include  <stdlib.h>
+#include  <string.h>
+#include  <errno.h>
+#include  <fcntl.h>
+#include  <unistd.h>
+#include  <sys/mman.h>
+#include  <sys/stat.h>
+
+#include  "bfsread.h"
+
+
+/* as in dump_udp_ow_17.c */
+struct __attribute__((__packed__))  header_lofar
+{
+  uint8_t   version;
+  union __attribute__ ((__packed__)) {
+    struct __attribute__ ((__packed__)) {
+      unsigned int  rsp_id   : 5;
+      unsigned int  unused1  : 1;
+      unsigned int  error    : 1;
+      unsigned int  is200mhz : 1;
+      unsigned int  bm       : 2;
+      unsigned int  unused2  : 6;
+    } source;
+    uint16_t  source_int;
+  };
+  uint8_t   config;
+  uint16_t  station;
+  uint8_t   num_beamlets, num_slices;
+  int32_t  timestamp, sequence;
+};
+
+
+static long  packno (const struct header_lofar  *header)
+{
+  return ((header->timestamp*1000000l*(160+40*header->source.is200mhz)+512)/1024+header->sequence)/16;
+}
+
+
+/* bits per value, 122 beamlets without bm set are 8 bits (as bffmtparams()
+   in bfs_data.py) */
+static int  bits (const struct header_lofar  *header)
+{
+  if (header->num_beamlets==2*61 && header->source.bm==0)
+    return 8;
+  return 16>>header->source.bm;
+}
+
+
+/* open and map a file, reclen 0: from the first header
+   returns NULL (with errno set) if not possible */
+struct bfs_file  *bfs_open (const char  *name, long  reclen)
+{
+  struct bfs_file  *f;
+  const struct header_lofar  *header;
+  struct stat  stats;
+
+  f= calloc (1, sizeof (*f));
+  if (f==NULL)
+    return NULL;
+  f->fd= open (name, O_RDONLY);
+  if (f->fd<0 || fstat (f->fd, &stats))
+    goto fail;
+  f->size= stats.st_size;
+  if (f->size<(long)sizeof (*header))
+    {
+      errno= EINVAL;  /* not even one header */
+      goto fail;
+    }
+  f->map= mmap (NULL, f->size, PROT_READ, MAP_SHARED, f->fd, 0);
+  if (f->map==MAP_FAILED)
+    {
+      f->map= NULL;
+      goto fail;
+    }
+  madvise ((void*)f->map, f->size, MADV_SEQUENTIAL);
+
+  if (reclen==0)
+    {
+      header= (const struct header_lofar*)f->map;
+      reclen= sizeof (*header)+
+	(long)header->num_beamlets*header->num_slices*bits (header)/2;
+    }
+  if (reclen<=(long)sizeof (*header))
+    {
+      errno= EINVAL;
+      goto fail;
+    }
+  f->reclen= reclen;
+  f->npacks= f->size/reclen;
+  return f;
+
+ fail:
+  bfs_close (f);
+  return NULL;
+}
+
+
+void  bfs_close (struct bfs_file  *f)
+{
+  int  e= errno;
+
+  if (f==NULL)
+    return;
+  if (f->map)
+    munmap ((void*)f->map, f->size);
+  if (f->fd>=0)
+    close (f->fd);
+  free (f);
+  errno= e;
+}
+
+
+/* decode the headers of packets first.. (at most n), returns how many */
+long  bfs_headers (struct bfs_file  *f, long  first, long  n,
+		   struct bfs_header  *out)
+{
+  const struct header_lofar  *header;
+  long  i;
+
+  if (first<0 || first>=f->npacks)
+    return 0;
+  if (n>f->npacks-first)
+    n= f->npacks-first;
+  for (i= 0; i<n; i++, out++)
+    {
+      header= (const struct header_lofar*)(f->map+(first+i)*f->reclen);
+      out->packno= packno (header);
+      out->timestamp= header->timestamp;
+      out->sequence= header->sequence;
+      out->station= header->station;
+      out->lane= header->source.rsp_id;
+      out->bits= bits (header);
+      out->nbeamlets= header->num_beamlets;
+      out->nslices= header->num_slices;
+      out->config= header->config;
+      out->is200mhz= header->source.is200mhz;
+      out->error= header->source.error;
+      out->version= header->version;
+    }
+  return n;
+}
+
+
+/* the samples of packet i (in the mapping, reclen bytes apart) */
+const uint8_t  *bfs_payload (struct bfs_file  *f, long  i)
+{
+  return f->map+i*f->reclen+sizeof (struct header_lofar);
+}
+
+
+/* the first packet with a packet number >= p (packets in order) */
+static long  bfs_find (struct bfs_file  *f, int64_t  p)
+{
+  long  lo= 0, hi= f->npacks, mid;
+
+  while (lo<hi)
+    {
+      mid= lo+(hi-lo)/2;
+      if (packno ((const struct header_lofar*)(f->map+mid*f->reclen))<p)
+	lo= mid+1;
+      else
+	hi= mid;
+    }
+  return lo;
+}
+
+
+/* for the packet numbers first_packno.. (nslots of them) the packet in the
+   file or -1 if missing, returns how many are there (packets out of order
+   or repeated are skipped) */
+long  bfs_slots (struct bfs_file  *f, int64_t  first_packno, long  nslots,
+		 int64_t  *packet)
+{
+  long  i, k, found= 0;
+  int64_t  p;
+
+  for (k= 0; k<nslots; k++)
+    packet[k]= -1;
+  for (i= bfs_find (f, first_packno); i<f->npacks; i++)
+    {
+      p= packno ((const struct header_lofar*)(f->map+i*f->reclen))-
+	first_packno;
+      if (p>=nslots)
+	break;
+      if (p>=0 && packet[p]<0)
+	{
+	  packet[p]= i;
+	  found++;
+	}
+    }
+  return found;
+}
+
+
+/* copy the payloads of packet numbers first_packno.. (nslots) to out, one
+   after the other, zeros for missing packets, returns how many are there */
+long  bfs_padded (struct bfs_file  *f, int64_t  first_packno, long  nslots,
+		  uint8_t  *out)
+{
+  long  paylen= f->reclen-sizeof (struct header_lofar), k, found;
+  int64_t  *packet;
+
+  packet= malloc (nslots*sizeof (*packet));
+  if (packet==NULL)
+    return -1;
+  found= bfs_slots (f, first_packno, nslots, packet);
+  for (k= 0; k<nslots; k++, out+= paylen)
+    if (packet[k]<0)
+      memset (out, 0, paylen);
+    else
+      memcpy (out, bfs_payload (f, packet[k]), paylen);
+  free (packet);
+  return found;
+}
+
+
+/* 4 bit values to 8 bit, n bytes (complex values) in -> 2n out (real,
+   imaginary) */
+void  bfs_unpack4 (const uint8_t  *in, int8_t  *out, long  n)
+{
+  long  i;
+
+  for (i= 0; i<n; i++)
+    {
+      out[2*i]= (int8_t)(in[i]<<4)>>4;
+      out[2*i+1]= (int8_t)in[i]>>4;
+    }
+}
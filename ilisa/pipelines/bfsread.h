@@ -0,0 +1,41 @@
+/* bfsread.h  reading recorded beamformed (BFS) files, see bfsread.c */
+
+#ifndef  BFSREAD_H
+#define  BFSREAD_H
+
+#include  <stdint.h>
+
+/* an open file, the packets are in map */
+struct bfs_file
+{
+  int  fd;
+  const uint8_t  *map;
+  long  size;  /* bytes */
+  long  reclen;  /* bytes per packet (header and payload) */
+  long  npacks;  /* whole packets in the file */
+};
+
+/* decoded header_lofar of a packet (see bfs_headers()) */
+struct bfs_header
+{
+  int64_t  packno;  /* as beamformed_packno() of dump_udp_ow_17 */
+  int32_t  timestamp, sequence;
+  int32_t  station;
+  int16_t  lane;  /* rsp_id */
+  int16_t  bits;  /* per value: 16, 8 or 4 */
+  int16_t  nbeamlets, nslices;
+  int8_t  config, is200mhz, error, version;
+};
+
+struct bfs_file  *bfs_open (const char  *name, long  reclen);
+void  bfs_close (struct bfs_file  *f);
+long  bfs_headers (struct bfs_file  *f, long  first, long  n,
+		   struct bfs_header  *out);
+const uint8_t  *bfs_payload (struct bfs_file  *f, long  i);
+long  bfs_slots (struct bfs_file  *f, int64_t  first_packno, long  nslots,
+		 int64_t  *packet);
+long  bfs_padded (struct bfs_file  *f, int64_t  first_packno, long  nslots,
+		  uint8_t  *out);
+void  bfs_unpack4 (const uint8_t  *in, int8_t  *out, long  n);
+
+#endif  /* BFSREAD_H */
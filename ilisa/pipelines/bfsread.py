@@ -0,0 +1,190 @@
+"""Fast reading of recorded BFS files with libbfsread.so (see bfsread.c)
+
+The file is mapped into memory and the samples are numpy views of the
+mapping, without copying, e.g.:
+
+    with BFSFile(bfs_filename) as bfs:
+        hdrs = bfs.headers()          # all headers, decoded
+        data = bfs.data()             # packet x beamlet x slice x XrXiYrYi
+        xpow = (data[:, 10, :, 0:2].astype(float)**2).sum(axis=-1)
+        padded, present = bfs.padded()  # copy with zeros for missing packets
+
+Build the library with make in this directory.
+"""
+import ctypes
+import os
+
+import numpy as np
+
+LIBBFSREAD = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                          'libbfsread.so')
+
+# struct bfs_header of bfsread.h
+BFSREAD_header_dtype = np.dtype([('packno', '<i8'), ('timestamp', '<i4'),
+                                 ('sequence', '<i4'), ('station', '<i4'),
+                                 ('lane', '<i2'), ('bits', '<i2'),
+                                 ('nbeamlets', '<i2'), ('nslices', '<i2'),
+                                 ('config', 'i1'), ('is200mhz', 'i1'),
+                                 ('error', 'i1'), ('version', 'i1')])
+PACKETHDRSZ = 16
+
+
+class _BFSFileStruct(ctypes.Structure):
+    _fields_ = [('fd', ctypes.c_int), ('map', ctypes.c_void_p),
+                ('size', ctypes.c_long), ('reclen', ctypes.c_long),
+                ('npacks', ctypes.c_long)]
+
+
+_lib = None
+
+
+def _load():
+    """The library, loaded on first use"""
+    global _lib
+    if _lib is None:
+        lib = ctypes.CDLL(LIBBFSREAD, use_errno=True)
+        lib.bfs_open.restype = ctypes.POINTER(_BFSFileStruct)
+        lib.bfs_open.argtypes = [ctypes.c_char_p, ctypes.c_long]
+        lib.bfs_close.argtypes = [ctypes.POINTER(_BFSFileStruct)]
+        lib.bfs_headers.restype = ctypes.c_long
+        lib.bfs_headers.argtypes = [ctypes.POINTER(_BFSFileStruct),
+                                    ctypes.c_long, ctypes.c_long,
+                                    ctypes.c_void_p]
+        lib.bfs_slots.restype = ctypes.c_long
+        lib.bfs_slots.argtypes = [ctypes.POINTER(_BFSFileStruct),
+                                  ctypes.c_int64, ctypes.c_long,
+                                  ctypes.c_void_p]
+        lib.bfs_padded.restype = ctypes.c_long
+        lib.bfs_padded.argtypes = [ctypes.POINTER(_BFSFileStruct),
+                                   ctypes.c_int64, ctypes.c_long,
+                                   ctypes.c_void_p]
+        lib.bfs_unpack4.argtypes = [ctypes.c_void_p, ctypes.c_void_p,
+                                    ctypes.c_long]
+        _lib = lib
+    return _lib
+
+
+def available():
+    """Whether libbfsread.so can be used"""
+    try:
+        _load()
+    except OSError:
+        return False
+    return True
+
+
+class BFSFile:
+    """A recorded BFS file (uncompressed), mapped into memory"""
+
+    def __init__(self, bfs_filename, reclen=0):
+        """reclen is the size of the packets, 0: from the first header"""
+        lib = _load()
+        self._f = lib.bfs_open(os.fsencode(bfs_filename), reclen)
+        if not self._f:
+            errno = ctypes.get_errno()
+            raise OSError(errno, os.strerror(errno), bfs_filename)
+        self.reclen = self._f.contents.reclen
+        self.npacks = self._f.contents.npacks
+        self._map = (ctypes.c_uint8 * self._f.contents.size).from_address(
+            self._f.contents.map)
+        first = self.headers(0, 1)
+        self.bits = int(first['bits'][0]) if len(first) else 16
+        self.nbeamlets = int(first['nbeamlets'][0]) if len(first) else 0
+        self.nslices = int(first['nslices'][0]) if len(first) else 16
+
+    def close(self):
+        """Unmap the file, views from data() must not be used any more"""
+        if self._f:
+            self._map = None
+            _load().bfs_close(self._f)
+            self._f = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def __del__(self):
+        self.close()
+
+    def headers(self, first=0, n=None):
+        """Decoded headers of packets first.. as a numpy record array"""
+        if n is None:
+            n = self.npacks - first
+        hdrs = np.empty(max(n, 0), dtype=BFSREAD_header_dtype)
+        got = _load().bfs_headers(self._f, first, len(hdrs),
+                                  hdrs.ctypes.data)
+        return hdrs[:got]
+
+    def _sample_dtype(self):
+        # with 4 bits one byte per complex value (see unpack4())
+        return np.dtype({16: '<i2', 8: 'i1', 4: 'u1'}[self.bits])
+
+    def _ncomp(self):
+        return 2 if self.bits == 4 else 4
+
+    def data(self):
+        """\
+        The samples of all packets as a view of the file (no copy)
+
+        Shape is packet x beamlet x slice x (Xr, Xi, Yr, Yi), with 4 bits
+        packet x beamlet x slice x (X, Y) as bytes (see unpack4()).
+        """
+        dtype = self._sample_dtype()
+        ncomp = self._ncomp()
+        return np.ndarray(
+            (self.npacks, self.nbeamlets, self.nslices, ncomp), dtype=dtype,
+            buffer=self._map, offset=PACKETHDRSZ,
+            strides=(self.reclen, self.nslices * ncomp * dtype.itemsize,
+                     ncomp * dtype.itemsize, dtype.itemsize))
+
+    def x(self):
+        """View of the X samples, packet x beamlet x slice x (re, im)"""
+        return self.data()[..., 0:2]
+
+    def y(self):
+        """View of the Y samples, packet x beamlet x slice x (re, im)"""
+        return self.data()[..., 2:4]
+
+    def slots(self, first_packno=None, nslots=None):
+        """\
+        Packet in the file of each packet number first_packno.. (or -1)
+
+        Default is from the first to the last packet of the file.
+        """
+        first_packno, nslots = self._range(first_packno, nslots)
+        packet = np.empty(nslots, dtype='<i8')
+        _load().bfs_slots(self._f, first_packno, nslots, packet.ctypes.data)
+        return packet
+
+    def padded(self, first_packno=None, nslots=None):
+        """\
+        Copy of the samples of packet numbers first_packno.., zeros for
+        missing packets (as data()), and which of them are present
+        """
+        first_packno, nslots = self._range(first_packno, nslots)
+        dtype = self._sample_dtype()
+        out = np.empty((nslots, self.nbeamlets, self.nslices, self._ncomp()),
+                       dtype=dtype)
+        assert out[0].nbytes == self.reclen - PACKETHDRSZ if nslots else True
+        _load().bfs_padded(self._f, first_packno, nslots, out.ctypes.data)
+        return out, self.slots(first_packno, nslots) >= 0
+
+    def _range(self, first_packno, nslots):
+        if first_packno is None or nslots is None:
+            ends = np.concatenate((self.headers(0, 1)['packno'],
+                                   self.headers(self.npacks - 1, 1)['packno']))
+            if first_packno is None:
+                first_packno = int(ends[0]) if len(ends) else 0
+            if nslots is None:
+                nslots = int(ends[-1]) - first_packno + 1 if len(ends) else 0
+        return first_packno, max(nslots, 0)
+
+
+def unpack4(samples):
+    """4 bit samples (bytes, as from data()) to int8 (..., re, im)"""
+    samples = np.ascontiguousarray(samples, dtype=np.uint8)
+    out = np.empty(samples.shape + (2,), dtype=np.int8)
+    _load().bfs_unpack4(samples.ctypes.data, out.ctypes.data, samples.size)
+    return out
@@ -2,6 +2,10 @@
 
 gcc -Wall -O -o dump_udp_ow_17 dump_udp_ow_17.c -lpthread
 
+with built-in compression (libzstd):
+
+gcc -Wall -O -DHAVE_ZSTD -o dump_udp_ow_17 dump_udp_ow_17.c -lpthread -lzstd
+
 or more pedantic:
 
 gcc -Wall -std=c11 -pedantic -Werror -O -o dump_udp_ow_17 dump_udp_ow_17.c -lpthread
@@ -35,6 +39,16 @@ dd if=/media/storage_1/wucknitz/TEMP/B1133+16_udp/B1133+16_band110_190_lanes4_sb
 
 ./dump_udp_ow_17 --ports 16011 --out /media/storage_1/wucknitz/TEST/test --duration 1 --check
 
+or with synthetic packets at station rate (or faster, with loss and
+reordering) from gen_udp_ow.c:
+
+./gen_udp_ow --ports 16011 --duration 10
+
+benchmark of the receive path (throughput, drops, CPU per GB) for several
+sets of options:
+
+./bench_udp_ow.py --rate 0 --count 200000 --config '' --config '--batch 64'
+
 
 
 on lofar1:
@@ -52,6 +66,44 @@ version 15  can select IP and/or device, and can write source IP and port
 version 16  allows compiling at KAIRA (SO_BINDTODEVICE missing there)
 
 version 17  can skip first n packets for each new stream (after timeout etc.)
+            batched receive with recvmmsg() (--batch, --batch_timeout)
+            receive directly into the ring buffer (--zerocopy)
+            lock-free ring buffer between producer and consumer
+            one receiving thread and ring buffer per socket (--rxthreads,
+            --sockrings, --rx_cpus)
+            capture from a packet ring (--capture packet, --packet_ring)
+            built-in compression with libzstd (-DHAVE_ZSTD, --zstd_workers,
+            --zstd_level, --zstd_params)
+            O_DIRECT writer with io_uring (--direct, --direct_depth)
+            ring buffer on huge pages, prefaulted, locked, on a NUMA node
+            (--hugepages, --prefault, --mlock, --numa_node)
+            packet index file next to each output file (--index)
+            reorder window and gap filling (--reorder, --fill_max)
+            live metrics in a shared memory page (--metrics,
+            --metrics_interval)
+            kernel drops over time and histograms of arrival jitter and
+            latency (--rx_stats)
+            thread placement and SCHED_FIFO (--consumer_cpus, --rx_priority,
+            --numa_node device)
+            beamlet selection and requantization with SSE2/AVX2/NEON
+            (--beamlets, --bitmode, --requant, --requant_scale)
+            online Stokes parameters with SSE2/NEON (--stokes, --stokes_int,
+            --stokes_mode)
+            transient buffer, written on trigger (--trigger, --trigger_post,
+            --trigger_port)
+            one output file per port from one process (--demux)
+            split files opened ahead and closed in the background
+            seekable zstd format, frames of whole packets (--zstd_frame)
+            headers apart from payloads, byte planes (--sephead, --shuffle)
+            forwarding to other hosts, non-blocking (--forward,
+            --forward_beamlets, --forward_rate)
+            striped output over several disks, one writer thread each
+            (--stripe, --stripe_balance)
+            overload policy in steps by fill level, logged (--overload,
+            --overload_level, --overload_beamlets, --overload_block,
+            --overload_log)
+            recorder that stays up, start/stop/split at packet times
+            over a control socket (--control)
 
 */
 
@@ -73,6 +125,7 @@ version 17  can skip first n packets for each new stream (after timeout etc.)
 
 #include  <sys/types.h>
 #include  <sys/socket.h>
+#include  <sys/un.h>
 #include  <netdb.h>
 #include  <assert.h>
 #include  <string.h>
@@ -102,6 +155,42 @@ version 17  can skip first n packets for each new stream (after timeout etc.)
 
 #include  <sys/mman.h>
 
+/* for the lock-free ring buffer: */
+#include  <stdatomic.h>
+#include  <limits.h>
+#include  <linux/futex.h>
+#include  <sys/syscall.h>
+
+/* for the packet ring (--capture packet): */
+#include  <linux/if_packet.h>
+#include  <linux/if_ether.h>
+#include  <linux/filter.h>
+#include  <net/if.h>
+
+/* for the O_DIRECT writer (--direct): */
+#include  <fcntl.h>
+#include  <stdint.h>
+#include  <linux/io_uring.h>
+
+/* for the memory of the ring buffers (--numa_node) */
+#include  <linux/mempolicy.h>
+
+/* for the live metrics (--metrics) */
+#include  <linux/sock_diag.h>
+
+/* for the beamlet transformation (--beamlets, --requant) */
+#if defined (__x86_64__)
+#include  <immintrin.h>
+#endif
+#if defined (__ARM_NEON) && defined (__aarch64__)
+#include  <arm_neon.h>
+#endif
+
+/* built-in compression (compile with -DHAVE_ZSTD -lzstd, make ZSTD=1) */
+#ifdef  HAVE_ZSTD
+#include  <zstd.h>
+#endif
+
 
 
 #define  MAXNSOCK  12
@@ -118,14 +207,13 @@ version 17  can skip first n packets for each new stream (after timeout etc.)
 
 
 
-pthread_mutex_t region_mutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_mutex_t stopped_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t space_available = PTHREAD_COND_INITIALIZER;
-pthread_cond_t data_available = PTHREAD_COND_INITIALIZER;
-/* the last one is also used to stop recording! It is used to tell consumer()
-to act one way or the other. */
+/* the ring buffer needs no mutex (see struct vrb). Waking up the consumer
+with vrb_wake_consumer() is also used to stop recording! It is used to tell
+consumer() to act one way or the other. */
 
-int  producer_running= 0;
+/* number of producer threads still running */
+_Atomic int  producer_running= 0;
 
 
 #if  MYDEBUG
@@ -145,39 +233,180 @@ pthread_mutex_t mydebug_mutex = PTHREAD_MUTEX_INITIALIZER;
 https://abhinavag.medium.com/a-fast-circular-ring-buffer-4d102ef4d4a3
 */
 
+/* lets a thread sleep until the other one has made progress (event count
+   on top of a futex). The other side only needs a system call if somebody
+   is actually waiting.
+*/
+struct vrb_event {
+  _Atomic int  seq,  /* changed for every wake-up */
+    waiters;  /* threads that are (about to go) sleeping */
+};
+
+
+/* announce that we want to wait, returns the key for vrb_event_wait()
+   the condition must be checked again after this */
+int  vrb_event_prepare (struct vrb_event  *ev)
+{
+  int  key;
+
+  atomic_fetch_add (&ev->waiters, 1);
+  key= atomic_load (&ev->seq);
+  atomic_thread_fence (memory_order_seq_cst);  /* before checking again */
+  return key;
+}
+
+
+/* sleep until notified (returns at once if that happened since prepare) */
+void  vrb_event_wait (struct vrb_event  *ev, int  key)
+{
+  syscall (SYS_futex, &ev->seq, FUTEX_WAIT_PRIVATE, key, NULL, NULL, 0);
+  atomic_fetch_sub (&ev->waiters, 1);
+}
+
+
+/* condition was true after all, do not wait */
+void  vrb_event_cancel (struct vrb_event  *ev)
+{
+  atomic_fetch_sub (&ev->waiters, 1);
+}
+
+
+/* wake up waiting threads, after making the progress visible
+   always: even if no waiter is seen (for signal_handler()) */
+void  vrb_event_notify (struct vrb_event  *ev, int  always)
+{
+  atomic_thread_fence (memory_order_seq_cst);  /* pairs with prepare */
+  if (always || atomic_load_explicit (&ev->waiters, memory_order_relaxed))
+    {
+      atomic_fetch_add (&ev->seq, 1);
+      syscall (SYS_futex, &ev->seq, FUTEX_WAKE_PRIVATE, INT_MAX,
+	       NULL, NULL, 0);
+    }
+}
+
+
+
 /* virtual ring buffer adapted from this:
    https://en.wikipedia.org/w/index.php?title=Circular_buffer&oldid=588930355#Optimization
    virtual ringbuffer with two virtual copies so that all access
    can be done without wrapping
+
+   single producer, single consumer without locks: rear and added are only
+   written by the producer, front and removed only by the consumer, each on
+   their own cache line. added and removed count all bytes ever added or
+   removed, their difference is the fill size.
 */
 struct vrb {
-  long  fillsize,  /* bytes in buffer */
-    front,  /* older end (take away data from here) */
-    rear,  /* newer end (add new data here) */
-    totsize;  /* total size of buffer */
+  long  totsize;  /* total size of buffer */
   char  *buff;  /* address of first copy, allowed range is 2*totsize */
   char  *filename;  /* or NULL */
+
+  long  rear  /* newer end (add new data here) */
+    __attribute__ ((aligned (64)));
+  _Atomic long  added;
+
+  long  front  /* older end (take away data from here) */
+    __attribute__ ((aligned (64)));
+  _Atomic long  removed;
+
+  /* consumer waits for data, producer for space (only for stdin)
+     data_event normally points to own_data_event, but several rings that
+     are read by one consumer share one (see vrb_share_data_event()) */
+  struct vrb_event  *data_event;
+  struct vrb_event  own_data_event  __attribute__ ((aligned (64)));
+  struct vrb_event  space_event  __attribute__ ((aligned (64)));
 };
 
 
 
+/* memory of the buffers (--hugepages, --prefault, --mlock, --numa_node) */
+int  vrb_hugepages= 0, vrb_prefault= 0, vrb_mlock= 0, vrb_numa_node= -1;
+
+
+/* default huge page size from /proc/meminfo, in bytes */
+long  huge_page_size (void)
+{
+  FILE  *f;
+  char  line[200];
+  long  kb= 2048;  /* if not found */
+
+  f= fopen ("/proc/meminfo", "r");
+  if (f)
+    {
+      while (fgets (line, sizeof (line), f))
+	if (sscanf (line, "Hugepagesize: %ld kB", &kb)==1)
+	  break;
+      fclose (f);
+    }
+  return kb*1024;
+}
+
+
+/* bind, prefault and lock both copies, before any packet arrives
+   (the second copy is written as well, so that it never page faults
+   either: the buffer is still empty) */
+void  vrb_prepare_memory (struct vrb  *vrb, long  pagesize)
+{
+  unsigned long  nodemask[16];
+  volatile char  *p;
+  long  l;
+
+  if (vrb_numa_node>=0)
+    {
+      memset (nodemask, 0, sizeof (nodemask));
+      nodemask[vrb_numa_node/64]= 1UL << (vrb_numa_node%64);
+      /* one call for both copies: they share the pages of the file */
+      if (syscall (SYS_mbind, vrb->buff, vrb->totsize, MPOL_BIND,
+		   nodemask, 8*sizeof (nodemask), 0))
+	{
+	  perror ("mbind() in init_vrb()");
+	  exit (1);
+	}
+    }
+
+  if (vrb_prefault)
+    for (p= vrb->buff, l= 0; l<2*vrb->totsize; l+= pagesize)
+      p[l]= 0;
+
+  if (vrb_mlock)
+    if (mlock (vrb->buff, 2*vrb->totsize))
+      {
+	perror ("mlock() in init_vrb() (see ulimit -l)");
+	exit (1);
+      }
+}
+
+
 /* allocate and init */
 void  init_vrb (struct vrb  *vrb, long  minsize)
 {
   int  i, fd;
-  static char  path1[]= "/dev/shm/dump_udp_ow_17_vrb-XXXXXX";
-  static char  path2[]= "/tmp/dump_udp_ow_17_vrb-XXXXXX";
+  /* not static: mkstemp() replaces the XXXXXX (and we may have several) */
+  char  path1[]= "/dev/shm/dump_udp_ow_17_vrb-XXXXXX";
+  char  path2[]= "/tmp/dump_udp_ow_17_vrb-XXXXXX";
   char  *addr, *path;
+  long  pagesize, slack;
   
   /* promote to the next full page size: */
-  i= getpagesize ();
-  vrb->totsize= (minsize+i-1)/i * i;
+  pagesize= vrb_hugepages ? huge_page_size () : getpagesize ();
+  vrb->totsize= (minsize+pagesize-1)/pagesize * pagesize;
 #if 0
   printf ("minsize %ld  totsize %ld  pages %ld\n", minsize, vrb->totsize,
 	  vrb->totsize/i);
 #endif
   /* set up the buffer */
 
+  if (vrb_hugepages)  /* anonymous file on hugetlbfs */
+    {
+      fd= memfd_create ("dump_udp_ow_17_vrb", MFD_HUGETLB);
+      if (fd<0)
+	{
+	  perror ("memfd_create() with MFD_HUGETLB in init_vrb()");
+	  exit (1);
+	}
+      goto have_fd;
+    }
+
   path= path1;
   fd= mkstemp (path);
   if (fd<0)  /* this failed for some reason: try /tmp */
@@ -200,6 +429,7 @@ void  init_vrb (struct vrb  *vrb, long  minsize)
     }
 #endif
 
+ have_fd:
   i= ftruncate (fd, vrb->totsize);
   if (i)
     {
@@ -208,19 +438,33 @@ void  init_vrb (struct vrb  *vrb, long  minsize)
     }
 
 
-  addr= mmap (NULL, 2*vrb->totsize,
+  /* huge pages must be mapped at a multiple of their size:
+     reserve one more and give back what is not aligned */
+  slack= vrb_hugepages ? pagesize : 0;
+  addr= mmap (NULL, 2*vrb->totsize + slack,
 	      PROT_NONE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
   if (addr==MAP_FAILED)
     {
       perror ("first mmap() in init_vrb()");
       exit (1);
     }
+  if (slack)
+    {
+      i= (uintptr_t) addr % pagesize ? pagesize - (uintptr_t) addr % pagesize
+	: 0;
+      if (i)
+	munmap (addr, i);
+      if (slack-i)
+	munmap (addr + i + 2*vrb->totsize, slack-i);
+      addr+= i;
+    }
 
   vrb->buff= mmap (addr, vrb->totsize, PROT_READ | PROT_WRITE,
 		   MAP_FIXED | MAP_SHARED, fd, 0);
   if (vrb->buff!=addr)
     {
-      perror ("second mmap() in init_vrb()");
+      perror (vrb_hugepages ? "second mmap() in init_vrb() "
+	      "(see /proc/sys/vm/nr_hugepages)" : "second mmap() in init_vrb()");
       exit (1);
     }
 
@@ -240,7 +484,16 @@ void  init_vrb (struct vrb  *vrb, long  minsize)
       exit (1);
     }
 
-  vrb->front= vrb->rear= vrb->fillsize= 0;
+  vrb_prepare_memory (vrb, pagesize);
+
+  vrb->front= vrb->rear= 0;
+  atomic_init (&vrb->added, 0);
+  atomic_init (&vrb->removed, 0);
+  vrb->data_event= &vrb->own_data_event;
+  atomic_init (&vrb->own_data_event.seq, 0);
+  atomic_init (&vrb->own_data_event.waiters, 0);
+  atomic_init (&vrb->space_event.seq, 0);
+  atomic_init (&vrb->space_event.waiters, 0);
 
 
 #if 0
@@ -268,10 +521,23 @@ void  free_vrb (struct vrb  *vrb)
 
 
 
+/* bytes in buffer, can be called from any thread
+   (removed is read first, so that the result is never negative) */
+long  vrb_fillsize (struct vrb  *vrb)
+{
+  long  removed;
+
+  removed= atomic_load_explicit (&vrb->removed, memory_order_acquire);
+  return atomic_load_explicit (&vrb->added, memory_order_acquire) - removed;
+}
+
+
+/* only for the producer: */
+
 char  *vrb_poi_new (struct vrb  *vrb, long  thissize)
 {
-  /*  fprintf (stdout, "vrb_poi_new %4ld  rear %8ld  front %8ld  fillsize %8ld\n", thissize, vrb->rear, vrb->front, vrb->fillsize); */
-  if (vrb->fillsize + thissize > vrb->totsize)  /* not enough space */
+  /*  fprintf (stdout, "vrb_poi_new %4ld  rear %8ld  front %8ld  fillsize %8ld\n", thissize, vrb->rear, vrb->front, vrb_fillsize (vrb)); */
+  if (vrb_fillsize (vrb) + thissize > vrb->totsize)  /* not enough space */
     return NULL;
   else
     return vrb->buff + vrb->rear;
@@ -281,15 +547,22 @@ char  *vrb_poi_new (struct vrb  *vrb, long  thissize)
 void  vrb_advance_new (struct vrb  *vrb, long  thissize)
 {
   vrb->rear= (vrb->rear+thissize)%vrb->totsize;
-  vrb->fillsize+= thissize;
-  /*  fprintf (stdout, "vrb_advance_new %4ld  rear %8ld  front %8ld  fillsize %8ld\n", thissize, vrb->rear, vrb->front, vrb->fillsize); */
+  /* release: the data are written before the consumer can see them */
+  atomic_store_explicit (&vrb->added,
+			 atomic_load_explicit (&vrb->added,
+					       memory_order_relaxed)+thissize,
+			 memory_order_release);
+  vrb_event_notify (vrb->data_event, 0);
+  /*  fprintf (stdout, "vrb_advance_new %4ld  rear %8ld  front %8ld  fillsize %8ld\n", thissize, vrb->rear, vrb->front, vrb_fillsize (vrb)); */
 }
 
 
+/* only for the consumer: */
+
 char  *vrb_poi_old (struct vrb  *vrb)
 {
-  /*  fprintf (stdout, "vrb_poi_old  rear %8ld  front %8ld  fillsize %8ld\n", vrb->rear, vrb->front, vrb->fillsize); */
-  if (vrb->fillsize==0) /* nothing in buffer */
+  /*  fprintf (stdout, "vrb_poi_old  rear %8ld  front %8ld  fillsize %8ld\n", vrb->rear, vrb->front, vrb_fillsize (vrb)); */
+  if (vrb_fillsize (vrb)==0) /* nothing in buffer */
     return NULL;
   else
     return vrb->buff + vrb->front;
@@ -299,28 +572,56 @@ char  *vrb_poi_old (struct vrb  *vrb)
 void  vrb_advance_old (struct vrb  *vrb, long  thissize)
 {
   vrb->front= (vrb->front+thissize)%vrb->totsize;
-  vrb->fillsize-= thissize;
-  /*  fprintf (stdout, "vrb_advance_old %4ld  rear %8ld  front %8ld  fillsize %8ld\n", thissize, vrb->rear, vrb->front, vrb->fillsize); */
+  /* release: we are done reading before the producer may overwrite */
+  atomic_store_explicit (&vrb->removed,
+			 atomic_load_explicit (&vrb->removed,
+					       memory_order_relaxed)+thissize,
+			 memory_order_release);
+  vrb_event_notify (&vrb->space_event, 0);
+  /*  fprintf (stdout, "vrb_advance_old %4ld  rear %8ld  front %8ld  fillsize %8ld\n", thissize, vrb->rear, vrb->front, vrb_fillsize (vrb)); */
+}
+
+
+/* wake up the consumer, even without new data (e.g. to stop) */
+void  vrb_wake_consumer (struct vrb  *vrb)
+{
+  vrb_event_notify (vrb->data_event, 1);
+}
+
+
+/* let vrb wake the same consumer as other (before it is used) */
+void  vrb_share_data_event (struct vrb  *vrb, struct vrb  *other)
+{
+  vrb->data_event= other->data_event;
 }
 
 
 
 struct vrb  ringbuffer;
 
+/* with --sockrings each socket has its own ring buffer, the first is
+   ringbuffer, the others are in moreringbuffers[]; otherwise all sockets use
+   ringbuffer. All rings share the data_event of ringbuffer. */
+struct vrb  moreringbuffers[MAXNSOCK-1];
+struct vrb  *rings[MAXNSOCK],  /* all rings */
+  *sockring[MAXNSOCK];  /* ring per socket */
+int  nrings= 1, sockrings= 0;
+
+/* several threads write into ringbuffer (--rxthreads without --sockrings),
+   then they take turns (locked by rear_mutex) */
+int  shared_ring= 0;
+pthread_mutex_t  rear_mutex= PTHREAD_MUTEX_INITIALIZER;
+
 
 
 /*
   rear is only used in producer, front only in consumer
-  size in both
+  size in both (as added-removed)
   allbuffs also in both, but there are no conflicts
-
-  region_mutex protects size and the buffer (?)
  */
 
-int  maxsock;
 int  sock[MAXNSOCK];
-
-long  dropped_kernel[MAXNSOCK];
+int  portnos[MAXNSOCK],nsock;
 
 int  packlen;
 
@@ -331,6 +632,15 @@ int  dowrite= 1;
 
 int  beamformed_check= 0;
 
+/* reorder window size, 0: off, and longest gap to fill (see reorder_packet()) */
+int  reorder= 0;
+long  fill_max= 100000;
+
+/* only write on trigger (see trigger_hold()) */
+int  trigger_mode= 0;
+int  demux= 0;  /* one output file per port (--demux) */
+int  demux_open ();
+
 
 /* recording stopped? 
    0: no, 1: for this file, 2: forever, -1: stop this file (split)
@@ -341,10 +651,145 @@ int  stopped= 0;
 int  timeout_exit= 0;
 
 /*long bufsize; */
-long maxsize, bytes_written_thisfile;
+long  bytes_written_thisfile;
+
+
+/* counters per socket, only updated by the thread that receives from this
+   socket (with --rxthreads these are different threads), each socket on
+   its own cache line(s) so that the threads do not get in each other's way
+
+   fill level statistics of the ring buffer the socket writes to, with
+   atomics because they are reset by the consumer: maximum fill size, sum of
+   fill fractions in units of 1/FILLLEVEL_UNIT, number of values summed */
+#define  FILLLEVEL_UNIT  (1l<<24)
+
+struct sockstat {
+  /* updated with count_add(), can be read live (see --metrics) */
+  _Atomic long  packs_seen, packs_dropped, bytes_written;
+  long  beamformed_good_packs;
+  long  beamformed_first_packno, beamformed_last_packno;
+  long  last_packs_dropped, last_packs_expected, last_packs_seen,
+    last_good_packs;
+  long  dropped_kernel;
+  _Atomic long  packs_filled, packs_late;  /* see --reorder */
+  int  this_nskip;  /* how many packets still to skip this round */
+  _Atomic long  maxsize, sum_filllevel, n_filllevel;
+  _Atomic long  last_rx;  /* time of last datagram (ns), see rx_timeout() */
+} __attribute__ ((aligned (64)));
+
+struct sockstat  sockstat[MAXNSOCK];
+
+
+/* a counter that only one thread writes: relaxed, without the cost of a
+   read-modify-write */
+static inline void  count_add (_Atomic long  *counter, long  n)
+{
+  atomic_store_explicit (counter, atomic_load_explicit (
+			   counter, memory_order_relaxed)+n,
+			 memory_order_relaxed);
+}
+
+
+
+/* capture engine (--capture): normal UDP sockets, or with CAPTURE_PACKET
+   an mmap'd AF_PACKET ring (TPACKET_V3) per port. Then sock[i] is the
+   packet socket, the UDP socket is only bound to keep the port open (so
+   that no ICMP errors are sent) and drops everything. */
+#define  CAPTURE_UDP  0
+#define  CAPTURE_PACKET  1
+int  capture= CAPTURE_UDP;
+double  packet_ring_size= 64e6;  /* per port */
+
+#define  PACKET_BLOCKSIZE  (1<<22)
+
+struct pktring {
+  char  *map;  /* nblocks blocks of PACKET_BLOCKSIZE */
+  int  nblocks, cur;  /* cur: next block to look at */
+  int  udp_sock;
+  long  drops;  /* summed from PACKET_STATISTICS (which resets them) */
+};
+
+struct pktring  pktrings[MAXNSOCK];
+
+
+
+/* add n values with a sum of fill fractions sumfrac (socket i) */
+void  count_filllevel (int  i, double  sumfrac, long  n)
+{
+  atomic_fetch_add_explicit (&sockstat[i].sum_filllevel,
+			     (long)(sumfrac*FILLLEVEL_UNIT),
+			     memory_order_relaxed);
+  atomic_fetch_add_explicit (&sockstat[i].n_filllevel, n,
+			     memory_order_relaxed);
+}
+
+
+void  count_maxsize (int  i, long  fillsize)
+{
+  if (fillsize>atomic_load_explicit (&sockstat[i].maxsize,
+				     memory_order_relaxed))
+    atomic_store_explicit (&sockstat[i].maxsize, fillsize,
+			   memory_order_relaxed);
+}
+
+
+/* the following combine all sockets */
+
+long  max_fillsize ()
+{
+  long  m, mi;
+  int  i;
+
+  m= 0;
+  for (i= 0; i<nsock; i++)
+    {
+      mi= atomic_load (&sockstat[i].maxsize);
+      if (mi>m)
+	m= mi;
+    }
+  return m;
+}
+
+
+double  mean_filllevel ()
+{
+  long  sum, n;
+  int  i;
+
+  sum= n= 0;
+  for (i= 0; i<nsock; i++)
+    {
+      sum+= atomic_load (&sockstat[i].sum_filllevel);
+      n+= atomic_load (&sockstat[i].n_filllevel);
+    }
+  return sum/(double)FILLLEVEL_UNIT/n;
+}
+
+
+void  reset_filllevel ()
+{
+  int  i;
+
+  for (i= 0; i<MAXNSOCK; i++)
+    {
+      atomic_store (&sockstat[i].maxsize, 0);
+      atomic_store (&sockstat[i].sum_filllevel, 0);
+      atomic_store (&sockstat[i].n_filllevel, 0);
+    }
+}
+
+
+/* bytes written (to the ring buffers) in total */
+long  total_bytes ()
+{
+  long  sum;
+  int  i;
 
-double  sum_filllevel;
-long  n_filllevel;
+  sum= 0;
+  for (i= 0; i<nsock; i++)
+    sum+= sockstat[i].bytes_written;
+  return sum;
+}
 
 
 /* write data in chunks so that the buffer is already partly free'd: */
@@ -353,21 +798,13 @@ long  maxwrite= 1024*1024;
 
 
 FILE  *outf;
-long  totlen, lasttotlen;
-long  packs_seen[MAXNSOCK], packs_dropped[MAXNSOCK], bytes_written[MAXNSOCK],
-  beamformed_good_packs[MAXNSOCK];
-int  portnos[MAXNSOCK],nsock;
-long  beamformed_first_packno[MAXNSOCK], beamformed_last_packno[MAXNSOCK];
-
-long  last_packs_dropped[MAXNSOCK], last_packs_expected[MAXNSOCK], last_packs_seen[MAXNSOCK], last_good_packs[MAXNSOCK];
+long  lasttotlen;
 
 
 
 struct timespec  timeout;
 
 
-fd_set  allsocks;
-
 char  thisfilename[2000], filename[500], hostname[100];
 
 char  *portlist;
@@ -377,11 +814,18 @@ char  *portlist;
 int  compress;
 char  compcommand[1000];
 
+/* built-in compression with libzstd (--compress without --compcommand),
+   the defaults correspond to the first zstd command in
+   determine_std_compcommand() */
+int  zstd_builtin= 0, zstd_workers= 2, zstd_level= 1;
+char  zstd_params[500]=
+  "strategy=0,windowLog=15,hashLog=7,searchLog=1,minMatch=7,jobSize=50M";
+long  bytes_compressed_thisfile;  /* output of built-in compression */
+
 
 double  maxfilesize;
 int  filenumber, stat_per_splitfile,
-  nskip,       /* how many first packets to skip, 0 for none */
-  this_nskip[MAXNSOCK];  /* how many packets still to skip this round (per socket) */
+  nskip;       /* how many first packets to skip, 0 for none */
 
 
 /* return timestamp for either timestamp as string or yyyy-mm-ddThh:mm:ss 
@@ -453,11 +897,239 @@ double  realtime ()
 }
 
 
+/* receive statistics per socket (--rx_stats)
+
+   The kernel adds control messages to each datagram: the time it was
+   received (SO_TIMESTAMPNS) and, once there have been drops, the number of
+   datagrams it has dropped on this socket so far (SO_RXQ_OVFL, per socket,
+   so also per destination IP). With --capture packet the time is in the
+   packet ring and the drops come from PACKET_STATISTICS, once per block.
+   The drops are attributed to the time of the next packet that arrives,
+   consecutive seconds with drops form one interval.
+
+   Histograms in powers of two microseconds (bin 0: < 1 us, bin k: < 2^k us)
+   of the jitter of the arrival times: difference of successive delays
+   (arrival minus time in the header) with --check, otherwise the time
+   between packets; and of the latency from receive to written out of the
+   ring buffer, sampled at most every RXSAMPLE_NS: the receiving thread
+   queues the ring position and time, the consumer takes them when it has
+   written up to there.
+
+   The histograms and intervals are for this file (see init_thisfilestat()),
+   the drop count is the total.
+*/
+#define  RXHIST_N  24
+#define  RXDROPS_N  100
+#define  RXSAMPLES_N  1024
+#define  RXSAMPLE_NS  1000000l
+
+struct rxhist {
+  long  n[RXHIST_N];
+  long  count, sum_ns, max_ns;
+};
+
+struct rxstat {
+  long  t_ns;  /* receive time of the current packet (ns since 1970) */
+  long  last_t_ns, last_delay_ns;  /* previous packet, 0 if none */
+  _Atomic long  ovfl;  /* datagrams dropped by the kernel */
+  struct rxhist  jitter, latency;
+  struct {
+    long  from, to;  /* seconds since 1970 */
+    long  n;
+  } drops[RXDROPS_N];
+  int  ndrops;
+
+  /* latency samples, written by the receiving thread, read by consumer */
+  struct {
+    long  pos, t_ns;  /* ring position (added) after the packet */
+  } samples[RXSAMPLES_N];
+  _Atomic long  sample_head  __attribute__ ((aligned (64)));
+  long  last_sample_ns;
+  _Atomic long  sample_tail  __attribute__ ((aligned (64)));
+} __attribute__ ((aligned (64)));
+
+struct rxstat  rxstat[MAXNSOCK];
+int  rx_stats= 0;
+
+
+void  rxhist_add (struct rxhist  *h, long  ns)
+{
+  long  us;
+  int  k;
+
+  if (ns<0)
+    ns= 0;
+  us= ns/1000;
+  for (k= 0; us>0 && k<RXHIST_N-1; k++)
+    us>>= 1;
+  h->n[k]++;
+  h->count++;
+  h->sum_ns+= ns;
+  if (ns>h->max_ns)
+    h->max_ns= ns;
+}
+
+
+/* total is the number of datagrams dropped by the kernel on socket i so far
+   (seen with the current packet) */
+void  rx_drops (int  i, long  total)
+{
+  struct rxstat  *rs;
+  long  n, t;
+
+  rs= &rxstat[i];
+  n= total-rs->ovfl;
+  if (n<=0)
+    return;
+  atomic_store_explicit (&rs->ovfl, total, memory_order_relaxed);
+
+  t= rs->t_ns/1000000000l;
+  if (rs->ndrops>0 &&
+      (t<=rs->drops[rs->ndrops-1].to+1 || rs->ndrops==RXDROPS_N))
+    /* continues the last interval (or no more room) */
+    {
+      if (t>rs->drops[rs->ndrops-1].to)
+	rs->drops[rs->ndrops-1].to= t;
+      rs->drops[rs->ndrops-1].n+= n;
+    }
+  else
+    {
+      rs->drops[rs->ndrops].from= rs->drops[rs->ndrops].to= t;
+      rs->drops[rs->ndrops].n= n;
+      rs->ndrops++;
+    }
+}
+
+
+/* queue a latency sample for socket i after its packet has been added to
+   the ring */
+void  rx_sample (int  i, struct vrb  *ring)
+{
+  struct rxstat  *rs;
+  long  head;
+
+  rs= &rxstat[i];
+  if (rs->t_ns-rs->last_sample_ns<RXSAMPLE_NS)
+    return;
+  head= atomic_load_explicit (&rs->sample_head, memory_order_relaxed);
+  if (head-atomic_load_explicit (&rs->sample_tail, memory_order_acquire)
+      >=RXSAMPLES_N)
+    return;  /* consumer is behind, skip this one */
+  rs->samples[head%RXSAMPLES_N].pos= atomic_load_explicit (
+    &ring->added, memory_order_relaxed);
+  rs->samples[head%RXSAMPLES_N].t_ns= rs->t_ns;
+  atomic_store_explicit (&rs->sample_head, head+1, memory_order_release);
+  rs->last_sample_ns= rs->t_ns;
+}
+
+
+/* the consumer has written (and removed) data of ring */
+void  rx_latency (struct vrb  *ring)
+{
+  struct rxstat  *rs;
+  struct timespec  ts;
+  long  removed, head, tail, now;
+  int  i;
+
+  if (!rx_stats)
+    return;
+  removed= atomic_load_explicit (&ring->removed, memory_order_relaxed);
+  now= 0;
+  for (i= 0; i<nsock; i++)
+    if (sockring[i]==ring)
+      {
+	rs= &rxstat[i];
+	head= atomic_load_explicit (&rs->sample_head, memory_order_acquire);
+	tail= atomic_load_explicit (&rs->sample_tail, memory_order_relaxed);
+	while (tail<head && rs->samples[tail%RXSAMPLES_N].pos<=removed)
+	  {
+	    if (now==0)
+	      {
+		clock_gettime (CLOCK_REALTIME, &ts);
+		now= ts.tv_sec*1000000000l+ts.tv_nsec;
+	      }
+	    rxhist_add (&rs->latency, now-rs->samples[tail%RXSAMPLES_N].t_ns);
+	    tail++;
+	  }
+	atomic_store_explicit (&rs->sample_tail, tail, memory_order_release);
+      }
+}
+
+
+void  print_rxhist (char  *name, struct rxhist  *h)
+{
+  int  k;
+
+  if (h->count==0)
+    return;
+  printf ("%30s %9ld   mean %.1f us, max %.1f us\n", name, h->count,
+	  h->sum_ns/1e3/h->count, h->max_ns/1e3);
+  for (k= 0; k<RXHIST_N; k++)
+    if (h->n[k])
+      printf ("                %2s %8ld us %9ld   %10.6f %%\n",
+	      k==RXHIST_N-1 ? ">=" : "<",
+	      k==RXHIST_N-1 ? 1l<<(k-1) : 1l<<k,
+	      h->n[k], h->n[k]*100./h->count);
+}
+
+
+void  print_rx_stats (int  i)
+{
+  struct rxstat  *rs;
+  char  from[40], to[40];
+  int  k;
+
+  rs= &rxstat[i];
+  printf (  "      dropped by kernel (rx) %9ld   in %d interval%s\n",
+	    rs->ovfl, rs->ndrops, rs->ndrops==1 ? "" : "s");
+  for (k= 0; k<rs->ndrops; k++)
+    {
+      timestamp_to_str (rs->drops[k].from, from, sizeof (from));
+      timestamp_to_str (rs->drops[k].to+1, to, sizeof (to));
+      printf ("      %s - %s %9ld\n", from, to+11, rs->drops[k].n);
+    }
+  print_rxhist (beamformed_check ? "arrival jitter" : "arrival interval",
+		&rs->jitter);
+  print_rxhist ("latency to write", &rs->latency);
+}
+
+
+void  reset_rx_stats (int  i)
+{
+  memset (&rxstat[i].jitter, 0, sizeof (rxstat[i].jitter));
+  memset (&rxstat[i].latency, 0, sizeof (rxstat[i].latency));
+  rxstat[i].ndrops= 0;
+}
+
+
 
 /* count packets dropped by kernel using /proc/net/udp
    the sockets must be open (and nsock set)
    initialised by 0, no abort on error (only message)
 */
+/* packets dropped because the packet ring of socket i was full,
+   -1 if unknown (PACKET_STATISTICS resets the counter, so we sum it up) */
+long  packet_ring_drops (int  i)
+{
+  static pthread_mutex_t  drops_mutex= PTHREAD_MUTEX_INITIALIZER;
+  struct tpacket_stats_v3  st;
+  socklen_t  len;
+  long  drops;
+
+  len= sizeof (st);
+  pthread_mutex_lock (&drops_mutex);
+  if (getsockopt (sock[i], SOL_PACKET, PACKET_STATISTICS, &st, &len))
+    {
+      perror ("getsockopt(PACKET_STATISTICS)");
+      drops= -1;
+    }
+  else
+    drops= pktrings[i].drops+= st.tp_drops;
+  pthread_mutex_unlock (&drops_mutex);
+  return drops;
+}
+
+
 void  count_dropped_kernel ()
 {
   char  buff[999];
@@ -465,9 +1137,16 @@ void  count_dropped_kernel ()
   int  valid, i;
 
 
+  if (capture==CAPTURE_PACKET)  /* drops in our packet ring */
+    {
+      for (i= 0; i<nsock; i++)
+	sockstat[i].dropped_kernel= packet_ring_drops (i);
+      return;
+    }
+
   /* initialise with 0 */
   for (i= 0; i<nsock; i++)
-    dropped_kernel[i]= -1;
+    sockstat[i].dropped_kernel= -1;
   
   f= fopen ("/proc/net/udp", "r");
   if (f==NULL)
@@ -502,7 +1181,7 @@ void  count_dropped_kernel ()
 #if 0
 	      printf ("found port %d in socket %d\n", port, i);
 #endif
-	    dropped_kernel[i]= dropped;
+	    sockstat[i].dropped_kernel= dropped;
 	    }
       }
     else
@@ -524,10 +1203,11 @@ void  count_dropped_kernel ()
 
 void  final_statistics ()
 {
-  long  ntot;
+  long  ntot, totlen;
   int  i;
 
 
+  totlen= total_bytes ();
   if (totlen==0)
     return;
   
@@ -537,7 +1217,7 @@ void  final_statistics ()
     {
       if (beamformed_check)
 	{
-	  ntot= beamformed_last_packno[i]-beamformed_first_packno[i]+1;
+	  ntot= sockstat[i].beamformed_last_packno-sockstat[i].beamformed_first_packno+1;
 	  printf (  "port %5d :  expected packets %9ld\n"
 		    "                missed packets %9ld   %10.6f %% of exp\n"
 		    "                  seen packets %9ld   %10.6f %% of exp\n"
@@ -547,37 +1227,44 @@ void  final_statistics ()
 		    "                                           "
 		    "%10.6f %% of exp\n",
 		    portnos[i], ntot,
-		    ntot-packs_seen[i], (ntot-packs_seen[i])*100./ntot,
-		    packs_seen[i], packs_seen[i]*100./ntot,
-		    beamformed_good_packs[i],
-		    beamformed_good_packs[i]*100./packs_seen[i],
-		    packs_dropped[i], packs_dropped[i]*100./packs_seen[i],
-		    packs_seen[i]-packs_dropped[i],
-		    (packs_seen[i]-packs_dropped[i])*100./packs_seen[i],
-		    (packs_seen[i]-packs_dropped[i])*100./ntot);
+		    ntot-sockstat[i].packs_seen, (ntot-sockstat[i].packs_seen)*100./ntot,
+		    sockstat[i].packs_seen, sockstat[i].packs_seen*100./ntot,
+		    sockstat[i].beamformed_good_packs,
+		    sockstat[i].beamformed_good_packs*100./sockstat[i].packs_seen,
+		    sockstat[i].packs_dropped, sockstat[i].packs_dropped*100./sockstat[i].packs_seen,
+		    sockstat[i].packs_seen-sockstat[i].packs_dropped,
+		    (sockstat[i].packs_seen-sockstat[i].packs_dropped)*100./sockstat[i].packs_seen,
+		    (sockstat[i].packs_seen-sockstat[i].packs_dropped)*100./ntot);
 	}
       else
 	{
-	  ntot= packs_seen[i];
+	  ntot= sockstat[i].packs_seen;
 	  printf (  "port %5d :  seen packets %9ld\n"
 		    "           dropped packets %9ld   %10.6f %% of seen\n"
 		    "           written packets %9ld   %10.6f %% of seen\n",
 		    portnos[i], ntot,
-		    packs_dropped[i], packs_dropped[i]*100./ntot,
-		    packs_seen[i]-packs_dropped[i],
-		    (packs_seen[i]-packs_dropped[i])*100./ntot);
+		    sockstat[i].packs_dropped, sockstat[i].packs_dropped*100./ntot,
+		    sockstat[i].packs_seen-sockstat[i].packs_dropped,
+		    (sockstat[i].packs_seen-sockstat[i].packs_dropped)*100./ntot);
 	}
+      if (reorder)
+	printf (    "                filled packets %9ld\n"
+		    "             late/dup. packets %9ld   %10.6f %% of seen\n",
+		    sockstat[i].packs_filled, sockstat[i].packs_late,
+		    sockstat[i].packs_late*100./sockstat[i].packs_seen);
       if (check_dropped_kernel)
-	printf (    "         dropped by kernel %9ld   %10.6f %% of (seen+dropped by kernel)\n", dropped_kernel[i], dropped_kernel[i]*100./(packs_seen[i]+dropped_kernel[i]));
+	printf (    "         dropped by kernel %9ld   %10.6f %% of (seen+dropped by kernel)\n", sockstat[i].dropped_kernel, sockstat[i].dropped_kernel*100./(sockstat[i].packs_seen+sockstat[i].dropped_kernel));
       printf ("                   volume    %7.3f GB\n",
-	      bytes_written[i]/pow (1024,3));
+	      sockstat[i].bytes_written/pow (1024,3));
+      if (rx_stats)
+	print_rx_stats (i);
 
     }
 
   printf ("\ntotal %7.3f GB  max buff %ld/%ld (%.1f %% full)  mean frac %.3e\n",
-	  totlen/pow(1024,3), maxsize, ringbuffer.totsize, /* bufsize, */
-	  maxsize/(double)ringbuffer.totsize*100.,
-	  sum_filllevel/n_filllevel);
+	  totlen/pow(1024,3), max_fillsize (), ringbuffer.totsize, /* bufsize, */
+	  max_fillsize ()/(double)ringbuffer.totsize*100.,
+	  mean_filllevel ());
 
 }
 
@@ -590,13 +1277,14 @@ void  final_statistics ()
 void  signal_handler(int signum)
 {
   int  i;
+  long  totlen;
 
 
   if (signum>0)
     printf ("caught signal %d%s\n", signum,
 	    signum==1 ? "  (HUP)" : signum==2 ? "  (INT)" :
 	    signum==14 ? "  (ALRM)   end_time reached" : signum==15 ? "  (TERM)" : "");
-  if (signum<0 && outf==NULL)  /* timeout, but no file open */
+  if (signum<0 && !demux_open ())  /* timeout, but no file open */
     {
       if (nsock==1 && portnos[0]==0)   /* then read stdin */
 	{
@@ -604,17 +1292,26 @@ void  signal_handler(int signum)
 	  pthread_mutex_lock(&stopped_mutex);
 	  stopped= 2;
 	  pthread_mutex_unlock(&stopped_mutex);
-	  pthread_cond_signal(&data_available);  /* pretend that data is available */
+	  vrb_wake_consumer (&ringbuffer);  /* pretend that data is available */
+	}
+      else if (trigger_mode && timeout_exit)  /* waiting for a trigger */
+	{
+	  printf ("timeout\n");
+	  pthread_mutex_lock(&stopped_mutex);
+	  stopped= 2;
+	  pthread_mutex_unlock(&stopped_mutex);
+	  vrb_wake_consumer (&ringbuffer);
 	}
       return;
     }
 
+  totlen= total_bytes ();
   if (totlen)
     {
       printf ("total %7.3f GB  max buff %ld/%ld (%.1f %% full)  mean frac %.3e\n\n",
-	      totlen/pow(1024,3), maxsize, ringbuffer.totsize, /* bufsize, */
-	    maxsize/(double)ringbuffer.totsize*100.,
-	    sum_filllevel/n_filllevel);
+	      totlen/pow(1024,3), max_fillsize (), ringbuffer.totsize, /* bufsize, */
+	    max_fillsize ()/(double)ringbuffer.totsize*100.,
+	    mean_filllevel ());
     }
   
   
@@ -634,51 +1331,51 @@ void  signal_handler(int signum)
 	    printf ("port %5d : %8ld exp  %10.6f %% missed  %10.6f %% dropped  "
 		    "%7.3f GB\n",
 		    portnos[i],
-		    beamformed_last_packno[i]-beamformed_first_packno[i]+1,
-		    100-packs_seen[i]*100./(
-			beamformed_last_packno[i]-beamformed_first_packno[i]+1),
-		    packs_dropped[i]*100./packs_seen[i],
-		    bytes_written[i]/pow (1024,3));
+		    sockstat[i].beamformed_last_packno-sockstat[i].beamformed_first_packno+1,
+		    100-sockstat[i].packs_seen*100./(
+			sockstat[i].beamformed_last_packno-sockstat[i].beamformed_first_packno+1),
+		    sockstat[i].packs_dropped*100./sockstat[i].packs_seen,
+		    sockstat[i].bytes_written/pow (1024,3));
 	    printf ("                           %10.6f %% good\n",
-		    beamformed_good_packs[i]*100./packs_seen[i]);
+		    sockstat[i].beamformed_good_packs*100./sockstat[i].packs_seen);
 
 	    printf ("      block: %8ld exp  %10.6f %% missed  "
 		    "%10.6f %% dropped\n",
-		    beamformed_last_packno[i]-beamformed_first_packno[i]+1 -
-		    last_packs_expected[i],
-		    100-(packs_seen[i]-last_packs_seen[i])*100. /
-		    (beamformed_last_packno[i]-beamformed_first_packno[i]+1
-		     -last_packs_expected[i]),
-		    (packs_dropped[i]-last_packs_dropped[i])*100./(
-			packs_seen[i]-last_packs_seen[i]));
+		    sockstat[i].beamformed_last_packno-sockstat[i].beamformed_first_packno+1 -
+		    sockstat[i].last_packs_expected,
+		    100-(sockstat[i].packs_seen-sockstat[i].last_packs_seen)*100. /
+		    (sockstat[i].beamformed_last_packno-sockstat[i].beamformed_first_packno+1
+		     -sockstat[i].last_packs_expected),
+		    (sockstat[i].packs_dropped-sockstat[i].last_packs_dropped)*100./(
+			sockstat[i].packs_seen-sockstat[i].last_packs_seen));
 	    printf ("                           %10.6f %% good\n",
-		    (beamformed_good_packs[i]-last_good_packs[i])*100./
-		    (packs_seen[i]-last_packs_seen[i]));
+		    (sockstat[i].beamformed_good_packs-sockstat[i].last_good_packs)*100./
+		    (sockstat[i].packs_seen-sockstat[i].last_packs_seen));
 	    
 	    
-	    last_packs_expected[i]= beamformed_last_packno[i]-
-		beamformed_first_packno[i]+1;
-	    last_good_packs[i]= beamformed_good_packs[i];
+	    sockstat[i].last_packs_expected= sockstat[i].beamformed_last_packno-
+		sockstat[i].beamformed_first_packno+1;
+	    sockstat[i].last_good_packs= sockstat[i].beamformed_good_packs;
 	}
 	else
 	{
 	    printf ("port %5d : %8ld seen  %10.6f %% dropped  "
 		    "%7.3f GB\n",
-		    portnos[i], packs_seen[i], /* packs_dropped[i], */
-		    packs_dropped[i]*100./packs_seen[i],
-		    bytes_written[i]/pow (1024,3));
+		    portnos[i], sockstat[i].packs_seen, /* sockstat[i].packs_dropped, */
+		    sockstat[i].packs_dropped*100./sockstat[i].packs_seen,
+		    sockstat[i].bytes_written/pow (1024,3));
 	    printf ("      block: %8ld seen  %10.6f %% dropped\n",
-		    packs_seen[i]-last_packs_seen[i],
-		    /*packs_dropped[i]-last_packs_dropped[i], */
-		    (packs_dropped[i]-last_packs_dropped[i])*100./(
-			packs_seen[i]-last_packs_seen[i]));
+		    sockstat[i].packs_seen-sockstat[i].last_packs_seen,
+		    /*sockstat[i].packs_dropped-sockstat[i].last_packs_dropped, */
+		    (sockstat[i].packs_dropped-sockstat[i].last_packs_dropped)*100./(
+			sockstat[i].packs_seen-sockstat[i].last_packs_seen));
 	}
 
 
 	
 	}
-    last_packs_dropped[i]= packs_dropped[i];
-    last_packs_seen[i]= packs_seen[i];
+    sockstat[i].last_packs_dropped= sockstat[i].packs_dropped;
+    sockstat[i].last_packs_seen= sockstat[i].packs_seen;
     }
 
 
@@ -692,7 +1389,7 @@ void  signal_handler(int signum)
       stopped= 2;
       pthread_mutex_unlock(&stopped_mutex);
 
-      pthread_cond_signal(&data_available);  /* pretend that data is available */
+      vrb_wake_consumer (&ringbuffer);  /* pretend that data is available */
 
     }
   else if (signum==-1 || signum==SIGHUP)
@@ -740,7 +1437,7 @@ void  signal_handler(int signum)
 		  stopped= 1;
 		  pthread_mutex_unlock(&stopped_mutex);
 		}
-	  pthread_cond_signal(&data_available);/* pretend that data is available */
+	  vrb_wake_consumer (&ringbuffer);/* pretend that data is available */
 
         }
     }
@@ -778,437 +1475,5883 @@ struct __attribute__((__packed__))  header_lofar
 
 
 
-long  beamformed_packno (struct header_lofar  *header)
+/* clock/512 for 160 and 200 MHz (is200mhz) */
+const long  lofar_clock512[2]= { 160000000l/512, 200000000l/512 };
+
+/* the first block (1024 samples) of second t, (t*clock+512)/1024: as
+   t*clock+512 is 512*(t*clock/512+1) this is (t*clock/512+1)/2, one multiply
+   by the clock/512 of the table and a division by 2 (a shift and the
+   correction for negative values, the same result as before for all t) */
+static inline long  lofar_second_block (long  t, int  is200mhz)
 {
-  return ((header->timestamp*1000000l*(160+40*header->source.is200mhz)+512)/1024+header->sequence)/16;
+  return (t*lofar_clock512[is200mhz]+1)/2;
 }
 
 
-int  beamformed_checkpack (struct header_lofar  *header)
+/* block number (not divided by 16 as beamformed_packno()) */
+static inline long  lofar_block (struct header_lofar  *header)
 {
-  return header->source.error==0 && header->timestamp!=-1;
+  return lofar_second_block (header->timestamp, header->source.is200mhz)+
+    header->sequence;
 }
 
 
+static inline long  beamformed_packno (struct header_lofar  *header)
+{
+  return lofar_block (header)/16;
+}
 
 
-void *producer ()
+int  beamformed_checkpack (struct header_lofar  *header)
 {
-  char  buff[MMAXLEN+2];
-  socklen_t  slen;
-  struct sockaddr_in  addr_src;
-  fd_set  myallsocks;
-  int  i, thissize; 
+  return header->source.error==0 && header->timestamp!=-1;
+}
 
-  char  *newpoi;
-  char  *buff2;
 
-  static struct sockaddr_in  addr_src_old;
-  static int  addr_src_n= 0;
+/* arrival of a packet on socket i (--rx_stats), header only with --check */
+void  rx_arrival (int  i, struct header_lofar  *header)
+{
+  struct rxstat  *rs;
+  long  clock, delay;
 
+  rs= &rxstat[i];
+  if (rs->t_ns==0)  /* no time from the kernel */
+    return;
+  if (header)
+    {
+      clock= 1000000l*(160+40*header->source.is200mhz);
+      delay= rs->t_ns-header->timestamp*1000000000l-
+	header->sequence*1024000000000l/clock;
+      if (rs->last_t_ns)
+	rxhist_add (&rs->jitter, labs (delay-rs->last_delay_ns));
+      rs->last_delay_ns= delay;
+    }
+  else if (rs->last_t_ns)
+    rxhist_add (&rs->jitter, rs->t_ns-rs->last_t_ns);
+  rs->last_t_ns= rs->t_ns;
+}
 
 
-  producer_running= 1;
-  
-  if (do_blocklen)
-    buff2= buff+2;  /* we need two bytes for size */
-  else
-      buff2= buff;
+/* beamlet selection and requantization (--beamlets, --bitmode, --requant,
+   --requant_scale)
 
+   The data of a packet are num_beamlets x num_slices (16) x XrXiYrYi,
+   with --bitmode bits per value (16: 61, 8: 122, 4: 244 beamlets in 7824
+   bytes). Only the selected beamlets are kept, in the order given;
+   --requant halves the bits (16->8 or 8->4): each value times the scale of
+   its beamlet, rounded to nearest and saturated. With 4 bits a byte holds
+   one complex value, real part in the low nibble. The header says what is
+   in the packet: num_beamlets is the number selected, source.bm the bit
+   mode (0: 16, 1: 8, 2: 4 bits), so readers need no extra information;
+   which beamlets they were is in filename.sel (see transform_open()).
 
-  slen= sizeof (addr_src);
-  while (1)
+   The transformation is in place (the output is never ahead of the input),
+   in the receiving thread before the packet goes to the ring buffer. The
+   inner loops use SSE2 or AVX2 (if the CPU has it) on x86-64 and NEON on
+   ARM.
+*/
+#define  MAXBEAMLETS  244
+#define  LOFAR_SLICES  16
+#define  LOFAR_PACKLEN  7824  /* header and 16 slices in any bit mode */
+
+int  transform= 0;
+int  in_bits= 16, out_bits= 0;  /* 0: no requantization */
+int  nsel, sel_beamlet[MAXBEAMLETS];
+float  sel_scale[MAXBEAMLETS];
+char  beamlets_str[500], scales_str[2000];
+int  in_beamlets;  /* per packet from --len and --bitmode */
+int  outlen;  /* packet length in the ring and output (packlen if none) */
+
+/* one beamlet of LOFAR_SLICES*4 values */
+void  (*requant_beamlet) (char  *in, char  *out, float  scale);
+
+
+static inline int  saturate (long  v, int  lo, int  hi)
+{
+  return v<lo ? lo : v>hi ? hi : v;
+}
+
+
+void  requant16to8_c (char  *in, char  *out, float  scale)
+{
+  int16_t  v;
+  int  k;
+
+  for (k= 0; k<LOFAR_SLICES*4; k++)
+    {
+      memcpy (&v, in+2*k, 2);
+      out[k]= saturate (lrintf (v*scale), -128, 127);
+    }
+}
+
+
+void  requant8to4_c (char  *in, char  *out, float  scale)
+{
+  int  k, re, im;
+
+  for (k= 0; k<LOFAR_SLICES*2; k++)
     {
+      re= saturate (lrintf ((int8_t)in[2*k]*scale), -8, 7);
+      im= saturate (lrintf ((int8_t)in[2*k+1]*scale), -8, 7);
+      out[k]= (re & 0xf) | (im << 4);
+    }
+}
 
 
-      if (totlen-lasttotlen>1e9)
-	signal_handler (0);  /* regular printouts */
+#if defined (__x86_64__) && defined (__SSE2__)
 
-      thissize= -999;  /* prevent compiler warning on some systems */
+/* four int32 times scale, rounded (to nearest, as lrintf()) */
+static inline __m128i  scale_epi32 (__m128i  v, __m128  scale)
+{
+  return _mm_cvtps_epi32 (_mm_mul_ps (_mm_cvtepi32_ps (v), scale));
+}
 
-      if (nsock==1 && portnos[0]==0)   /* then read stdin */
+
+void  requant16to8_sse2 (char  *in, char  *out, float  scale)
+{
+  __m128  s= _mm_set1_ps (scale);
+  __m128i  a, b;
+  int  k;
+
+  for (k= 0; k<LOFAR_SLICES*4; k+= 16)
+    {
+      a= _mm_loadu_si128 ((__m128i*)(in+2*k));
+      b= _mm_loadu_si128 ((__m128i*)(in+2*k+16));
+      /* sign extend to 32 bits, scale, pack with saturation */
+      a= _mm_packs_epi32 (
+	scale_epi32 (_mm_srai_epi32 (_mm_unpacklo_epi16 (a, a), 16), s),
+	scale_epi32 (_mm_srai_epi32 (_mm_unpackhi_epi16 (a, a), 16), s));
+      b= _mm_packs_epi32 (
+	scale_epi32 (_mm_srai_epi32 (_mm_unpacklo_epi16 (b, b), 16), s),
+	scale_epi32 (_mm_srai_epi32 (_mm_unpackhi_epi16 (b, b), 16), s));
+      _mm_storeu_si128 ((__m128i*)(out+k), _mm_packs_epi16 (a, b));
+    }
+}
+
+
+/* eight values (re, im pairs as int16) to four bytes in the low bytes of
+   the 32-bit lanes */
+static inline __m128i  nibbles_sse2 (__m128i  v)
+{
+  v= _mm_min_epi16 (_mm_max_epi16 (v, _mm_set1_epi16 (-8)),
+		    _mm_set1_epi16 (7));
+  return _mm_or_si128 (_mm_and_si128 (v, _mm_set1_epi32 (0xf)),
+		       _mm_and_si128 (_mm_srli_epi32 (v, 12),
+				      _mm_set1_epi32 (0xf0)));
+}
+
+
+void  requant8to4_sse2 (char  *in, char  *out, float  scale)
+{
+  __m128  s= _mm_set1_ps (scale);
+  __m128i  a, lo, hi, r[2];
+  int  k, j;
+
+  for (k= 0; k<LOFAR_SLICES*4; k+= 32)
+    {
+      for (j= 0; j<2; j++)
 	{
-	  if (stopped)
-	    thissize= 0;
-	  else
-	    {
-	      
-	      /* wait till space available in buffer 
+	  a= _mm_loadu_si128 ((__m128i*)(in+k+16*j));
+	  lo= _mm_srai_epi16 (_mm_unpacklo_epi8 (a, a), 8);
+	  hi= _mm_srai_epi16 (_mm_unpackhi_epi8 (a, a), 8);
+	  lo= _mm_packs_epi32 (
+	    scale_epi32 (_mm_srai_epi32 (_mm_unpacklo_epi16 (lo, lo), 16), s),
+	    scale_epi32 (_mm_srai_epi32 (_mm_unpackhi_epi16 (lo, lo), 16), s));
+	  hi= _mm_packs_epi32 (
+	    scale_epi32 (_mm_srai_epi32 (_mm_unpacklo_epi16 (hi, hi), 16), s),
+	    scale_epi32 (_mm_srai_epi32 (_mm_unpackhi_epi16 (hi, hi), 16), s));
+	  r[j]= _mm_packs_epi32 (nibbles_sse2 (lo), nibbles_sse2 (hi));
+	}
+      _mm_storeu_si128 ((__m128i*)(out+k/2), _mm_packus_epi16 (r[0], r[1]));
+    }
+}
 
-	      (for stdin we can wait with reading, don't drop packets)
-	      */
 
-	      pthread_mutex_lock(&region_mutex);
-	      while ( vrb_poi_new (&ringbuffer, packlen) == NULL )
-		/* not enough space */
-		  pthread_cond_wait(&space_available,&region_mutex); 
-	      pthread_mutex_unlock(&region_mutex);
-	      /* printf ("after    available: %ld\n", ringbuffer.totsize-ringbuffer.fillsize); */
-	      
+__attribute__ ((target ("avx2")))
+void  requant16to8_avx2 (char  *in, char  *out, float  scale)
+{
+  __m256  s= _mm256_set1_ps (scale);
+  __m256i  a, b, p;
+  int  k;
+
+  for (k= 0; k<LOFAR_SLICES*4; k+= 16)
+    {
+      a= _mm256_cvtps_epi32 (_mm256_mul_ps (_mm256_cvtepi32_ps (
+	_mm256_cvtepi16_epi32 (_mm_loadu_si128 ((__m128i*)(in+2*k)))), s));
+      b= _mm256_cvtps_epi32 (_mm256_mul_ps (_mm256_cvtepi32_ps (
+	_mm256_cvtepi16_epi32 (_mm_loadu_si128 ((__m128i*)(in+2*k+16)))), s));
+      /* packs works per 128-bit lane, put the quarters back in order */
+      p= _mm256_permute4x64_epi64 (_mm256_packs_epi32 (a, b), 0xd8);
+      _mm_storeu_si128 ((__m128i*)(out+k),
+			_mm_packs_epi16 (_mm256_castsi256_si128 (p),
+					 _mm256_extracti128_si256 (p, 1)));
+    }
+}
+
+
+__attribute__ ((target ("avx2")))
+void  requant8to4_avx2 (char  *in, char  *out, float  scale)
+{
+  __m256  s= _mm256_set1_ps (scale);
+  __m256i  a, b, p;
+  int  k;
+
+  for (k= 0; k<LOFAR_SLICES*4; k+= 16)
+    {
+      a= _mm256_cvtps_epi32 (_mm256_mul_ps (_mm256_cvtepi32_ps (
+	_mm256_cvtepi8_epi32 (_mm_loadl_epi64 ((__m128i*)(in+k)))), s));
+      b= _mm256_cvtps_epi32 (_mm256_mul_ps (_mm256_cvtepi32_ps (
+	_mm256_cvtepi8_epi32 (_mm_loadl_epi64 ((__m128i*)(in+k+8)))), s));
+      p= _mm256_permute4x64_epi64 (_mm256_packs_epi32 (a, b), 0xd8);
+      p= _mm256_min_epi16 (_mm256_max_epi16 (p, _mm256_set1_epi16 (-8)),
+			   _mm256_set1_epi16 (7));
+      p= _mm256_or_si256 (_mm256_and_si256 (p, _mm256_set1_epi32 (0xf)),
+			  _mm256_and_si256 (_mm256_srli_epi32 (p, 12),
+					    _mm256_set1_epi32 (0xf0)));
+      /* eight bytes, in the low bytes of the 32-bit lanes */
+      p= _mm256_packs_epi32 (p, p);
+      p= _mm256_packus_epi16 (p, p);
+      *(int32_t*)(out+k/2)= _mm256_extract_epi32 (p, 0);
+      *(int32_t*)(out+k/2+4)= _mm256_extract_epi32 (p, 4);
+    }
+}
 
-	      /* read one packet, first skip this_nskip if necessary */
-#if MYDEBUG>=2
-	      if (this_nskip[0]>0)
-fprintf (stderr, "SKIP: skipping %d packets\n", this_nskip[0]);
 #endif
-	      
-	      for (int iskip= 0; iskip<this_nskip[0]+1; iskip++)
-		{
-		  thissize= fread (buff2, 1, packlen, stdin);
-		  if (ferror (stdin))
-		    perror ("reading from stdin in producer()");
-		  
-		  if (thissize==0)  /* treat as timeout */
-		    {
-		      signal_handler (-1);
-		      /*stopped= 2; */
-		    }
-		}
-	      this_nskip[0]= 0;
-	    }
-	  /* here we already have read the packet (or thissize==0) */
+
+
+#if defined (__ARM_NEON) && defined (__aarch64__)
+
+static inline int32x4_t  scale_s32 (int32x4_t  v, float  scale)
+{
+  return vcvtnq_s32_f32 (vmulq_n_f32 (vcvtq_f32_s32 (v), scale));
+}
+
+
+void  requant16to8_neon (char  *in, char  *out, float  scale)
+{
+  int16x8_t  a, b;
+  int  k;
+
+  for (k= 0; k<LOFAR_SLICES*4; k+= 16)
+    {
+      a= vld1q_s16 ((int16_t*)(in+2*k));
+      b= vld1q_s16 ((int16_t*)(in+2*k+16));
+      a= vcombine_s16 (vqmovn_s32 (scale_s32 (vmovl_s16 (vget_low_s16 (a)),
+					      scale)),
+		       vqmovn_s32 (scale_s32 (vmovl_s16 (vget_high_s16 (a)),
+					      scale)));
+      b= vcombine_s16 (vqmovn_s32 (scale_s32 (vmovl_s16 (vget_low_s16 (b)),
+					      scale)),
+		       vqmovn_s32 (scale_s32 (vmovl_s16 (vget_high_s16 (b)),
+					      scale)));
+      vst1q_s8 ((int8_t*)(out+k), vcombine_s8 (vqmovn_s16 (a),
+					       vqmovn_s16 (b)));
+    }
+}
+
+
+void  requant8to4_neon (char  *in, char  *out, float  scale)
+{
+  int16x8_t  a;
+  uint32x4_t  u;
+  int  k;
+
+  for (k= 0; k<LOFAR_SLICES*4; k+= 8)
+    {
+      a= vmovl_s8 (vld1_s8 ((int8_t*)(in+k)));
+      a= vcombine_s16 (vqmovn_s32 (scale_s32 (vmovl_s16 (vget_low_s16 (a)),
+					      scale)),
+		       vqmovn_s32 (scale_s32 (vmovl_s16 (vget_high_s16 (a)),
+					      scale)));
+      a= vminq_s16 (vmaxq_s16 (a, vdupq_n_s16 (-8)), vdupq_n_s16 (7));
+      u= vreinterpretq_u32_s16 (a);
+      u= vorrq_u32 (vandq_u32 (u, vdupq_n_u32 (0xf)),
+		    vandq_u32 (vshrq_n_u32 (u, 12), vdupq_n_u32 (0xf0)));
+      vst1_lane_u32 ((uint32_t*)(out+k/2),
+		     vreinterpret_u32_u8 (vmovn_u16 (vcombine_u16 (
+		       vmovn_u32 (u), vmovn_u32 (u)))), 0);
+    }
+}
+
+#endif
+
+
+/* a list of beamlets as 0-19,40,50-60 into sel[] (*nsel of them, e.g.
+   sel_beamlet[], nsel), returns 0 if okay */
+int  parse_beamlets (char  *list, int  *sel, int  *nsel)
+{
+  char  *p;
+  int  first, last, n;
+
+  *nsel= 0;
+  p= list;
+  while (*p)
+    {
+      if (sscanf (p, "%d%n", &first, &n)!=1)
+	return 1;
+      p+= n;
+      last= first;
+      if (*p=='-')
+	{
+	  if (sscanf (p+1, "%d%n", &last, &n)!=1)
+	    return 1;
+	  p+= 1+n;
 	}
-      else  /* read from socket */
+      if (first<0 || last<first || last>=MAXBEAMLETS)
+	return 1;
+      for (; first<=last; first++)
 	{
-	  if (stopped==2)
-	    {
-#if  MYDEBUG
-	      pthread_mutex_lock (&mydebug_mutex);
-	      printf ("MYDEBUG producer(), line %d  stopped==2: "
-		      "closing sockets\n", __LINE__);
-	      pthread_mutex_unlock (&mydebug_mutex);
-#endif
+	  /* in increasing order, for the transformation in place */
+	  if (*nsel>0 && first<=sel[*nsel-1])
+	    return 1;
+	  sel[(*nsel)++]= first;
+	}
+      if (*p==',')
+	p++;
+      else if (*p)
+	return 1;
+    }
+  return *nsel==0;
+}
 
-	      
-	      /* close all sockets and return */
-	      assert (nsock!=1 || portnos[0]!=0);  /* not reading from stdin */
-	      for (i= 0; i<nsock; i++)
-		{
-		  int  j;
 
-		  j= close (sock[i]);
-		  if (j)
-		    {
-		      perror ("closing socket");
-		      producer_running= 0;
-		      exit (1);
-		    }
-		}
-	      /*return NULL;*/
-#if  MYDEBUG
-	      pthread_mutex_lock (&mydebug_mutex);
-	      printf ("MYDEBUG producer(), line %d  calling pthread_exit()\n",
-		      __LINE__);
-	      pthread_mutex_unlock (&mydebug_mutex);
+/* after the options: check them, the layout and choose the inner loop */
+void  transform_init ()
+{
+  int  k, n;
+  char  *p;
+
+  if (packlen==0)
+    {
+      fprintf (stderr, "--beamlets, --requant require --len.\n");
+      exit (1);
+    }
+  if (out_bits==0)
+    out_bits= in_bits;
+  if (out_bits!=in_bits && !(in_bits==16 && out_bits==8) &&
+      !(in_bits==8 && out_bits==4))
+    {
+      fprintf (stderr, "--requant can only go from 16 to 8 or 8 to 4 bits.\n");
+      exit (1);
+    }
+  in_beamlets= (packlen-sizeof (struct header_lofar))/
+    (LOFAR_SLICES*in_bits/2);
+  if ((packlen-sizeof (struct header_lofar))%(LOFAR_SLICES*in_bits/2) ||
+      in_beamlets>MAXBEAMLETS)
+    {
+      fprintf (stderr, "packet length %d does not fit --bitmode %d\n",
+	       packlen, in_bits);
+      exit (1);
+    }
+  if (beamlets_str[0]==0)  /* all of them */
+    for (nsel= 0; nsel<in_beamlets; nsel++)
+      sel_beamlet[nsel]= nsel;
+  else if (parse_beamlets (beamlets_str, sel_beamlet, &nsel) ||
+	   sel_beamlet[nsel-1]>=in_beamlets)
+    {
+      fprintf (stderr, "problem with beamlets (0...%d)\n", in_beamlets-1);
+      exit (1);
+    }
+
+  /* one scale for all or one per selected beamlet */
+  for (k= 0; k<nsel; k++)
+    sel_scale[k]= 1.;
+  p= scales_str;
+  for (k= 0; *p && k<nsel; k++)
+    {
+      if (sscanf (p, "%f%n", &sel_scale[k], &n)!=1)
+	break;
+      p+= n;
+      if (*p==',')
+	p++;
+    }
+  if (*p || (k!=1 && k!=nsel && scales_str[0]))
+    {
+      fprintf (stderr, "problem with requant_scale (1 or %d values)\n", nsel);
+      exit (1);
+    }
+  if (k==1)
+    for (k= 1; k<nsel; k++)
+      sel_scale[k]= sel_scale[0];
+
+  outlen= sizeof (struct header_lofar)+nsel*LOFAR_SLICES*out_bits/2;
+
+  requant_beamlet= out_bits==8 ? requant16to8_c : requant8to4_c;
+#if defined (__x86_64__) && defined (__SSE2__)
+  requant_beamlet= out_bits==8 ? requant16to8_sse2 : requant8to4_sse2;
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx2"))
+    requant_beamlet= out_bits==8 ? requant16to8_avx2 : requant8to4_avx2;
 #endif
-	      /*exit (0);*/
-	      producer_running= 0;
-	      pthread_exit (NULL);
-	      
-	    }
-	  
-	  
-	  myallsocks= allsocks;  /* we have to reset this every call */
-	  
-	  i= pselect (maxsock+1, &myallsocks, NULL, NULL,
-		      &timeout,
-		      NULL);
-	  if (i==-1)
-	    {
-	      perror ("pselect in producer()");
-	      producer_running= 0;
-	      exit (1);
-	    }
-	  if (i==0)  /* timeout */
+#if defined (__ARM_NEON) && defined (__aarch64__)
+  requant_beamlet= out_bits==8 ? requant16to8_neon : requant8to4_neon;
+#endif
+}
+
+
+/* select and requantize packet p (thissize==packlen) in place,
+   returns the new size, or 0 if the packet does not have the expected
+   layout */
+int  transform_packet (char  *p, int  thissize)
+{
+  struct header_lofar  *header;
+  char  *in, *out;
+  int  k, inlen, onelen;
+
+  header= (struct header_lofar*)p;
+  if (header->num_beamlets!=in_beamlets ||
+      header->num_slices!=LOFAR_SLICES)
+    {
+      printf ("received packet with %d beamlets x %d slices, "
+	      "should be %d x %d\n", header->num_beamlets,
+	      header->num_slices, in_beamlets, LOFAR_SLICES);
+      return 0;
+    }
+
+  inlen= LOFAR_SLICES*in_bits/2;
+  onelen= LOFAR_SLICES*out_bits/2;
+  in= p+sizeof (struct header_lofar);
+  out= in;
+  for (k= 0; k<nsel; k++, out+= onelen)
+    if (out_bits==in_bits)
+      memmove (out, in+sel_beamlet[k]*inlen, inlen);
+    else
+      requant_beamlet (in+sel_beamlet[k]*inlen, out, sel_scale[k]);
+
+  header->num_beamlets= nsel;
+  header->source.bm= out_bits==16 ? 0 : out_bits==8 ? 1 : 2;
+  return outlen;
+}
+
+
+/* filename.sel next to each file: which beamlets are in it */
+void  transform_open ()
+{
+  char  name[sizeof (thisfilename)+10];
+  FILE  *f;
+  int  k;
+
+  if (!transform || !dowrite || strcmp (thisfilename, "/dev/null")==0)
+    return;
+  snprintf (name, sizeof (name), "%s.sel", thisfilename);
+  f= fopen (name, "w");
+  if (f==NULL)
+    {
+      perror ("opening beamlet selection file");
+      exit (1);
+    }
+  fprintf (f, "bits %d %d\nbeamlets", in_bits, out_bits);
+  for (k= 0; k<nsel; k++)
+    fprintf (f, " %d", sel_beamlet[k]);
+  fprintf (f, "\nscales");
+  for (k= 0; k<nsel; k++)
+    fprintf (f, " %g", sel_scale[k]);
+  fprintf (f, "\n");
+  if (fclose (f))
+    {
+      perror ("writing beamlet selection file");
+      exit (1);
+    }
+}
+
+
+
+
+/* overload policy (--overload, --overload_level, --overload_beamlets,
+   --overload_block, --overload_log)
+
+   Without it a full ring buffer drops the packets that do not fit, at
+   random through the observation. With --overload the load is shed in
+   steps before that, each switched on when the ring buffer is filled to
+   its high mark and off again below its low mark, e.g.
+   zstd:0.5,beamlets:0.7:0.4,blocks:0.9 (low mark high-0.2 if not given):
+     zstd      built-in compression at --overload_level, at once with
+               --zstd_workers>0, otherwise from the next frame
+     beamlets  only --overload_beamlets keep their samples, the others are
+               zeros (same layout, cheap to compress)
+     blocks    whole blocks of --overload_block packets are dropped,
+               aligned to the packet numbers (the same for all ports)
+   beamlets and blocks are per socket (in the receiving thread), zstd goes
+   with the ring the consumer writes from. Every change is a line in the
+   log (--overload_log, else stdout): time, port, packet number (the first
+   affected, the start of the block for blocks), fill level, step and on or
+   off, so that the loss can be reconstructed.
+*/
+#define  OVERLOAD_ZSTD      0
+#define  OVERLOAD_BEAMLETS  1
+#define  OVERLOAD_BLOCKS    2
+#define  OVERLOAD_STEPS     3
+
+const char  *overload_names[OVERLOAD_STEPS]= {"zstd", "beamlets", "blocks"};
+
+struct overload_sock {
+  int  on[OVERLOAD_STEPS];
+  long  block;  /* packet number/overload_block of the last packet */
+  int  shedding;  /* that block is dropped */
+  _Atomic long  packs_shed, packs_zeroed;
+};
+
+int  overload= 0;  /* any step */
+char  overload_str[500];
+int  overload_use[OVERLOAD_STEPS];
+double  overload_high[OVERLOAD_STEPS], overload_low[OVERLOAD_STEPS];
+int  overload_level= -5;
+char  overload_beamlets_str[2000];
+int  overload_zero[2*MAXBEAMLETS], overload_nzero;  /* first, n to zero */
+long  overload_block= 1024;
+char  overload_logname[1000];
+FILE  *overload_log;
+struct overload_sock  overload_socks[MAXNSOCK];
+_Atomic int  overload_zstd_on;  /* also read by the --stripe writers */
+
+
+/* a step on or off */
+void  overload_note (int  step, int  on, int  port, long  packno,
+		     double  fill)
+{
+  fprintf (overload_log, "%s%.6f port %d packet %ld fill %.3f %s %s\n",
+	   overload_log==stdout ? "overload: " : "", realtime (), port, packno,
+	   fill, overload_names[step], on ? "on" : "off");
+  fflush (overload_log);
+}
+
+
+/* the state of a step at this fill level */
+int  overload_step (int  step, int  on, double  fill)
+{
+  if (!on && fill>=overload_high[step])
+    return 1;
+  if (on && fill<overload_low[step])
+    return 0;
+  return on;
+}
+
+
+/* packet p (as received) of socket i, returns 0 if it is to be dropped
+   (blocks), zeros the samples of beamlets if so */
+int  overload_packet (int  i, char  *p)
+{
+  struct overload_sock  *os= &overload_socks[i];
+  struct header_lofar  *header= (struct header_lofar*)p;
+  double  fill;
+  long  packno, block;
+  int  k, first, n, len, on;
+
+  fill= vrb_fillsize (sockring[i])/(double)sockring[i]->totsize;
+  packno= beamformed_packno (header);
+  if (overload_use[OVERLOAD_BEAMLETS] &&
+      (on= overload_step (OVERLOAD_BEAMLETS, os->on[OVERLOAD_BEAMLETS],
+			  fill))!=os->on[OVERLOAD_BEAMLETS])
+    {
+      os->on[OVERLOAD_BEAMLETS]= on;
+      overload_note (OVERLOAD_BEAMLETS, on, portnos[i], packno, fill);
+    }
+  if (overload_use[OVERLOAD_BLOCKS])
+    {
+      /* takes effect at the next block */
+      os->on[OVERLOAD_BLOCKS]= overload_step (OVERLOAD_BLOCKS,
+					      os->on[OVERLOAD_BLOCKS], fill);
+      block= packno/overload_block;
+      if (block!=os->block)
+	{
+	  os->block= block;
+	  if (os->shedding!=os->on[OVERLOAD_BLOCKS])
 	    {
-	      signal_handler (-1);
+	      os->shedding= os->on[OVERLOAD_BLOCKS];
+	      overload_note (OVERLOAD_BLOCKS, os->shedding, portnos[i],
+			     block*overload_block, fill);
 	    }
 	}
-      
-      for (i= 0; i<nsock; i++)
+      if (os->shedding)
 	{
-	  if (nsock!=1 || portnos[0]!=0)  /* not reading from stdin */
-	    {
-	      if (FD_ISSET (sock[i], &myallsocks))
-		{
-		  if (verbose)
-		    {
-		      thissize= recvfrom (sock[i], buff2,
-					  MMAXLEN-1, /* play safe */
-					  0,
-					  (struct sockaddr *)&addr_src,
-					  &slen);
-		      if (addr_src_n==0 ||
-		  ((
-		    addr_src.sin_port!=addr_src_old.sin_port ||
-		    addr_src.sin_addr.s_addr!=addr_src_old.sin_addr.s_addr )
-		      && addr_src_n<100))
-			{
-			  char  host[20], serv[10];
-			  int  i;
-			  
-			  i= getnameinfo ((struct sockaddr*)&addr_src, slen,
-					  host, sizeof (host),
-					  serv, sizeof (serv),
-					  NI_NUMERICHOST | NI_NUMERICSERV);
-			  if (i)
-			    printf ("getnameinfo() error %d\n", i);
-			  else
-			    {
-			      if (addr_src_n==0)
-				printf ("first packet received from source %s:%s\n",
-					host, serv);
-			      else
-				printf (
-				  "packet received from different (%d) source %s:%s\n",
-				  addr_src_n, host, serv);
-			    }
-			  addr_src_n++;
-			  addr_src_old= addr_src;;
-			}
-				
-		    }
-		  else
-		    thissize= recvfrom (sock[i], buff2,
-					MMAXLEN-1, /* play safe */
-					0,
-					NULL, 0);
+	  count_add (&os->packs_shed, 1);
+	  return 0;
+	}
+    }
+  if (os->on[OVERLOAD_BEAMLETS])
+    {
+      len= LOFAR_SLICES*8>>header->source.bm;  /* bytes per beamlet */
+      for (k= 0; k<overload_nzero; k++)
+	{
+	  first= overload_zero[2*k];
+	  n= overload_zero[2*k+1];
+	  if (first>=header->num_beamlets)
+	    break;
+	  if (first+n>header->num_beamlets)
+	    n= header->num_beamlets-first;
+	  memset (p+sizeof (struct header_lofar)+first*len, 0, n*len);
+	}
+      count_add (&os->packs_zeroed, 1);
+    }
+  return 1;
+}
 
-		  
-		  if (thissize==-1)
-		    {
-		      perror ("recvfrom() in producer()");
-		      producer_running= 0;
-		      exit (1);
-		    }
-		  if (thissize>=MMAXLEN)  /* this should not happen */
-		    {
-		      fprintf (stderr, "producer(): recvfrom() result %d >= %d"
-			       " (should not happen)\n", thissize, MMAXLEN);
-		      producer_running= 0;
-		      exit (1);
-		    }
-		  
-		}
-	      else
-		thissize= 0;
-	    }
-	  if (thissize)
+
+#ifdef  HAVE_ZSTD
+/* before compressing with cctx (see zstd_write(), stripe_write()): the
+   level as the zstd step wants it, cheap if it stays the same */
+void  overload_compress (ZSTD_CCtx  *cctx)
+{
+  if (overload_use[OVERLOAD_ZSTD])
+    ZSTD_CCtx_setParameter (cctx, ZSTD_c_compressionLevel,
+			    overload_zstd_on ? overload_level : zstd_level);
+}
+#endif
+
+
+/* before the consumer writes from ring, oldpoi at a packet */
+void  overload_consume (struct vrb  *ring, char  *oldpoi)
+{
+  double  fill;
+  int  k, on;
+
+  if (!overload_use[OVERLOAD_ZSTD])
+    return;
+  fill= vrb_fillsize (ring)/(double)ring->totsize;
+  on= overload_step (OVERLOAD_ZSTD, overload_zstd_on, fill);
+  if (on!=overload_zstd_on)
+    {
+      overload_zstd_on= on;
+      for (k= 0; k<nsock-1 && sockring[k]!=ring; k++)
+	;
+      overload_note (OVERLOAD_ZSTD, on, portnos[k], beamformed_packno (
+	(struct header_lofar*)(oldpoi+(do_blocklen ? 2 : 0))), fill);
+    }
+}
+
+
+/* after the options: the steps, beamlets to zero and the log */
+void  overload_init ()
+{
+  char  list[sizeof (overload_str)], *p, *save;
+  int  keep[MAXBEAMLETS], sel[MAXBEAMLETS], nkeep, k, step, n;
+  double  high, low;
+
+  if (overload_str[0]==0)
+    return;
+  strcpy (list, overload_str);
+  for (p= strtok_r (list, ",", &save); p; p= strtok_r (NULL, ",", &save))
+    {
+      for (step= 0; step<OVERLOAD_STEPS; step++)
+	if (strncmp (p, overload_names[step], strlen (overload_names[step]))
+	    ==0 && p[strlen (overload_names[step])]==':')
+	  break;
+      low= -1;
+      if (step==OVERLOAD_STEPS ||
+	  (n= sscanf (p+strlen (overload_names[step])+1, "%lf:%lf", &high,
+		      &low))<1 || high<=0 || high>1 || (n==2 && (low<0 ||
+							    low>=high)))
+	{
+	  fprintf (stderr, "problem with overload: %s\n", p);
+	  exit (1);
+	}
+      overload_use[step]= 1;
+      overload_high[step]= high;
+      overload_low[step]= n==2 ? low : high>0.2 ? high-0.2 : 0;
+    }
+  if (packlen==0 || (nsock==1 && portnos[0]==0))
+    {
+      fprintf (stderr, "--overload requires --len, not with stdin.\n");
+      exit (1);
+    }
+  if (overload_use[OVERLOAD_ZSTD] && !zstd_builtin)
+    {
+      fprintf (stderr, "overload step zstd requires built-in compression "
+	       "(--compress without --compcommand).\n");
+      exit (1);
+    }
+  if (overload_use[OVERLOAD_BEAMLETS])
+    {
+      if (parse_beamlets (overload_beamlets_str, sel, &nkeep))
+	{
+	  fprintf (stderr, "overload step beamlets requires "
+		   "--overload_beamlets.\n");
+	  exit (1);
+	}
+      memset (keep, 0, sizeof (keep));
+      for (k= 0; k<nkeep; k++)
+	keep[sel[k]]= 1;
+      /* runs of beamlets to zero */
+      overload_nzero= 0;
+      for (k= 0; k<MAXBEAMLETS; k++)
+	if (!keep[k])
 	  {
-	      if (stopped
+	    if (overload_nzero &&
+		overload_zero[2*overload_nzero-2]+
+		overload_zero[2*overload_nzero-1]==k)
+	      overload_zero[2*overload_nzero-1]++;
+	    else
+	      {
+		overload_zero[2*overload_nzero]= k;
+		overload_zero[2*overload_nzero+1]= 1;
+		overload_nzero++;
+	      }
+	  }
+    }
+  if (overload_block<=0)
+    {
+      fprintf (stderr, "problem with overload_block\n");
+      exit (1);
+    }
+  for (k= 0; k<MAXNSOCK; k++)
+    overload_socks[k].block= -1;
+
+  overload_log= stdout;
+  if (overload_logname[0] &&
+      (overload_log= fopen (overload_logname, "a"))==NULL)
+    {
+      perror ("opening overload log");
+      exit (1);
+    }
+  overload= 1;
+  if (verbose)
+    for (step= 0; step<OVERLOAD_STEPS; step++)
+      if (overload_use[step])
+	printf ("overload step %s on at fill %.3f, off below %.3f\n",
+		overload_names[step], overload_high[step], overload_low[step]);
+}
+
+
+void  overload_close ()
+{
+  int  k;
+
+  if (!overload)
+    return;
+  for (k= 0; k<nsock; k++)
+    if (overload_socks[k].packs_shed || overload_socks[k].packs_zeroed)
+      printf ("overload port %d: %ld packets dropped in blocks, %ld with "
+	      "beamlets zeroed\n", portnos[k], overload_socks[k].packs_shed,
+	      overload_socks[k].packs_zeroed);
+  if (overload_log!=stdout)
+    fclose (overload_log);
+  overload= 0;
+}
+
+
+
+int  nbatch= 1;
+double  batch_timeout_sec= 0.;
+struct timespec  batch_timeout;
+
+/* receive directly into the ring buffer? (--zerocopy) */
+int  zerocopy= 0;
+
+/* room for the control messages of one datagram (--rx_stats) */
+#define  RXCTRL_SIZE  (CMSG_SPACE (sizeof (struct timespec))+\
+		       CMSG_SPACE (sizeof (uint32_t)))
+
+
+/* a receiving (producer) thread and the sockets it serves
+
+   Normally there is one for all sockets, with --rxthreads one per socket.
+   Each has its own buffers for batched receive with recvmmsg(), one per
+   datagram, each with two bytes in front for the optional size header (see
+   --batch), and message headers for --zerocopy that point into the ring
+   buffer.
+*/
+struct rxthread {
+  int  first, n;  /* sockets first ... first+n-1 */
+  fd_set  socks;
+  int  maxsock;
+  int  cpu;  /* -1 for no affinity */
+  pthread_t  thread;
+
+  char  *batchbuffs;
+  struct mmsghdr  *batchmsgs;
+  struct iovec  *batchiovs;
+  struct sockaddr_in  *batchaddrs;
+
+  struct mmsghdr  *zcopymsgs;
+  struct iovec  *zcopyiovs;
+
+  char  *batchctrls;  /* control messages for --rx_stats */
+
+  /* for report_source() */
+  struct sockaddr_in  addr_src_old;
+  int  addr_src_n;
+};
+
+struct rxthread  rxthreads[MAXNSOCK];
+int  nrxthreads= 1;
+int  rxthread_per_sock= 0;
+
+
+/* placement of the threads (--rx_cpus, --consumer_cpus, --rx_priority,
+   --numa_node)
+
+   Receiving threads without a CPU of their own, the consumer (and with it
+   the zstd workers and the compression command, which inherit its CPUs)
+   and the metrics thread are kept on the CPUs of the NUMA node of the ring
+   buffer, if one is given. The receiving threads can run with SCHED_FIFO.
+*/
+cpu_set_t  consumer_cpus, numa_cpus;
+int  have_consumer_cpus= 0, have_numa_cpus= 0;
+int  rx_priority= 0;  /* 0: normal scheduling */
+
+
+/* a list of CPUs as for taskset -c:  0,2,4-7  returns 0 if okay */
+int  parse_cpulist (char  *list, cpu_set_t  *cpus)
+{
+  char  *p;
+  int  first, last, n;
+
+  CPU_ZERO (cpus);
+  p= list;
+  while (*p && *p!='\n')
+    {
+      if (sscanf (p, "%d%n", &first, &n)!=1)
+	return 1;
+      p+= n;
+      last= first;
+      if (*p=='-')
+	{
+	  if (sscanf (p+1, "%d%n", &last, &n)!=1)
+	    return 1;
+	  p+= 1+n;
+	}
+      if (first<0 || last<first || last>=CPU_SETSIZE)
+	return 1;
+      for (; first<=last; first++)
+	CPU_SET (first, cpus);
+      if (*p==',')
+	p++;
+      else if (*p && *p!='\n')
+	return 1;
+    }
+  return CPU_COUNT (cpus)==0;
+}
+
+
+/* the other way round, for the printouts */
+void  cpulist_to_str (cpu_set_t  *cpus, char  *buff, int  len)
+{
+  int  k, last, n;
+
+  n= 0;
+  buff[0]= 0;
+  for (k= 0; k<CPU_SETSIZE && n<len-16; k++)
+    if (CPU_ISSET (k, cpus))
+      {
+	for (last= k; last+1<CPU_SETSIZE && CPU_ISSET (last+1, cpus); last++)
+	  ;
+	if (last>k)
+	  n+= sprintf (buff+n, "%s%d-%d", n ? "," : "", k, last);
+	else
+	  n+= sprintf (buff+n, "%s%d", n ? "," : "", k);
+	k= last;
+      }
+}
+
+
+/* NUMA node of a network device, -1 if not known (or only one node) */
+int  device_numa_node (char  *device)
+{
+  char  path[200];
+  FILE  *f;
+  int  node;
+
+  snprintf (path, sizeof (path), "/sys/class/net/%s/device/numa_node",
+	    device);
+  f= fopen (path, "r");
+  if (f==NULL)
+    return -1;
+  if (fscanf (f, "%d", &node)!=1)
+    node= -1;
+  fclose (f);
+  return node;
+}
+
+
+/* the CPUs of NUMA node, returns 0 if okay */
+int  node_cpus (int  node, cpu_set_t  *cpus)
+{
+  char  path[100], list[4000];
+  FILE  *f;
+  int  res;
+
+  snprintf (path, sizeof (path), "/sys/devices/system/node/node%d/cpulist",
+	    node);
+  f= fopen (path, "r");
+  if (f==NULL)
+    return 1;
+  res= fgets (list, sizeof (list), f)==NULL || parse_cpulist (list, cpus);
+  fclose (f);
+  return res;
+}
+
+
+/* attributes for a new thread on cpus (or NULL), with SCHED_FIFO if
+   priority>0 */
+void  thread_placement (pthread_attr_t  *attr, cpu_set_t  *cpus,
+			int  priority, char  *name)
+{
+  int  j;
+
+  pthread_attr_init (attr);
+  if (cpus)
+    {
+      j= pthread_attr_setaffinity_np (attr, sizeof (*cpus), cpus);
+      if (j)
+	{
+	  errno= j;
+	  fprintf (stderr, "%s: ", name);
+	  perror ("pthread_attr_setaffinity_np");
+	  exit (1);
+	}
+    }
+  if (priority>0)
+    {
+      struct sched_param  param;
+
+      memset (&param, 0, sizeof (param));
+      param.sched_priority= priority;
+      j= pthread_attr_setinheritsched (attr, PTHREAD_EXPLICIT_SCHED);
+      if (j==0)
+	j= pthread_attr_setschedpolicy (attr, SCHED_FIFO);
+      if (j==0)
+	j= pthread_attr_setschedparam (attr, &param);
+      if (j)
+	{
+	  errno= j;
+	  fprintf (stderr, "%s: ", name);
+	  perror ("SCHED_FIFO");
+	  exit (1);
+	}
+    }
+}
+
+
+/* print where a thread runs (always, to check it in the logs) */
+void  report_placement (char  *name, pthread_t  thread)
+{
+  cpu_set_t  cpus;
+  struct sched_param  param;
+  char  list[200];
+  int  policy;
+
+  if (pthread_getaffinity_np (thread, sizeof (cpus), &cpus))
+    strcpy (list, "?");
+  else
+    cpulist_to_str (&cpus, list, sizeof (list));
+  if (pthread_getschedparam (thread, &policy, &param))
+    policy= -1;
+  if (policy==SCHED_FIFO)
+    printf ("%s on CPUs %s, SCHED_FIFO priority %d\n", name, list,
+	    param.sched_priority);
+  else
+    printf ("%s on CPUs %s\n", name, list);
+}
+
+
+/* allocate and init the buffers for recvmmsg() */
+void  init_batch (struct rxthread  *rx)
+{
+  int  k;
+
+  rx->batchbuffs= malloc (nbatch*(MMAXLEN+2l));
+  rx->batchmsgs= calloc (nbatch, sizeof (struct mmsghdr));
+  rx->batchiovs= calloc (nbatch, sizeof (struct iovec));
+  rx->batchaddrs= calloc (nbatch, sizeof (struct sockaddr_in));
+  rx->zcopymsgs= calloc (nbatch, sizeof (struct mmsghdr));
+  rx->zcopyiovs= calloc (nbatch, sizeof (struct iovec));
+  rx->batchctrls= calloc (nbatch, RXCTRL_SIZE);
+  if (rx->batchbuffs==NULL || rx->batchmsgs==NULL || rx->batchiovs==NULL ||
+      rx->batchaddrs==NULL || rx->zcopymsgs==NULL || rx->zcopyiovs==NULL ||
+      rx->batchctrls==NULL)
+    {
+      perror ("allocating buffers in init_batch()");
+      exit (1);
+    }
+
+  for (k= 0; k<nbatch; k++)
+    {
+      rx->batchiovs[k].iov_base= rx->batchbuffs+k*(MMAXLEN+2l)+
+	(do_blocklen ? 2 : 0);
+      rx->batchiovs[k].iov_len= MMAXLEN-1;  /* play safe, as for recvfrom() */
+      rx->batchmsgs[k].msg_hdr.msg_iov= &rx->batchiovs[k];
+      rx->batchmsgs[k].msg_hdr.msg_iovlen= 1;
+      if (verbose)
+	{
+	  rx->batchmsgs[k].msg_hdr.msg_name= &rx->batchaddrs[k];
+	  rx->batchmsgs[k].msg_hdr.msg_namelen= sizeof (rx->batchaddrs[k]);
+	}
+
+      /* the iovecs are set for each call */
+      rx->zcopymsgs[k].msg_hdr.msg_iov= &rx->zcopyiovs[k];
+      rx->zcopymsgs[k].msg_hdr.msg_iovlen= 1;
+      if (verbose)
+	{
+	  rx->zcopymsgs[k].msg_hdr.msg_name= &rx->batchaddrs[k];
+	  rx->zcopymsgs[k].msg_hdr.msg_namelen= sizeof (rx->batchaddrs[k]);
+	}
+
+      /* msg_controllen is set for each call */
+      if (rx_stats)
+	rx->batchmsgs[k].msg_hdr.msg_control=
+	  rx->zcopymsgs[k].msg_hdr.msg_control= rx->batchctrls+k*RXCTRL_SIZE;
+    }
+}
+
+
+
+/* the control messages of a datagram from socket i (--rx_stats) */
+void  rx_cmsg (int  i, struct msghdr  *mh)
+{
+  struct cmsghdr  *cm;
+  struct timespec  ts;
+  uint32_t  ovfl;
+  int  have_ovfl;
+
+  rxstat[i].t_ns= 0;
+  have_ovfl= 0;
+  for (cm= CMSG_FIRSTHDR (mh); cm; cm= CMSG_NXTHDR (mh, cm))
+    if (cm->cmsg_level==SOL_SOCKET)
+      {
+	if (cm->cmsg_type==SCM_TIMESTAMPNS)
+	  {
+	    memcpy (&ts, CMSG_DATA (cm), sizeof (ts));
+	    rxstat[i].t_ns= ts.tv_sec*1000000000l+ts.tv_nsec;
+	  }
+	else if (cm->cmsg_type==SO_RXQ_OVFL)
+	  {
+	    memcpy (&ovfl, CMSG_DATA (cm), sizeof (ovfl));
+	    have_ovfl= 1;
+	  }
+      }
+  if (have_ovfl)  /* the kernel counter has 32 bits */
+    rx_drops (i, rxstat[i].ovfl+(uint32_t)(ovfl-(uint32_t)rxstat[i].ovfl));
+}
+
+
+/* as recvfrom(), with the control messages for --rx_stats */
+int  rx_recvmsg (int  i, char  *buff, int  len,
+		 struct sockaddr_in  *addr_src, socklen_t  *slen)
+{
+  struct msghdr  mh;
+  struct iovec  iov;
+  char  control[RXCTRL_SIZE];
+  int  thissize;
+
+  iov.iov_base= buff;
+  iov.iov_len= len;
+  memset (&mh, 0, sizeof (mh));
+  mh.msg_name= addr_src;
+  mh.msg_namelen= addr_src ? *slen : 0;
+  mh.msg_iov= &iov;
+  mh.msg_iovlen= 1;
+  mh.msg_control= control;
+  mh.msg_controllen= sizeof (control);
+  thissize= recvmsg (sock[i], &mh, 0);
+  if (thissize!=-1)
+    {
+      if (addr_src)
+	*slen= mh.msg_namelen;
+      rx_cmsg (i, &mh);
+    }
+  return thissize;
+}
+
+
+
+/* print the source address of the first packet and of changing sources
+   (only for --verbose), separately for each receiving thread */
+void  report_source (struct rxthread  *rx,
+		     struct sockaddr_in  *addr_src, socklen_t  slen)
+{
+  if (rx->addr_src_n==0 ||
+      ((
+	addr_src->sin_port!=rx->addr_src_old.sin_port ||
+	addr_src->sin_addr.s_addr!=rx->addr_src_old.sin_addr.s_addr )
+       && rx->addr_src_n<100))
+    {
+      char  host[20], serv[10];
+      int  i;
+
+      i= getnameinfo ((struct sockaddr*)addr_src, slen,
+		      host, sizeof (host),
+		      serv, sizeof (serv),
+		      NI_NUMERICHOST | NI_NUMERICSERV);
+      if (i)
+	printf ("getnameinfo() error %d\n", i);
+      else
+	{
+	  if (rx->addr_src_n==0)
+	    printf ("first packet received from source %s:%s\n",
+		    host, serv);
+	  else
+	    printf (
+	      "packet received from different (%d) source %s:%s\n",
+	      rx->addr_src_n, host, serv);
+	}
+      rx->addr_src_n++;
+      rx->addr_src_old= *addr_src;
+    }
+}
+
+
+
+/* checks and statistics for one packet of thissize bytes (>0) that has
+   been received from socket i (or stdin, then i==0)
+   buff has the two bytes for the size header in front of the data, even if
+   they are not used; the size header is filled in here
+   returns the number of bytes that go into the ring buffer (packet plus
+   size header), or 0 if the packet is not to be used
+
+   blocklen (--sizehead), len (--len, 0 any) and check (--check) are
+   constants in the loops of receive_batch_as() and receive_zerocopy_as(),
+   with fast the checks for a whole batch are left to them: stopped and
+   this_nskip before the batch, and the packets do not need overload,
+   transform or rx_stats (see rx_select()). packs_seen is still counted
+   per packet, with the other counters of the file (a split resets them)
+*/
+static inline __attribute__ ((always_inline))
+int  accept_packet_as (int  i, char  *buff, int  thissize, int  blocklen,
+		       int  len, int  check, int  fast)
+{
+  char  *buff2;
+
+  if (blocklen)
+    buff2= buff+2;  /* we need two bytes for size */
+  else
+    buff2= buff;
+
+  if (!fast && stopped
+
+      ==2  /* discard only of we really want to stop */
+
+
+      )
+    {
+      if (verbose)
+	printf ("discarding packet\n");
+      return 0;
+    }
+
+  /* now we have a packet either from socket or from stdin */
+  if (len!=0 && thissize!=len)
+    {
+      printf ("received %5d bytes, wrong length in sock %d, "
+	      "should be %d\n", thissize, i, len);
+      return 0;
+    }
+  /* good size, or size does not matter */
+
+  if (!fast && overload && !overload_packet (i, buff2))
+    return 0;
+
+  if (!fast && transform)  /* the size header is for the result */
+    {
+      thissize= transform_packet (buff2, thissize);
+      if (thissize==0)
+	return 0;
+    }
+
+  if (blocklen)/*add the blocklen if wanted (two bytes) */
+    /* not tested */
+    {
+      *(uint16_t*)buff= (uint16_t)thissize;
+      thissize+= 2;
+    }
+
+
+  if (!fast && sockstat[i].this_nskip>0) /* skip this packet */
+    {
+
+
+#if MYDEBUG>=2
+      fprintf (stderr, "SKIP: still to skip %d packets in socket %d\n",
+	       sockstat[i].this_nskip, i);
+#endif
+
+      sockstat[i].this_nskip--;
+      return 0;
+    }
+
+  /* use this packet */
+
+  if (check)
+    {
+      sockstat[i].beamformed_last_packno= beamformed_packno (
+	(struct header_lofar*)buff2);
+      if (sockstat[i].beamformed_first_packno==-1)
+	sockstat[i].beamformed_first_packno=
+	  sockstat[i].beamformed_last_packno;
+      if (beamformed_checkpack ((struct
+				 header_lofar*)buff2))
+	sockstat[i].beamformed_good_packs++;
+    }
+
+  if (!fast && rx_stats)
+    rx_arrival (i, check ? (struct header_lofar*)buff2 : NULL);
+
+  count_add (&sockstat[i].packs_seen, 1);
+
+  return thissize;
+}
+
+
+int  accept_packet (int  i, char  *buff, int  thissize)
+{
+  return accept_packet_as (i, buff, thissize, do_blocklen, packlen,
+			   beamformed_check, 0);
+}
+
+
+
+/* wait till space available in buffer
+   (for stdin we can wait with reading, don't drop packets) */
+void  wait_space (struct vrb  *ring, long  size)
+{
+  while ( vrb_poi_new (ring, size) == NULL )
+    /* not enough space */
+    {
+      int  key;
+
+      key= vrb_event_prepare (&ring->space_event);
+      if (vrb_poi_new (ring, size) != NULL)
+	{
+	  vrb_event_cancel (&ring->space_event);
+	  break;
+	}
+      vrb_event_wait (&ring->space_event, key);
+    }
+}
+
+
+/* copy a packet that has been accepted (see accept_packet()) to the ring
+   buffer if there is space */
+void  put_packet (int  i, char  *buff, int  thissize)
+{
+  char  *newpoi;
+  struct vrb  *ring;
+
+  ring= sockring[i];
+  if (nsock==1 && portnos[0]==0)  /* stdin, more than one with --reorder */
+    wait_space (ring, thissize);
+
+  /* (no conflicts for rear and allbuffs) */
+
+  /* no locking needed with a single producer per ring */
+  if (shared_ring)
+    pthread_mutex_lock (&rear_mutex);
+  newpoi= vrb_poi_new (ring, thissize);
+  count_filllevel (i, vrb_fillsize (ring)/(double)ring->totsize, 1);
+
+
+  if (newpoi==NULL)   /* not enough space */
+    /* this should not happen for read from stdin */
+    {
+      /* simply drop this packet */
+      count_add (&sockstat[i].packs_dropped, 1);
+    }
+  else /* enough space */
+
+    {
+      memcpy (newpoi, buff, thissize);
+
+      /* this also wakes the consumer if it is waiting */
+      vrb_advance_new (ring, thissize);
+
+      count_maxsize (i, vrb_fillsize (ring));
+
+      count_add (&sockstat[i].bytes_written, thissize);
+      if (rx_stats)
+	rx_sample (i, ring);
+    }
+  if (shared_ring)
+    pthread_mutex_unlock (&rear_mutex);
+}
+
+
+
+/* reorder window and gap filling (--reorder n, --fill_max n)
+
+   The packets of each socket are put in the order of their packet numbers
+   (see beamformed_packno()) in a window of n slots. A packet is passed on
+   as soon as all before it are there, or when the window has to move on
+   for a later one: then the missing packets are replaced by zero packets
+   with the error bit set (header of a neighbour, with their own block
+   number). So the output has constant stride (with --len). Late packets
+   (the window has moved on) and duplicates are dropped. Gaps of more than
+   fill_max packets are not filled, the window starts new; so does a jump
+   back. At timeout and at the end the rest of the window is passed on.
+*/
+struct reorder_window {
+  char  *slots;  /* reorder slots of ringlen bytes (with size header) */
+  char  *have;
+  long  base;  /* packet number of the oldest slot */
+  int  started;
+  struct header_lofar  ref;  /* of the last passed packet, for the fill */
+} windows[MAXNSOCK];
+
+
+void  reorder_init ()
+{
+  long  ringlen= outlen+(do_blocklen ? 2 : 0);
+  int  i;
+
+  for (i= 0; i<nsock; i++)
+    {
+      windows[i].slots= malloc (reorder*ringlen);
+      windows[i].have= calloc (reorder, 1);
+      if (windows[i].slots==NULL || windows[i].have==NULL)
+	{
+	  perror ("allocating reorder window");
+	  exit (1);
+	}
+      windows[i].started= 0;
+    }
+}
+
+
+/* timestamp and sequence of block number block (see lofar_block()) */
+void  set_lofar_block (struct header_lofar  *header, long  block)
+{
+  int  is200mhz= header->source.is200mhz;
+  long  t;
+
+  t= block*2/lofar_clock512[is200mhz];
+  while (lofar_second_block (t, is200mhz)>block)
+    t--;
+  while (lofar_second_block (t+1, is200mhz)<=block)
+    t++;
+  header->timestamp= t;
+  header->sequence= block-lofar_second_block (t, is200mhz);
+}
+
+
+/* pass on the oldest slot of the window of socket i (or its fill) */
+void  reorder_pass (int  i)
+{
+  struct reorder_window  *w= &windows[i];
+  long  ringlen= outlen+(do_blocklen ? 2 : 0);
+  int  hl= do_blocklen ? 2 : 0;
+  char  *slot, fill[MMAXLEN+2];
+  long  packno;
+
+  slot= w->slots+w->base%reorder*ringlen;
+  if (w->have[w->base%reorder])
+    {
+      memcpy (&w->ref, slot+hl, sizeof (w->ref));
+      put_packet (i, slot, ringlen);
+      w->have[w->base%reorder]= 0;
+    }
+  else
+    {
+      struct header_lofar  *header= (struct header_lofar*)(fill+hl);
+
+      memset (fill, 0, ringlen);
+      if (do_blocklen)
+	*(uint16_t*)fill= outlen;
+      *header= w->ref;
+      packno= beamformed_packno (&w->ref);
+      set_lofar_block (header, lofar_block (&w->ref)+16*(w->base-packno));
+      header->source.error= 1;
+      put_packet (i, fill, ringlen);
+      count_add (&sockstat[i].packs_filled, 1);
+    }
+  w->base++;
+}
+
+
+/* pass on all of the window of socket i, then start new */
+void  reorder_flush (int  i)
+{
+  struct reorder_window  *w= &windows[i];
+  long  k, last;
+
+  if (!w->started)
+    return;
+  last= -1;
+  for (k= 0; k<reorder; k++)
+    if (w->have[(w->base+k)%reorder])
+      last= k;
+  for (k= 0; k<=last; k++)
+    reorder_pass (i);
+  w->started= 0;
+}
+
+
+/* put an accepted packet (see accept_packet()) into the window */
+void  reorder_packet (int  i, char  *buff, int  thissize)
+{
+  struct reorder_window  *w= &windows[i];
+  struct header_lofar  *header;
+  long  packno;
+
+  header= (struct header_lofar*)(buff+(do_blocklen ? 2 : 0));
+  packno= beamformed_packno (header);
+
+  if (w->started && (packno<w->base-reorder ||
+		     packno>=w->base+reorder+fill_max))
+    {
+      if (verbose)
+	printf ("reorder: jump from %ld to %ld in sock %d, start new\n",
+		w->base, packno, i);
+      reorder_flush (i);
+    }
+  if (!w->started)
+    {
+      w->base= packno;
+      w->ref= *header;
+      w->started= 1;
+    }
+  if (packno<w->base)  /* late */
+    {
+      count_add (&sockstat[i].packs_late, 1);
+      return;
+    }
+  while (packno>=w->base+reorder)
+    reorder_pass (i);
+  if (w->have[packno%reorder])  /* duplicate */
+    {
+      count_add (&sockstat[i].packs_late, 1);
+      return;
+    }
+  memcpy (w->slots+packno%reorder*thissize, buff, thissize);
+  w->have[packno%reorder]= 1;
+  while (w->have[w->base%reorder])
+    reorder_pass (i);
+}
+
+
+
+/* handle one packet received into a separate buffer (see accept_packet()),
+   copy it to the ring buffer if there is space */
+void  handle_packet (int  i, char  *buff, int  thissize)
+{
+  thissize= accept_packet (i, buff, thissize);
+  if (thissize==0)
+    return;
+
+  if (reorder)
+    reorder_packet (i, buff, thissize);
+  else
+    put_packet (i, buff, thissize);
+}
+
+
+
+/* receive from socket i directly into the free part of the ring buffer
+   (--zerocopy)
+
+   With --len the datagrams of a batch go to consecutive slots behind rear,
+   otherwise one datagram at a time is received (its size is not known
+   beforehand). Nothing is committed (rear not advanced) before
+   accept_packet() has checked the packets. Packets that are not used leave
+   a hole that is closed by moving the following ones (this is rare).
+   returns 0 if there is not enough free space, then the caller has to
+   receive (and drop) the packets in the normal way
+   blocklen, len, check and fast as for accept_packet_as(), see RX_LOOPS
+*/
+static inline __attribute__ ((always_inline))
+int  receive_zerocopy_as (struct rxthread  *rx, int  i, int  blocklen,
+			  int  len, int  check, int  fast)
+{
+  long  nfree, stride, used;
+  char  *rearpoi, *poi;
+  int  head, k, n, nused, nslots, thissize, ringsize;
+  double  sum;
+  struct vrb  *ring;
+  struct mmsghdr  *zcopymsgs;
+
+  ring= sockring[i];
+  zcopymsgs= rx->zcopymsgs;
+
+  head= blocklen ? 2 : 0;
+  if (len)
+    stride= head+len;
+  else
+    stride= MMAXLEN+2;
+
+  nfree= ring->totsize-vrb_fillsize (ring);
+  rearpoi= ring->buff+ring->rear;
+
+  nslots= nfree/stride;
+  if (nslots==0)
+    return 0;
+  if (len==0 || nslots>nbatch)
+    nslots= len ? nbatch : 1;
+
+  for (k= 0; k<nslots; k++)
+    {
+      rx->zcopyiovs[k].iov_base= rearpoi+k*stride+head;
+      rx->zcopyiovs[k].iov_len= len ? len : MMAXLEN-1;
+      if (!fast && verbose)
+	zcopymsgs[k].msg_hdr.msg_namelen= sizeof (rx->batchaddrs[k]);
+      if (!fast && rx_stats)
+	zcopymsgs[k].msg_hdr.msg_controllen= RXCTRL_SIZE;
+    }
+
+  /* with MSG_TRUNC we get the real length of datagrams that are too long */
+  n= recvmmsg (sock[i], zcopymsgs, nslots,
+	       (batch_timeout_sec>0 && nslots>1 ? 0 : MSG_DONTWAIT) |
+	       (len ? MSG_TRUNC : 0),
+	       batch_timeout_sec>0 && nslots>1 ? &batch_timeout : NULL);
+  if (n==-1)
+    {
+      if (errno==EAGAIN || errno==EWOULDBLOCK || errno==EINTR)
+	return 1;  /* nothing there after all, try again */
+      perror ("recvmmsg() in receive_zerocopy_as()");
+      producer_running= 0;
+      exit (1);
+    }
+
+  used= nused= 0;
+  sum= 0;
+  for (k= 0; k<n; k++)
+    {
+      thissize= zcopymsgs[k].msg_len;
+      if (len==0 && thissize>=MMAXLEN)  /* this should not happen */
+	{
+	  fprintf (stderr, "producer(): recvmmsg() result %d >= %d"
+		   " (should not happen)\n", thissize, MMAXLEN);
+	  producer_running= 0;
+	  exit (1);
+	}
+      if (!fast && verbose)
+	report_source (rx, &rx->batchaddrs[k],
+		       zcopymsgs[k].msg_hdr.msg_namelen);
+      if (!fast && rx_stats)
+	rx_cmsg (i, &zcopymsgs[k].msg_hdr);
+      if (thissize==0)
+	continue;
+
+      poi= rearpoi+k*stride;
+      ringsize= accept_packet_as (i, poi, thissize, blocklen, len, check,
+				  fast);
+      if (ringsize==0)  /* not used */
+	continue;
+      if (poi!=rearpoi+used)  /* close the gap */
+	memmove (rearpoi+used, poi, ringsize);
+      sum+= (ring->totsize-nfree+used)/(double)ring->totsize;
+      used+= ringsize;
+      nused++;
+    }
+
+  /* fill levels as if the packets were added one by one */
+  count_filllevel (i, sum, nused);
+  if (used)
+    {
+      vrb_advance_new (ring, used);
+
+      count_maxsize (i, vrb_fillsize (ring));
+      if (!fast && rx_stats)
+	rx_sample (i, ring);
+    }
+
+  count_add (&sockstat[i].bytes_written, used);
+
+  return 1;
+}
+
+
+
+/* one recvmmsg() call for socket i into the buffers of rx (--batch), each
+   packet is copied to the ring buffer if there is space
+   blocklen, len, check and fast as for accept_packet_as(), see RX_LOOPS
+*/
+static inline __attribute__ ((always_inline))
+void  receive_batch_as (struct rxthread  *rx, int  i, int  blocklen, int  len,
+			int  check, int  fast)
+{
+  struct mmsghdr  *batchmsgs;
+  char  *buff;
+  int  k, n, thissize;
+
+  batchmsgs= rx->batchmsgs;
+  if (!fast && verbose)
+    for (k= 0; k<nbatch; k++)
+      batchmsgs[k].msg_hdr.msg_namelen= sizeof (rx->batchaddrs[k]);
+  if (!fast && rx_stats)
+    for (k= 0; k<nbatch; k++)
+      batchmsgs[k].msg_hdr.msg_controllen= RXCTRL_SIZE;
+
+  n= recvmmsg (sock[i], batchmsgs, nbatch,
+	       batch_timeout_sec>0 ? 0 : MSG_DONTWAIT,
+	       batch_timeout_sec>0 ? &batch_timeout : NULL);
+  if (n==-1)
+    {
+      if (errno==EAGAIN || errno==EWOULDBLOCK || errno==EINTR)
+	return;  /* nothing there after all, try again */
+      perror ("recvmmsg() in producer()");
+      producer_running= 0;
+      exit (1);
+    }
+
+  for (k= 0; k<n; k++)
+    {
+      thissize= batchmsgs[k].msg_len;
+      if (thissize>=MMAXLEN)  /* this should not happen */
+	{
+	  fprintf (stderr, "producer(): recvmmsg() result %d >= %d"
+		   " (should not happen)\n", thissize, MMAXLEN);
+	  producer_running= 0;
+	  exit (1);
+	}
+      if (!fast && verbose)
+	report_source (rx, &rx->batchaddrs[k],
+		       batchmsgs[k].msg_hdr.msg_namelen);
+      if (!fast && rx_stats)
+	rx_cmsg (i, &batchmsgs[k].msg_hdr);
+      if (thissize==0)
+	continue;
+      buff= rx->batchbuffs+k*(MMAXLEN+2l);
+      if (!fast)
+	{
+	  handle_packet (i, buff, thissize);
+	  continue;
+	}
+      thissize= accept_packet_as (i, buff, thissize, blocklen, len, check, 1);
+      if (thissize==0)
+	continue;
+      if (reorder)
+	reorder_packet (i, buff, thissize);
+      else
+	put_packet (i, buff, thissize);
+    }
+}
+
+
+
+/* the receive loops for fixed settings, each with the flags as constants
+   (the compiler leaves out what is not used): receive_batch_name() and
+   receive_zerocopy_name(). For blocklen, len and check the variables of the
+   options make the generic loops (any) that check everything per packet.
+   rx_select() takes the fast loops if the options are a fixed case, and
+   receive_socket() uses them for batches while not stopping or skipping
+   (the fast loops do not test stopped and this_nskip per packet).
+*/
+#define  RX_LOOPS(name, blocklen, len, check, fast) \
+void  receive_batch_##name (struct rxthread  *rx, int  i) \
+{ \
+  receive_batch_as (rx, i, blocklen, len, check, fast); \
+} \
+\
+int  receive_zerocopy_##name (struct rxthread  *rx, int  i) \
+{ \
+  return receive_zerocopy_as (rx, i, blocklen, len, check, fast); \
+}
+
+RX_LOOPS (any, do_blocklen, packlen, beamformed_check, 0)
+RX_LOOPS (lofar, 0, LOFAR_PACKLEN, 0, 1)
+RX_LOOPS (lofar_check, 0, LOFAR_PACKLEN, 1, 1)
+RX_LOOPS (lofar_sizehead, 1, LOFAR_PACKLEN, 0, 1)
+RX_LOOPS (lofar_sizehead_check, 1, LOFAR_PACKLEN, 1, 1)
+
+struct rx_loops {
+  const char  *name;
+  void  (*batch) (struct rxthread  *rx, int  i);
+  int  (*zerocopy) (struct rxthread  *rx, int  i);
+};
+
+/* [blocklen][check] */
+struct rx_loops  rx_loops_lofar[2][2]= {
+  { { "lofar", receive_batch_lofar, receive_zerocopy_lofar },
+    { "lofar_check", receive_batch_lofar_check,
+      receive_zerocopy_lofar_check } },
+  { { "lofar_sizehead", receive_batch_lofar_sizehead,
+      receive_zerocopy_lofar_sizehead },
+    { "lofar_sizehead_check", receive_batch_lofar_sizehead_check,
+      receive_zerocopy_lofar_sizehead_check } } };
+
+struct rx_loops  *rx_fast= NULL;  /* NULL: receive_batch_any() etc. */
+
+
+/* once the options are known: the fast loops for 7824 byte packets
+   (--check implies --len 7824) that need nothing done per packet but the
+   checks, not with --verbose (the sources are reported per packet) */
+void  rx_select ()
+{
+  rx_fast= NULL;
+  if (packlen==LOFAR_PACKLEN && !overload && !transform && !rx_stats &&
+      !verbose)
+    rx_fast= &rx_loops_lofar[do_blocklen!=0][beamformed_check!=0];
+  printf ("receive loops: %s\n", rx_fast ? rx_fast->name : "any");
+}
+
+
+
+/* open the packet socket for port i (its UDP socket is already bound)
+
+   The ring consists of blocks that the kernel fills with many packets and
+   hands over to us when they are full or after a timeout. A classic BPF
+   filter takes only unfragmented UDP packets for this port (and IP if
+   given). SOCK_DGRAM: the packets start with the IP header.
+*/
+int  init_packet_socket (int  i, char  *device, struct in_addr  dest_ip)
+{
+  struct sock_filter  code[12];
+  struct sock_fprog  prog;
+  struct tpacket_req3  req;
+  struct sockaddr_ll  sll;
+  int  fd, n, j, drop, version;
+
+  /* protocol 0: receive nothing before the filter is there (bind()) */
+  fd= socket (AF_PACKET, SOCK_DGRAM, 0);
+  if (fd==-1)
+    {
+      perror ("socket(AF_PACKET) (requires root or CAP_NET_RAW)");
+      exit (1);
+    }
+
+  /* the filter, jumps to drop are relative */
+  drop= dest_ip.s_addr==htonl (INADDR_ANY) ? 8 : 10;
+  n= 0;
+  code[n++]= (struct sock_filter)BPF_STMT (BPF_LD|BPF_B|BPF_ABS, 9);
+  code[n]= (struct sock_filter)BPF_JUMP (BPF_JMP|BPF_JEQ|BPF_K, IPPROTO_UDP,
+					 0, drop-n-1);
+  n++;
+  code[n++]= (struct sock_filter)BPF_STMT (BPF_LD|BPF_H|BPF_ABS, 6);
+  code[n]= (struct sock_filter)BPF_JUMP (BPF_JMP|BPF_JSET|BPF_K, 0x3fff,
+					 drop-n-1, 0);  /* fragment */
+  n++;
+  if (dest_ip.s_addr!=htonl (INADDR_ANY))
+    {
+      code[n++]= (struct sock_filter)BPF_STMT (BPF_LD|BPF_W|BPF_ABS, 16);
+      code[n]= (struct sock_filter)BPF_JUMP (BPF_JMP|BPF_JEQ|BPF_K,
+					     ntohl (dest_ip.s_addr),
+					     0, drop-n-1);
+      n++;
+    }
+  code[n++]= (struct sock_filter)BPF_STMT (BPF_LDX|BPF_B|BPF_MSH, 0);
+  code[n++]= (struct sock_filter)BPF_STMT (BPF_LD|BPF_H|BPF_IND, 2);
+  code[n]= (struct sock_filter)BPF_JUMP (BPF_JMP|BPF_JEQ|BPF_K, portnos[i],
+					 0, drop-n-1);
+  n++;
+  code[n++]= (struct sock_filter)BPF_STMT (BPF_RET|BPF_K, 0x40000);
+  assert (n==drop);
+  code[n++]= (struct sock_filter)BPF_STMT (BPF_RET|BPF_K, 0);
+
+  prog.len= n;
+  prog.filter= code;
+  if (setsockopt (fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof (prog)))
+    {
+      perror ("setsockopt(SO_ATTACH_FILTER) for packet socket");
+      exit (1);
+    }
+
+#ifdef  PACKET_IGNORE_OUTGOING
+  j= 1;  /* e.g. on lo, we would see everything twice */
+  if (setsockopt (fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &j, sizeof (j)))
+    perror ("setsockopt(PACKET_IGNORE_OUTGOING)");  /* not fatal */
+#endif
+
+  version= TPACKET_V3;
+  if (setsockopt (fd, SOL_PACKET, PACKET_VERSION, &version,
+		  sizeof (version)))
+    {
+      perror ("setsockopt(PACKET_VERSION)");
+      exit (1);
+    }
+
+  memset (&req, 0, sizeof (req));
+  req.tp_block_size= PACKET_BLOCKSIZE;
+  req.tp_block_nr= packet_ring_size/PACKET_BLOCKSIZE;
+  if (req.tp_block_nr<2)
+    req.tp_block_nr= 2;
+  req.tp_frame_size= 1<<11;  /* only for checks, packets are packed */
+  req.tp_frame_nr= req.tp_block_nr*(PACKET_BLOCKSIZE/req.tp_frame_size);
+  /* hand over a block after this many ms even if not full */
+  req.tp_retire_blk_tov= batch_timeout_sec>0 ? batch_timeout_sec*1e3+0.5 : 4;
+  if (req.tp_retire_blk_tov==0)
+    req.tp_retire_blk_tov= 1;
+  if (setsockopt (fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof (req)))
+    {
+      perror ("setsockopt(PACKET_RX_RING)");
+      exit (1);
+    }
+
+  pktrings[i].nblocks= req.tp_block_nr;
+  pktrings[i].cur= 0;
+  pktrings[i].drops= 0;
+  pktrings[i].map= mmap (NULL, (long)req.tp_block_nr*PACKET_BLOCKSIZE,
+			 PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			 fd, 0);
+  if (pktrings[i].map==MAP_FAILED)
+    {
+      perror ("mmap() of packet ring");
+      exit (1);
+    }
+
+  memset (&sll, 0, sizeof (sll));
+  sll.sll_family= AF_PACKET;
+  sll.sll_protocol= htons (ETH_P_IP);
+  if (device)
+    {
+      sll.sll_ifindex= if_nametoindex (device);
+      if (sll.sll_ifindex==0)
+	{
+	  perror ("if_nametoindex() for packet socket");
+	  exit (1);
+	}
+    }
+  else
+    sll.sll_ifindex= 0;  /* all devices */
+  if (bind (fd, (struct sockaddr*)&sll, sizeof (sll)))
+    {
+      perror ("bind() of packet socket");
+      exit (1);
+    }
+
+  return fd;
+}
+
+
+
+/* one packet from the packet ring of socket i */
+void  handle_captured (struct rxthread  *rx, int  i,
+		       struct tpacket3_hdr  *ppd)
+{
+  struct sockaddr_ll  *sll;
+  uint8_t  *ip, *udp;
+  int  ihl, thissize;
+
+  sll= (struct sockaddr_ll *)((char*)ppd+
+			      TPACKET_ALIGN (sizeof (struct tpacket3_hdr)));
+  if (sll->sll_pkttype==PACKET_OUTGOING)
+    return;
+
+  ip= (uint8_t*)ppd+ppd->tp_net;
+  ihl= (ip[0]&0xf)*4;
+  udp= ip+ihl;
+  thissize= ntohs (*(uint16_t*)(udp+4))-8;  /* UDP length */
+  if (ihl+8+thissize>ppd->tp_snaplen)  /* this should not happen */
+    thissize= ppd->tp_snaplen-ihl-8;
+  if (thissize<=0)
+    return;
+  if (thissize>=MMAXLEN)
+    {
+      printf ("received %5d bytes, too long in sock %d\n", thissize, i);
+      return;
+    }
+  if (rx_stats)
+    rxstat[i].t_ns= ppd->tp_sec*1000000000l+ppd->tp_nsec;
+
+  if (verbose)
+    {
+      struct sockaddr_in  addr_src;
+
+      memset (&addr_src, 0, sizeof (addr_src));
+      addr_src.sin_family= AF_INET;
+      memcpy (&addr_src.sin_addr, ip+12, 4);
+      memcpy (&addr_src.sin_port, udp, 2);
+      report_source (rx, &addr_src, sizeof (addr_src));
+    }
+
+  /* the UDP checksum in front of the data (in our block) can take the size
+     header */
+  handle_packet (i, (char*)udp+8-(do_blocklen ? 2 : 0), thissize);
+}
+
+
+
+/* take all blocks the kernel has handed over for socket i */
+void  receive_packet_ring (struct rxthread  *rx, int  i)
+{
+  struct pktring  *pr;
+  struct tpacket_block_desc  *bd;
+  struct tpacket3_hdr  *ppd;
+  int  k;
+
+  pr= &pktrings[i];
+  while (1)
+    {
+      bd= (struct tpacket_block_desc *)(pr->map+
+					(long)pr->cur*PACKET_BLOCKSIZE);
+      if ((__atomic_load_n (&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE)
+	   & TP_STATUS_USER) == 0)
+	break;
+
+      ppd= (struct tpacket3_hdr *)((char*)bd+bd->hdr.bh1.offset_to_first_pkt);
+      for (k= 0; k<bd->hdr.bh1.num_pkts; k++)
+	{
+	  handle_captured (rx, i, ppd);
+	  ppd= (struct tpacket3_hdr *)((char*)ppd+ppd->tp_next_offset);
+	}
+
+      /* give it back to the kernel */
+      __atomic_store_n (&bd->hdr.bh1.block_status, TP_STATUS_KERNEL,
+			__ATOMIC_RELEASE);
+      pr->cur= (pr->cur+1)%pr->nblocks;
+      if (rx_stats)  /* drops since the last block */
+	rx_drops (i, packet_ring_drops (i));
+    }
+}
+
+
+
+/* read from socket i that pselect() has reported as readable
+
+   With --batch (nbatch>1) we take up to nbatch datagrams in one recvmmsg()
+   call. Without --batch_timeout only those already queued are taken,
+   otherwise we wait up to the batch timeout (per datagram, via SO_RCVTIMEO,
+   and in total) for the batch to fill. Statistics are per datagram as
+   before.
+*/
+void  receive_socket (struct rxthread  *rx, int  i)
+{
+  char  buff[MMAXLEN+2];
+  char  *buff2;
+  socklen_t  slen;
+  struct sockaddr_in  addr_src;
+  int  thissize, fast;
+
+  if (rxthread_per_sock)  /* for rx_timeout() */
+    {
+      struct timespec  ts;
+
+      clock_gettime (CLOCK_MONOTONIC_COARSE, &ts);
+      atomic_store_explicit (&sockstat[i].last_rx,
+			     ts.tv_sec*1000000000l+ts.tv_nsec,
+			     memory_order_relaxed);
+    }
+
+  if (capture==CAPTURE_PACKET)
+    {
+      receive_packet_ring (rx, i);
+      return;
+    }
+
+  /* the fast loops not while stopping or skipping (see RX_LOOPS) */
+  fast= rx_fast && stopped!=2 && sockstat[i].this_nskip==0;
+  if (zerocopy &&
+      (fast ? rx_fast->zerocopy (rx, i) : receive_zerocopy_any (rx, i)))
+    return;
+  if (fast)  /* also for single datagrams, as a batch of one */
+    {
+      rx_fast->batch (rx, i);
+      return;
+    }
+
+  if (nbatch<=1)  /* single datagram */
+    {
+      if (do_blocklen)
+	buff2= buff+2;  /* we need two bytes for size */
+      else
+	buff2= buff;
+
+      if (rx_stats)
+	{
+	  slen= sizeof (addr_src);
+	  thissize= rx_recvmsg (i, buff2, MMAXLEN-1, /* play safe */
+				verbose ? &addr_src : NULL, &slen);
+	  if (thissize!=-1 && verbose)
+	    report_source (rx, &addr_src, slen);
+	}
+      else if (verbose)
+	{
+	  slen= sizeof (addr_src);
+	  thissize= recvfrom (sock[i], buff2,
+			      MMAXLEN-1, /* play safe */
+			      0,
+			      (struct sockaddr *)&addr_src,
+			      &slen);
+	  if (thissize!=-1)
+	    report_source (rx, &addr_src, slen);
+	}
+      else
+	thissize= recvfrom (sock[i], buff2,
+			    MMAXLEN-1, /* play safe */
+			    0,
+			    NULL, 0);
+
+
+      if (thissize==-1)
+	{
+	  perror ("recvfrom() in producer()");
+	  producer_running= 0;
+	  exit (1);
+	}
+      if (thissize>=MMAXLEN)  /* this should not happen */
+	{
+	  fprintf (stderr, "producer(): recvfrom() result %d >= %d"
+		   " (should not happen)\n", thissize, MMAXLEN);
+	  producer_running= 0;
+	  exit (1);
+	}
+
+      if (thissize)
+	handle_packet (i, buff, thissize);
+      return;
+    }
+
+
+  /* batch of datagrams */
+  receive_batch_any (rx, i);
+}
+
+
+
+/* pselect() timeout in a thread with --rxthreads: this only means that
+   the sockets of this thread had no data. It is a real timeout if no
+   socket had data for that long. Then call signal_handler() as for a single
+   producer, but only once (from the thread that notices it first) until
+   data arrive again.
+*/
+void  rx_timeout ()
+{
+  static long  last_fired= -1;
+  static pthread_mutex_t  timeout_mutex= PTHREAD_MUTEX_INITIALIZER;
+  struct timespec  ts;
+  long  now, last_rx, t;
+  int  i;
+
+  last_rx= 0;
+  for (i= 0; i<nsock; i++)
+    {
+      t= atomic_load_explicit (&sockstat[i].last_rx, memory_order_relaxed);
+      if (t>last_rx)
+	last_rx= t;
+    }
+  clock_gettime (CLOCK_MONOTONIC_COARSE, &ts);
+  now= ts.tv_sec*1000000000l+ts.tv_nsec;
+  if (now-last_rx < timeout.tv_sec*1000000000l+timeout.tv_nsec)
+    return;  /* other sockets are still busy */
+
+  pthread_mutex_lock (&timeout_mutex);
+  if (last_fired<last_rx)  /* not yet reported */
+    {
+      last_fired= now;
+      signal_handler (-1);
+    }
+  pthread_mutex_unlock (&timeout_mutex);
+}
+
+
+
+/* regular printouts (from any producer thread) */
+void  regular_printouts ()
+{
+  static pthread_mutex_t  printout_mutex= PTHREAD_MUTEX_INITIALIZER;
+
+  if (total_bytes ()-lasttotlen>1e9 &&
+      pthread_mutex_trylock (&printout_mutex)==0)  /* not another thread */
+    {
+      if (total_bytes ()-lasttotlen>1e9)
+	signal_handler (0);
+      pthread_mutex_unlock (&printout_mutex);
+    }
+}
+
+
+
+void *producer (void  *arg)
+{
+  char  buff[MMAXLEN+2];
+  fd_set  myallsocks;
+  int  i, thissize; 
+  struct rxthread  *rx= arg;
+
+  char  *buff2;
+
+
+
+  if (do_blocklen)
+    buff2= buff+2;  /* we need two bytes for size */
+  else
+      buff2= buff;
+
+
+  while (1)
+    {
+
+
+      regular_printouts ();
+
+      if (nsock==1 && portnos[0]==0)   /* then read stdin */
+	{
+	  if (stopped==2)  /* end of input, nothing more to read */
+	    {
+	      producer_running--;
+	      pthread_exit (NULL);
+	    }
+	  if (stopped)
+	    continue;
+
+	      
+	  wait_space (&ringbuffer, packlen);
+	  /* printf ("after    available: %ld\n", ringbuffer.totsize-vrb_fillsize (&ringbuffer)); */
+	      
+
+	  /* read one packet, first skip this_nskip if necessary */
+#if MYDEBUG>=2
+	  if (sockstat[0].this_nskip>0)
+fprintf (stderr, "SKIP: skipping %d packets\n", sockstat[0].this_nskip);
+#endif
+
+	  thissize= 0;
+	  for (int iskip= 0; iskip<sockstat[0].this_nskip+1; iskip++)
+	    {
+	      thissize= fread (buff2, 1, packlen, stdin);
+	      if (ferror (stdin))
+		perror ("reading from stdin in producer()");
+
+	      if (thissize==0)  /* treat as timeout */
+		{
+		  if (reorder)
+		    reorder_flush (0);
+		  signal_handler (-1);
+		  /*stopped= 2; */
+		}
+	    }
+	  sockstat[0].this_nskip= 0;
+
+	  /* here we already have read the packet (or thissize==0) */
+	  if (thissize)
+	    handle_packet (0, buff, thissize);
+	  continue;
+	}
+
+
+      /* read from socket */
+      if (stopped==2)
+	{
+#if  MYDEBUG
+	  pthread_mutex_lock (&mydebug_mutex);
+	  printf ("MYDEBUG producer(), line %d  stopped==2: "
+		  "closing sockets\n", __LINE__);
+	  pthread_mutex_unlock (&mydebug_mutex);
+#endif
+
+	      
+	  /* close all (our) sockets and return */
+	  assert (nsock!=1 || portnos[0]!=0);  /* not reading from stdin */
+	  for (i= rx->first; i<rx->first+rx->n; i++)
+	    {
+	      int  j;
+
+	      if (reorder)  /* if the consumer is still there */
+		reorder_flush (i);
+
+	      j= close (sock[i]);
+	      if (j)
+		{
+		  perror ("closing socket");
+		  producer_running= 0;
+		  exit (1);
+		}
+	    }
+	  /*return NULL;*/
+#if  MYDEBUG
+	  pthread_mutex_lock (&mydebug_mutex);
+	  printf ("MYDEBUG producer(), line %d  calling pthread_exit()\n",
+		  __LINE__);
+	  pthread_mutex_unlock (&mydebug_mutex);
+#endif
+	  /*exit (0);*/
+	  producer_running--;
+	  pthread_exit (NULL);
+	      
+	}
+	  
+	  
+      myallsocks= rx->socks;  /* we have to reset this every call */
+	  
+      i= pselect (rx->maxsock+1, &myallsocks, NULL, NULL,
+		  &timeout,
+		  NULL);
+      if (i==-1)
+	{
+	  perror ("pselect in producer()");
+	  producer_running= 0;
+	  exit (1);
+	}
+      if (i==0)  /* timeout */
+	{
+	  if (reorder)  /* our sockets are quiet */
+	    for (i= rx->first; i<rx->first+rx->n; i++)
+	      reorder_flush (i);
+	  if (rxthread_per_sock)
+	    rx_timeout ();
+	  else
+	    signal_handler (-1);
+	  continue;
+	}
+
+      for (i= rx->first; i<rx->first+rx->n; i++)
+	if (FD_ISSET (sock[i], &myallsocks))
+	  receive_socket (rx, i);
+    } /* while (1) */
+}
+
+
+
+void  init_thisfilestat ()
+{
+  int  j;
+
+  for (j= 0; j<nsock; j++)
+    {
+      sockstat[j].beamformed_first_packno= -1;
+      sockstat[j].bytes_written= sockstat[j].packs_seen= sockstat[j].packs_dropped= 
+	sockstat[j].beamformed_good_packs= 0;
+
+      sockstat[j].last_packs_dropped= sockstat[j].last_packs_expected= sockstat[j].last_packs_seen= 
+	sockstat[j].last_good_packs= 0;
+      sockstat[j].packs_filled= sockstat[j].packs_late= 0;
+      reset_rx_stats (j);
+
+    }
+
+  lasttotlen= 0;
+  reset_filllevel ();
+
+}
+
+
+#ifdef  HAVE_ZSTD
+
+ZSTD_CCtx  *zstd_cctx;
+char  *zstd_outbuff;
+size_t  zstd_outsize;
+
+/* seekable format (--zstd_frame): independent frames of zstd_frame
+   uncompressed bytes (whole packets), followed by a seek table in a
+   skippable frame (zstd contrib/seekable_format), so that parts of a file
+   can be decompressed without the rest, also in parallel */
+long  zstd_frame= 0;
+struct zstd_seektable {
+  uint32_t  *entries;  /* compressed and decompressed size of each frame */
+  long  n, alloc;
+  long  in;  /* uncompressed bytes in the current frame */
+  long  out;  /* compressed bytes of the file before it */
+};
+struct zstd_seektable  zstd_seek;  /* of the current file */
+
+#define  ZSTD_SEEKABLE_MAGIC  0x8F92EAB1
+#define  ZSTD_SEEKTABLE_MAGIC  0x184D2A5E  /* of the skippable frame */
+
+
+/* set the compression parameters from a string like the --zstd= option of
+   the zstd programme:  name=value,name=value,...  with K and M suffixes,
+   returns 0 if okay
+*/
+int  zstd_set_params (ZSTD_CCtx  *cctx, char  *params)
+{
+  struct {
+    char  *name, *alias;
+    ZSTD_cParameter  param;
+  } names[]= {
+    {"strategy",     "strat", ZSTD_c_strategy},
+    {"windowLog",    "wlog",  ZSTD_c_windowLog},
+    {"hashLog",      "hlog",  ZSTD_c_hashLog},
+    {"chainLog",     "clog",  ZSTD_c_chainLog},
+    {"searchLog",    "slog",  ZSTD_c_searchLog},
+    {"minMatch",     "slen",  ZSTD_c_minMatch},
+    {"targetLength", "tlen",  ZSTD_c_targetLength},
+    {"overlapLog",   "ovlog", ZSTD_c_overlapLog},
+    {"jobSize",      "block-size", ZSTD_c_jobSize},
+  };
+  char  buff[500], *p, *save, *eq, *end;
+  long  value;
+  int  k;
+  size_t  res;
+
+  strncpy (buff, params, sizeof (buff)-1);
+  buff[sizeof (buff)-1]= 0;
+  save= NULL;
+  for (p= strtok_r (buff, ",", &save); p; p= strtok_r (NULL, ",", &save))
+    {
+      eq= strchr (p, '=');
+      if (eq==NULL)
+	{
+	  fprintf (stderr, "zstd parameter without value: %s\n", p);
+	  return 1;
+	}
+      *eq= 0;
+      value= strtol (eq+1, &end, 10);
+      if (*end=='K')
+	value<<= 10, end++;
+      else if (*end=='M')
+	value<<= 20, end++;
+      if (eq[1]==0 || *end!=0)
+	{
+	  fprintf (stderr, "problem with value of zstd parameter %s\n", p);
+	  return 1;
+	}
+      for (k= 0; k<sizeof (names)/sizeof (names[0]); k++)
+	if (strcmp (p, names[k].name)==0 || strcmp (p, names[k].alias)==0)
+	  break;
+      if (k==sizeof (names)/sizeof (names[0]))
+	{
+	  fprintf (stderr, "unknown zstd parameter %s\n", p);
+	  return 1;
+	}
+      if (names[k].param==ZSTD_c_jobSize && zstd_workers==0)
+	continue;  /* only for multithreading */
+      res= ZSTD_CCtx_setParameter (cctx, names[k].param, value);
+      if (ZSTD_isError (res))
+	{
+	  fprintf (stderr, "zstd parameter %s=%ld: %s\n", p, value,
+		   ZSTD_getErrorName (res));
+	  return 1;
+	}
+    }
+  return 0;
+}
+
+
+/* a compression context with the parameters of the options */
+ZSTD_CCtx  *zstd_new_cctx ()
+{
+  ZSTD_CCtx  *cctx;
+  size_t  res;
+
+  cctx= ZSTD_createCCtx ();
+  if (cctx==NULL)
+    {
+      fprintf (stderr, "cannot create zstd compression context\n");
+      exit (1);
+    }
+
+  res= ZSTD_CCtx_setParameter (cctx, ZSTD_c_compressionLevel, zstd_level);
+  if (!ZSTD_isError (res))
+    /* as the zstd programme */
+    res= ZSTD_CCtx_setParameter (cctx, ZSTD_c_checksumFlag, 1);
+  if (!ZSTD_isError (res))
+    res= ZSTD_CCtx_setParameter (cctx, ZSTD_c_nbWorkers, zstd_workers);
+  if (ZSTD_isError (res))
+    {
+      fprintf (stderr, "setting zstd parameters: %s\n",
+	       ZSTD_getErrorName (res));
+      exit (1);
+    }
+  if (zstd_set_params (cctx, zstd_params))
+    exit (1);
+  return cctx;
+}
+
+
+/* create the compression context (parameters stay for all files) */
+void  zstd_init ()
+{
+  zstd_cctx= zstd_new_cctx ();
+  zstd_outsize= ZSTD_CStreamOutSize ();
+  zstd_outbuff= malloc (zstd_outsize);
+  if (zstd_outbuff==NULL)
+    {
+      fprintf (stderr, "cannot create zstd compression context\n");
+      exit (1);
+    }
+}
+
+
+/* compress data (or finish the frame for ZSTD_e_end) with cctx and write to
+   f, outbuff has zstd_outsize bytes, returns the compressed size written */
+long  zstd_stream (ZSTD_CCtx  *cctx, char  *outbuff, FILE  *f, char  *data,
+		   long  len, ZSTD_EndDirective  mode)
+{
+  ZSTD_inBuffer  in;
+  ZSTD_outBuffer  out;
+  size_t  remaining;
+  long  written= 0;
+  int  done;
+
+  in.src= data;
+  in.size= len;
+  in.pos= 0;
+  do
+    {
+      out.dst= outbuff;
+      out.size= zstd_outsize;
+      out.pos= 0;
+      remaining= ZSTD_compressStream2 (cctx, &out, &in, mode);
+      if (ZSTD_isError (remaining))
+	{
+	  fprintf (stderr, "zstd compression: %s\n",
+		   ZSTD_getErrorName (remaining));
+	  exit (1);
+	}
+      if (out.pos && fwrite (outbuff, 1, out.pos, f)!=out.pos)
+	{
+	  perror ("writing compressed file in zstd_stream()");
+	  exit (1);
+	}
+      written+= out.pos;
+      done= mode==ZSTD_e_end ? remaining==0 : in.pos==in.size;
+    }
+  while (!done);
+  return written;
+}
+
+
+/* a frame has ended, compressed is the size of the file so far */
+void  zstd_seek_add (struct zstd_seektable  *seek, long  compressed)
+{
+  if (seek->n==seek->alloc)
+    {
+      seek->alloc= seek->alloc ? 2*seek->alloc : 1024;
+      seek->entries= realloc (seek->entries,
+			      2*seek->alloc*sizeof (*seek->entries));
+      if (seek->entries==NULL)
+	{
+	  fprintf (stderr, "cannot allocate zstd seek table\n");
+	  exit (1);
+	}
+    }
+  seek->entries[2*seek->n]= compressed-seek->out;
+  seek->entries[2*seek->n+1]= seek->in;
+  seek->n++;
+  seek->in= 0;
+  seek->out= compressed;
+}
+
+
+/* write the seek table at the end of f and free it, returns its size */
+long  zstd_seek_write (struct zstd_seektable  *seek, FILE  *f)
+{
+  uint32_t  head[2];
+  struct __attribute__((__packed__))  {
+    uint32_t  nframes;
+    uint8_t  descriptor;  /* no checksums in the table */
+    uint32_t  magic;
+  }  foot;
+
+  head[0]= ZSTD_SEEKTABLE_MAGIC;
+  head[1]= seek->n*2*sizeof (uint32_t)+sizeof (foot);
+  foot.nframes= seek->n;
+  foot.descriptor= 0;
+  foot.magic= ZSTD_SEEKABLE_MAGIC;
+  if (fwrite (head, sizeof (head), 1, f)!=1 ||
+      fwrite (seek->entries, 2*sizeof (uint32_t), seek->n, f)!=seek->n ||
+      fwrite (&foot, sizeof (foot), 1, f)!=1)
+    {
+      perror ("writing zstd seek table");
+      exit (1);
+    }
+  free (seek->entries);
+  seek->entries= NULL;
+  return sizeof (head)+head[1];
+}
+
+
+/* compress data (or finish the frame for ZSTD_e_end) and write to outf,
+   with --zstd_frame a frame ends after every zstd_frame bytes */
+void  zstd_write (char  *data, long  len, ZSTD_EndDirective  mode)
+{
+  long  n;
+
+  overload_compress (zstd_cctx);
+  while (zstd_frame && mode==ZSTD_e_continue && zstd_seek.in+len>=zstd_frame)
+    {
+      n= zstd_frame-zstd_seek.in;
+      bytes_compressed_thisfile+= zstd_stream (zstd_cctx, zstd_outbuff, outf,
+					       data, n, ZSTD_e_end);
+      zstd_seek.in+= n;
+      zstd_seek_add (&zstd_seek, bytes_compressed_thisfile);
+      data+= n;
+      len-= n;
+    }
+  if (len==0 && mode==ZSTD_e_continue)
+    return;
+  bytes_compressed_thisfile+= zstd_stream (zstd_cctx, zstd_outbuff, outf,
+					   data, len, mode);
+  zstd_seek.in+= len;
+}
+
+#endif  /* HAVE_ZSTD */
+
+
+
+/* write data to the output file (compressed if built-in) */
+void  write_raw (char  *data, long  len)
+{
+  long  i;
+
+#ifdef  HAVE_ZSTD
+  if (zstd_builtin)
+    {
+      zstd_write (data, len, ZSTD_e_continue);
+      return;
+    }
+#endif
+
+  i= fwrite (data, 1, len, outf);
+  if (i!=len)
+    {
+      perror ("writing file in consumer()");
+      exit (1);
+    }
+}
+
+
+
+/* headers apart from the payloads (--sephead, --shuffle)
+
+   The headers hardly change from packet to packet, but interleaved with
+   the noisy data they cost zstd time and gain little. With --sephead the
+   output file has only the payloads, contiguous, and filename.hdr has the
+   headers that are not as predicted: the same as that of the previous
+   packet, num_slices samples later (timestamp and sequence as in
+   beamformed_packno()). These exceptions are the first packet of each file
+   and those after a gap or with other changes, normally once per second.
+   With --shuffle each payload is stored in byte planes (the first byte of
+   every sample XrXiYrYi, then the second, ..., 8 planes with 16 bits, 4
+   with 8 bits, 2 with 4 bits), which compresses better.
+   filename.hdr is a struct sephead_header followed by struct
+   sephead_exception, all little endian (native). read_bfssephead() and
+   bfssephead_packets() in bfs_data.py rebuild the original packets, the
+   offsets of --index are those of the original packets.
+*/
+struct __attribute__((__packed__))  sephead_header
+{
+  char  magic[4];  /* "BFHD" */
+  int32_t  version;  /* 1 */
+  int32_t  reclen;  /* bytes per original packet (with header) */
+  int32_t  shuffle;  /* payloads in byte planes */
+};
+
+struct __attribute__((__packed__))  sephead_exception
+{
+  int64_t  packet;  /* in this file, from 0 */
+  struct header_lofar  header;
+};
+
+int  sephead= 0, sephead_shuffle= 0;
+FILE  *sephead_f;  /* NULL if no .hdr for this file */
+struct header_lofar  sephead_next;  /* predicted header of the next packet */
+long  sephead_npacks;  /* packets in this file */
+char  *sephead_buff;  /* payloads of one write */
+
+
+/* the header of the packet num_slices samples after that in h */
+void  sephead_predict (struct header_lofar  *h)
+{
+  long  block;
+
+  block= lofar_block (h)+h->num_slices;
+  while (lofar_second_block (h->timestamp+1l, h->source.is200mhz)<=block)
+    h->timestamp++;
+  h->sequence= block-lofar_second_block (h->timestamp, h->source.is200mhz);
+}
+
+
+/* payload of len bytes from in to out, in byte planes of the samples */
+void  sephead_shuffle_payload (char  *out, char  *in, long  len,
+			       struct header_lofar  *h)
+{
+  long  stride, n, i, k;
+
+  stride= (16>>h->source.bm)/2;  /* bytes per sample XrXiYrYi */
+  n= len/stride;
+  for (k= 0; k<stride; k++)
+    for (i= 0; i<n; i++)
+      out[k*n+i]= in[i*stride+k];
+  memcpy (out+n*stride, in+n*stride, len-n*stride);  /* if not whole */
+}
+
+
+void  sephead_open ()
+{
+  char  name[sizeof (thisfilename)+10];
+  struct sephead_header  head;
+
+  sephead_npacks= 0;
+  sephead_f= NULL;
+  if (!sephead || !dowrite || strcmp (thisfilename, "/dev/null")==0)
+    return;
+  snprintf (name, sizeof (name), "%s.hdr", thisfilename);
+  sephead_f= fopen (name, "w");
+  if (sephead_f==NULL)
+    {
+      perror ("opening header file");
+      exit (1);
+    }
+  memcpy (head.magic, "BFHD", 4);
+  head.version= 1;
+  head.reclen= outlen;
+  head.shuffle= sephead_shuffle;
+  if (fwrite (&head, sizeof (head), 1, sephead_f)!=1)
+    {
+      perror ("writing header file");
+      exit (1);
+    }
+}
+
+
+void  sephead_close ()
+{
+  if (sephead_f==NULL)
+    return;
+  if (fclose (sephead_f))
+    {
+      perror ("closing header file");
+      exit (1);
+    }
+  sephead_f= NULL;
+}
+
+
+/* len bytes of whole packets: exceptional headers to .hdr and the payloads
+   to the output file */
+void  sephead_write (char  *data, long  len)
+{
+  struct sephead_exception  ex;
+  struct header_lofar  *header;
+  long  paylen= outlen-sizeof (*header), k;
+  char  *out;
+
+  assert (len%outlen==0 && len<=maxwrite);
+  if (sephead_buff==NULL && (sephead_buff= malloc (maxwrite))==NULL)
+    {
+      fprintf (stderr, "cannot allocate the buffer for --sephead\n");
+      exit (1);
+    }
+  out= sephead_buff;
+  for (k= 0; k<len; k+= outlen)
+    {
+      header= (struct header_lofar*)(data+k);
+      if (sephead_f && (sephead_npacks==0 ||
+			memcmp (header, &sephead_next, sizeof (*header))))
+	{
+	  ex.packet= sephead_npacks;
+	  ex.header= *header;
+	  if (fwrite (&ex, sizeof (ex), 1, sephead_f)!=1)
+	    {
+	      perror ("writing header file");
+	      exit (1);
+	    }
+	}
+      sephead_next= *header;
+      sephead_predict (&sephead_next);
+      if (sephead_shuffle)
+	sephead_shuffle_payload (out, (char*)(header+1), paylen, header);
+      else
+	memcpy (out, header+1, paylen);
+      out+= paylen;
+      sephead_npacks++;
+    }
+  write_raw (sephead_buff, out-sephead_buff);
+}
+
+
+/* write whole packets to the output file (see write_raw()) */
+void  write_output (char  *data, long  len)
+{
+  if (sephead)
+    sephead_write (data, len);
+  else
+    write_raw (data, len);
+}
+
+
+
+/* packet index next to each output file (--index): filename plus .idx
+
+   The index is built from the data as they are written, so that offsets are
+   exact (uncompressed, also for split files and --direct). It is a header
+   followed by entries, each for a run of packets with consecutive packet
+   numbers (see beamformed_packno()) and the same size, contiguous in the
+   file, or for a gap of missing packets between two runs (where the next
+   run starts). All numbers are little endian (native).
+   Packets of several ports interleave in the file, then the runs are short:
+   meant for one port per file.
+   Positions are counted through all files, as the data leave the ring. A
+   packet that is cut by a split (without --len) is in neither index.
+   With --stripe the file is in pieces in several files: a chunk entry for
+   each piece, in the order of the file (offset), with its position in the
+   file of its stripe (packno), its bytes (npacks) and the stripe (reclen).
+*/
+#define INDEX_RUN 0
+#define INDEX_GAP 1
+#define INDEX_CHUNK 2
+
+struct __attribute__((__packed__))  index_header
+{
+  char  magic[4];  /* "BFIX" */
+  int32_t  version;  /* 2 since frame_size was added (1: the header ended
+			after sizehead, 16 bytes) */
+  int32_t  clock_mhz;  /* 160 or 200, from the first packet */
+  int32_t  sizehead;  /* records have a size header (--sizehead) */
+  int32_t  frame_size;  /* zstd frames of this many bytes, 0 if not seekable
+			   (--zstd_frame), see the seek table in the file */
+};
+
+struct __attribute__((__packed__))  index_entry
+{
+  int64_t  offset;  /* file position of the first packet (or next run) */
+  int64_t  packno;  /* first packet number (of the run or missing) */
+  int64_t  npacks;  /* packets in the run or missing */
+  int32_t  type;  /* INDEX_RUN, INDEX_GAP or INDEX_CHUNK */
+  int32_t  reclen;  /* bytes per packet in the file (incl. size header) */
+};
+
+int  do_index= 0;
+FILE  *indexf;  /* NULL if no index for this file */
+struct index_header  index_head;
+struct index_entry  index_run;  /* current run, npacks==0 if none yet */
+long  index_filepos;  /* bytes seen so far (all files) */
+long  index_next;  /* position of the next packet */
+long  index_base;  /* position of the start of this file */
+long  index_lastlen;  /* size of the packet before index_next */
+char  index_carry[2+sizeof (struct header_lofar)];  /* header split */
+int  index_ncarry;  /*  between two writes */
+
+
+void  index_put (struct index_entry  *entry)
+{
+  if (index_head.magic[0]==0)  /* header first, clock is known now */
+    {
+      memcpy (index_head.magic, "BFIX", 4);
+      index_head.version= 2;
+      if (fwrite (&index_head, sizeof (index_head), 1, indexf)!=1)
+	{
+	  perror ("writing index file header");
+	  exit (1);
+	}
+    }
+  if (fwrite (entry, sizeof (*entry), 1, indexf)!=1)
+    {
+      perror ("writing index file");
+      exit (1);
+    }
+}
+
+
+/* one packet (record with size header if --sizehead) at index_next */
+void  index_packet (char  *rec)
+{
+  struct header_lofar  *header;
+  long  packno, reclen;
+
+  if (do_blocklen)
+    {
+      reclen= *(uint16_t*)rec+2;
+      header= (struct header_lofar*)(rec+2);
+    }
+  else
+    {
+      reclen= outlen;
+      header= (struct header_lofar*)rec;
+    }
+  packno= beamformed_packno (header);
+  index_lastlen= reclen;
+  if (index_next<index_base)  /* started in the previous file */
+    {
+      index_next+= reclen;
+      return;
+    }
+
+  if (index_run.npacks==0)
+    index_head.clock_mhz= 160+40*header->source.is200mhz;
+  if (index_run.npacks && packno==index_run.packno+index_run.npacks &&
+      reclen==index_run.reclen)
+    index_run.npacks++;
+  else
+    {
+      if (index_run.npacks)
+	{
+	  struct index_entry  gap;
+
+	  index_put (&index_run);
+	  if (packno>index_run.packno+index_run.npacks)  /* not if back */
+	    {
+	      gap.offset= index_next-index_base;
+	      gap.packno= index_run.packno+index_run.npacks;
+	      gap.npacks= packno-gap.packno;
+	      gap.type= INDEX_GAP;
+	      gap.reclen= 0;
+	      index_put (&gap);
+	    }
+	}
+      index_run.offset= index_next-index_base;
+      index_run.packno= packno;
+      index_run.npacks= 1;
+      index_run.type= INDEX_RUN;
+      index_run.reclen= reclen;
+    }
+  index_next+= reclen;
+}
+
+
+/* with --stripe: the len bytes just given to index_data() went to stripe,
+   at offset in its file */
+void  index_chunk (int  stripe, long  offset, long  len)
+{
+  struct index_entry  chunk;
+
+  if (indexf==NULL)
+    return;
+  chunk.offset= index_filepos-len-index_base;
+  chunk.packno= offset;
+  chunk.npacks= len;
+  chunk.type= INDEX_CHUNK;
+  chunk.reclen= stripe;
+  index_put (&chunk);
+}
+
+
+/* the next len bytes of the file, at poi (in any pieces) */
+void  index_data (char  *poi, long  len)
+{
+  long  end, k, n;
+  int  hl;
+
+  if (indexf==NULL)
+    return;
+  end= index_filepos+len;
+  hl= (do_blocklen ? 2 : 0)+sizeof (struct header_lofar);
+  while (1)
+    {
+      if (index_ncarry==0 && index_next+hl<=end)
+	{
+	  assert (index_next>=index_filepos);
+	  index_packet (poi+index_next-index_filepos);
+	  continue;
+	}
+      if (index_next+index_ncarry>=end)
+	break;
+      /* header continues in the next piece: collect it */
+      k= index_next+index_ncarry-index_filepos;
+      n= hl-index_ncarry;
+      if (n>end-index_next-index_ncarry)
+	n= end-index_next-index_ncarry;
+      memcpy (index_carry+index_ncarry, poi+k, n);
+      index_ncarry+= n;
+      if (index_ncarry<hl)
+	break;
+      index_ncarry= 0;
+      index_packet (index_carry);
+    }
+  index_filepos= end;
+}
+
+
+void  index_open ()
+{
+  char  name[sizeof (thisfilename)+10];
+
+  indexf= NULL;
+  if (!do_index || !dowrite || strcmp (thisfilename, "/dev/null")==0)
+    return;
+  snprintf (name, sizeof (name), "%s.idx", thisfilename);
+  indexf= fopen (name, "w");
+  if (indexf==NULL)
+    {
+      perror ("opening index file");
+      exit (1);
+    }
+  memset (&index_head, 0, sizeof (index_head));
+  index_head.sizehead= do_blocklen;
+#ifdef  HAVE_ZSTD
+  index_head.frame_size= zstd_builtin ? zstd_frame : 0;
+#endif
+  index_run.npacks= 0;
+  index_base= index_filepos;
+}
+
+
+void  index_close ()
+{
+  if (indexf==NULL)
+    return;
+  if (index_next>index_filepos && index_next-index_lastlen>=index_base)
+    index_run.npacks--;  /* the last packet continues in the next file */
+  if (index_run.npacks)
+    index_put (&index_run);
+  if (fclose (indexf))
+    {
+      perror ("closing index file");
+      exit (1);
+    }
+  indexf= NULL;
+}
+
+
+
+/* online Stokes parameters (--stokes, --stokes_int, --stokes_mode)
+
+   The consumer integrates the packets as they leave the ring buffer (also
+   with --nowrite): per lane (source.rsp_id) and beamlet XX, YY and XY (X
+   times conjugate Y) over --stokes_int seconds, rounded down to whole
+   packets. An integration of a lane is written when the first packet of a
+   later one arrives (packets for an integration already written are
+   ignored), the last ones at the end, after a timeout and when the
+   recording is stopped. Packets with errors (and filled ones, --reorder)
+   are not counted.
+   The file is a header followed by records, each a stokes_record and
+   nbeamlets x 4 floats: I Q U V (iquv, V= 2 Im (conj (X) Y)) or XX YY
+   Re (XY) Im (XY) (xxyy), means per time sample. Each record is flushed,
+   so that the file can be followed while recording. All numbers are
+   little endian (native).
+*/
+#define  STOKES_IQUV  0
+#define  STOKES_XXYY  1
+#define  STOKES_LANES  32
+
+struct __attribute__((__packed__))  stokes_header
+{
+  char  magic[4];  /* "BFST" */
+  int32_t  version;  /* 1 */
+  int32_t  mode;  /* STOKES_IQUV or STOKES_XXYY */
+  int32_t  clock_mhz;  /* 160 or 200, from the first packet */
+  int32_t  nint;  /* packets per integration */
+  double  int_time;  /* seconds per integration */
+};
+
+struct __attribute__((__packed__))  stokes_record
+{
+  double  time;  /* start of the integration, seconds since 1970 */
+  int16_t  lane;  /* source.rsp_id */
+  int16_t  nbeamlets;
+  int32_t  npacks;  /* packets integrated */
+};
+
+struct stokes_acc {
+  long  index;  /* integration number, -1 if none */
+  int  nbeamlets;
+  long  npacks;
+  double  sum[MAXBEAMLETS][4];  /* XX YY Re (XY) Im (XY) */
+};
+
+char  stokes_filename[500];
+FILE  *stokesf;  /* NULL if no --stokes */
+double  stokes_int= 1.0;
+int  stokes_mode= STOKES_IQUV;
+struct stokes_header  stokes_head;
+struct stokes_acc  stokes_acc[STOKES_LANES];
+long  stokes_late, stokes_bad;  /* packets ignored */
+char  stokes_carry[MMAXLEN+2];  /* record split */
+int  stokes_ncarry;  /* between two pieces */
+
+
+/* XX, YY, Re (XY), Im (XY) summed over the slices of one beamlet */
+void  stokes_beamlet (char  *p, int  bits, float  *res)
+{
+  int  k, v[4];
+  float  xx= 0, yy= 0, re= 0, im= 0;
+
+#if defined (__x86_64__) && defined (__SSE2__)
+  if (bits!=4)
+    {
+      __m128i  w;
+      __m128  f, sq, xy, xyi;
+      float  a[4], b[4], c[4];
+      int32_t  x;
+
+      sq= xy= xyi= _mm_setzero_ps ();
+      for (k= 0; k<LOFAR_SLICES; k++)
+	{
+	  if (bits==16)
+	    {
+	      w= _mm_loadl_epi64 ((__m128i*)(p+8*k));
+	      w= _mm_srai_epi32 (_mm_unpacklo_epi16 (w, w), 16);
+	    }
+	  else
+	    {
+	      memcpy (&x, p+4*k, 4);
+	      w= _mm_cvtsi32_si128 (x);
+	      w= _mm_unpacklo_epi8 (w, w);
+	      w= _mm_srai_epi32 (_mm_unpacklo_epi16 (w, w), 24);
+	    }
+	  f= _mm_cvtepi32_ps (w);  /* Xr Xi Yr Yi */
+	  sq= _mm_add_ps (sq, _mm_mul_ps (f, f));
+	  /* times Yr Yi Xr Xi and Yi Yr Xi Xr */
+	  xy= _mm_add_ps (xy, _mm_mul_ps (f, _mm_shuffle_ps (f, f,
+	     _MM_SHUFFLE (1, 0, 3, 2))));
+	  xyi= _mm_add_ps (xyi, _mm_mul_ps (f, _mm_shuffle_ps (f, f,
+	     _MM_SHUFFLE (0, 1, 2, 3))));
+	}
+      _mm_storeu_ps (a, sq);
+      _mm_storeu_ps (b, xy);
+      _mm_storeu_ps (c, xyi);
+      res[0]= a[0]+a[1];
+      res[1]= a[2]+a[3];
+      res[2]= b[0]+b[1];
+      res[3]= c[1]-c[0];
+      return;
+    }
+#endif
+#if defined (__ARM_NEON) && defined (__aarch64__)
+  if (bits!=4)
+    {
+      float32x4_t  f, g, sq, xy, xyi;
+      int32_t  x;
+
+      sq= xy= xyi= vdupq_n_f32 (0);
+      for (k= 0; k<LOFAR_SLICES; k++)
+	{
+	  if (bits==16)
+	    f= vcvtq_f32_s32 (vmovl_s16 (vld1_s16 ((int16_t*)(p+8*k))));
+	  else
+	    {
+	      memcpy (&x, p+4*k, 4);
+	      f= vcvtq_f32_s32 (vmovl_s16 (vget_low_s16 (vmovl_s8 (
+		 vreinterpret_s8_s32 (vdup_n_s32 (x))))));
+	    }
+	  g= vextq_f32 (f, f, 2);  /* Yr Yi Xr Xi */
+	  sq= vmlaq_f32 (sq, f, f);
+	  xy= vmlaq_f32 (xy, f, g);
+	  xyi= vmlaq_f32 (xyi, f, vrev64q_f32 (g));
+	}
+      res[0]= vgetq_lane_f32 (sq, 0)+vgetq_lane_f32 (sq, 1);
+      res[1]= vgetq_lane_f32 (sq, 2)+vgetq_lane_f32 (sq, 3);
+      res[2]= vgetq_lane_f32 (xy, 0)+vgetq_lane_f32 (xy, 1);
+      res[3]= vgetq_lane_f32 (xyi, 1)-vgetq_lane_f32 (xyi, 0);
+      return;
+    }
+#endif
+  for (k= 0; k<LOFAR_SLICES; k++)
+    {
+      int16_t  s[4];
+
+      if (bits==16)
+	{
+	  memcpy (s, p+8*k, 8);
+	  v[0]= s[0];  v[1]= s[1];  v[2]= s[2];  v[3]= s[3];
+	}
+      else if (bits==8)
+	{
+	  v[0]= (int8_t)p[4*k];  v[1]= (int8_t)p[4*k+1];
+	  v[2]= (int8_t)p[4*k+2];  v[3]= (int8_t)p[4*k+3];
+	}
+      else  /* low nibble real part */
+	{
+	  v[0]= (int8_t)(p[2*k]<<4)>>4;  v[1]= (int8_t)p[2*k]>>4;
+	  v[2]= (int8_t)(p[2*k+1]<<4)>>4;  v[3]= (int8_t)p[2*k+1]>>4;
+	}
+      xx+= v[0]*v[0]+v[1]*v[1];
+      yy+= v[2]*v[2]+v[3]*v[3];
+      re+= v[0]*v[2]+v[1]*v[3];
+      im+= v[1]*v[2]-v[0]*v[3];
+    }
+  res[0]= xx;
+  res[1]= yy;
+  res[2]= re;
+  res[3]= im;
+}
+
+
+/* write the integration of a lane (if any) */
+void  stokes_flush_lane (int  lane)
+{
+  struct stokes_acc  *acc;
+  struct stokes_record  rec;
+  float  out[MAXBEAMLETS][4];
+  double  n, *s;
+  int  b;
+
+  acc= &stokes_acc[lane];
+  if (acc->index<0 || acc->npacks==0)
+    return;
+  if (stokes_head.magic[0]==0)  /* header first, clock is known now */
+    {
+      memcpy (stokes_head.magic, "BFST", 4);
+      stokes_head.version= 1;
+      if (fwrite (&stokes_head, sizeof (stokes_head), 1, stokesf)!=1)
+	{
+	  perror ("writing stokes file header");
+	  exit (1);
+	}
+    }
+  rec.time= acc->index*stokes_head.int_time;
+  rec.lane= lane;
+  rec.nbeamlets= acc->nbeamlets;
+  rec.npacks= acc->npacks;
+  n= acc->npacks*(double)LOFAR_SLICES;
+  for (b= 0; b<acc->nbeamlets; b++)
+    {
+      s= acc->sum[b];
+      if (stokes_mode==STOKES_IQUV)
+	{
+	  out[b][0]= (s[0]+s[1])/n;
+	  out[b][1]= (s[0]-s[1])/n;
+	  out[b][2]= 2*s[2]/n;
+	  out[b][3]= -2*s[3]/n;
+	}
+      else
+	{
+	  out[b][0]= s[0]/n;
+	  out[b][1]= s[1]/n;
+	  out[b][2]= s[2]/n;
+	  out[b][3]= s[3]/n;
+	}
+    }
+  if (fwrite (&rec, sizeof (rec), 1, stokesf)!=1 ||
+      fwrite (out, 4*sizeof (float), acc->nbeamlets, stokesf)!=
+      (size_t) acc->nbeamlets || fflush (stokesf))
+    {
+      perror ("writing stokes file");
+      exit (1);
+    }
+  acc->npacks= 0;
+}
+
+
+/* one packet (record with size header if --sizehead) */
+void  stokes_packet (char  *rec, long  reclen)
+{
+  struct header_lofar  *header;
+  struct stokes_acc  *acc;
+  long  index;
+  int  bits, b, nb;
+  float  res[4];
+  char  *p;
+
+  if (do_blocklen)
+    {
+      rec+= 2;
+      reclen-= 2;
+    }
+  header= (struct header_lofar*)rec;
+  if (!beamformed_checkpack (header))
+    return;
+  bits= header->source.bm==0 ? 16 : header->source.bm==1 ? 8 : 4;
+  nb= header->num_beamlets;
+  if (header->source.bm==3 || nb>MAXBEAMLETS ||
+      (long) sizeof (*header)+nb*LOFAR_SLICES*bits/2!=reclen)
+    {
+      stokes_bad++;
+      return;
+    }
+  if (stokes_head.nint==0)  /* first packet */
+    {
+      stokes_head.clock_mhz= 160+40*header->source.is200mhz;
+      stokes_head.nint= stokes_int*stokes_head.clock_mhz*1e6/
+	(1024*LOFAR_SLICES);
+      if (stokes_head.nint<1)
+	stokes_head.nint= 1;
+      stokes_head.int_time= stokes_head.nint*1024.*LOFAR_SLICES/
+	(stokes_head.clock_mhz*1e6);
+    }
+  index= beamformed_packno (header)/stokes_head.nint;
+  acc= &stokes_acc[header->source.rsp_id];
+  if (index<acc->index)
+    {
+      stokes_late++;
+      return;
+    }
+  if (index>acc->index || nb!=acc->nbeamlets)
+    {
+      stokes_flush_lane (header->source.rsp_id);
+      acc->index= index;
+      acc->nbeamlets= nb;
+      memset (acc->sum, 0, sizeof (acc->sum[0])*nb);
+    }
+  p= rec+sizeof (*header);
+  for (b= 0; b<nb; b++, p+= LOFAR_SLICES*bits/2)
+    {
+      stokes_beamlet (p, bits, res);
+      acc->sum[b][0]+= res[0];
+      acc->sum[b][1]+= res[1];
+      acc->sum[b][2]+= res[2];
+      acc->sum[b][3]+= res[3];
+    }
+  acc->npacks++;
+}
+
+
+/* length of the record at p, 0 if not known from the n bytes there */
+long  stokes_reclen (char  *p, long  n)
+{
+  if (!do_blocklen)
+    return outlen;
+  if (n<2)
+    return 0;
+  return *(uint16_t*)p+2;
+}
+
+
+/* the next len bytes leaving the ring buffer, at poi (in any pieces) */
+void  stokes_data (char  *poi, long  len)
+{
+  long  n, need;
+
+  if (stokesf==NULL)
+    return;
+  while (len>0)
+    {
+      if (stokes_ncarry==0)
+	{
+	  n= stokes_reclen (poi, len);
+	  if (n && n<=len)
+	    {
+	      stokes_packet (poi, n);
+	      poi+= n;
+	      len-= n;
+	      continue;
+	    }
+	}
+      /* record continues in the next piece: collect it */
+      need= stokes_reclen (stokes_carry, stokes_ncarry);
+      if (need==0)
+	need= 2;
+      n= need-stokes_ncarry;
+      if (n>len)
+	n= len;
+      memcpy (stokes_carry+stokes_ncarry, poi, n);
+      stokes_ncarry+= n;
+      poi+= n;
+      len-= n;
+      if (stokes_ncarry==stokes_reclen (stokes_carry, stokes_ncarry))
+	{
+	  stokes_packet (stokes_carry, stokes_ncarry);
+	  stokes_ncarry= 0;
+	}
+    }
+}
+
+
+/* write all integrations (end of the stream) */
+void  stokes_flush ()
+{
+  int  i;
+
+  if (stokesf==NULL)
+    return;
+  for (i= 0; i<STOKES_LANES; i++)
+    stokes_flush_lane (i);
+}
+
+
+void  stokes_open ()
+{
+  int  i;
+
+  if (stokes_filename[0]==0)
+    return;
+  stokesf= fopen (stokes_filename, "w");
+  if (stokesf==NULL)
+    {
+      perror ("opening stokes file");
+      exit (1);
+    }
+  memset (&stokes_head, 0, sizeof (stokes_head));
+  stokes_head.mode= stokes_mode;
+  for (i= 0; i<STOKES_LANES; i++)
+    stokes_acc[i].index= -1;
+}
+
+
+void  stokes_close ()
+{
+  if (stokesf==NULL)
+    return;
+  stokes_flush ();
+  if (stokes_late || stokes_bad)
+    printf ("stokes: ignored %ld late and %ld unknown packets\n",
+	    stokes_late, stokes_bad);
+  if (fclose (stokesf))
+    {
+      perror ("closing stokes file");
+      exit (1);
+    }
+  stokesf= NULL;
+}
+
+
+
+/* writing with O_DIRECT (--direct): the page cache is bypassed, blocks
+   that are multiples of direct_align are written straight from the ring
+   buffer through io_uring (or pwrite() if not available), with up to
+   direct_depth writes in flight. The front of the ring buffer is only
+   advanced when the writes have completed (in order).
+
+   If the data of a file do not start at an aligned address in the ring
+   (after a file was closed at an odd position), the file is written from
+   copies in bounce buffers (direct_copy). The last bytes of a file are
+   written padded from a bounce buffer, then the file is truncated to the
+   correct size. With --Maxfilesize and --len, files are split where the
+   ring position is aligned and at a packet boundary, if that is not too
+   far (split_lcm), so that the next file starts aligned again.
+*/
+int  direct= 0, direct_depth= 4;
+long  direct_align, direct_offset, direct_inflight, direct_bouncesize,
+  split_lcm;
+int  direct_copy;
+
+struct dwrite {
+  long  len;
+  int  done;
+  char  *bounce;  /* direct_bouncesize, aligned */
+} *dwrites;
+int  dw_head, dw_count;  /* FIFO of writes in flight */
+
+/* io_uring, set up with system calls (no liburing needed) */
+int  uring_fd= -1;
+unsigned  *sq_tail, *sq_mask, *sq_array, *cq_head, *cq_tail, *cq_mask;
+struct io_uring_sqe  *sqes;
+struct io_uring_cqe  *cqes;
+
+
+
+void  uring_init ()
+{
+  struct io_uring_params  p;
+  char  *sq, *cq;
+  long  sqsize, cqsize;
+  int  fd;
+
+  memset (&p, 0, sizeof (p));
+  fd= syscall (__NR_io_uring_setup, direct_depth, &p);
+  if (fd<0)
+    {
+      perror ("io_uring_setup(), writing with pwrite() instead");
+      return;
+    }
+
+  sqsize= p.sq_off.array+p.sq_entries*sizeof (unsigned);
+  cqsize= p.cq_off.cqes+p.cq_entries*sizeof (struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+      if (cqsize>sqsize)
+	sqsize= cqsize;
+      cqsize= sqsize;
+    }
+  sq= mmap (NULL, sqsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	    fd, IORING_OFF_SQ_RING);
+  if (sq==MAP_FAILED)
+    {
+      perror ("mmap() of io_uring submission queue");
+      exit (1);
+    }
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    cq= sq;
+  else
+    {
+      cq= mmap (NULL, cqsize, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+      if (cq==MAP_FAILED)
+	{
+	  perror ("mmap() of io_uring completion queue");
+	  exit (1);
+	}
+    }
+  sqes= mmap (NULL, p.sq_entries*sizeof (struct io_uring_sqe),
+	      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	      fd, IORING_OFF_SQES);
+  if (sqes==MAP_FAILED)
+    {
+      perror ("mmap() of io_uring submission entries");
+      exit (1);
+    }
+
+  sq_tail= (unsigned*)(sq+p.sq_off.tail);
+  sq_mask= (unsigned*)(sq+p.sq_off.ring_mask);
+  sq_array= (unsigned*)(sq+p.sq_off.array);
+  cq_head= (unsigned*)(cq+p.cq_off.head);
+  cq_tail= (unsigned*)(cq+p.cq_off.tail);
+  cq_mask= (unsigned*)(cq+p.cq_off.ring_mask);
+  cqes= (struct io_uring_cqe*)(cq+p.cq_off.cqes);
+  uring_fd= fd;
+}
+
+
+
+void  direct_init ()
+{
+  int  k;
+
+  dwrites= calloc (direct_depth, sizeof (struct dwrite));
+  if (dwrites==NULL)
+    {
+      perror ("allocating dwrites in direct_init()");
+      exit (1);
+    }
+  dw_head= dw_count= 0;
+  direct_inflight= 0;
+  direct_align= 4096;  /* until the first file is open */
+  direct_bouncesize= 0;
+  for (k= 0; k<direct_depth; k++)
+    dwrites[k].bounce= NULL;
+  uring_init ();
+}
+
+
+
+/* the O_DIRECT file outf has just been opened */
+void  direct_open ()
+{
+  long  wanted, ringlen;
+  int  k;
+
+  direct_align= 4096;  /* if we do not know better */
+#ifdef  STATX_DIOALIGN
+  {
+    struct statx  st;
+
+    if (statx (fileno (outf), "", AT_EMPTY_PATH, STATX_DIOALIGN, &st)==0 &&
+	(st.stx_mask & STATX_DIOALIGN) && st.stx_dio_offset_align)
+      {
+	direct_align= st.stx_dio_offset_align;
+	if (st.stx_dio_mem_align>direct_align)
+	  direct_align= st.stx_dio_mem_align;
+      }
+  }
+#endif
+  direct_offset= 0;
+  assert (dw_count==0 && direct_inflight==0);
+  direct_copy= ringbuffer.totsize%direct_align ||
+    (uintptr_t)vrb_poi_old (&ringbuffer)%direct_align;
+  if (direct_copy && verbose)
+    printf ("data not aligned in ring buffer, writing from copies\n");
+
+  /* bounce buffers, also for the last bytes of a file */
+  wanted= maxwrite>MMAXLEN+2 ? maxwrite : MMAXLEN+2;
+  wanted= (wanted+direct_align-1)/direct_align*direct_align;
+  if (wanted>direct_bouncesize)
+    {
+      for (k= 0; k<direct_depth; k++)
+	{
+	  free (dwrites[k].bounce);
+	  if (posix_memalign ((void**)&dwrites[k].bounce, direct_align,
+			      wanted))
+	    {
+	      fprintf (stderr, "cannot allocate bounce buffers\n");
+	      exit (1);
+	    }
+	}
+      direct_bouncesize= wanted;
+    }
+
+  /* split points, see above */
+  split_lcm= 0;
+  ringlen= outlen+(do_blocklen ? 2 : 0);
+  if (packlen && maxfilesize>0)
+    {
+      long  a, b, t;
+
+      for (a= ringlen, b= direct_align; b; t= a%b, a= b, b= t)
+	;  /* gcd in a */
+      if (ringlen/a*direct_align<=64*1024*1024)
+	split_lcm= ringlen/a*direct_align;
+    }
+}
+
+
+
+/* ring position (total bytes) of the next data to be submitted */
+long  direct_pos ()
+{
+  return atomic_load_explicit (&ringbuffer.removed, memory_order_relaxed)+
+    direct_inflight;
+}
+
+
+/* pass completed writes, wait for at least one if wait
+   the front of the ring advances for the oldest completed ones */
+void  direct_reap (int  wait)
+{
+  struct io_uring_cqe  *cqe;
+  unsigned  head;
+  int  slot;
+
+  if (uring_fd>=0 && dw_count)
+    {
+      while (1)
+	{
+	  head= *cq_head;
+	  if (head!=__atomic_load_n (cq_tail, __ATOMIC_ACQUIRE))
+	    break;
+	  if (!wait)
+	    break;
+	  if (syscall (__NR_io_uring_enter, uring_fd, 0, 1,
+		       IORING_ENTER_GETEVENTS, NULL, 0)<0 && errno!=EINTR)
+	    {
+	      perror ("io_uring_enter() waiting");
+	      exit (1);
+	    }
+	}
+      while (head!=__atomic_load_n (cq_tail, __ATOMIC_ACQUIRE))
+	{
+	  cqe= &cqes[head & *cq_mask];
+	  slot= cqe->user_data;
+	  if (cqe->res!=dwrites[slot].len)  /* incl. short write */
+	    {
+	      errno= cqe->res<0 ? -cqe->res : EIO;
+	      perror ("writing file (io_uring) in consumer()");
+	      exit (1);
+	    }
+	  dwrites[slot].done= 1;
+	  head++;
+	}
+      __atomic_store_n (cq_head, head, __ATOMIC_RELEASE);
+    }
+
+  while (dw_count && dwrites[dw_head].done)
+    {
+      /* this also wakes the producer if it is waiting (stdin) */
+      vrb_advance_old (&ringbuffer, dwrites[dw_head].len);
+      rx_latency (&ringbuffer);
+      direct_inflight-= dwrites[dw_head].len;
+      dw_head= (dw_head+1)%direct_depth;
+      dw_count--;
+    }
+}
+
+
+/* write len bytes (multiple of direct_align) from the ring buffer at poi */
+void  direct_write (char  *poi, long  len)
+{
+  struct dwrite  *dw;
+  struct io_uring_sqe  *sqe;
+  unsigned  tail;
+  int  slot;
+  char  *src;
+
+  while (dw_count==direct_depth)
+    direct_reap (1);
+
+  slot= (dw_head+dw_count)%direct_depth;
+  dw= &dwrites[slot];
+  dw->len= len;
+  dw->done= 0;
+  index_data (poi, len);
+  stokes_data (poi, len);
+  src= poi;
+  if (direct_copy)
+    {
+      assert (len<=direct_bouncesize);
+      memcpy (dw->bounce, poi, len);
+      src= dw->bounce;
+    }
+  dw_count++;
+  direct_inflight+= len;
+
+  if (uring_fd<0)
+    {
+      if (pwrite (fileno (outf), src, len, direct_offset)!=len)
+	{
+	  perror ("writing file (pwrite) in consumer()");
+	  exit (1);
+	}
+      dw->done= 1;
+    }
+  else
+    {
+      tail= *sq_tail;
+      sqe= &sqes[tail & *sq_mask];
+      memset (sqe, 0, sizeof (*sqe));
+      sqe->opcode= IORING_OP_WRITE;
+      sqe->fd= fileno (outf);
+      sqe->addr= (uintptr_t)src;
+      sqe->len= len;
+      sqe->off= direct_offset;
+      sqe->user_data= slot;
+      sq_array[tail & *sq_mask]= tail & *sq_mask;
+      __atomic_store_n (sq_tail, tail+1, __ATOMIC_RELEASE);
+      if (syscall (__NR_io_uring_enter, uring_fd, 1, 0, 0, NULL, 0)!=1)
+	{
+	  perror ("io_uring_enter() submitting");
+	  exit (1);
+	}
+    }
+  direct_offset+= len;
+  direct_reap (0);
+}
+
+
+/* wait for all writes, then write len more bytes from the ring (less than
+   a bounce buffer, the file cannot continue aligned after this) padded to
+   the next aligned size, and cut the file to the right size */
+void  direct_flush (long  len)
+{
+  long  padded;
+
+  while (dw_count)
+    direct_reap (1);
+  if (len==0)
+    return;
+
+  assert (len<=direct_bouncesize);
+  padded= (len+direct_align-1)/direct_align*direct_align;
+  memcpy (dwrites[0].bounce, vrb_poi_old (&ringbuffer), len);
+  index_data (dwrites[0].bounce, len);
+  stokes_data (dwrites[0].bounce, len);
+  memset (dwrites[0].bounce+len, 0, padded-len);
+  if (pwrite (fileno (outf), dwrites[0].bounce, padded, direct_offset)!=
+      padded)
+    {
+      perror ("writing end of file (pwrite) in consumer()");
+      exit (1);
+    }
+  if (ftruncate (fileno (outf), direct_offset+len))
+    {
+      perror ("ftruncate() of file in consumer()");
+      exit (1);
+    }
+  direct_offset+= len;
+  bytes_written_thisfile+= len;
+  vrb_advance_old (&ringbuffer, len);
+  rx_latency (&ringbuffer);
+}
+
+
+/* before closing a file: finish it at a packet boundary (if --len) */
+void  direct_close ()
+{
+  long  ringlen, tail;
+
+  while (dw_count)
+    direct_reap (1);
+  tail= 0;
+  if (packlen)
+    {
+      ringlen= outlen+(do_blocklen ? 2 : 0);
+      tail= (ringlen-bytes_written_thisfile%ringlen)%ringlen;
+    }
+  direct_flush (tail);
+}
+
+
+/* how much of the size available (behind the writes in flight) to write
+   now: maxwrite, aligned, and up to the next good split point once the file
+   is long enough (see above) */
+long  direct_chunk (long  size)
+{
+  long  to_split;
+
+  if (size>direct_bouncesize)
+    size= direct_bouncesize;
+  size-= size%direct_align;
+  if (split_lcm && bytes_written_thisfile+size>maxfilesize)
+    {
+      to_split= split_lcm-direct_pos ()%split_lcm;
+      if (size>to_split)
+	size= to_split;
+    }
+  return size;
+}
+
+
+/* wait for the consumer with --direct: until there is at least one aligned
+   block to write or we are stopped, completed writes are passed on the way
+   returns the oldest data in the ring (also if in flight), NULL if empty */
+char  *direct_wait ()
+{
+  int  key;
+
+  while (1)
+    {
+      direct_reap (0);
+      if (vrb_fillsize (&ringbuffer)-direct_inflight>=direct_align || stopped)
+	break;
+      if (dw_count)  /* wait for the disk */
+	{
+	  direct_reap (1);
+	  continue;
+	}
+      /* nothing in flight: wait for data as usual */
+      key= vrb_event_prepare (ringbuffer.data_event);
+      if (vrb_fillsize (&ringbuffer)>=direct_align || stopped)
+	{
+	  vrb_event_cancel (ringbuffer.data_event);
+	  break;
+	}
+      vrb_event_wait (ringbuffer.data_event, key);
+    }
+  return vrb_poi_old (&ringbuffer);
+}
+
+
+
+/* striped output over several disks (--stripe, --stripe_balance)
+
+   One filesystem (or one compression pipe) may not keep up: with --stripe
+   dir1,dir2,... each file of the recording is written as one file of the
+   same name in each of the directories, by one writer thread each, with
+   its own compression pipe or context. The consumer takes chunks of whole
+   packets from the ring buffer, --maxwrite bytes (less only if no writer
+   is busy, so that slow data do not wait), and gives them round robin to
+   the writers, with --stripe_balance to the one with the fewest bytes
+   still to write (a faster disk gets more). The chunks stay in the ring
+   buffer until they are written. They can finish in any order: the ring
+   advances over the oldest ones once they are done (as with --direct). The
+   order of the chunks is in the packet index (--index is implied), an
+   INDEX_CHUNK entry for each, see unstripe_bfsfile() in bfs_data.py.
+   Files are split (--Maxfilesize) once the writers are done, not in the
+   background.
+*/
+#define  MAXSTRIPES  16
+#define  STRIPE_QUEUE  4  /* chunks per writer */
+#define  STRIPE_CHUNKS  (MAXSTRIPES*STRIPE_QUEUE)
+
+struct stripe {
+  char  dir[500];
+  char  name[sizeof (thisfilename)];
+  FILE  *f;
+  long  given;  /* bytes of this file given to the writer (consumer) */
+  long  written, compressed;  /* bytes of this file (writer) */
+  long  queued;  /* bytes given, not yet written */
+  int  chunks[STRIPE_QUEUE];  /* in stripe_chunks[], in order */
+  int  head, count;
+  pthread_t  thread;
+#ifdef  HAVE_ZSTD
+  ZSTD_CCtx  *cctx;
+  char  *outbuff;
+#endif
+};
+
+struct stripe_chunk {
+  char  *data;  /* in the ring buffer */
+  long  len;
+  int  done;
+};
+
+struct stripe  stripes[MAXSTRIPES];
+int  nstripes= 0;  /* 0: no --stripe */
+int  stripe_balance= 0;
+char  stripe_str[2000];
+int  stripe_next;  /* round robin */
+struct stripe_chunk  stripe_chunks[STRIPE_CHUNKS];  /* in flight, in order */
+int  sc_head, sc_count;
+long  stripe_inflight;  /* bytes of them */
+pthread_mutex_t  stripe_mutex= PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t  stripe_cond= PTHREAD_COND_INITIALIZER;  /* both ways */
+
+
+
+double  start_file_timestamp;  /* of the first part of a split file */
+
+/* the name of a file started at timestamp, number<0 for no number */
+void  file_name (char  *name, size_t  size, double  timestamp, int  number)
+{
+  char  buff[1000];
+
+  timestamp_to_str (timestamp, buff, sizeof (buff));
+  if (number>=0)
+    /*	sprintf (thisfilename, "%s_%s.%s.%s.%s%s", filename, portlist, */
+    /*hostname, comment, buff, compress ? ".zst" : ""); */
+    snprintf (name, size, "%s_%s.%s.%s_%04d%s", filename, portlist,
+	      hostname, buff, number, compress ? ".zst" : "");
+  else
+    snprintf (name, size, "%s_%s.%s.%s%s", filename, portlist, hostname,
+	      buff, compress ? ".zst" : "");
+}
+
+
+FILE  *rollover_take (char  *name);
+void  stripe_open ();
+void  control_opened ();
+
+void  start_file (double  timestamp)
+{
+  char  buff[1000];
+
+  if (timestamp)
+    start_file_timestamp= timestamp;  /* we may need this for the next part */
+  else
+    timestamp= start_file_timestamp;  /* then we are re-using the last */
+  
+  if (zstd_builtin)
+    printf ("start compressed file\n");
+  else if (compress)
+    printf ("start compression pipe\n");
+  else
+    printf ("start file\n");
+  if (strcmp (filename, "/dev/null")==0)
+    {
+      strcpy (thisfilename, filename);
+      printf ("\nopening %s\n", thisfilename);
+    }
+  else
+    {
+      file_name (thisfilename, sizeof (thisfilename), timestamp, filenumber);
+      if (filenumber>=0)
+	filenumber++;
+      printf ("\ncreating %s\n", thisfilename);
+
+    }
+
+  bytes_written_thisfile= 0;
+  bytes_compressed_thisfile= 0;
+  if (nstripes)
+    {
+      stripe_open ();
+      outf= stripes[0].f;  /* the file is open */
+    }
+  else if ((outf= rollover_take (thisfilename))!=NULL)
+    printf ("(opened ahead)\n");
+  else if (compress && !zstd_builtin)
+    {
+      sprintf (buff, compcommand, thisfilename);
+      outf= popen (buff, "w");
+      if (outf==NULL)
+	{
+	  perror ("opening output compression pipe in start_file()");
+	  exit (1);
+	}
+    }
+  else if (direct)
+    {
+      int  fd;
+
+      fd= open (thisfilename, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0666);
+      if (fd<0 && errno==EINVAL)  /* e.g. /dev/null or tmpfs */
+	{
+	  printf ("no O_DIRECT for %s, writing without\n", thisfilename);
+	  fd= open (thisfilename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	}
+      if (fd<0 || (outf= fdopen (fd, "w"))==NULL)  /* only for fileno() */
+	{
+	  perror ("opening output file in start_file()");
+	  exit (1);
+	}
+      direct_open ();
+    }
+  else
+    {
+      outf= fopen (thisfilename, "w");
+      if (outf==NULL)
+	{
+	  perror ("opening output file in start_file()");
+	  exit (1);
+	}
+#ifdef  HAVE_ZSTD
+      if (zstd_builtin)
+	ZSTD_CCtx_reset (zstd_cctx, ZSTD_reset_session_only);
+#endif
+    }
+  index_open ();
+  sephead_open ();
+  transform_open ();
+  control_opened ();
+}
+
+
+/* one output file per port (--demux)
+
+   Each port has its own ring buffer (as with --sockrings) and its own
+   files: --out can be a list with one name per port (or one for all), the
+   port is in the file name instead of the port list, --compress and
+   --index work per file and --Maxfilesize splits each file on its own.
+   Receiving threads and the consumer are shared. The consumer only works on
+   the current output (outf, thisfilename and the rest), demux_select()
+   switches to that of another port by swapping these globals, so that
+   everything else stays as for a single file.
+*/
+struct demux_stream {
+  FILE  *outf;
+  char  thisfilename[sizeof (thisfilename)], filename[sizeof (filename)],
+    port[12];
+  char  *portlist;
+  long  bytes_written_thisfile, bytes_compressed_thisfile;
+  int  filenumber;
+  double  start_file_timestamp;
+#ifdef  HAVE_ZSTD
+  ZSTD_CCtx  *zstd_cctx;
+  struct zstd_seektable  zstd_seek;
+#endif
+  FILE  *indexf;
+  struct index_header  index_head;
+  struct index_entry  index_run;
+  long  index_filepos, index_next, index_base, index_lastlen;
+  FILE  *sephead_f;
+  struct header_lofar  sephead_next;
+  long  sephead_npacks;
+};
+
+int  demux_cur= 0;  /* the port whose output is in the globals */
+struct demux_stream  demux_streams[MAXNSOCK];
+
+#define  DEMUX_VARS(X)  X (outf) X (portlist) X (bytes_written_thisfile) \
+  X (bytes_compressed_thisfile) X (filenumber) X (start_file_timestamp) \
+  X (indexf) X (index_head) X (index_run) X (index_filepos) X (index_next) \
+  X (index_base) X (index_lastlen) X (sephead_f) X (sephead_next) \
+  X (sephead_npacks)
+
+
+/* make the output of port k the current one */
+void  demux_select (int  k)
+{
+  struct demux_stream  *d;
+
+  if (!demux || k==demux_cur)
+    return;
+  d= &demux_streams[demux_cur];
+#define  DEMUX_SAVE(x)  d->x= x;
+  DEMUX_VARS (DEMUX_SAVE)
+  strcpy (d->thisfilename, thisfilename);
+  strcpy (d->filename, filename);
+#ifdef  HAVE_ZSTD
+  d->zstd_cctx= zstd_cctx;
+  d->zstd_seek= zstd_seek;
+#endif
+  d= &demux_streams[k];
+#define  DEMUX_LOAD(x)  x= d->x;
+  DEMUX_VARS (DEMUX_LOAD)
+  strcpy (thisfilename, d->thisfilename);
+  strcpy (filename, d->filename);
+#ifdef  HAVE_ZSTD
+  zstd_cctx= d->zstd_cctx;
+  zstd_seek= d->zstd_seek;
+#endif
+  demux_cur= k;
+}
+
+
+/* the port (stream) of a ring buffer */
+int  demux_ring (struct vrb  *ring)
+{
+  int  k;
+
+  for (k= 0; k<nrings; k++)
+    if (rings[k]==ring)
+      return k;
+  abort ();
+}
+
+
+/* is any file open? */
+int  demux_open ()
+{
+  int  k;
+
+  if (outf)
+    return 1;
+  for (k= 0; demux && k<nsock; k++)
+    if (k!=demux_cur && demux_streams[k].outf)
+      return 1;
+  return 0;
+}
+
+
+/* after the setup of the first (current) output: the others, out is the
+   list of --out names */
+void  demux_init (char  *out)
+{
+  char  *name, *save;
+  int  k, n;
+
+  /* the first port is current, its values are in the globals */
+  n= 0;
+  for (name= strtok_r (out, ",", &save); name;
+       name= strtok_r (NULL, ",", &save))
+    {
+      if (n==nsock)
+	break;
+      strncpy (demux_streams[n++].filename, name, sizeof (filename)-1);
+    }
+  if (n!=1 && n!=nsock)
+    {
+      fprintf (stderr, "--demux: %d names for --out, but %d ports.\n", n,
+	       nsock);
+      exit (1);
+    }
+  for (k= 0; k<nsock; k++)
+    {
+      struct demux_stream  *d= &demux_streams[k];
+
+      if (k>=n)
+	strcpy (d->filename, demux_streams[0].filename);
+      snprintf (d->port, sizeof (d->port), "%d", portnos[k]);
+      d->portlist= d->port;
+      d->filenumber= filenumber;
+    }
+  strcpy (filename, demux_streams[0].filename);
+  portlist= demux_streams[0].portlist;
+  for (k= 1; k<nsock; k++)  /* each its own compression */
+    {
+      demux_select (k);
+#ifdef  HAVE_ZSTD
+      if (zstd_builtin)
+	zstd_init ();
+#endif
+    }
+  demux_select (0);
+}
+
+
+
+/* the ring buffer to take data from next: with --sockrings the rings take
+   turns (round robin), so that each gets its share if writing is too slow
+   NULL if all are empty */
+struct vrb  *next_ring ()
+{
+  static int  last= 0;
+  int  j, k;
+
+  for (j= 1; j<=nrings; j++)
+    {
+      k= (last+j)%nrings;
+      if (vrb_fillsize (rings[k]))
+	{
+	  last= k;
+	  return rings[k];
+	}
+    }
+  return NULL;
+}
+
+
+
+/* pointer to the oldest data in the next ring buffer (see next_ring()),
+   NULL if there are none */
+char  *consumer_poi_old (struct vrb  **ring)
+{
+  *ring= next_ring ();
+  return *ring ? vrb_poi_old (*ring) : NULL;
+}
+
+
+
+/* live metrics in a shared memory page (--metrics file, e.g. in /dev/shm)
+
+   A thread fills the page every --metrics_interval seconds from the
+   counters (which the other threads update with relaxed atomics): the
+   counters of the printouts summed since the start, rates over the last
+   interval, fill of the ring buffers (max and mean per file, like the
+   printouts), and how long the writes took. Readers map the file and copy
+   the page, and retry if seq was odd or has changed meanwhile (seqlock).
+   See read_dumper_metrics() in bfbackend.py. The page stays after the end,
+   with the last values.
+*/
+#define METRICS_VERSION 1
+
+struct metrics_socket {
+  int64_t  port;
+  int64_t  packs_seen, packs_dropped, dropped_kernel;  /* -1: unknown */
+  int64_t  bytes_written, packs_filled, packs_late;
+  int64_t  ring_fill, maxsize;  /* bytes in its ring buffer, max */
+  double  mean_filllevel;  /* fraction of ring buffer */
+  double  packs_rate, drops_rate, kernel_drops_rate, bytes_rate;  /* /s */
+};
+
+struct metrics_page {
+  char  magic[8];  /* "DUMPMET" */
+  int64_t  version, pid, nsock;
+  _Atomic int64_t  seq;  /* odd while the page is written */
+  double  start_time, update_time, interval;  /* unix time, sec */
+  int64_t  ring_size, ring_fill;  /* all ring buffers */
+  int64_t  bytes_out, writes;  /* written to files (before compression) */
+  double  write_rate;  /* bytes/s over the last interval */
+  double  write_time_mean, write_time_max;  /* sec per write, last interval */
+  double  ring_delay;  /* sec, ring_fill/write_rate: age of written data */
+  struct metrics_socket  sock[MAXNSOCK];
+};
+
+char  metrics_file[500]= "";  /* empty: off */
+double  metrics_interval= 1.;
+struct metrics_page  *metrics;
+pthread_t  metrics_thread;
+
+/* of the consumer, see count_write() */
+_Atomic long  out_bytes, out_writes, out_write_ns, out_write_ns_max;
+
+
+long  monotonic_ns ()
+{
+  struct timespec  ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1000000000l+ts.tv_nsec;
+}
+
+
+/* a write of len bytes by the consumer, that started at t0 (monotonic_ns) */
+void  count_write (long  len, long  t0)
+{
+  long  dt= monotonic_ns ()-t0;
+
+  count_add (&out_bytes, len);
+  count_add (&out_writes, 1);
+  count_add (&out_write_ns, dt);
+  if (dt>atomic_load_explicit (&out_write_ns_max, memory_order_relaxed))
+    atomic_store_explicit (&out_write_ns_max, dt, memory_order_relaxed);
+}
+
+
+/* packets dropped by the kernel for socket i, -1 if unknown
+   (SO_MEMINFO counts the same drops as /proc/net/udp) */
+long  metrics_kernel_drops (int  i)
+{
+  uint32_t  meminfo[SK_MEMINFO_VARS];
+  socklen_t  len= sizeof (meminfo);
+
+  if (capture==CAPTURE_PACKET)
+    return packet_ring_drops (i);
+  if (portnos[0]==0 ||
+      getsockopt (sock[i], SOL_SOCKET, SO_MEMINFO, meminfo, &len) ||
+      len<=SK_MEMINFO_DROPS*sizeof (uint32_t))
+    return -1;
+  return meminfo[SK_MEMINFO_DROPS];
+}
+
+
+void  init_metrics ()
+{
+  int  fd;
+
+  fd= open (metrics_file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd<0 || ftruncate (fd, sizeof (struct metrics_page)))
+    {
+      perror ("creating metrics file");
+      exit (1);
+    }
+  metrics= mmap (NULL, sizeof (struct metrics_page), PROT_READ | PROT_WRITE,
+		 MAP_SHARED, fd, 0);
+  if (metrics==MAP_FAILED)
+    {
+      perror ("mmap() of metrics file");
+      exit (1);
+    }
+  close (fd);
+  memcpy (metrics->magic, "DUMPMET", 8);
+  metrics->version= METRICS_VERSION;
+  metrics->pid= getpid ();
+  metrics->nsock= nsock;
+  metrics->start_time= realtime ();
+  metrics->interval= metrics_interval;
+}
+
+
+/* a counter that is reset for each file: add to its total what came since
+   its last value, returns that */
+long  metrics_delta (long  value, long  *last, long  *total)
+{
+  long  d= value>=*last ? value-*last : value;
+
+  *last= value;
+  *total+= d;
+  return d;
+}
+
+
+/* fill the page (from the metrics thread, and by the consumer before the
+   counters are reset for the next file)
+   final: after the end, the sockets may be closed already */
+void  update_metrics (int  final)
+{
+  static pthread_mutex_t  metrics_mutex= PTHREAD_MUTEX_INITIALIZER;
+  static long  last_ns, last_out_bytes, last_out_writes, last_out_write_ns;
+  static long  last[MAXNSOCK][6], total[MAXNSOCK][6];
+  struct metrics_socket  *ms;
+  long  now, v, n;
+  double  dt;
+  int  i;
+
+  pthread_mutex_lock (&metrics_mutex);
+  now= monotonic_ns ();
+  dt= last_ns ? (now-last_ns)*1e-9 : 0;
+  last_ns= now;
+#define  RATE(d)  (dt>0 ? (d)/dt : 0)
+#define  TOTAL(k, counter) \
+  metrics_delta (atomic_load_explicit (&(counter), memory_order_relaxed), \
+		 &last[i][k], &total[i][k])
+
+  atomic_store_explicit (&metrics->seq, metrics->seq+1, memory_order_relaxed);
+  atomic_thread_fence (memory_order_release);
+
+  metrics->update_time= realtime ();
+  metrics->ring_size= metrics->ring_fill= 0;
+  for (i= 0; i<nrings; i++)
+    {
+      metrics->ring_size+= rings[i]->totsize;
+      metrics->ring_fill+= vrb_fillsize (rings[i]);
+    }
+  v= atomic_load_explicit (&out_bytes, memory_order_relaxed);
+  metrics->write_rate= RATE (v-last_out_bytes);
+  metrics->bytes_out= last_out_bytes= v;
+  v= atomic_load_explicit (&out_writes, memory_order_relaxed);
+  n= v-last_out_writes;
+  metrics->writes= last_out_writes= v;
+  v= atomic_load_explicit (&out_write_ns, memory_order_relaxed);
+  metrics->write_time_mean= n ? (v-last_out_write_ns)*1e-9/n : 0;
+  last_out_write_ns= v;
+  metrics->write_time_max= atomic_exchange (&out_write_ns_max, 0)*1e-9;
+  metrics->ring_delay= metrics->write_rate>0 ?
+    metrics->ring_fill/metrics->write_rate : 0;
+
+  for (i= 0; i<nsock; i++)
+    {
+      ms= &metrics->sock[i];
+      ms->port= portnos[i];
+      ms->packs_rate= RATE (TOTAL (0, sockstat[i].packs_seen));
+      ms->packs_seen= total[i][0];
+      ms->drops_rate= RATE (TOTAL (1, sockstat[i].packs_dropped));
+      ms->packs_dropped= total[i][1];
+      ms->bytes_rate= RATE (TOTAL (2, sockstat[i].bytes_written));
+      ms->bytes_written= total[i][2];
+      TOTAL (3, sockstat[i].packs_filled);
+      ms->packs_filled= total[i][3];
+      TOTAL (4, sockstat[i].packs_late);
+      ms->packs_late= total[i][4];
+      /* the kernel counts since the start, keep the last one at the end */
+      v= final || stopped==2 ? last[i][5] : metrics_kernel_drops (i);
+      ms->kernel_drops_rate= v>=0 ? RATE (v-last[i][5]) : 0;
+      ms->dropped_kernel= last[i][5]= v;
+
+      ms->ring_fill= vrb_fillsize (sockring[i]);
+      ms->maxsize= atomic_load_explicit (&sockstat[i].maxsize,
+					 memory_order_relaxed);
+      n= atomic_load_explicit (&sockstat[i].n_filllevel,
+			       memory_order_relaxed);
+      ms->mean_filllevel= n ? atomic_load_explicit (
+	&sockstat[i].sum_filllevel, memory_order_relaxed)/
+	(double)FILLLEVEL_UNIT/n : 0;
+    }
+#undef  RATE
+#undef  TOTAL
+
+  atomic_store_explicit (&metrics->seq, metrics->seq+1, memory_order_release);
+  pthread_mutex_unlock (&metrics_mutex);
+}
+
+
+void  *metrics_loop (void  *arg)
+{
+  struct timespec  ts;
+
+  ts.tv_sec= (long)metrics_interval;
+  ts.tv_nsec= (metrics_interval-ts.tv_sec)*1e9;
+  while (1)
+    {
+      nanosleep (&ts, NULL);  /* cancellation point, not while updating */
+      pthread_setcancelstate (PTHREAD_CANCEL_DISABLE, NULL);
+      update_metrics (0);
+      pthread_setcancelstate (PTHREAD_CANCEL_ENABLE, NULL);
+    }
+  return NULL;
+}
+
+
+
+/* forwarding of the packets (--forward, --forward_beamlets, --forward_rate)
+
+   The consumer sends every packet leaving the ring buffer (as --stokes,
+   also with --nowrite) to the --forward destinations, host:port, unicast
+   or multicast, with one connected socket each and sendmmsg(). Nothing is
+   copied: the messages point into the ring buffer. With --forward_beamlets
+   only those beamlets of the packet (as in the ring buffer, i.e. after
+   --beamlets) are sent, one piece per run of consecutive beamlets after a
+   copy of the header with num_beamlets and the bit mode set (as
+   transform_packet() does).
+   A destination must never hold up the recording, so the sockets do not
+   block (MSG_DONTWAIT): what does not fit in the socket buffer is dropped,
+   as is what is over --forward_rate (bytes per second per destination,
+   token bucket of FORWARD_BURST seconds), and counted per destination.
+*/
+#define  FORWARD_MAX  8  /* destinations */
+#define  FORWARD_BATCH  64  /* packets per sendmmsg() */
+#define  FORWARD_RUNS  (MAXBEAMLETS/2+1)  /* of selected beamlets, at most */
+#define  FORWARD_BURST  0.01  /* sec */
+
+struct forward_dest {
+  char  name[100];  /* host:port */
+  int  sock;
+  double  tokens;  /* bytes that may be sent now, --forward_rate */
+  long  sent, dropped_rate, dropped_full, errors;  /* packets */
+};
+
+struct forward_dest  forward_dests[FORWARD_MAX];
+int  nforward= 0;
+char  forward_str[1000];
+char  forward_beamlets_str[500];
+double  forward_rate= 0;  /* bytes per second, 0: no limit */
+long  forward_last_ns;  /* of the tokens */
+long  forward_bad;  /* packets without the --forward_beamlets */
+
+/* runs of consecutive selected beamlets: first and number */
+int  forward_nruns, forward_run_first[FORWARD_RUNS], forward_run_n[FORWARD_RUNS];
+int  forward_nsel;
+
+struct mmsghdr  forward_msgs[FORWARD_BATCH];
+struct iovec  forward_iov[FORWARD_BATCH][1+FORWARD_RUNS];
+struct header_lofar  forward_headers[FORWARD_BATCH];
+int  forward_nmsg;  /* in the batch */
+long  forward_bytes;
+
+
+/* open the sockets, after the options */
+void  forward_init ()
+{
+  char  list[sizeof (forward_str)], *item, *save, *port;
+  struct addrinfo  hints, *res;
+  int  sel[MAXBEAMLETS], k, j, bufsize= 4*1024*1024;
+
+  if (forward_str[0]==0)
+    return;
+  if (forward_beamlets_str[0])
+    {
+      if (parse_beamlets (forward_beamlets_str, sel, &forward_nsel))
+	{
+	  fprintf (stderr, "problem with forward_beamlets\n");
+	  exit (1);
+	}
+      for (k= 0; k<forward_nsel; k= j)
+	{
+	  for (j= k+1; j<forward_nsel && sel[j]==sel[j-1]+1; j++)
+	    ;
+	  forward_run_first[forward_nruns]= sel[k];
+	  forward_run_n[forward_nruns++]= j-k;
+	}
+    }
+
+  strcpy (list, forward_str);
+  for (item= strtok_r (list, ",", &save); item;
+       item= strtok_r (NULL, ",", &save))
+    {
+      struct forward_dest  *d= &forward_dests[nforward];
+      int  e;
+
+      port= strrchr (item, ':');
+      if (nforward==FORWARD_MAX || port==NULL)
+	{
+	  fprintf (stderr, "problem with forward: %s (host:port, at most "
+		   "%d)\n", item, FORWARD_MAX);
+	  exit (1);
+	}
+      snprintf (d->name, sizeof (d->name), "%s", item);
+      *port++= 0;
+      memset (&hints, 0, sizeof (hints));
+      hints.ai_family= AF_INET;
+      hints.ai_socktype= SOCK_DGRAM;
+      e= getaddrinfo (item, port, &hints, &res);
+      if (e)
+	{
+	  fprintf (stderr, "forward %s: %s\n", d->name, gai_strerror (e));
+	  exit (1);
+	}
+      d->sock= socket (AF_INET, SOCK_DGRAM, 0);
+      if (d->sock<0 ||
+	  connect (d->sock, res->ai_addr, res->ai_addrlen))
+	{
+	  perror ("forward socket");
+	  exit (1);
+	}
+      freeaddrinfo (res);
+      /* not fatal, the default is only smaller */
+      setsockopt (d->sock, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof (bufsize));
+      d->tokens= forward_rate*FORWARD_BURST;
+      nforward++;
+      if (verbose)
+	printf ("forwarding to %s\n", d->name);
+    }
+  forward_last_ns= monotonic_ns ();
+}
+
+
+/* the header and pieces of one packet into the batch */
+void  forward_add (char  *rec)
+{
+  struct header_lofar  *header= (struct header_lofar*)rec;
+  struct mmsghdr  *msg= &forward_msgs[forward_nmsg];
+  struct iovec  *iov= forward_iov[forward_nmsg];
+  long  len= outlen, onelen;
+  int  k, niov= 0;
+
+  if (forward_nsel==0)  /* the whole packet */
+    {
+      iov[niov].iov_base= rec;
+      iov[niov++].iov_len= len;
+    }
+  else
+    {
+      int  nb= header->num_beamlets, bits;
+
+      onelen= nb ? (len-(long) sizeof (*header))/nb : 0;
+      bits= header->num_slices ? 2*onelen/header->num_slices : 0;
+      if (forward_run_first[forward_nruns-1]+
+	  forward_run_n[forward_nruns-1]>nb ||
+	  (bits!=16 && bits!=8 && bits!=4))
+	{
+	  forward_bad++;
+	  return;
+	}
+      forward_headers[forward_nmsg]= *header;
+      header= &forward_headers[forward_nmsg];
+      header->num_beamlets= forward_nsel;
+      header->source.bm= bits==16 ? 0 : bits==8 ? 1 : 2;
+      iov[niov].iov_base= header;
+      iov[niov++].iov_len= sizeof (*header);
+      len= sizeof (*header);
+      for (k= 0; k<forward_nruns; k++)
+	{
+	  iov[niov].iov_base= rec+sizeof (*header)+
+	    forward_run_first[k]*onelen;
+	  iov[niov++].iov_len= forward_run_n[k]*onelen;
+	  len+= forward_run_n[k]*onelen;
+	}
+    }
+  memset (&msg->msg_hdr, 0, sizeof (msg->msg_hdr));
+  msg->msg_hdr.msg_iov= iov;
+  msg->msg_hdr.msg_iovlen= niov;
+  forward_bytes+= len;
+  forward_nmsg++;
+}
+
+
+/* send the batch to all destinations, as much as they take */
+void  forward_send ()
+{
+  int  nmsg= forward_nmsg, i, n, k, allowed;
+  long  now;
+  double  packbytes;
+
+  if (nmsg==0)
+    return;
+  packbytes= forward_bytes/(double) nmsg;
+  now= monotonic_ns ();
+  for (k= 0; k<nforward; k++)
+    {
+      struct forward_dest  *d= &forward_dests[k];
+
+      allowed= nmsg;
+      if (forward_rate>0)
+	{
+	  d->tokens+= forward_rate*(now-forward_last_ns)*1e-9;
+	  if (d->tokens>forward_rate*FORWARD_BURST+forward_bytes)
+	    d->tokens= forward_rate*FORWARD_BURST+forward_bytes;
+	  if (d->tokens<nmsg*packbytes)
+	    allowed= d->tokens/packbytes;
+	  d->tokens-= allowed*packbytes;
+	  d->dropped_rate+= nmsg-allowed;
+	}
+      for (i= 0; i<allowed; )
+	{
+	  n= sendmmsg (d->sock, forward_msgs+i, allowed-i, MSG_DONTWAIT);
+	  if (n>0)
+	    {
+	      d->sent+= n;
+	      i+= n;
+	    }
+	  else if (errno==EINTR)
+	    continue;
+	  else if (errno==EAGAIN || errno==EWOULDBLOCK || errno==ENOBUFS)
+	    {
+	      d->dropped_full+= allowed-i;  /* socket buffer full */
+	      break;
+	    }
+	  else  /* e.g. ECONNREFUSED from an earlier one, skip this one */
+	    {
+	      d->errors++;
+	      i++;
+	    }
+	}
+    }
+  forward_last_ns= now;
+  forward_nmsg= 0;
+  forward_bytes= 0;
+}
+
+
+/* the next len bytes leaving the ring buffer (whole records) */
+void  forward_data (char  *poi, long  len)
+{
+  long  ringlen= outlen+(do_blocklen ? 2 : 0);
+
+  if (nforward==0)
+    return;
+  for (; len>=ringlen; poi+= ringlen, len-= ringlen)
+    {
+      forward_add (poi+(do_blocklen ? 2 : 0));
+      if (forward_nmsg==FORWARD_BATCH)
+	forward_send ();
+    }
+  forward_send ();
+}
+
+
+void  forward_close ()
+{
+  int  k;
+
+  for (k= 0; k<nforward; k++)
+    {
+      struct forward_dest  *d= &forward_dests[k];
+
+      printf ("forward %s: sent %ld, dropped %ld over rate, %ld socket "
+	      "full, %ld errors\n", d->name, d->sent, d->dropped_rate,
+	      d->dropped_full, d->errors);
+      close (d->sock);
+    }
+  if (forward_bad)
+    printf ("forward: %ld packets without the forward_beamlets\n",
+	    forward_bad);
+  nforward= 0;
+}
+
+
+
+/* transient buffer (--trigger, --trigger_post, --trigger_port)
+
+   No file is written until a trigger comes: the ring buffer holds the last
+   --trigger seconds (of packet time, or as much as fits in 3/4 of the
+   ring, 0: only that), older packets are dropped from the front as new
+   ones arrive (see trigger_hold()). A trigger is SIGUSR1 or any datagram
+   to --trigger_port. Then a file is started with the packets in the ring,
+   from the front at a packet boundary, and continued until the first
+   packet more than --trigger_post seconds after the newest one at the time
+   of the trigger. A trigger during that extends the dump. The range of
+   packet numbers (see beamformed_packno()) and their times are printed and
+   written to filename.trig (see trigger_close()). Requires --len, one ring
+   buffer, not with --direct.
+*/
+#define  TRIGGER_IDLE  0
+#define  TRIGGER_DUMP  1  /* writing until trigger_end */
+#define  TRIGGER_DONE  2  /* then close the file */
+
+double  trigger_pre= 0, trigger_post= 1.0;
+int  trigger_port= 0, trigger_sock= -1;
+pthread_t  trigger_thread;
+_Atomic int  trigger_pending;  /* set by signal or trigger datagram */
+int  trigger_state= TRIGGER_IDLE;
+long  trigger_end, trigger_first, trigger_last;  /* packet numbers */
+double  trigger_time;  /* realtime () of the (first) trigger */
+int  trigger_clock_mhz;  /* of the newest packet when triggered */
+long  trigger_count;
+
+
+/* the packet at p in the ring (with size header if --sizehead) */
+static inline struct header_lofar  *trigger_header (char  *p)
+{
+  return (struct header_lofar*)(p+(do_blocklen ? 2 : 0));
+}
+
+
+void  trigger_signal (int  signum)
+{
+  atomic_store (&trigger_pending, 1);
+  vrb_wake_consumer (&ringbuffer);
+}
+
+
+/* waits for trigger datagrams (--trigger_port) */
+void  *trigger_listen (void  *arg)
+{
+  char  buff[200];
+  struct sockaddr_in  addr;
+  socklen_t  slen;
+  ssize_t  n;
+
+  while (1)
+    {
+      slen= sizeof (addr);
+      n= recvfrom (trigger_sock, buff, sizeof (buff)-1, 0,
+		   (struct sockaddr*)&addr, &slen);
+      if (n<0)
+	{
+	  if (errno==EINTR)
+	    continue;
+	  perror ("recvfrom() trigger socket");
+	  return NULL;
+	}
+      buff[n]= 0;
+      buff[strcspn (buff, "\r\n")]= 0;
+      printf ("trigger datagram from %s: %s\n", inet_ntoa (addr.sin_addr),
+	      buff);
+      atomic_store (&trigger_pending, 1);
+      vrb_wake_consumer (&ringbuffer);
+    }
+  return NULL;
+}
+
+
+void  trigger_init ()
+{
+  struct sockaddr_in  addr;
+  int  j;
+
+  signal (SIGUSR1, trigger_signal);
+  if (trigger_port==0)
+    return;
+  trigger_sock= socket (AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (trigger_sock==-1)
+    {
+      perror ("socket() for trigger");
+      exit (1);
+    }
+  memset (&addr, 0, sizeof (addr));
+  addr.sin_family= AF_INET;
+  addr.sin_port= htons (trigger_port);
+  addr.sin_addr.s_addr= htonl (INADDR_ANY);
+  if (bind (trigger_sock, (struct sockaddr *)&addr, sizeof (addr))==-1)
+    {
+      perror ("bind() trigger socket");
+      exit (1);
+    }
+  j= pthread_create (&trigger_thread, NULL, trigger_listen, NULL);
+  if (j)
+    {
+      errno= j;
+      perror ("pthread_create for trigger");
+      exit (1);
+    }
+  printf ("waiting for triggers on port %d\n", trigger_port);
+}
+
+
+/* the dump continues until trigger_post after the newest packet */
+void  trigger_extend (char  *newest)
+{
+  struct header_lofar  *header;
+  long  end;
+
+  header= trigger_header (newest);
+  trigger_clock_mhz= 160+40*header->source.is200mhz;
+  end= beamformed_packno (header)+
+    (long) (trigger_post*trigger_clock_mhz*1e6/(1024*LOFAR_SLICES));
+  if (trigger_state==TRIGGER_IDLE || end>trigger_end)
+    trigger_end= end;
+}
+
+
+/* keep the last --trigger seconds of the thissize bytes at oldpoi (in
+   whole packets), returns 1 if triggered: then write from the front */
+int  trigger_hold (struct vrb  *ring, char  *oldpoi, long  thissize,
+		   int  my_stopped)
+{
+  long  ringlen, keep, window, newest, drop;
+  long  seen;
+
+  ringlen= outlen+(do_blocklen ? 2 : 0);
+  if (my_stopped==2)  /* nothing more to keep */
+    {
+      stokes_data (oldpoi, thissize);
+      forward_data (oldpoi, thissize);
+      vrb_advance_old (ring, thissize);
+      return 0;
+    }
+  thissize= thissize/ringlen*ringlen;
+  if (thissize==0)
+    return 0;
+  if (atomic_exchange (&trigger_pending, 0))
+    {
+      trigger_extend (oldpoi+thissize-ringlen);
+      trigger_state= TRIGGER_DUMP;
+      trigger_first= beamformed_packno (trigger_header (oldpoi));
+      trigger_last= -1;
+      trigger_time= realtime ();
+      trigger_count++;
+      printf ("trigger %ld: dumping packets %ld.. until %ld (%.3f s in the "
+	      "ring)\n", trigger_count, trigger_first, trigger_end,
+	      (beamformed_packno (trigger_header (oldpoi+thissize-ringlen))-
+	       trigger_first+1)*1024.*LOFAR_SLICES/(trigger_clock_mhz*1e6));
+      return 1;
+    }
+
+  keep= ring->totsize*3/4/ringlen*ringlen;
+  drop= thissize>keep ? thissize-keep : 0;
+  if (trigger_pre>0)
+    {
+      struct header_lofar  *header;
+
+      header= trigger_header (oldpoi+thissize-ringlen);
+      newest= beamformed_packno (header);
+      window= trigger_pre*(160+40*header->source.is200mhz)*1e6/
+	(1024*LOFAR_SLICES);
+      while (drop<thissize-ringlen &&
+	     beamformed_packno (trigger_header (oldpoi+drop))<newest-window)
+	drop+= ringlen;
+    }
+  if (drop)
+    {
+      stokes_data (oldpoi, drop);
+      forward_data (oldpoi, drop);
+      vrb_advance_old (ring, drop);
+    }
+
+  /* wait until there is more (or a trigger or stop) */
+  seen= atomic_load (&ring->added);
+  while (atomic_load (&ring->added)==seen && !stopped &&
+	 !atomic_load (&trigger_pending))
+    {
+      int  key;
+
+      key= vrb_event_prepare (ring->data_event);
+      if (atomic_load (&ring->added)!=seen || stopped ||
+	  atomic_load (&trigger_pending))
+	{
+	  vrb_event_cancel (ring->data_event);
+	  break;
+	}
+      vrb_event_wait (ring->data_event, key);
+    }
+  return 0;
+}
+
+
+/* of the thissize bytes at oldpoi being dumped, how many to write */
+long  trigger_limit (char  *oldpoi, long  thissize)
+{
+  long  ringlen, k, packno;
+
+  if (thissize==0)
+    return 0;
+  ringlen= outlen+(do_blocklen ? 2 : 0);
+  if (atomic_exchange (&trigger_pending, 0))  /* again */
+    trigger_extend (oldpoi+thissize-ringlen);
+  for (k= 0; k<thissize; k+= ringlen)
+    {
+      packno= beamformed_packno (trigger_header (oldpoi+k));
+      if (packno>trigger_end)
+	{
+	  trigger_state= TRIGGER_DONE;
+	  return k;
+	}
+      if (packno>trigger_last)
+	trigger_last= packno;
+    }
+  return thissize;
+}
+
+
+/* at the end of a dump: its range of packets in filename.trig */
+void  trigger_close ()
+{
+  char  name[sizeof (thisfilename)+10];
+  double  t0, t1;
+  FILE  *f;
+
+  if (!trigger_mode || trigger_state==TRIGGER_IDLE)
+    return;
+  trigger_state= TRIGGER_IDLE;
+  t0= trigger_first*1024.*LOFAR_SLICES/(trigger_clock_mhz*1e6);
+  t1= (trigger_last+1)*1024.*LOFAR_SLICES/(trigger_clock_mhz*1e6);
+  printf ("trigger %ld: packets %ld-%ld  %.6f-%.6f (%.3f s)\n",
+	  trigger_count, trigger_first, trigger_last, t0, t1, t1-t0);
+  if (!dowrite || strcmp (thisfilename, "/dev/null")==0)
+    return;
+  snprintf (name, sizeof (name), "%s.trig", thisfilename);
+  f= fopen (name, "w");
+  if (f==NULL ||
+      fprintf (f, "trigger %.6f\npackets %ld %ld\ntimes %.6f %.6f\n"
+	       "clock_mhz %d\n", trigger_time, trigger_first, trigger_last,
+	       t0, t1, trigger_clock_mhz)<0 ||
+      fclose (f))
+    {
+      perror ("writing trigger file");
+      exit (1);
+    }
+}
+
+
+
+/* control socket for a recorder that stays up (--control path)
+
+   The sockets, ring buffer and threads stay warm between observations:
+   no file is written until a start command, a stop ends the file but not
+   the programme. Commands are lines on the Unix stream socket, each is
+   answered with a line "ok ..." or "error ...":
+     start [at t | packet t]   start a file (while recording: as split)
+     stop [at t | packet t]    close it
+     split [at t | packet t]   close it and start the next
+     out name                  --out for the files of the next start or split
+     status                    idle or recording, file, last packet, queued
+     quit                      end the programme (as SIGTERM)
+   t is unix seconds or yyyy-mm-ddThh:mm:ss (UTC). Without a time the
+   command takes effect at the oldest packet in the ring buffer, with at
+   once the (wall clock) time has come, with packet at the first packet
+   whose header time (timestamp and sequence) is t or later: the file
+   begins (or ends) exactly at that packet, the same on all lanes. The
+   commands are done in turn, each after the one before. While idle the
+   packets leave the ring buffer unwritten (--stokes and --forward go on).
+   Requires --len and one ring buffer, not with --trigger, --direct or
+   --stripe.
+*/
+#define  CONTROL_IDLE    0
+#define  CONTROL_RECORD  1
+#define  CONTROL_CLOSE   2  /* stop or split due: close the file */
+
+#define  CONTROL_START  0
+#define  CONTROL_STOP   1
+#define  CONTROL_SPLIT  2
+#define  CONTROL_OUT    3
+
+#define  CONTROL_NOW     0
+#define  CONTROL_WALL    1
+#define  CONTROL_PACKET  2
+
+#define  CONTROL_QUEUE  16
+
+struct control_cmd {
+  int  what, when;
+  double  time;  /* unix time or packet time */
+  char  out[sizeof (filename)];
+};
+
+const char  *control_names[]= {"start", "stop", "split", "out"};
+
+int  control= 0;
+char  control_path[108];  /* sun_path */
+int  control_sock= -1;
+pthread_t  control_thread;
+pthread_mutex_t  control_mutex= PTHREAD_MUTEX_INITIALIZER;
+struct control_cmd  control_queue[CONTROL_QUEUE];
+int  control_head, control_count;
+_Atomic int  control_state= CONTROL_IDLE;
+int  control_split;  /* the close is for a split */
+char  control_out[sizeof (filename)];  /* for the next start or split */
+char  control_file[sizeof (thisfilename)];  /* for status, "" if none */
+_Atomic long  control_last= -1;  /* newest packet written */
+
+
+/* a command line, the answer to reply (in the thread of the socket) */
+void  control_command (char  *line, char  *reply, size_t  size)
+{
+  struct control_cmd  cmd;
+  char  word[20], when[20], time[100];
+  int  pos, n;
+
+  memset (&cmd, 0, sizeof (cmd));
+  if (sscanf (line, "%19s%n", word, &pos)!=1)
+    {
+      snprintf (reply, size, "error empty command");
+      return;
+    }
+  line+= pos;
+  line+= strspn (line, " \t");
+  if (strcmp (word, "status")==0)
+    {
+      pthread_mutex_lock (&control_mutex);
+      if (control_state==CONTROL_IDLE)
+	snprintf (reply, size, "ok idle queued %d", control_count);
+      else
+	snprintf (reply, size, "ok recording %s packet %ld queued %d",
+		  control_file[0] ? control_file : "-", control_last,
+		  control_count);
+      pthread_mutex_unlock (&control_mutex);
+      return;
+    }
+  if (strcmp (word, "quit")==0)
+    {
+      snprintf (reply, size, "ok quit");
+      kill (getpid (), SIGTERM);
+      return;
+    }
+
+  for (cmd.what= 0; cmd.what<=CONTROL_OUT; cmd.what++)
+    if (strcmp (word, control_names[cmd.what])==0)
+      break;
+  if (cmd.what>CONTROL_OUT)
+    {
+      snprintf (reply, size, "error unknown command %s", word);
+      return;
+    }
+  if (cmd.what==CONTROL_OUT)
+    {
+      if (line[0]==0 || strlen (line)>=sizeof (cmd.out))
+	{
+	  snprintf (reply, size, "error out needs a name");
+	  return;
+	}
+      strcpy (cmd.out, line);
+    }
+  else if (line[0])
+    {
+      n= sscanf (line, "%19s %99s %n", when, time, &pos);
+      cmd.when= strcmp (when, "at")==0 ? CONTROL_WALL :
+	strcmp (when, "packet")==0 ? CONTROL_PACKET : -1;
+      if (n!=2 || cmd.when<0 || line[pos] ||
+	  (cmd.time= time_to_timestamp (time))<0)
+	{
+	  snprintf (reply, size, "error %s [at t | packet t]", word);
+	  return;
+	}
+    }
+
+  pthread_mutex_lock (&control_mutex);
+  if (control_count==CONTROL_QUEUE)
+    snprintf (reply, size, "error %d commands queued already",
+	      CONTROL_QUEUE);
+  else
+    {
+      control_queue[(control_head+control_count)%CONTROL_QUEUE]= cmd;
+      control_count++;
+      snprintf (reply, size, "ok %s queued %d", word, control_count);
+    }
+  pthread_mutex_unlock (&control_mutex);
+}
+
+
+/* accepts the connections to the control socket, one at a time */
+void  *control_listen (void  *arg)
+{
+  char  line[1000], reply[sizeof (thisfilename)+200];
+  FILE  *f;
+  int  fd;
+
+  while (1)
+    {
+      fd= accept (control_sock, NULL, NULL);
+      if (fd<0)
+	{
+	  if (errno==EINTR || errno==ECONNABORTED)
+	    continue;
+	  perror ("accept() control socket");
+	  return NULL;
+	}
+      f= fdopen (fd, "r");
+      if (f==NULL)
+	{
+	  close (fd);
+	  continue;
+	}
+      while (fgets (line, sizeof (line), f))
+	{
+	  line[strcspn (line, "\r\n")]= 0;
+	  control_command (line, reply, sizeof (reply));
+	  printf ("control: %s  -> %s\n", line, reply);
+	  strcat (reply, "\n");
+	  /* not the end of the programme if the client is gone */
+	  if (send (fd, reply, strlen (reply), MSG_NOSIGNAL)<0)
+	    break;
+	}
+      fclose (f);
+    }
+  return NULL;
+}
+
+
+/* the first command, out commands before it are done on the way (in the
+   consumer), returns the offset in the thissize bytes at oldpoi (whole
+   packets) where it is due, thissize if not in there, -1 if none */
+long  control_due (char  *oldpoi, long  thissize, struct control_cmd  *cmd)
+{
+  long  ringlen, k, packno;
+  double  clock;
+
+  ringlen= outlen+(do_blocklen ? 2 : 0);
+  pthread_mutex_lock (&control_mutex);
+  while (control_count && control_queue[control_head].what==CONTROL_OUT)
+    {
+      strcpy (control_out, control_queue[control_head].out);
+      control_head= (control_head+1)%CONTROL_QUEUE;
+      control_count--;
+    }
+  if (control_count==0)
+    {
+      pthread_mutex_unlock (&control_mutex);
+      return -1;
+    }
+  *cmd= control_queue[control_head];
+  pthread_mutex_unlock (&control_mutex);
+
+  if (cmd->when==CONTROL_NOW ||
+      (cmd->when==CONTROL_WALL && realtime ()>=cmd->time))
+    return 0;
+  if (cmd->when==CONTROL_WALL)
+    return thissize;
+  /* the first packet that starts at time or later (see
+     beamformed_packno()) */
+  clock= (160+40*trigger_header (oldpoi)->source.is200mhz)*1e6;
+  packno= ceil (floor ((cmd->time*clock+512)/1024)/LOFAR_SLICES);
+  for (k= 0; k<thissize; k+= ringlen)
+    if (beamformed_packno (trigger_header (oldpoi+k))>=packno)
+      break;
+  return k;
+}
+
+
+/* the command from control_due() is done */
+void  control_pop ()
+{
+  pthread_mutex_lock (&control_mutex);
+  control_head= (control_head+1)%CONTROL_QUEUE;
+  control_count--;
+  pthread_mutex_unlock (&control_mutex);
+}
+
+
+/* the next files go to the name of the last out command */
+void  control_take_out ()
+{
+  if (control_out[0]==0)
+    return;
+  strcpy (filename, control_out);
+  control_out[0]= 0;
+  printf ("control: out %s\n", filename);
+}
+
+
+/* while idle: drop the thissize bytes at oldpoi up to the start, returns
+   1 if the start is at the front (then it is recording) */
+int  control_hold (struct vrb  *ring, char  *oldpoi, long  thissize,
+		   int  my_stopped)
+{
+  struct control_cmd  cmd;
+  long  ringlen, k;
+
+  ringlen= outlen+(do_blocklen ? 2 : 0);
+  if (my_stopped!=2)
+    thissize= thissize/ringlen*ringlen;
+  if (thissize==0)
+    return 0;
+  k= my_stopped==2 ? -1 : control_due (oldpoi, thissize, &cmd);
+  if (k==0)
+    {
+      control_pop ();
+      if (cmd.what!=CONTROL_START)
+	{
+	  printf ("control: %s while idle, nothing to do\n",
+		  control_names[cmd.what]);
+	  return 0;  /* the next one */
+	}
+      control_take_out ();
+      init_thisfilestat ();  /* the statistics of the file from here */
+      control_state= CONTROL_RECORD;
+      printf ("control: start at packet %ld\n",
+	      beamformed_packno (trigger_header (oldpoi)));
+      return 1;
+    }
+  if (k<0)
+    k= thissize;
+  stokes_data (oldpoi, k);
+  forward_data (oldpoi, k);
+  vrb_advance_old (ring, k);
+  return 0;
+}
+
+
+/* while recording: how many of the thissize bytes at oldpoi to write
+   before a stop or split */
+long  control_limit (char  *oldpoi, long  thissize)
+{
+  struct control_cmd  cmd;
+  long  ringlen, k;
+
+  if (control_state==CONTROL_CLOSE || thissize==0)
+    return 0;
+  ringlen= outlen+(do_blocklen ? 2 : 0);
+  k= control_due (oldpoi, thissize, &cmd);
+  if (k>=0 && k<thissize)
+    {
+      control_pop ();
+      control_state= CONTROL_CLOSE;
+      control_split= cmd.what!=CONTROL_STOP;
+      printf ("control: %s at packet %ld\n", control_names[cmd.what],
+	      beamformed_packno (trigger_header (oldpoi+k)));
+      thissize= k;
+    }
+  if (thissize)
+    control_last= beamformed_packno (trigger_header (oldpoi+thissize-
+						     ringlen));
+  return thissize;
+}
+
+
+/* a file has been started (for status) */
+void  control_opened ()
+{
+  if (!control)
+    return;
+  pthread_mutex_lock (&control_mutex);
+  strcpy (control_file, thisfilename);
+  pthread_mutex_unlock (&control_mutex);
+}
+
+
+/* the file has been closed: after a stop idle, after a split the next
+   file starts with the next packet */
+void  control_closed ()
+{
+  if (!control)
+    return;
+  pthread_mutex_lock (&control_mutex);
+  control_file[0]= 0;
+  pthread_mutex_unlock (&control_mutex);
+  if (control_state!=CONTROL_CLOSE)  /* timeout, still recording */
+    return;
+  if (control_split)
+    control_take_out ();
+  control_state= control_split ? CONTROL_RECORD : CONTROL_IDLE;
+}
+
+
+void  control_init ()
+{
+  struct sockaddr_un  addr;
+  int  j;
+
+  if (control_path[0]==0)
+    return;
+  if (packlen==0 || sockrings || demux || trigger_mode || direct ||
+      nstripes)
+    {
+      fprintf (stderr, "--control requires --len, not with --sockrings, "
+	       "--demux, --trigger, --direct or --stripe.\n");
+      exit (1);
+    }
+  control_sock= socket (AF_UNIX, SOCK_STREAM, 0);
+  if (control_sock==-1)
+    {
+      perror ("socket() for control");
+      exit (1);
+    }
+  memset (&addr, 0, sizeof (addr));
+  addr.sun_family= AF_UNIX;
+  strcpy (addr.sun_path, control_path);
+  unlink (control_path);  /* left from before */
+  if (bind (control_sock, (struct sockaddr *)&addr, sizeof (addr))==-1 ||
+      listen (control_sock, 4)==-1)
+    {
+      perror ("bind() control socket");
+      exit (1);
+    }
+  j= pthread_create (&control_thread, NULL, control_listen, NULL);
+  if (j)
+    {
+      errno= j;
+      perror ("pthread_create for control");
+      exit (1);
+    }
+  control= 1;
+  printf ("control socket %s, idle\n", control_path);
+}
+
+
+void  control_end ()
+{
+  if (!control)
+    return;
+  unlink (control_path);
+  control= 0;
+}
+
+
+
+/* asynchronous rollover of split files (--Maxfilesize)
+
+   A split should cost the data path nothing: the outgoing file is finished
+   by the rollover thread (end of the zstd frame, waiting for the
+   compression command in pclose(), fclose()), and once the current file is
+   half full the same thread opens the next one ahead of time (the
+   compression command is running already, plain files are preallocated
+   with fallocate() to the expected size, what is not used is freed when
+   they are closed). The consumer only swaps the FILE pointers, the
+   contexts of built-in compression are used in turn. At the end of the
+   recording everything goes in order again before the last file is closed.
+   Not with --direct, which splits at aligned positions itself, the (small)
+   .idx and .sel files are still written by the consumer.
+*/
+#define  ROLLOVER_QUEUE  8
+
+#define  ROLLOVER_CLOSE  0
+#define  ROLLOVER_OPEN   1
+
+struct rollover_job {
+  int  what;  /* ROLLOVER_CLOSE, ROLLOVER_OPEN */
+  int  stream;  /* demux_cur */
+  FILE  *f;
+  char  name[sizeof (thisfilename)];
+  long  written, compressed;  /* bytes so far */
+#ifdef  HAVE_ZSTD
+  ZSTD_CCtx  *cctx;  /* with the frame still to be finished */
+  struct zstd_seektable  seek;
+#endif
+};
+
+/* the next file of each port (only one without --demux) */
+struct rollover_next {
+  char  name[sizeof (thisfilename)];
+  FILE  *f;  /* opened ahead, NULL if not (yet) */
+  int  number;  /* filenumber it was asked for, -1 none */
+  int  pending;  /* the job is queued */
+#ifdef  HAVE_ZSTD
+  ZSTD_CCtx  *spare;  /* finished context to use again */
+#endif
+};
+
+int  rollover= 0;  /* the thread is running */
+pthread_t  rollover_thread;
+pthread_mutex_t  rollover_mutex= PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t  rollover_cond= PTHREAD_COND_INITIALIZER;  /* both ways */
+struct rollover_job  rollover_jobs[ROLLOVER_QUEUE];
+int  rollover_head, rollover_count, rollover_busy;
+struct rollover_next  rollover_nexts[MAXNSOCK];
+char  *rollover_outbuff;  /* for the end of the zstd frames */
+
+
+/* open an output file (or compression pipe), NULL if not possible,
+   plain files are preallocated for maxfilesize plus a last write */
+FILE  *rollover_open (char  *name)
+{
+  char  buff[sizeof (thisfilename)+1000];
+  FILE  *f;
+
+  if (compress && !zstd_builtin)
+    {
+      snprintf (buff, sizeof (buff), compcommand, name);
+      f= popen (buff, "w");
+    }
+  else
+    {
+      f= fopen (name, "w");
+      if (f && fallocate (fileno (f), FALLOC_FL_KEEP_SIZE, 0,
+			  (long)maxfilesize+maxwrite) && verbose)
+	perror ("fallocate()");  /* not important */
+    }
+  if (f==NULL)
+    perror ("opening the next output file in rollover_open()");
+  return f;
+}
+
+
+/* finish a file (see close_file()), outbuff for built-in compression */
+void  rollover_finish (struct rollover_job  *job, char  *outbuff)
+{
+  long  i;
+  int  j;
+
+#ifdef  HAVE_ZSTD
+  if (zstd_builtin)
+    {
+      /* finish the frame (unless it has just ended, --zstd_frame) */
+      if (!zstd_frame || job->seek.in || job->seek.n==0)
+	{
+	  job->compressed+= zstd_stream (job->cctx, outbuff, job->f, NULL, 0,
+					 ZSTD_e_end);
+	  if (zstd_frame)
+	    zstd_seek_add (&job->seek, job->compressed);
+	}
+      if (zstd_frame)
+	job->compressed+= zstd_seek_write (&job->seek, job->f);
+      j= fclose (job->f);
+      if (j!=0)
+	{
+	  perror ("closing compressed file in rollover_finish()");
+	  exit (1);
+	}
+      printf ("compression of %s: %ld -> %ld  reduced to %.3f %%\n",
+	      job->name, job->written, job->compressed,
+	      job->compressed/(double)job->written*100);
+    }
+  else
+#endif
+  if (compress)
+    {
+      struct stat  stats;
+      long  len;
+
+      /* not entirely sure if pclose is flushing */
+      j= fflush (job->f);
+      if (j)
+	perror ("fflush() output pipe");
+      /* but don't exit */
+
+      j= pclose (job->f);
+      if (j!=0)
+	{
+	  perror ("closing output compression pipe in rollover_finish()");
+	  exit (1);
+	}
+      i= stat (job->name, &stats);
+      if (i<0)
+	{
+	  perror ("checking filesize with stat() in rollover_finish()");
+	  len= 0;
+	}
+      else
+	len= stats.st_size;
+      printf ("compression of %s: %ld -> %ld  reduced to %.3f %%\n",
+	      job->name,
+	      /*totlen, */
+	      job->written,
+	      len, len/(double)job->written*100);
+    }
+  else
+    {
+      struct stat  stats;
+
+      if (direct)
+	direct_close ();
+      else if (fflush (job->f)!=0)
+	{
+	  perror ("flushing file in rollover_finish()");
+	  exit (1);
+	}
+      /* frees what fallocate() has reserved beyond the end, only regular
+	 files have been preallocated (not e.g. /dev/null) */
+      else if (fstat (fileno (job->f), &stats)==0 && S_ISREG (stats.st_mode)
+	       && ftruncate (fileno (job->f), ftello (job->f))!=0)
+	{
+	  perror ("truncating file in rollover_finish()");
+	  exit (1);
+	}
+      j= fclose (job->f);
+      if (j!=0)
+	{
+	  perror ("closing file in rollover_finish()");
+	  exit (1);
+	}
+    }
+}
+
+
+/* the rollover thread: does the jobs in turn */
+void  *rollover_loop (void  *arg)
+{
+  struct rollover_job  job;
+  struct rollover_next  *next;
+
+  (void)arg;
+  pthread_mutex_lock (&rollover_mutex);
+  while (1)
+    {
+      while (rollover_count==0)
+	pthread_cond_wait (&rollover_cond, &rollover_mutex);
+      job= rollover_jobs[rollover_head];
+      rollover_busy= 1;
+      pthread_mutex_unlock (&rollover_mutex);
+
+      next= &rollover_nexts[job.stream];
+      if (job.what==ROLLOVER_OPEN)
+	job.f= rollover_open (job.name);
+      else
+	{
+	  rollover_finish (&job, rollover_outbuff);
+#ifdef  HAVE_ZSTD
+	  if (zstd_builtin)
+	    ZSTD_CCtx_reset (job.cctx, ZSTD_reset_session_only);
+#endif
+	}
+
+      pthread_mutex_lock (&rollover_mutex);
+      if (job.what==ROLLOVER_OPEN)
+	{
+	  next->f= job.f;
+	  next->pending= 0;
+	}
+#ifdef  HAVE_ZSTD
+      else if (zstd_builtin)
+	{
+	  if (next->spare)  /* cannot happen, only one split at a time */
+	    ZSTD_freeCCtx (job.cctx);
+	  else
+	    next->spare= job.cctx;
+	}
+#endif
+      rollover_head= (rollover_head+1)%ROLLOVER_QUEUE;
+      rollover_count--;
+      rollover_busy= 0;
+      pthread_cond_broadcast (&rollover_cond);
+    }
+  return NULL;
+}
+
+
+/* queue a job for the rollover thread (with the mutex locked) */
+void  rollover_queue (struct rollover_job  *job)
+{
+  while (rollover_count==ROLLOVER_QUEUE)
+    pthread_cond_wait (&rollover_cond, &rollover_mutex);
+  rollover_jobs[(rollover_head+rollover_count)%ROLLOVER_QUEUE]= *job;
+  rollover_count++;
+  pthread_cond_broadcast (&rollover_cond);
+}
+
+
+/* after writing: open the next file once this one is half full */
+void  rollover_prepare ()
+{
+  struct rollover_next  *next= &rollover_nexts[demux_cur];
+  struct rollover_job  job;
+
+  if (!rollover || bytes_written_thisfile<maxfilesize/2 ||
+      next->number==filenumber)
+    return;
+  job.what= ROLLOVER_OPEN;
+  job.stream= demux_cur;
+  file_name (job.name, sizeof (job.name), start_file_timestamp, filenumber);
+  pthread_mutex_lock (&rollover_mutex);
+  strcpy (next->name, job.name);
+  next->number= filenumber;
+  next->pending= 1;
+  rollover_queue (&job);
+  pthread_mutex_unlock (&rollover_mutex);
+}
+
+
+/* the file opened ahead if it is this one, otherwise NULL */
+FILE  *rollover_take (char  *name)
+{
+  struct rollover_next  *next= &rollover_nexts[demux_cur];
+  FILE  *f= NULL;
+
+  if (!rollover)
+    return NULL;
+  pthread_mutex_lock (&rollover_mutex);
+  while (next->pending)  /* the disk is slow, but it is almost there */
+    pthread_cond_wait (&rollover_cond, &rollover_mutex);
+  if (next->f && strcmp (next->name, name)==0)
+    {
+      f= next->f;
+      next->f= NULL;
+    }
+  pthread_mutex_unlock (&rollover_mutex);
+  return f;
+}
+
+
+/* hand the current file over to the rollover thread, the next one starts
+   at once */
+void  rollover_close ()
+{
+  struct rollover_job  job;
+
+  job.what= ROLLOVER_CLOSE;
+  job.stream= demux_cur;
+  job.f= outf;
+  strcpy (job.name, thisfilename);
+  job.written= bytes_written_thisfile;
+  job.compressed= bytes_compressed_thisfile;
+  pthread_mutex_lock (&rollover_mutex);
+#ifdef  HAVE_ZSTD
+  job.cctx= zstd_cctx;
+  job.seek= zstd_seek;
+  memset (&zstd_seek, 0, sizeof (zstd_seek));  /* for the next file */
+  if (zstd_builtin)
+    {
+      zstd_cctx= rollover_nexts[demux_cur].spare;
+      rollover_nexts[demux_cur].spare= NULL;
+    }
+#endif
+  rollover_queue (&job);
+  pthread_mutex_unlock (&rollover_mutex);
+#ifdef  HAVE_ZSTD
+  if (zstd_builtin && zstd_cctx==NULL)  /* the first split */
+    zstd_cctx= zstd_new_cctx ();
+#endif
+}
+
+
+/* wait until all jobs are done, the file opened ahead on this port is not
+   needed any more */
+void  rollover_drain ()
+{
+  struct rollover_next  *next= &rollover_nexts[demux_cur];
+
+  if (!rollover)
+    return;
+  pthread_mutex_lock (&rollover_mutex);
+  while (rollover_count)
+    pthread_cond_wait (&rollover_cond, &rollover_mutex);
+  if (next->f)
+    {
+      if (compress && !zstd_builtin)
+	pclose (next->f);
+      else
+	fclose (next->f);
+      unlink (next->name);
+      next->f= NULL;
+    }
+  next->number= -1;
+  pthread_mutex_unlock (&rollover_mutex);
+}
+
+
+void  rollover_init ()
+{
+  int  j;
+
+  if (maxfilesize<=0 || direct || nstripes || !dowrite ||
+      strcmp (filename, "/dev/null")==0)
+    return;
+  for (j= 0; j<MAXNSOCK; j++)
+    rollover_nexts[j].number= -1;
+#ifdef  HAVE_ZSTD
+  if (zstd_builtin)
+    {
+      rollover_outbuff= malloc (zstd_outsize);
+      if (rollover_outbuff==NULL)
+	{
+	  fprintf (stderr, "cannot allocate rollover buffer\n");
+	  exit (1);
+	}
+    }
+#endif
+  j= pthread_create (&rollover_thread, NULL, rollover_loop, NULL);
+  if (j)
+    {
+      errno= j;
+      perror ("pthread_create for rollover");
+      exit (1);
+    }
+  rollover= 1;
+}
 
-		  ==2  /* discard only of we really want to stop */
 
 
-		  )
-		{
-		  if (verbose)
-		    printf ("discarding packet\n");
-		}
-	      else
-	      {
-		/* now we have a packet either from socket or from stdin */
-		  if (packlen==0 || thissize==packlen)
-		    /* good size, or size does not matter */
-		    
-		    {
+/* striped output: writing the chunks (see above) */
+
+/* write a chunk to the file of stripe s (in its thread) */
+void  stripe_write (struct stripe  *s, char  *data, long  len)
+{
+#ifdef  HAVE_ZSTD
+  if (zstd_builtin)
+    {
+      overload_compress (s->cctx);
+      s->compressed+= zstd_stream (s->cctx, s->outbuff, s->f, data, len,
+				   ZSTD_e_continue);
+    }
+  else
+#endif
+  if (fwrite (data, 1, len, s->f)!=(size_t) len)
+    {
+      perror ("writing file in stripe_writer()");
+      exit (1);
+    }
+  s->written+= len;
+}
 
-		      if (do_blocklen)/*add the blocklen if wanted (two bytes) */
-			/* not tested */
-			{
-			    *(uint16_t*)buff= (uint16_t)thissize;
-			    /*thissize+= 2;  see below */
-			}
 
-		      
-		      if (do_blocklen)/* add the blocklen if wanted (two bytes) */
-			thissize+= 2;
+/* the writer thread of a stripe: writes its chunks in turn */
+void  *stripe_writer (void  *arg)
+{
+  struct stripe  *s= arg;
+  struct stripe_chunk  *c;
+  long  t0;
 
+  pthread_mutex_lock (&stripe_mutex);
+  while (1)
+    {
+      while (s->count==0)
+	pthread_cond_wait (&stripe_cond, &stripe_mutex);
+      c= &stripe_chunks[s->chunks[s->head]];
+      pthread_mutex_unlock (&stripe_mutex);
+
+      t0= metrics ? monotonic_ns () : 0;
+      stripe_write (s, c->data, c->len);
+      if (metrics)
+	count_write (c->len, t0);
+
+      pthread_mutex_lock (&stripe_mutex);
+      c->done= 1;
+      s->queued-= c->len;
+      s->head= (s->head+1)%STRIPE_QUEUE;
+      s->count--;
+      pthread_cond_broadcast (&stripe_cond);
+      vrb_wake_consumer (&ringbuffer);  /* to pass it on */
+    }
+  return NULL;
+}
 
-		      if (this_nskip[i]>0) /* skip this packet */
-			{
 
+/* pass completed chunks: the front of the ring advances for the oldest */
+void  stripe_reap ()
+{
+  long  len= 0;
 
-#if MYDEBUG>=2
-	      if (this_nskip[i]>0)
-fprintf (stderr, "SKIP: still to skip %d packets in socket %d\n",
-	 this_nskip[i], i);
-#endif
-			  
-			this_nskip[i]--;
-			}
-		      
-		      else  /* use this packet */
-
-			{
-			  
-			  if (beamformed_check)
-			    {
-			      beamformed_last_packno[i]= beamformed_packno (
-					    (struct header_lofar*)buff2);
-			      if (beamformed_first_packno[i]==-1)
-				beamformed_first_packno[i]= 
-				  beamformed_last_packno[i];
-			      if (beamformed_checkpack ((struct 
-							 header_lofar*)buff2))
-				beamformed_good_packs[i]++;
-			    }
-			  
-			  packs_seen[i]++;
-			  
-			  /* (no conflicts for rear and allbuffs) */
-			  
-		  /* locking is probably not necessary here, but anyway */
-			  pthread_mutex_lock(&region_mutex);
-			  newpoi= vrb_poi_new (&ringbuffer, thissize);
-			  sum_filllevel+= ringbuffer.fillsize
-			    /(double)ringbuffer.totsize;
-			  n_filllevel++;
-			  pthread_mutex_unlock(&region_mutex);
-			  
-			  
-			  if (newpoi==NULL)   /* not enough space */
-			    /* this should not happen for read from stdin */
-			    {
-			      /* simply drop this packet */
-			      packs_dropped[i]++;
-			    }
-			  else /* enough space */
-			    
-			    {
-			      memcpy (newpoi, buff, thissize);
-			      
-			      /* ... and then lock again here  */
-			      pthread_mutex_lock(&region_mutex);
-			      
-			      vrb_advance_new (&ringbuffer, thissize);
-			      
-			      if (ringbuffer.fillsize>maxsize)
-				maxsize= ringbuffer.fillsize;
-			      
-			      pthread_cond_signal(&data_available);
-			      pthread_mutex_unlock(&region_mutex);
-			      
-			      totlen+= thissize;
-			      
-			      bytes_written[i]+= thissize;
-			    }
-			  
-			} /* use this packet */
-		      
-		    }  /* packlen==0 || ... */
-		  else
-		    printf ("received %5d bytes, wrong length in sock %d, "
-			    "should be %d\n", thissize, i, packlen);
-	      }   /* not stopped */
-	  }  /* thissize!=0 */
-	}  /* for (i= 0; i<nsock .... */
-    } /* while (1) */
+  pthread_mutex_lock (&stripe_mutex);
+  while (sc_count && stripe_chunks[sc_head].done)
+    {
+      len+= stripe_chunks[sc_head].len;
+      sc_head= (sc_head+1)%STRIPE_CHUNKS;
+      sc_count--;
+    }
+  pthread_mutex_unlock (&stripe_mutex);
+  if (len)
+    {
+      /* this also wakes the producer if it is waiting (stdin) */
+      vrb_advance_old (&ringbuffer, len);
+      rx_latency (&ringbuffer);
+      stripe_inflight-= len;
+    }
 }
 
 
-
-void  init_thisfilestat ()
+/* the stripe for the next chunk, -1 if none can take one now (with the
+   mutex locked) */
+int  stripe_pick ()
 {
-  int  j;
+  int  j, k, best= -1;
 
-  for (j= 0; j<nsock; j++)
+  if (sc_count==STRIPE_CHUNKS)  /* wait for the oldest */
+    return -1;
+  if (!stripe_balance)
+    return stripes[stripe_next].count<STRIPE_QUEUE ? stripe_next : -1;
+  for (j= 0; j<nstripes; j++)
     {
-      beamformed_first_packno[j]= -1;
-      bytes_written[j]= packs_seen[j]= packs_dropped[j]= 
-	beamformed_good_packs[j]= 0;
+      k= (stripe_next+j)%nstripes;
+      if (stripes[k].count<STRIPE_QUEUE &&
+	  (best<0 || stripes[k].queued<stripes[best].queued))
+	best= k;
+    }
+  return best;
+}
 
-      last_packs_dropped[j]= last_packs_expected[j]= last_packs_seen[j]= 
-	last_good_packs[j]= 0;
 
-    }
+/* give len bytes at poi (whole packets, behind those in flight) to a
+   writer, waits until one can take them */
+void  stripe_give (char  *poi, long  len)
+{
+  struct stripe  *s;
+  struct stripe_chunk  *c;
+  int  k, slot;
+
+  pthread_mutex_lock (&stripe_mutex);
+  while ((k= stripe_pick ())<0)
+    pthread_cond_wait (&stripe_cond, &stripe_mutex);
+  pthread_mutex_unlock (&stripe_mutex);
+  s= &stripes[k];
+  stripe_next= (k+1)%nstripes;
+
+  index_data (poi, len);
+  index_chunk (k, s->given, len);
+  stokes_data (poi, len);
+  forward_data (poi, len);
+  s->given+= len;
+  stripe_inflight+= len;
+
+  pthread_mutex_lock (&stripe_mutex);
+  slot= (sc_head+sc_count)%STRIPE_CHUNKS;
+  c= &stripe_chunks[slot];
+  c->data= poi;
+  c->len= len;
+  c->done= 0;
+  sc_count++;
+  s->chunks[(s->head+s->count)%STRIPE_QUEUE]= slot;
+  s->count++;
+  s->queued+= len;
+  pthread_cond_broadcast (&stripe_cond);
+  pthread_mutex_unlock (&stripe_mutex);
+}
 
-  lasttotlen= totlen= 0;
-  maxsize= 0;
-  sum_filllevel= 0;
-  n_filllevel= 0;
 
+/* whether the consumer has something to do with avail bytes behind those
+   in flight */
+int  stripe_ready (long  avail)
+{
+  long  ringlen= outlen+(do_blocklen ? 2 : 0);
+
+  if (stopped)  /* the rest, or nothing is there any more */
+    return avail>=ringlen || sc_count==0;
+  return avail>=maxwrite || (avail>=ringlen && sc_count==0);
 }
 
 
-void  start_file (double  timestamp)
+/* wait for the consumer with --stripe: until there is a chunk to give or
+   we are stopped (and nothing is in flight), completed chunks are passed
+   on the way
+   returns the oldest data in the ring (also if in flight), NULL if empty */
+char  *stripe_wait ()
 {
-  char  buff[1000];
-  static double  timestamp_last= 0;
+  int  key;
 
-  if (timestamp)
-    timestamp_last= timestamp;  /* we may need this for the next part */
-  else
-    timestamp= timestamp_last;  /* then we are re-using the last */
-  
-  if (compress)
-    printf ("start compression pipe\n");
-  else
-    printf ("start file\n");
-  timestamp_to_str (timestamp, buff, sizeof (buff));
-  if (strcmp (filename, "/dev/null")==0)
+  while (1)
     {
-      strcpy (thisfilename, filename);
-      printf ("\nopening %s\n", thisfilename);
+      stripe_reap ();
+      if (stripe_ready (vrb_fillsize (&ringbuffer)-stripe_inflight))
+	break;
+      /* the writers wake us as well */
+      key= vrb_event_prepare (ringbuffer.data_event);
+      stripe_reap ();
+      if (stripe_ready (vrb_fillsize (&ringbuffer)-stripe_inflight))
+	{
+	  vrb_event_cancel (ringbuffer.data_event);
+	  break;
+	}
+      vrb_event_wait (ringbuffer.data_event, key);
     }
-  else
+  return vrb_poi_old (&ringbuffer);
+}
+
+
+/* open the files of the stripes for thisfilename */
+void  stripe_open ()
+{
+  char  buff[sizeof (thisfilename)+1000], *base;
+  struct stripe  *s;
+  int  k;
+
+  base= strrchr (thisfilename, '/');
+  base= base ? base+1 : thisfilename;
+  for (k= 0; k<nstripes; k++)
     {
-      if (filenumber>=0)
-	/*	sprintf (thisfilename, "%s_%s.%s.%s.%s%s", filename, portlist, */
-	/*hostname, comment, buff, compress ? ".zst" : ""); */
+      s= &stripes[k];
+      if (snprintf (s->name, sizeof (s->name), "%s/%s", s->dir, base)
+	  >=(int) sizeof (s->name))
+	{
+	  fprintf (stderr, "stripe file name too long: %s\n", s->name);
+	  exit (1);
+	}
+      printf ("creating %s\n", s->name);
+      if (compress && !zstd_builtin)
 	{
-	  snprintf (thisfilename, sizeof (thisfilename), "%s_%s.%s.%s_%04d%s",
-		   filename, portlist,
-		   hostname, buff, filenumber, compress ? ".zst" : "");
-	  filenumber++;
+	  snprintf (buff, sizeof (buff), compcommand, s->name);
+	  s->f= popen (buff, "w");
 	}
       else
-	snprintf (thisfilename, sizeof (thisfilename), "%s_%s.%s.%s%s",
-		  filename, portlist, hostname,
-		 buff, compress ? ".zst" : "");
-      printf ("\ncreating %s\n", thisfilename);
+	s->f= fopen (s->name, "w");
+      if (s->f==NULL)
+	{
+	  perror ("opening output file in stripe_open()");
+	  exit (1);
+	}
+#ifdef  HAVE_ZSTD
+      if (zstd_builtin)
+	ZSTD_CCtx_reset (s->cctx, ZSTD_reset_session_only);
+#endif
+      s->given= s->written= s->compressed= 0;
+    }
+}
 
+
+/* wait for the writers, then close the files of the stripes */
+void  stripe_close ()
+{
+  struct rollover_job  job;
+  int  k;
+
+  pthread_mutex_lock (&stripe_mutex);
+  for (k= 0; k<nstripes; k++)
+    while (stripes[k].count)
+      pthread_cond_wait (&stripe_cond, &stripe_mutex);
+  pthread_mutex_unlock (&stripe_mutex);
+  stripe_reap ();
+  assert (sc_count==0 && stripe_inflight==0);
+
+  memset (&job, 0, sizeof (job));
+  for (k= 0; k<nstripes; k++)
+    {
+      job.f= stripes[k].f;
+      strcpy (job.name, stripes[k].name);
+      job.written= stripes[k].written;
+      job.compressed= stripes[k].compressed;
+#ifdef  HAVE_ZSTD
+      job.cctx= stripes[k].cctx;
+      rollover_finish (&job, stripes[k].outbuff);
+#else
+      rollover_finish (&job, NULL);
+#endif
+      stripes[k].f= NULL;
     }
+}
 
-  bytes_written_thisfile= 0;
-  if (compress)
+
+/* after the options: the directories and the writer threads */
+void  stripe_init ()
+{
+  char  list[sizeof (stripe_str)], *dir, *save;
+  struct stat  stats;
+  struct stripe  *s;
+  int  j;
+
+  if (stripe_str[0]==0)
+    return;
+  strcpy (list, stripe_str);
+  for (dir= strtok_r (list, ",", &save); dir; dir= strtok_r (NULL, ",", &save))
     {
-      sprintf (buff, compcommand, thisfilename);
-      outf= popen (buff, "w");
-      if (outf==NULL)
+      if (nstripes==MAXSTRIPES || stat (dir, &stats) || !S_ISDIR (stats.st_mode))
 	{
-	  perror ("opening output compression pipe in start_file()");
+	  fprintf (stderr, "problem with stripe: %s (directories, at most "
+		   "%d)\n", dir, MAXSTRIPES);
 	  exit (1);
 	}
+      s= &stripes[nstripes++];
+      snprintf (s->dir, sizeof (s->dir), "%s", dir);
+#ifdef  HAVE_ZSTD
+      if (zstd_builtin)
+	{
+	  s->cctx= zstd_new_cctx ();
+	  s->outbuff= malloc (zstd_outsize);
+	  if (s->outbuff==NULL)
+	    {
+	      fprintf (stderr, "cannot allocate stripe buffers\n");
+	      exit (1);
+	    }
+	}
+#endif
     }
-  else
+  for (j= 0; j<nstripes; j++)
     {
-      outf= fopen (thisfilename, "w");
-      if (outf==NULL)
+      errno= pthread_create (&stripes[j].thread, NULL, stripe_writer,
+			     &stripes[j]);
+      if (errno)
 	{
-	  perror ("opening output file in start_file()");
+	  perror ("pthread_create for stripe writer");
 	  exit (1);
 	}
     }
+  do_index= 1;  /* the order of the chunks */
+  if (verbose)
+    printf ("striping over %d directories, %s\n", nstripes,
+	    stripe_balance ? "to the least busy" : "round robin");
+}
+
+
+
+/* close the output file (of this port with --demux), for a split
+   (my_stopped==-1) the next file is started */
+void  close_file (int  my_stopped)
+{
+  printf ("closing %s%s\n", thisfilename,
+	  my_stopped==-1 ? "  (split file)" : "" );
+  if (nstripes)
+    stripe_close ();
+  else if (my_stopped==-1 && rollover)
+    rollover_close ();  /* finished in the background */
+  else
+    {
+      struct rollover_job  job;
+
+      rollover_drain ();  /* in order */
+      job.f= outf;
+      strcpy (job.name, thisfilename);
+      job.written= bytes_written_thisfile;
+      job.compressed= bytes_compressed_thisfile;
+#ifdef  HAVE_ZSTD
+      job.cctx= zstd_cctx;
+      job.seek= zstd_seek;
+      memset (&zstd_seek, 0, sizeof (zstd_seek));
+      rollover_finish (&job, zstd_outbuff);
+#else
+      rollover_finish (&job, NULL);
+#endif
+    }
+  outf= NULL;
+  index_close ();
+  sephead_close ();
+  /* not for a split or the end of a dump, the stream continues */
+  if (my_stopped!=-1 && trigger_state!=TRIGGER_DONE && !control)
+    stokes_flush ();
+  if (my_stopped!=-1)
+    {
+      trigger_close ();
+      control_closed ();
+    }
+  if (my_stopped==-1)
+    /* then we stopped to start a new split-file */
+    {
+      assert (filenumber>=0);  /* otherwise bug */
+      start_file (0); /* with same name, new number */
+    }
 }
 
 
+
 void *consumer ()
 {
-  long  i, thissize;
+  long  thissize;
   char  *oldpoi;
+  struct vrb  *ring;
   int  my_stopped, old_stopped;  /* to buffer stopped internally and avoid race conditions with signal_handler()  (and don't want to lock it for too long) */
   
   while (1)
     {
 
-      pthread_mutex_lock(&region_mutex);
       /*      if (size == 0 && ! stopped)  // no data available */
 
-      while ((oldpoi=vrb_poi_old (&ringbuffer)) == NULL
+      if (direct)  /* only one ring */
+	{
+	  ring= &ringbuffer;
+	  oldpoi= direct_wait ();
+	}
+      else if (nstripes)  /* only one ring */
+	{
+	  ring= &ringbuffer;
+	  oldpoi= stripe_wait ();
+	}
+      else
+      /* all rings share the data_event of ringbuffer */
+      while ((oldpoi=consumer_poi_old (&ring)) == NULL
 	     && ! stopped)  /* no data available */
-	pthread_cond_wait(&data_available,&region_mutex); 
-      pthread_mutex_unlock(&region_mutex);
+	{
+	  int  key;
+
+	  key= vrb_event_prepare (ringbuffer.data_event);
+	  if ((oldpoi=consumer_poi_old (&ring)) != NULL || stopped)
+	    {
+	      vrb_event_cancel (ringbuffer.data_event);
+	      break;
+	    }
+	  vrb_event_wait (ringbuffer.data_event, key);
+	}
+
+      if (demux && oldpoi)  /* write to the file of this port */
+	demux_select (demux_ring (ring));
 
       /* now we have oldpoi!=NULL or stopped 
 
@@ -1233,14 +7376,25 @@ void *consumer ()
 
       
       /* also stop for filesize */
-      if (my_stopped==0 && (maxfilesize>0 && bytes_written_thisfile>maxfilesize))
+      if (my_stopped==0 && (maxfilesize>0 && bytes_written_thisfile>maxfilesize)
+	  && (!direct || split_lcm==0 || direct_pos ()%split_lcm==0))
 	my_stopped= -1;
+      if (my_stopped==0 && trigger_state==TRIGGER_DONE)
+	my_stopped= 1;  /* end of the dump (--trigger) */
+      if (my_stopped==0 && control_state==CONTROL_CLOSE)  /* --control */
+	{
+	  if (outf)
+	    my_stopped= 1;
+	  else
+	    control_closed ();
+	}
 
       /* end file if wanted  */
       if (( (my_stopped==2 && oldpoi==NULL)|| /* we want to end and buffer is empty */
 	    abs (my_stopped)==1)  /* or timeout or HUP or split file, then we do */
 	  /* not need empty buffer */
-	  && outf)  /* either this file or total:  close this file */
+	  && (outf || (demux && my_stopped!=-1 && demux_open ())))
+	  /* either this file or total:  close this file */
 	{
 	  int  j;
 	      
@@ -1255,6 +7409,8 @@ void *consumer ()
 	  if (my_stopped!=-1 || stat_per_splitfile)
 	    {
 	      final_statistics ();
+	      if (metrics)  /* before the counters are reset */
+		update_metrics (0);
 	      init_thisfilestat ();
 	    }
 
@@ -1264,57 +7420,23 @@ void *consumer ()
 	      fprintf (stderr, "SKIP: init 2: %d for nsock=%d\n", nskip, nsock);
 #endif
 	    for (int i= 0; i<nsock; i++)
-	      this_nskip[i]= nskip;  /* start new receive round */
+	      sockstat[i].this_nskip= nskip;  /* start new receive round */
 	    }
 
-	  printf ("closing %s%s\n", thisfilename,
-		  my_stopped==-1 ? "  (split file)" : "" );
-	  if (compress)
+	  if (demux && my_stopped!=-1)  /* the files of all ports */
 	    {
-	      struct stat  stats;
-	      long  len;
+	      int  cur= demux_cur;
 
-	      /* not entirely sure if pclose is flushing */
-	      j= fflush (outf);
-	      if (j)
-		perror ("fflush() output pipe");
-	      /* but don't exit */
-	      
-	      j= pclose (outf);
-	      if (j!=0)
+	      for (j= 0; j<nsock; j++)
 		{
-		  perror ("closing output compression pipe in consumer()");
-		  exit (1);
-		}
-	      i= stat (thisfilename, &stats);
-	      if (i<0)
-		{
-		  perror ("checking filesize with stat() in consumer()");
-		  len= 0;
+		  demux_select (j);
+		  if (outf)
+		    close_file (my_stopped);
 		}
-	      else
-		len= stats.st_size;
-	      printf ("compression: %ld -> %ld  reduced to %.3f %%\n",
-		      /*totlen, */
-		      bytes_written_thisfile,
-		      len, len/(double)bytes_written_thisfile*100);
+	      demux_select (cur);
 	    }
 	  else
-	    {
-	      j= fclose (outf);
-	      if (j!=0)
-		{
-		  perror ("closing file in consumer()");
-		  exit (1);
-		}
-	    }
-	  outf= NULL;
-	  if (my_stopped==-1)
-	    /* then we stopped to start a new split-file */
-	    {
-	      assert (filenumber>=0);  /* otherwise bug */
-	      start_file (0); /* with same name, new number */
-	    }
+	    close_file (my_stopped);
 	}  /* close file */
       if (my_stopped==2 && oldpoi==NULL)   /* end program (even if no file) */
 	{
@@ -1324,6 +7446,10 @@ void *consumer ()
 		  __LINE__);
 	  pthread_mutex_unlock (&mydebug_mutex);
 #endif
+	  stokes_close ();
+	  forward_close ();
+	  overload_close ();
+	  control_end ();
 	  /*exit (0);*/
 	  pthread_exit (NULL);
 	}
@@ -1354,6 +7480,8 @@ void *consumer ()
       pthread_mutex_unlock(&stopped_mutex);
 
       /* my_stopped= 0;   this is not needed */
+      if (direct || nstripes)  /* closing may have written (and removed) data */
+	oldpoi= vrb_poi_old (&ringbuffer);
       if (oldpoi==NULL)  /* then no data available, wait for next */
 	  continue;
 
@@ -1361,10 +7489,15 @@ void *consumer ()
       
       assert (oldpoi);
       
-      pthread_mutex_lock(&region_mutex);
-      thissize= ringbuffer.fillsize;
+      thissize= vrb_fillsize (ring);
       assert (thissize);
-      pthread_mutex_unlock(&region_mutex);
+
+      if (trigger_mode && trigger_state==TRIGGER_IDLE &&
+	  !trigger_hold (ring, oldpoi, thissize, my_stopped))
+	continue;  /* nothing to write yet */
+      if (control && control_state==CONTROL_IDLE &&
+	  !control_hold (ring, oldpoi, thissize, my_stopped))
+	continue;  /* no file (--control) */
       
       if (outf==NULL)  /* no file open, open it now */
         /* producer can produce in parallel */
@@ -1374,14 +7507,87 @@ void *consumer ()
 	  start_file (realtime ());
         }
 
+      if (overload)
+	overload_consume (ring, oldpoi);
 
       /* now write to disk */
 
+      if (direct)  /* aligned blocks behind those in flight */
+	{
+	  thissize= direct_chunk (thissize-direct_inflight);
+	  if (thissize==0)
+	    {
+	      if (my_stopped==2)  /* the rest cannot wait for more */
+		direct_flush (vrb_fillsize (&ringbuffer)-direct_inflight);
+	      continue;
+	    }
+	  if (metrics)
+	    {
+	      long  t0= monotonic_ns ();
+
+	      direct_write (oldpoi+direct_inflight, thissize);
+	      count_write (thissize, t0);
+	    }
+	  else
+	    direct_write (oldpoi+direct_inflight, thissize);
+	  bytes_written_thisfile+= thissize;
+	  continue;
+	}
+
+      if (nstripes)  /* whole packets behind those in flight */
+	{
+	  long  ringlen= outlen+(do_blocklen ? 2 : 0);
+
+	  thissize-= stripe_inflight;
+	  if (thissize>maxwrite)
+	    thissize= maxwrite;
+	  thissize= (thissize/ringlen)*ringlen;
+	  if (thissize==0)
+	    continue;
+	  stripe_give (oldpoi+stripe_inflight, thissize);
+	  bytes_written_thisfile+= thissize;
+	  continue;
+	}
+
       if (thissize>maxwrite)
 	  thissize= maxwrite;
 
       if (packlen)  /* only write full packages (if length known) */
-	thissize= (thissize/packlen)*packlen;
+	{
+	  long  ringlen= outlen+(do_blocklen ? 2 : 0);  /* with size header */
+
+	  thissize= (thissize/ringlen)*ringlen;
+	}
+      if (trigger_state!=TRIGGER_IDLE)
+	{
+	  thissize= trigger_limit (oldpoi, thissize);
+	  if (thissize==0)
+	    {
+	      if (my_stopped==2)  /* the rest is not needed */
+		{
+		  thissize= vrb_fillsize (ring);
+		  stokes_data (oldpoi, thissize);
+		  forward_data (oldpoi, thissize);
+		  vrb_advance_old (ring, thissize);
+		}
+	      continue;
+	    }
+	}
+      if (control)
+	{
+	  thissize= control_limit (oldpoi, thissize);
+	  if (thissize==0)  /* the file is closed first */
+	    {
+	      if (my_stopped==2)
+		{
+		  thissize= vrb_fillsize (ring);
+		  stokes_data (oldpoi, thissize);
+		  forward_data (oldpoi, thissize);
+		  vrb_advance_old (ring, thissize);
+		}
+	      continue;
+	    }
+	}
 
 #if 0
       /* some delay for tests */
@@ -1394,23 +7600,24 @@ void *consumer ()
       }
 #endif
 
-      /*oldpoi= vrb_poi_old (&ringbuffer); */
+      /*oldpoi= vrb_poi_old (ring); */
+      stokes_data (oldpoi, thissize);
+      forward_data (oldpoi, thissize);
       if (dowrite)
 	{
-	  i= fwrite (oldpoi, 1, thissize, outf);
-	  if (i!=thissize)
-	    {
-	      perror ("writing file in consumer()");
-	      exit (1);
-	    }
+	  long  t0= metrics ? monotonic_ns () : 0;
+
+	  index_data (oldpoi, thissize);
+	  write_output (oldpoi, thissize);
+	  if (metrics)
+	    count_write (thissize, t0);
 	}
       bytes_written_thisfile+= thissize;
+      rollover_prepare ();  /* the next split file */
       
-      /* ... and then lock again here (for advance) */
-      pthread_mutex_lock(&region_mutex);
-      vrb_advance_old (&ringbuffer, thissize);
-      pthread_cond_signal(&space_available);
-      pthread_mutex_unlock(&region_mutex);
+      /* this also wakes the producer if it is waiting (stdin) */
+      vrb_advance_old (ring, thissize);
+      rx_latency (ring);
     }
 }
 
@@ -1470,11 +7677,68 @@ int  determine_std_compcommand (char  *p, int  verbose)
 
 
 
+/* long options without short form, values outside the char range */
+enum {
+  OPT_BATCH= 256,
+  OPT_BATCH_TIMEOUT,
+  OPT_ZEROCOPY,
+  OPT_RXTHREADS,
+  OPT_SOCKRINGS,
+  OPT_RX_CPUS,
+  OPT_CAPTURE,
+  OPT_PACKET_RING,
+  OPT_ZSTD_WORKERS,
+  OPT_ZSTD_LEVEL,
+  OPT_ZSTD_PARAMS,
+  OPT_ZSTD_FRAME,
+  OPT_DIRECT,
+  OPT_DIRECT_DEPTH,
+  OPT_HUGEPAGES,
+  OPT_PREFAULT,
+  OPT_MLOCK,
+  OPT_NUMA_NODE,
+  OPT_INDEX,
+  OPT_REORDER,
+  OPT_FILL_MAX,
+  OPT_METRICS,
+  OPT_METRICS_INTERVAL,
+  OPT_RX_STATS,
+  OPT_CONSUMER_CPUS,
+  OPT_RX_PRIORITY,
+  OPT_BEAMLETS,
+  OPT_BITMODE,
+  OPT_REQUANT,
+  OPT_REQUANT_SCALE,
+  OPT_STOKES,
+  OPT_STOKES_INT,
+  OPT_STOKES_MODE,
+  OPT_TRIGGER,
+  OPT_TRIGGER_POST,
+  OPT_TRIGGER_PORT,
+  OPT_DEMUX,
+  OPT_SEPHEAD,
+  OPT_SHUFFLE,
+  OPT_FORWARD,
+  OPT_FORWARD_BEAMLETS,
+  OPT_FORWARD_RATE,
+  OPT_STRIPE,
+  OPT_STRIPE_BALANCE,
+  OPT_OVERLOAD,
+  OPT_OVERLOAD_LEVEL,
+  OPT_OVERLOAD_BEAMLETS,
+  OPT_OVERLOAD_BLOCK,
+  OPT_OVERLOAD_LOG,
+  OPT_CONTROL,
+};
+
+
+
+/* bench_dump_udp_ow.c includes this file for the functions only */
+#ifndef  DUMP_UDP_OW_NOMAIN
 int  main (int  argc, char  **argv)
 {
   struct sockaddr_in  addr[MAXNSOCK];
 
-  pthread_t producer_thread; 
   pthread_t consumer_thread;
 
   struct option long_options[] =
@@ -1505,6 +7769,58 @@ int  main (int  argc, char  **argv)
 #endif
       {"ip",       required_argument, 0, 'I'},
       {"skip",     required_argument, 0, 'K'},
+      {"batch",    required_argument, 0, OPT_BATCH},
+      {"batch_timeout", required_argument, 0, OPT_BATCH_TIMEOUT},
+      {"zerocopy", no_argument,       0, OPT_ZEROCOPY},
+      {"rxthreads", no_argument,      0, OPT_RXTHREADS},
+      {"sockrings", no_argument,      0, OPT_SOCKRINGS},
+      {"rx_cpus",  required_argument, 0, OPT_RX_CPUS},
+      {"consumer_cpus", required_argument, 0, OPT_CONSUMER_CPUS},
+      {"rx_priority", required_argument, 0, OPT_RX_PRIORITY},
+      {"capture",  required_argument, 0, OPT_CAPTURE},
+      {"packet_ring", required_argument, 0, OPT_PACKET_RING},
+      {"direct",   no_argument,       0, OPT_DIRECT},
+      {"direct_depth", required_argument, 0, OPT_DIRECT_DEPTH},
+      {"hugepages", no_argument,      0, OPT_HUGEPAGES},
+      {"prefault", no_argument,       0, OPT_PREFAULT},
+      {"mlock",    no_argument,       0, OPT_MLOCK},
+      {"numa_node", required_argument, 0, OPT_NUMA_NODE},
+      {"index",    no_argument,       0, OPT_INDEX},
+      {"reorder",  required_argument, 0, OPT_REORDER},
+      {"fill_max", required_argument, 0, OPT_FILL_MAX},
+      {"metrics",  required_argument, 0, OPT_METRICS},
+      {"metrics_interval", required_argument, 0, OPT_METRICS_INTERVAL},
+      {"rx_stats", no_argument, 0, OPT_RX_STATS},
+      {"beamlets", required_argument, 0, OPT_BEAMLETS},
+      {"bitmode",  required_argument, 0, OPT_BITMODE},
+      {"requant",  required_argument, 0, OPT_REQUANT},
+      {"requant_scale", required_argument, 0, OPT_REQUANT_SCALE},
+      {"stokes",   required_argument, 0, OPT_STOKES},
+      {"stokes_int", required_argument, 0, OPT_STOKES_INT},
+      {"stokes_mode", required_argument, 0, OPT_STOKES_MODE},
+      {"trigger",  required_argument, 0, OPT_TRIGGER},
+      {"trigger_post", required_argument, 0, OPT_TRIGGER_POST},
+      {"trigger_port", required_argument, 0, OPT_TRIGGER_PORT},
+      {"demux",    no_argument,       0, OPT_DEMUX},
+      {"sephead",  no_argument,       0, OPT_SEPHEAD},
+      {"shuffle",  no_argument,       0, OPT_SHUFFLE},
+      {"forward",  required_argument, 0, OPT_FORWARD},
+      {"forward_beamlets", required_argument, 0, OPT_FORWARD_BEAMLETS},
+      {"forward_rate", required_argument, 0, OPT_FORWARD_RATE},
+      {"stripe",   required_argument, 0, OPT_STRIPE},
+      {"stripe_balance", no_argument, 0, OPT_STRIPE_BALANCE},
+      {"overload", required_argument, 0, OPT_OVERLOAD},
+      {"overload_level", required_argument, 0, OPT_OVERLOAD_LEVEL},
+      {"overload_beamlets", required_argument, 0, OPT_OVERLOAD_BEAMLETS},
+      {"overload_block", required_argument, 0, OPT_OVERLOAD_BLOCK},
+      {"overload_log", required_argument, 0, OPT_OVERLOAD_LOG},
+      {"control", required_argument, 0, OPT_CONTROL},
+#ifdef  HAVE_ZSTD
+      {"zstd_workers", required_argument, 0, OPT_ZSTD_WORKERS},
+      {"zstd_level", required_argument, 0, OPT_ZSTD_LEVEL},
+      {"zstd_params", required_argument, 0, OPT_ZSTD_PARAMS},
+      {"zstd_frame", required_argument, 0, OPT_ZSTD_FRAME},
+#endif
       {0, 0, 0, 0}
     };
   char  /* *short_options= "hHvl:p:o:sb:B:m:t:S:E:d:M:ckzZ:P:n",*/
@@ -1525,11 +7841,17 @@ int  main (int  argc, char  **argv)
   /*uint32_t  dest_ip;*/
   struct in_addr  dest_ip;
 
+  int  rx_cpus[MAXNSOCK], n_rx_cpus= 0;
+
 
 
   j= 0;
   for (i= 0; i<sizeof (long_options)/sizeof (long_options[0])-1; i++)
     {
+      /* flags and long-only options have no short form (a val of 0 would
+	 also terminate the string) */
+      if (long_options[i].flag || long_options[i].val>255)
+	continue;
       short_options[j]= long_options[i].val;
       j++;
       if (long_options[i].has_arg)
@@ -1751,42 +8073,368 @@ int  main (int  argc, char  **argv)
 	case 'k':
 	  check_dropped_kernel= 1;
 	  break;
-	case 'z':
-	    compress= 1;
-	    break;
-	  case 'Z':
-	    /* compcommand= optarg; */
-	    strcpy (compcommand, optarg);
-	    if (strstr (compcommand, "%s")==NULL)
-	      {
-		fprintf (stderr, "Compression command must include '%%s' for the filename.\n");
-		c= '?';
-	      }
-	    break;
-	case 'P':
-	  if (setenv ("PATH", optarg, 1)!=0)
+	case 'z':
+	    compress= 1;
+	    break;
+	  case 'Z':
+	    /* compcommand= optarg; */
+	    strcpy (compcommand, optarg);
+	    if (strstr (compcommand, "%s")==NULL)
+	      {
+		fprintf (stderr, "Compression command must include '%%s' for the filename.\n");
+		c= '?';
+	      }
+	    break;
+	case 'P':
+	  if (setenv ("PATH", optarg, 1)!=0)
+	    {
+	      perror ("setenv");
+	      exit (1);
+	    }
+	  break;
+#ifdef  SO_BINDTODEVICE
+	case 'D':
+	  dest_device_str= optarg;
+	  break;
+#endif
+	case 'I':
+	  dest_ip_str= optarg;
+	  break;
+	case 'K':
+	  if (sscanf (optarg, "%d", &nskip)!=1 ||
+                nskip<0)
+              {
+                fprintf (stderr,
+                         "problem with skip\n");
+                c= '?';
+              }
+	    break;
+	case OPT_BATCH:
+	  if (sscanf (optarg, "%d", &nbatch)!=1 ||
+	      nbatch<1 || nbatch>1024)
+	    {
+	      fprintf (stderr,
+		       "problem with batch\n");
+	      c= '?';
+	    }
+	  break;
+	case OPT_BATCH_TIMEOUT:
+	  if (sscanf (optarg, "%lf", &batch_timeout_sec)!=1 ||
+	      batch_timeout_sec<0 || batch_timeout_sec>=1)
+	    {
+	      fprintf (stderr,
+		       "problem with batch_timeout\n");
+	      c= '?';
+	    }
+	  break;
+	case OPT_ZEROCOPY:
+	  zerocopy= 1;
+	  break;
+	case OPT_INDEX:
+	  do_index= 1;
+	  break;
+	case OPT_REORDER:
+	  if (sscanf (optarg, "%d", &reorder)!=1 ||
+	      reorder<0 || reorder>100000)
+	    {
+	      fprintf (stderr,
+		       "problem with reorder\n");
+	      c= '?';
+	    }
+	  break;
+	case OPT_METRICS:
+	  strncpy (metrics_file, optarg, sizeof (metrics_file)-1);
+	  break;
+	case OPT_METRICS_INTERVAL:
+	  if (sscanf (optarg, "%lf", &metrics_interval)!=1 ||
+	      metrics_interval<1e-3)
+	    {
+	      fprintf (stderr,
+		       "problem with metrics_interval\n");
+	      c= '?';
+	    }
+	  break;
+	case OPT_RX_STATS:
+	  rx_stats= 1;
+	  break;
+	case OPT_BEAMLETS:
+	  strncpy (beamlets_str, optarg, sizeof (beamlets_str)-1);
+	  transform= 1;
+	  break;
+	case OPT_BITMODE:
+	  if (sscanf (optarg, "%d", &in_bits)!=1 ||
+	      (in_bits!=16 && in_bits!=8 && in_bits!=4))
+	    {
+	      fprintf (stderr,
+		       "problem with bitmode\n");
+	      c= '?';
+	    }
+	  break;
+	case OPT_REQUANT:
+	  if (sscanf (optarg, "%d", &out_bits)!=1 ||
+	      (out_bits!=8 && out_bits!=4))
+	    {
+	      fprintf (stderr,
+		       "problem with requant\n");
+	      c= '?';
+	    }
+	  transform= 1;
+	  break;
+	case OPT_REQUANT_SCALE:
+	  strncpy (scales_str, optarg, sizeof (scales_str)-1);
+	  break;
+	case OPT_STOKES:
+	  strncpy (stokes_filename, optarg, sizeof (stokes_filename)-1);
+	  break;
+	case OPT_STOKES_INT:
+	  if (sscanf (optarg, "%lf", &stokes_int)!=1 || stokes_int<=0)
+	    {
+	      fprintf (stderr,
+		       "problem with stokes_int\n");
+	      c= '?';
+	    }
+	  break;
+	case OPT_STOKES_MODE:
+	  if (strcmp (optarg, "iquv")==0)
+	    stokes_mode= STOKES_IQUV;
+	  else if (strcmp (optarg, "xxyy")==0)
+	    stokes_mode= STOKES_XXYY;
+	  else
+	    {
+	      fprintf (stderr,
+		       "problem with stokes_mode\n");
+	      c= '?';
+	    }
+	  break;
+	case OPT_TRIGGER:
+	  if (sscanf (optarg, "%lf", &trigger_pre)!=1 || trigger_pre<0)
+	    {
+	      fprintf (stderr,
+		       "problem with trigger\n");
+	      c= '?';
+	    }
+	  trigger_mode= 1;
+	  break;
+	case OPT_TRIGGER_POST:
+	  if (sscanf (optarg, "%lf", &trigger_post)!=1 || trigger_post<0)
 	    {
-	      perror ("setenv");
-	      exit (1);
+	      fprintf (stderr,
+		       "problem with trigger_post\n");
+	      c= '?';
 	    }
 	  break;
-#ifdef  SO_BINDTODEVICE
-	case 'D':
-	  dest_device_str= optarg;
+	case OPT_TRIGGER_PORT:
+	  if (sscanf (optarg, "%d", &trigger_port)!=1 || trigger_port<=0 ||
+	      trigger_port>65535)
+	    {
+	      fprintf (stderr,
+		       "problem with trigger_port\n");
+	      c= '?';
+	    }
+	  break;
+	case OPT_FILL_MAX:
+	  if (sscanf (optarg, "%ld", &fill_max)!=1 || fill_max<0)
+	    {
+	      fprintf (stderr,
+		       "problem with fill_max\n");
+	      c= '?';
+	    }
+	  break;
+	case OPT_CONSUMER_CPUS:
+	  if (parse_cpulist (optarg, &consumer_cpus))
+	    {
+	      fprintf (stderr, "problem with consumer_cpus\n");
+	      c= '?';
+	    }
+	  have_consumer_cpus= 1;
+	  break;
+	case OPT_RX_PRIORITY:
+	  if (sscanf (optarg, "%d", &rx_priority)!=1 ||
+	      rx_priority<0 || rx_priority>99)
+	    {
+	      fprintf (stderr,
+		       "problem with rx_priority\n");
+	      c= '?';
+	    }
+	  break;
+	case OPT_RXTHREADS:
+	  rxthread_per_sock= 1;
+	  break;
+	case OPT_SOCKRINGS:
+	  sockrings= 1;
+	  break;
+	case OPT_DEMUX:
+	  demux= sockrings= 1;
+	  break;
+	case OPT_SEPHEAD:
+	  sephead= 1;
+	  break;
+	case OPT_SHUFFLE:
+	  sephead_shuffle= 1;
+	  break;
+	case OPT_FORWARD:
+	  strncpy (forward_str, optarg, sizeof (forward_str)-1);
+	  break;
+	case OPT_FORWARD_BEAMLETS:
+	  strncpy (forward_beamlets_str, optarg,
+		   sizeof (forward_beamlets_str)-1);
+	  break;
+	case OPT_FORWARD_RATE:
+	  if (sscanf (optarg, "%lf", &forward_rate)!=1 || forward_rate<0)
+	    {
+	      fprintf (stderr,
+		       "problem with forward_rate\n");
+	      c= '?';
+	    }
+	  break;
+	case OPT_STRIPE:
+	  strncpy (stripe_str, optarg, sizeof (stripe_str)-1);
+	  break;
+	case OPT_STRIPE_BALANCE:
+	  stripe_balance= 1;
+	  break;
+	case OPT_OVERLOAD:
+	  strncpy (overload_str, optarg, sizeof (overload_str)-1);
+	  break;
+	case OPT_OVERLOAD_LEVEL:
+	  if (sscanf (optarg, "%d", &overload_level)!=1)
+	    {
+	      fprintf (stderr,
+		       "problem with overload_level\n");
+	      c= '?';
+	    }
+	  break;
+	case OPT_OVERLOAD_BEAMLETS:
+	  strncpy (overload_beamlets_str, optarg,
+		   sizeof (overload_beamlets_str)-1);
+	  break;
+	case OPT_OVERLOAD_BLOCK:
+	  if (sscanf (optarg, "%ld", &overload_block)!=1 || overload_block<1)
+	    {
+	      fprintf (stderr,
+		       "problem with overload_block\n");
+	      c= '?';
+	    }
+	  break;
+	case OPT_OVERLOAD_LOG:
+	  strncpy (overload_logname, optarg, sizeof (overload_logname)-1);
+	  break;
+	case OPT_CONTROL:
+	  if (strlen (optarg)>=sizeof (control_path))
+	    {
+	      fprintf (stderr, "problem with control\n");
+	      c= '?';
+	    }
+	  else
+	    strcpy (control_path, optarg);
+	  break;
+	case OPT_RX_CPUS:
+	  {
+	    char  *p, *save;
+
+	    save= NULL;
+	    for (p= strtok_r (optarg, ",", &save); p;
+		 p= strtok_r (NULL, ",", &save))
+	      if (n_rx_cpus>=MAXNSOCK ||
+		  sscanf (p, "%d", &rx_cpus[n_rx_cpus])!=1 ||
+		  rx_cpus[n_rx_cpus]<0 || rx_cpus[n_rx_cpus]>=CPU_SETSIZE)
+		{
+		  fprintf (stderr, "problem with rx_cpus\n");
+		  c= '?';
+		  break;
+		}
+	      else
+		n_rx_cpus++;
+	  }
+	  break;
+	case OPT_CAPTURE:
+	  if (strcmp (optarg, "udp")==0)
+	    capture= CAPTURE_UDP;
+	  else if (strcmp (optarg, "packet")==0)
+	    capture= CAPTURE_PACKET;
+	  else
+	    {
+	      fprintf (stderr, "problem with capture (udp or packet)\n");
+	      c= '?';
+	    }
+	  break;
+	case OPT_DIRECT:
+	  direct= 1;
+	  break;
+	case OPT_DIRECT_DEPTH:
+	  if (sscanf (optarg, "%d", &direct_depth)!=1 ||
+	      direct_depth<1 || direct_depth>256)
+	    {
+	      fprintf (stderr,
+		       "problem with direct_depth\n");
+	      c= '?';
+	    }
+	  break;
+	case OPT_HUGEPAGES:
+	  vrb_hugepages= 1;
+	  break;
+	case OPT_PREFAULT:
+	  vrb_prefault= 1;
+	  break;
+	case OPT_MLOCK:
+	  vrb_mlock= vrb_prefault= 1;
+	  break;
+	case OPT_NUMA_NODE:
+	  if (strcmp (optarg, "device")==0)
+	    vrb_numa_node= -2;  /* see below */
+	  else if (sscanf (optarg, "%d", &vrb_numa_node)!=1 ||
+	      vrb_numa_node<0 || vrb_numa_node>=1024)
+	    {
+	      fprintf (stderr,
+		       "problem with numa_node\n");
+	      c= '?';
+	    }
+	  break;
+#ifdef  HAVE_ZSTD
+	case OPT_ZSTD_WORKERS:
+	  if (sscanf (optarg, "%d", &zstd_workers)!=1 ||
+	      zstd_workers<0 || zstd_workers>200)
+	    {
+	      fprintf (stderr,
+		       "problem with zstd_workers\n");
+	      c= '?';
+	    }
+	  break;
+	case OPT_ZSTD_LEVEL:
+	  if (sscanf (optarg, "%d", &zstd_level)!=1 ||
+	      zstd_level<ZSTD_minCLevel () || zstd_level>ZSTD_maxCLevel ())
+	    {
+	      fprintf (stderr,
+		       "problem with zstd_level\n");
+	      c= '?';
+	    }
+	  break;
+	case OPT_ZSTD_PARAMS:
+	  strncpy (zstd_params, optarg, sizeof (zstd_params)-1);
+	  break;
+	case OPT_ZSTD_FRAME:
+	  {
+	    double  d;
+
+	    if (sscanf (optarg, "%lf", &d)!=1 || d<=0 || d>=2e9)
+	      {
+		fprintf (stderr,
+			 "problem with zstd_frame\n");
+		c= '?';
+	      }
+	    zstd_frame= d;
+	  }
 	  break;
 #endif
-	case 'I':
-	  dest_ip_str= optarg;
+	case OPT_PACKET_RING:
+	  if (sscanf (optarg, "%lf", &packet_ring_size)!=1 ||
+	      packet_ring_size<2*PACKET_BLOCKSIZE || packet_ring_size>16e9)
+	    {
+	      fprintf (stderr,
+		       "problem with packet_ring\n");
+	      c= '?';
+	    }
 	  break;
-	case 'K':
-	  if (sscanf (optarg, "%d", &nskip)!=1 ||
-                nskip<0)
-              {
-                fprintf (stderr,
-                         "problem with skip\n");
-                c= '?';
-              }
-	    break;
 	case 'H':
 	  break;  /* is treated below */
 	default:  /* incl '?' */
@@ -1823,6 +8471,9 @@ int  main (int  argc, char  **argv)
 		   "    [--dropped_kernel/-k]    count packets dropped by kernel (may not work)\n"
 		   "                             implies --len 7824\n"
 		   "    [--compress/-z]          compress with zstd\n"
+#ifdef  HAVE_ZSTD
+		   "                             (built-in, unless --compcommand is given)\n"
+#endif
 		   "    [--compcommand/-Z]       compression command, current: %s\n"
 		   "    [--path/-P]              PATH to be used, e.g. compcommand\n"
 		   "    [--Maxfilesize/-M float] split files to this maximum size\n"
@@ -1839,10 +8490,95 @@ int  main (int  argc, char  **argv)
 #endif
 		   "    [--ip/-I name]           receive only via this destination IP\n"
 		   "    [--skip/-K n]            skip this many packets in each new receive round (not per split-file)\n"
+		   "    [--batch n]              receive up to n packets per system call, current: %d\n"
+		   "    [--batch_timeout sec]    wait this long to fill a batch, current: %f\n"
+		   "                             0: only take packets already queued\n"
+		   "    [--zerocopy]             receive directly into the ring buffer\n"
+		   "    [--rxthreads]            one receiving thread per socket\n"
+		   "    [--sockrings]            one ring buffer per socket (bufsize is split),\n"
+		   "                             requires --len\n"
+		   "    [--demux]                one file per port, --out can be a list\n"
+		   "                             (implies --sockrings)\n"
+		   "    [--rx_cpus list]         CPUs for the receiving threads, e.g. 2,3,4,5\n"
+		   "    [--consumer_cpus list]   CPUs for the writing thread, e.g. 6-7\n"
+		   "    [--rx_priority n]        SCHED_FIFO priority of the receiving threads,\n"
+		   "                             1...99, 0: normal, current: %d\n"
+		   "    [--capture engine]       udp: normal sockets, packet: mmap'd packet ring\n"
+		   "                             (AF_PACKET, root only), current: %s\n"
+		   "    [--packet_ring size]     packet ring per port, current: %.0f\n"
+		   "    [--direct]               write with O_DIRECT (through io_uring)\n"
+		   "    [--direct_depth n]       writes in flight for --direct, current: %d\n"
+		   "    [--hugepages]            ring buffer on huge pages (see vm.nr_hugepages)\n"
+		   "    [--prefault]             touch all of the ring buffer at start\n"
+		   "    [--mlock]                lock the ring buffer in memory, implies --prefault\n"
+		   "    [--numa_node n]          ring buffer memory and threads on this NUMA\n"
+		   "                             node, device: the node of --device\n"
+		   "    [--index]                write a packet index (.idx) for each file,\n"
+		   "                             requires --len or --sizehead\n"
+		   "    [--reorder n]            put packets in order in a window of n and\n"
+		   "                             fill gaps, requires --len, 0: off, current: %d\n"
+		   "    [--fill_max n]           longest gap (packets) to fill, current: %ld\n"
+		   "    [--metrics file]         live metrics in this shared memory page,\n"
+		   "                             e.g. /dev/shm/dump_16011\n"
+		   "    [--metrics_interval sec] update of the metrics, current: %f\n"
+		   "    [--rx_stats]             kernel drops over time, histograms of arrival\n"
+		   "                             jitter and latency to write, per port\n"
+		   "    [--beamlets list]        keep only these beamlets, e.g. 0-19,40-60\n"
+		   "    [--bitmode n]            bits per value in the packets (16, 8, 4),\n"
+		   "                             current: %d\n"
+		   "    [--requant n]            requantize to n bits (16->8 or 8->4)\n"
+		   "    [--requant_scale list]   factor for all or for each kept beamlet\n"
+		   "    [--stokes file]          integrate Stokes parameters into this file,\n"
+		   "                             requires --len or --sizehead\n"
+		   "    [--stokes_int sec]       integration time, current: %f\n"
+		   "    [--stokes_mode m]        iquv or xxyy, current: %s\n"
+		   "    [--trigger sec]          keep the last sec in the ring buffer, write\n"
+		   "                             only on SIGUSR1 or trigger datagram, 0: as\n"
+		   "                             much as fits, requires --len\n"
+		   "    [--trigger_post sec]     write this long after a trigger, current: %f\n"
+		   "    [--trigger_port port]    UDP port for trigger datagrams\n"
+		   "    [--sephead]              headers apart, only exceptions in filename.hdr,\n"
+		   "                             requires --len\n"
+		   "    [--shuffle]              with --sephead: payloads in byte planes\n"
+		   "    [--forward list]         also send the packets to these host:port,\n"
+		   "                             requires --len, not with --direct\n"
+		   "    [--forward_beamlets list] only these beamlets, e.g. 0-9,20-29\n"
+		   "    [--forward_rate r]       at most r bytes/s to each, 0: no limit,\n"
+		   "                             current: %.0f\n"
+		   "    [--stripe list]          write each file in chunks over these directories,\n"
+		   "                             requires --len\n"
+		   "    [--stripe_balance]       chunks to the least busy, not round robin\n"
+		   "    [--overload list]        steps by ring fill, e.g. zstd:0.5,blocks:0.9:0.6\n"
+		   "                             (zstd, beamlets, blocks), requires --len\n"
+		   "    [--overload_level n]     compression level for zstd, current: %d\n"
+		   "    [--overload_beamlets list] beamlets kept for beamlets\n"
+		   "    [--overload_block n]     packets per block for blocks, current: %ld\n"
+		   "    [--overload_log file]    changes of the steps, default stdout\n"
+		   "    [--control path]         no file until start on this Unix socket\n"
+		   "                             (start, stop, split, out, status, quit)\n"
+#ifdef  HAVE_ZSTD
+		   "    [--zstd_workers n]       built-in compression threads, current: %d\n"
+		   "    [--zstd_level n]         built-in compression level, current: %d\n"
+		   "    [--zstd_params list]     built-in compression parameters, current:\n"
+		   "                             %s\n"
+		   "    [--zstd_frame size]      seekable, frames of size bytes, requires --len\n"
+#else
+		   "    not available on this system:  [--zstd_workers n] [--zstd_level n]\n"
+		   "                                    [--zstd_params list] [--zstd_frame size]\n"
+#endif
                    "    [--help/-h]              brief help\n"
                    "    [--Help/-H]              extended help\n",
 		   argv[0], portlist, filename, packlen,
-		   timeout_sec, compcommand, bufsize, sock_bufsize, maxwrite);
+		   timeout_sec, compcommand, bufsize, sock_bufsize, maxwrite,
+		   nbatch, batch_timeout_sec, rx_priority,
+		   capture==CAPTURE_PACKET ? "packet" : "udp", packet_ring_size,
+		   direct_depth, reorder, fill_max, metrics_interval, in_bits,
+		   stokes_int, stokes_mode==STOKES_IQUV ? "iquv" : "xxyy",
+		   trigger_post, forward_rate, overload_level, overload_block
+#ifdef  HAVE_ZSTD
+		   , zstd_workers, zstd_level, zstd_params
+#endif
+		   );
 	  /*printf ("\n\n\n%c\n\n", c);*/
 	  if (c=='H')
 	    fprintf (stderr,
@@ -1878,8 +8614,140 @@ int  main (int  argc, char  **argv)
 "The compression command must include a %%s that will be replaced by the\n"
 "output filename. The standard options depend on the zstd version that\n"
 "is available.\n"
+#ifdef  HAVE_ZSTD
+"If no --compcommand is given, we compress in the programme with libzstd,\n"
+"with --zstd_workers threads, --zstd_level and --zstd_params (names as for\n"
+"--zstd= of the zstd programme, jobSize corresponds to --block-size). The\n"
+"files are the same .zst format. With --zstd_frame they are in the seekable\n"
+"format: independent frames of that many bytes (rounded down to whole\n"
+"packets), any of them can be decompressed alone, a seek table at the end\n"
+"has their sizes (see read_bfsseektable() in bfs_data.py; zstd decompresses\n"
+"the files as usual). frame_size in the .idx header says where they start.\n"
+#endif
+
 "Skipping packets is in each new file (but not split-file), and per socket.\n"
-"Skipped packets are not counted in statistics.\n",
+"Skipped packets are not counted in statistics.\n"
+"With --Maxfilesize the next file (or compression command) is opened ahead\n"
+"by another thread, plain files preallocated, and the old one is finished\n"
+"there too, so that a split does not hold up the writing (not --direct).\n"
+"With --batch packets are received with recvmmsg(), up to n per call. By\n"
+"default a call only takes the packets that are already queued. With\n"
+"--batch_timeout it waits up to that time for more packets to fill the\n"
+"batch. Statistics and --timeout are not affected.\n"
+"With --zerocopy packets are received directly into the free part of the\n"
+"ring buffer instead of being copied there. With --len and --batch a whole\n"
+"batch goes into consecutive slots, otherwise one packet at a time. Packets\n"
+"are only added to the buffer after they have been checked. If the buffer\n"
+"is full they are received and dropped as before.\n"
+"With --rxthreads each socket is received by its own thread, otherwise one\n"
+"thread serves all of them. The threads share the ring buffer (taking\n"
+"turns), or with --sockrings each socket has its own, then bufsize is split\n"
+"between them. The output is still one file, whole packets are taken from\n"
+"the rings in turn (so their order between sockets is not strictly kept).\n"
+"With --demux (implies --sockrings) each port has its own file instead, with\n"
+"the port in the name, --out can be a comma separated list of one name per\n"
+"port. --index, --compress and --Maxfilesize apply to each file.\n"
+"--timeout means no packets on any socket. --rx_cpus binds the receiving\n"
+"threads to these CPUs (in turn, the list may be shorter), --consumer_cpus\n"
+"the thread that writes (zstd workers and --compcommand inherit them). With\n"
+"--rx_priority the receiving threads run with SCHED_FIFO (root or\n"
+"CAP_SYS_NICE, see ulimit -r), keep them off the CPUs of the network\n"
+"interrupts. The placement of all threads is printed at the start.\n"
+"With --capture packet the packets are taken from a packet ring (AF_PACKET,\n"
+"TPACKET_V3) per port that the kernel fills in large blocks, bypassing the\n"
+"UDP socket buffers. It uses --device (otherwise all devices) and --ip, and\n"
+"takes only unfragmented packets. A block is handed over when full or after\n"
+"--batch_timeout (default 4 ms). --dropped_kernel then counts packets\n"
+"dropped because the packet ring was full. --batch and --zerocopy are not\n"
+"used. Statistics and output are the same as for udp.\n"
+"With --direct files are written with O_DIRECT, bypassing the page cache,\n"
+"in aligned blocks straight from the ring buffer, with up to --direct_depth\n"
+"writes in flight (io_uring if available, otherwise pwrite()). Buffer space\n"
+"is only released when a write has completed. The end of a file is padded\n"
+"and the file truncated. With --Maxfilesize and --len, files are split\n"
+"where the next can start aligned again (up to a few MB later), otherwise\n"
+"that file is written from copies. Not with --compress or --sockrings.\n"
+"--hugepages puts the ring buffer on huge pages (memfd, default huge page\n"
+"size, bufsize rounded up to it), they must be reserved beforehand, e.g.\n"
+"sysctl vm.nr_hugepages. --prefault touches all pages at the start so that\n"
+"the receiving thread never waits for a page fault, --mlock also locks them\n"
+"(see ulimit -l). --numa_node binds the memory to that node, best the one\n"
+"of the network card and the --rx_cpus (--numa_node device). Then the\n"
+"threads without --rx_cpus or --consumer_cpus run on the CPUs of that node.\n"
+"--index writes filename.idx next to each file: runs of consecutive packet\n"
+"numbers (as for --check) with their byte offset in the (uncompressed) file\n"
+"and the gaps between them, so that readers can seek to a time without\n"
+"reading the whole file (see read_bfsindex() in bfs_data.py). Best with one\n"
+"port per file, the packets of several ports interleave.\n"
+"With --reorder the packets of each port are put in the order of their\n"
+"packet numbers, waiting for a missing one until n later packets have come.\n"
+"Missing packets are replaced by zero packets with the error bit set, late\n"
+"and duplicate packets are dropped. With one port the file has constant\n"
+"stride and can be used directly as an array. Gaps of more than --fill_max\n"
+"packets are not filled. Packets still in the window when stopping may be\n"
+"lost (not at timeout, or end of stdin).\n"
+"With --metrics the counters of the printouts, their rates, the fill of the\n"
+"ring buffers, drops by the kernel and the time per write are published in\n"
+"a shared memory page, every --metrics_interval seconds, see\n"
+"read_dumper_metrics() in bfbackend.py. Use a file in /dev/shm.\n"
+"With --rx_stats the kernel passes the time of arrival and its count of\n"
+"dropped datagrams with each datagram (SO_TIMESTAMPNS, SO_RXQ_OVFL). The\n"
+"statistics then show the intervals (in seconds) with drops, a histogram of\n"
+"the arrival jitter (with --check: change of the delay after the time in the\n"
+"header, otherwise the time between packets) and of the time from arrival\n"
+"until written (sampled every ms). Not for stdin.\n"
+"--beamlets and --requant reduce the packets before they go to the ring\n"
+"buffer (requires --len, --bitmode says how they come in): only the listed\n"
+"beamlets are kept (in increasing order), with --requant the values are\n"
+"multiplied by --requant_scale, rounded and saturated to half the bits\n"
+"(with 4 bits one byte per complex value, real part in the low nibble).\n"
+"num_beamlets and the bit mode in the header are set accordingly;\n"
+"filename.sel has the beamlets that were kept and their scales (see\n"
+"read_bfssel() in bfs_data.py).\n"
+"With --stokes the packets are integrated per lane and beamlet as they are\n"
+"written (also with --nowrite) over --stokes_int seconds (whole packets),\n"
+"giving I Q U V or XX YY Re(XY) Im(XY) (XY: X times conjugate Y), means\n"
+"per time sample. The records are written once an integration is complete\n"
+"and can be followed while recording, see read_bfsstokes() in bfs_data.py.\n"
+"With --trigger nothing is written until a trigger (SIGUSR1, or a datagram\n"
+"to --trigger_port, e.g. echo go > /dev/udp/host/port): meanwhile the ring\n"
+"buffer keeps the last --trigger seconds (packet time, at most 3/4 of\n"
+"--bufsize). On a trigger they are written to a new file, followed by the\n"
+"packets up to --trigger_post seconds after the newest at the time of the\n"
+"trigger (further triggers extend this). filename.trig has the time of the\n"
+"trigger and the packet numbers and times of the first and last packet.\n"
+"With --sephead the file has only the payloads of the packets, one after\n"
+"the other, and filename.hdr the headers that are not as predicted from\n"
+"the one before (same fields, num_slices samples later), normally one per\n"
+"second. With --shuffle each payload is in byte planes of the samples.\n"
+"Both compress faster and better, bfssephead_packets() in bfs_data.py gives\n"
+"the original packets.\n"
+"With --forward the packets are also sent on as they leave the ring buffer\n"
+"(also with --nowrite), to each destination (unicast or multicast) without\n"
+"copying, with --forward_beamlets only those beamlets (of the packets in the\n"
+"ring buffer), header set accordingly. The sockets never block: what they\n"
+"do not take is dropped, as is what is over --forward_rate, and counted per\n"
+"destination (printed at the end).\n"
+"With --stripe each file is written in chunks of --maxwrite bytes (whole\n"
+"packets) over files of the same name in these directories (e.g. on\n"
+"different disks), one writer thread (and compression) each. The order of\n"
+"the chunks is in the index, unstripe_bfsfile() in bfs_data.py joins them.\n"
+"With --overload the load is shed in steps before the ring buffer is full\n"
+"(which drops packets at random): each step is on from its fill level (of\n"
+"the ring) and off below the second (default 0.2 less). zstd compresses at\n"
+"--overload_level, beamlets zeros all but --overload_beamlets, blocks drops\n"
+"whole blocks of --overload_block packets, aligned to the packet numbers.\n"
+"Every change is logged with time, port and packet number.\n"
+"With --control no file is written until a start command on the Unix socket\n"
+"at path, until stop the programme keeps running. Commands are lines, each\n"
+"answered with ok or error: start, stop, split (close, start the next file)\n"
+"[at t | packet t], out name (--out for the next files), status and quit.\n"
+"t is unix seconds or yyyy-mm-ddThh:mm:ss UTC, at is the wall clock, packet\n"
+"the first packet with this header time or later, the same on all lanes.\n"
+"Commands take effect in turn. While idle the packets are not written\n"
+"(--stokes and --forward go on). Requires --len, not with --sockrings,\n"
+"--demux, --trigger, --direct or --stripe. dumper_command() in\n"
+"bfbackend.py sends commands.\n",
 hostname
 );
 
@@ -1889,7 +8757,18 @@ hostname
     }  /* while (1) */
 
 
-  if (compress && compcommand[0]==0)  /* no command set explicitly */
+#ifdef  HAVE_ZSTD
+  if (compress && compcommand[0]==0)  /* no command: use built-in */
+    {
+      zstd_builtin= 1;
+      zstd_init ();
+      if (verbose)
+	printf ("built-in compression with libzstd %s, level %d, %d workers,"
+		" %s\n", ZSTD_versionString (), zstd_level, zstd_workers,
+		zstd_params);
+    }
+#endif
+  if (compress && !zstd_builtin && compcommand[0]==0)  /* no command set explicitly */
     {
       int  i;
 
@@ -1982,15 +8861,27 @@ hostname
       if (beamformed_check)
 	printf ("check%s beamformed statistics\n",
 		beamformed_check==2 ? "extended" : "");
+      if (nbatch>1)
+	printf ("batch %d packets, batch timeout %.6f sec\n", nbatch,
+		batch_timeout_sec);
+      if (zerocopy)
+	printf ("receive directly into ring buffer\n");
+      if (rxthread_per_sock)
+	printf ("one receiving thread per socket\n");
+      if (sockrings)
+	printf ("one ring buffer per socket\n");
+      if (capture==CAPTURE_PACKET)
+	printf ("capture with packet ring of %.0f bytes per port\n",
+		packet_ring_size);
     }
 
-  init_vrb (&ringbuffer, bufsize);
+  batch_timeout.tv_sec= batch_timeout_sec;
+  batch_timeout.tv_nsec= (long)((batch_timeout_sec-batch_timeout.tv_sec)*1e9
+				+0.5);
 
   lasttotlen= 0;
 
-  maxsize= 0;
-  sum_filllevel= 0;
-  n_filllevel= 0;
+  reset_filllevel ();
 
 
 
@@ -2056,9 +8947,13 @@ hostname
   fprintf (stderr, "SKIP: init 1: %d for nsock=%d\n", nskip, nsock);
 #endif
   for (int i= 0; i<nsock; i++)
-    this_nskip[i]= nskip;  /* start new receive round */
+    sockstat[i].this_nskip= nskip;  /* start new receive round */
 
 
+  outlen= packlen;
+  if (transform)
+    transform_init ();
+
   if (nsock==1 && portnos[0]==0)   /* then read stdin */
     {
       if (packlen==0)
@@ -2072,7 +8967,182 @@ hostname
 		   "--Start, --End, --duration.\n");
 	  exit (1);
 	}
+      rxthread_per_sock= sockrings= 0;  /* only one "socket" anyway */
+      if (capture==CAPTURE_PACKET || rx_stats)
+	{
+	  fprintf (stderr, "Reading from stdin is not compatible with "
+		   "--capture packet, --rx_stats.\n");
+	  exit (1);
+	}
+    }
+
+  if (direct && (compress || sockrings))
+    {
+      fprintf (stderr, "--direct cannot be used with --compress or "
+	       "--sockrings.\n");
+      exit (1);
+    }
+  if (direct && !dowrite)
+    direct= 0;  /* nothing to write */
+  if (direct)
+    direct_init ();
+
+  if (sockrings && packlen==0)
+    {
+      fprintf (stderr, "--sockrings requires --len.\n");
+      exit (1);
+    }
+  if (reorder && (packlen==0 || zerocopy))
+    {
+      fprintf (stderr, "--reorder requires --len, not with --zerocopy.\n");
+      exit (1);
+    }
+  if (do_index && packlen==0 && !do_blocklen)
+    {
+      fprintf (stderr, "--index requires --len or --sizehead.\n");
+      exit (1);
+    }
+  if (stokes_filename[0] && packlen==0 && !do_blocklen)
+    {
+      fprintf (stderr, "--stokes requires --len or --sizehead.\n");
+      exit (1);
+    }
+  stokes_open ();
+  if (trigger_mode && (packlen==0 || direct || sockrings))
+    {
+      fprintf (stderr, "--trigger requires --len, not with --direct or "
+	       "--sockrings.\n");
+      exit (1);
+    }
+  if (demux && nsock==1 && portnos[0]==0)
+    {
+      fprintf (stderr, "--demux cannot be used with stdin.\n");
+      exit (1);
+    }
+#ifdef  HAVE_ZSTD
+  if (zstd_frame)
+    {
+      long  ringlen= outlen+(do_blocklen ? 2 : 0);
+
+      if (!zstd_builtin || packlen==0)
+	{
+	  fprintf (stderr, "--zstd_frame requires built-in compression "
+		   "(--compress without --compcommand) and --len.\n");
+	  exit (1);
+	}
+      zstd_frame= zstd_frame/ringlen*ringlen;  /* whole packets */
+      if (zstd_frame==0)
+	zstd_frame= ringlen;
+      if (verbose)
+	printf ("seekable zstd frames of %ld bytes\n", zstd_frame);
+    }
+#endif
+  if (stripe_str[0] && (packlen==0 || direct || sockrings || trigger_mode ||
+#ifdef  HAVE_ZSTD
+			zstd_frame ||
+#endif
+			sephead))
+    {
+      fprintf (stderr, "--stripe requires --len, not with --direct, "
+	       "--sockrings, --demux, --trigger, --zstd_frame or --sephead.\n");
+      exit (1);
+    }
+  stripe_init ();
+  overload_init ();
+  control_init ();
+  rx_select ();
+  if (demux)
+    demux_init (strdup (filename));
+  rollover_init ();
+  if ((sephead && (packlen==0 || do_blocklen || direct)) ||
+      (sephead_shuffle && !sephead))
+    {
+      fprintf (stderr, "--sephead requires --len, not with --sizehead or "
+	       "--direct, --shuffle requires --sephead.\n");
+      exit (1);
+    }
+  if (forward_str[0] && (packlen==0 || direct))
+    {
+      fprintf (stderr, "--forward requires --len, not with --direct.\n");
+      exit (1);
+    }
+  forward_init ();
+  if (zerocopy && rxthread_per_sock && nsock>1 && !sockrings)
+    {
+      fprintf (stderr, "--zerocopy with --rxthreads requires --sockrings.\n");
+      exit (1);
+    }
+
+
+  /* NUMA node of the network card, and the CPUs of the node */
+  if (vrb_numa_node==-2)
+    {
+#ifdef  SO_BINDTODEVICE
+      if (dest_device_str==NULL)
+#endif
+	{
+	  fprintf (stderr, "--numa_node device requires --device.\n");
+	  exit (1);
+	}
+#ifdef  SO_BINDTODEVICE
+      vrb_numa_node= device_numa_node (dest_device_str);
+      if (vrb_numa_node<0)
+	printf ("NUMA node of device %s not known, no placement\n",
+		dest_device_str);
+      else
+	printf ("device %s is on NUMA node %d\n", dest_device_str,
+		vrb_numa_node);
+#endif
+    }
+  if (vrb_numa_node>=0)
+    {
+      if (node_cpus (vrb_numa_node, &numa_cpus))
+	{
+	  fprintf (stderr, "cannot read the CPUs of NUMA node %d\n",
+		   vrb_numa_node);
+	  exit (1);
+	}
+      have_numa_cpus= 1;
+    }
+
+
+  /* ring buffers */
+  if (sockrings)
+    nrings= nsock;
+  for (i= 0; i<nrings; i++)
+    {
+      rings[i]= i ? &moreringbuffers[i-1] : &ringbuffer;
+      init_vrb (rings[i], bufsize/nrings);
+      vrb_share_data_event (rings[i], &ringbuffer);
+    }
+  for (i= 0; i<nsock; i++)
+    sockring[i]= rings[sockrings ? i : 0];
+  if (reorder)
+    reorder_init ();
+  if (verbose && nrings>1)
+    printf ("%d ring buffers of %ld bytes\n", nrings, ringbuffer.totsize);
+  if ((verbose && (vrb_hugepages || vrb_prefault)) || vrb_numa_node>=0)
+    {
+      printf ("ring buffer memory:%s%s%s", vrb_hugepages ? " huge pages" : "",
+	      vrb_prefault ? " prefaulted" : "", vrb_mlock ? " locked" : "");
+      if (vrb_numa_node>=0)
+	printf (" on node %d", vrb_numa_node);
+      printf ("\n");
+    }
+
+
+  /* receiving threads and their sockets */
+  if (rxthread_per_sock)
+    nrxthreads= nsock;
+  for (i= 0; i<nrxthreads; i++)
+    {
+      rxthreads[i].first= rxthread_per_sock ? i : 0;
+      rxthreads[i].n= rxthread_per_sock ? 1 : nsock;
+      rxthreads[i].cpu= n_rx_cpus ? rx_cpus[i%n_rx_cpus] : -1;
+      if (nbatch>1 || zerocopy || rx_fast)
+	init_batch (&rxthreads[i]);
     }
+  shared_ring= nrxthreads>1 && nrings==1;
 
 
   if (start_timestamp)
@@ -2150,8 +9220,11 @@ hostname
 
 
 
-  maxsock= -1;
-  FD_ZERO (&allsocks);
+  for (i= 0; i<nrxthreads; i++)
+    {
+      rxthreads[i].maxsock= -1;
+      FD_ZERO (&rxthreads[i].socks);
+    }
 
   if (nsock==1 && portnos[0]==0)   /* then read stdin */
     printf ("reading from stdin\n");
@@ -2170,8 +9243,6 @@ hostname
 	      exit (1);
 	    }
 	  /*      printf ("sock %d %d\n", i, sock[i]); */
-	  if (sock[i]>maxsock)
-	    maxsock= sock[i];
 
 	  if (sock_bufsize>0 &&
 	      (setsockopt (sock[i], SOL_SOCKET, SO_RCVBUF, &sock_bufsize,
@@ -2192,6 +9263,34 @@ hostname
 		}
 	      assert (optlen==sizeof (siz));
 	  }
+	  if (rx_stats && capture==CAPTURE_UDP)
+	    /* per datagram: time of arrival and count of drops */
+	    {
+	      int  on= 1;
+
+	      if (setsockopt (sock[i], SOL_SOCKET, SO_TIMESTAMPNS, &on,
+			      sizeof (on)) < 0 ||
+		  setsockopt (sock[i], SOL_SOCKET, SO_RXQ_OVFL, &on,
+			      sizeof (on)) < 0)
+		{
+		  perror ("setsockopt(SO_TIMESTAMPNS/SO_RXQ_OVFL)");
+		  exit (1);
+		}
+	    }
+	  if (nbatch>1 && batch_timeout_sec>0)
+	    /* limits the wait per datagram in recvmmsg() */
+	    {
+	      struct timeval  tv;
+
+	      tv.tv_sec= batch_timeout.tv_sec;
+	      tv.tv_usec= (batch_timeout.tv_nsec+999)/1000;
+	      if (setsockopt (sock[i], SOL_SOCKET, SO_RCVTIMEO, &tv,
+			      sizeof (tv)) < 0)
+		{
+		  perror ("setsockopt(SO_RCVTIMEO)");
+		  exit (1);
+		}
+	    }
 #ifdef  SO_BINDTODEVICE
 	  if (dest_device_str &&
 	      (setsockopt (sock[i], SOL_SOCKET, SO_BINDTODEVICE,
@@ -2214,7 +9313,31 @@ hostname
 	      exit (1);
 	    }
 
-	  FD_SET (sock[i], &allsocks);
+	  if (capture==CAPTURE_PACKET)
+	    /* keep the UDP socket, but it drops everything */
+	    {
+	      struct sock_filter  code[1]= { BPF_STMT (BPF_RET|BPF_K, 0) };
+	      struct sock_fprog  prog= { 1, code };
+
+	      if (setsockopt (sock[i], SOL_SOCKET, SO_ATTACH_FILTER, &prog,
+			      sizeof (prog)) < 0)
+		{
+		  perror ("setsockopt(SO_ATTACH_FILTER)");
+		  exit (1);
+		}
+	      pktrings[i].udp_sock= sock[i];
+	      sock[i]= init_packet_socket (i, dest_device_str, dest_ip);
+	    }
+
+	  /* the receiving thread for this socket */
+	  {
+	    struct rxthread  *rx;
+
+	    rx= &rxthreads[rxthread_per_sock ? i : 0];
+	    FD_SET (sock[i], &rx->socks);
+	    if (sock[i]>rx->maxsock)
+	      rx->maxsock= sock[i];
+	  }
 	}
     }
 
@@ -2230,21 +9353,79 @@ hostname
   signal (SIGINT, signal_handler);
   signal (SIGTERM, signal_handler);
   signal (SIGHUP, signal_handler);
+  if (trigger_mode)
+    trigger_init ();
 
-  totlen= 0;
-
-  j= pthread_create(&consumer_thread,NULL,consumer,NULL);
-  if (j)
+  /* the quiet time for rx_timeout() starts now */
   {
-      perror ("pthread_create for consumer");
-      exit (1);
+    struct timespec  ts;
+
+    clock_gettime (CLOCK_MONOTONIC_COARSE, &ts);
+    for (i= 0; i<nsock; i++)
+      atomic_store (&sockstat[i].last_rx, ts.tv_sec*1000000000l+ts.tv_nsec);
   }
-  j= pthread_create(&producer_thread,NULL,producer,NULL);
-  if (j)
+
+  if (metrics_file[0])
+    init_metrics ();
+
   {
-      perror ("pthread_create for producer");
-      exit (1);
+    pthread_attr_t  attr;
+    cpu_set_t  *cpus;
+
+    cpus= have_consumer_cpus ? &consumer_cpus :
+      have_numa_cpus ? &numa_cpus : NULL;
+    thread_placement (&attr, cpus, 0, "consumer");
+    j= pthread_create(&consumer_thread,&attr,consumer,NULL);
+    if (j)
+      {
+	errno= j;
+	perror ("pthread_create for consumer");
+	exit (1);
+      }
+    pthread_attr_destroy (&attr);
+    report_placement ("writing thread", consumer_thread);
   }
+  producer_running= nrxthreads;
+  for (i= 0; i<nrxthreads; i++)
+    {
+      pthread_attr_t  attr;
+      cpu_set_t  cpus, *p;
+      char  name[50];
+
+      p= have_numa_cpus ? &numa_cpus : NULL;
+      if (rxthreads[i].cpu>=0)
+	{
+	  CPU_ZERO (&cpus);
+	  CPU_SET (rxthreads[i].cpu, &cpus);
+	  p= &cpus;
+	}
+      thread_placement (&attr, p, rx_priority, "producer");
+      j= pthread_create(&rxthreads[i].thread,&attr,producer,&rxthreads[i]);
+      if (j)
+	{
+	  errno= j;
+	  perror ("pthread_create for producer");
+	  exit (1);
+	}
+      pthread_attr_destroy (&attr);
+      sprintf (name, "receiving thread %d", i);
+      report_placement (name, rxthreads[i].thread);
+    }
+  if (metrics)
+    {
+      pthread_attr_t  attr;
+
+      thread_placement (&attr, have_consumer_cpus ? &consumer_cpus :
+			have_numa_cpus ? &numa_cpus : NULL, 0, "metrics");
+      j= pthread_create (&metrics_thread, &attr, metrics_loop, NULL);
+      if (j)
+	{
+	  errno= j;
+	  perror ("pthread_create for metrics");
+	  exit (1);
+	}
+      pthread_attr_destroy (&attr);
+    }
 
   j= pthread_join(consumer_thread,NULL);
   if (j)
@@ -2268,9 +9449,12 @@ hostname
 	  printf ("MYDEBUG line %d  ask producer to cancel\n", __LINE__);
 	  pthread_mutex_unlock (&mydebug_mutex);
       
-	  j= pthread_cancel (producer_thread);
-	  if (j)
-	    perror ("cancel producer");
+	  for (i= 0; i<nrxthreads; i++)
+	    {
+	      j= pthread_cancel (rxthreads[i].thread);
+	      if (j && j!=ESRCH)
+		perror ("cancel producer");
+	    }
 	}
       else
 	{
@@ -2282,17 +9466,28 @@ hostname
     }
 	  
 
-  /* wait until it really has finished */
-  j= pthread_join(producer_thread,NULL);
-  if (j)
-  {
-      perror ("pthread_join");
-      exit (1);
-  }
+  /* wait until they really have finished */
+  for (i= 0; i<nrxthreads; i++)
+    {
+      j= pthread_join(rxthreads[i].thread,NULL);
+      if (j)
+	{
+	  perror ("pthread_join");
+	  exit (1);
+	}
+    }
 
 
   
-  free_vrb (&ringbuffer);
+  if (metrics)  /* the last values stay */
+    {
+      pthread_cancel (metrics_thread);
+      pthread_join (metrics_thread, NULL);
+      update_metrics (1);
+    }
+
+  for (i= 0; i<nrings; i++)
+    free_vrb (rings[i]);
 
 
   
@@ -2305,3 +9500,4 @@ hostname
 
   return 0;
 }
+#endif  /* DUMP_UDP_OW_NOMAIN */
@@ -0,0 +1,502 @@
+/*
+
+gcc -Wall -O -o gen_udp_ow gen_udp_ow.c -lm
+
+synthetic LOFAR beamformed packets at (close to) line rate, as a source for
+tests and benchmarks of dump_udp_ow_17 (see bench_udp_ow.py), instead of
+
+dd ... | throttle -w 1 -M 100 -s 7824 | socat -b 7824 -u STDIN UDP-DATAGRAM:localhost:16011
+
+e.g. 4 lanes at the rate of a station (200 MHz clock, 12207 packets/s each):
+
+./gen_udp_ow --ports 16011x4 --duration 10
+
+./gen_udp_ow --ports 16011 --rate 0 --count 1000000 --loss 1e-4 --reorder 1e-3
+
+Each lane (port) gets its own rsp_id. The header_lofar progresses as for a
+station: packet n of all lanes starts at block 16*n, timestamp is the second
+and sequence the block in that second (as in beamformed_packno() of
+dump_udp_ow_17.c). The payload is taken at changing offsets from a block of
+random values (with the range of --bitmode), so that it does not cost time.
+Packets are sent with sendmmsg() in batches of up to --batch, paced to
+--rate packets per second and lane (0: as fast as possible): every packet
+number has its due time and a batch only takes the packets that are due, so
+at a set rate the lanes send one packet each at a time, not --batch packets
+at once (more only to catch up when late). --loss drops packets
+at random (their numbers are skipped), --reorder swaps a packet with one of
+the next --reorder_depth (in the same batch).
+
+*/
+
+#define _GNU_SOURCE
+#include  <stdio.h>
+#include  <stdlib.h>
+#include  <stdint.h>
+#include  <string.h>
+#include  <errno.h>
+#include  <math.h>
+#include  <time.h>
+#include  <unistd.h>
+#include  <getopt.h>
+#include  <sys/socket.h>
+#include  <sys/uio.h>
+#include  <netinet/in.h>
+#include  <arpa/inet.h>
+#include  <netdb.h>
+
+#define  MAXLANES  64
+#define  MAXBATCH  1024
+#define  MAXLEN  9000
+#define  MAXBEAMLETS  244  /* as in dump_udp_ow_17.c */
+#define  SLICES  16
+#define  PATTERN  (1<<20)  /* random payload, plus MAXLEN */
+
+
+/* as in dump_udp_ow_17.c */
+struct __attribute__((__packed__))  header_lofar
+{
+  uint8_t   version;
+  union __attribute__ ((__packed__)) {
+    struct __attribute__ ((__packed__)) {
+      unsigned int  rsp_id   : 5;
+      unsigned int  unused1  : 1;
+      unsigned int  error    : 1;
+      unsigned int  is200mhz : 1;
+      unsigned int  bm       : 2;
+      unsigned int  unused2  : 6;
+    } source;
+    uint16_t  source_int;
+  };
+  uint8_t   config;
+  uint16_t  station;
+  uint8_t   num_beamlets, num_slices;
+  int32_t  timestamp, sequence;
+};
+
+
+int  nlanes, portnos[MAXLANES];
+char  *host= "127.0.0.1";
+int  packlen= 7824, bits= 16, clock_mhz= 200, station= 607;
+double  rate= -1;  /* packets per second and lane, -1: as a station */
+double  duration= 0, loss= 0, reorder= 0;
+int  reorder_depth= 4, nbatch= 64, verbose= 0;
+long  count= 0;  /* packets per lane, 0: --duration */
+long  start_ts= 0;  /* first second, 0: now */
+int  sock_bufsize= 1<<22;
+
+char  pattern[PATTERN+MAXLEN];
+struct header_lofar  headers[MAXBATCH];
+struct iovec  iovs[MAXBATCH][2];
+struct mmsghdr  msgs[MAXBATCH];
+struct sockaddr_in  addr[MAXLANES];
+int  nqueued;
+long  sent, lost, swapped, send_errors, refused;
+
+
+double  monotonic ()
+{
+  struct timespec  ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec+ts.tv_nsec*1e-9;
+}
+
+
+/* "16011,16013x3" (as --ports of dump_udp_ow_17: port x number) */
+int  parse_ports (char  *list)
+{
+  char  *p= list, *end;
+  long  from, n;
+
+  nlanes= 0;
+  while (*p)
+    {
+      from= strtol (p, &end, 10);
+      n= 1;
+      if (end==p)
+	return -1;
+      if (*end=='x')
+	{
+	  p= end+1;
+	  n= strtol (p, &end, 10);
+	  if (end==p)
+	    return -1;
+	}
+      for (; n>0; n--, from++)
+	{
+	  if (nlanes==MAXLANES || from<=0 || from>65535)
+	    return -1;
+	  portnos[nlanes++]= from;
+	}
+      p= end;
+      if (*p==',')
+	p++;
+      else if (*p)
+	return -1;
+    }
+  return nlanes ? 0 : -1;
+}
+
+
+/* blocks before second t (rounded as by the station) */
+static inline long  blocks (long  t)
+{
+  return (t*clock_mhz*1000000l+512)/1024;
+}
+
+
+/* header of packet number packno (blocks 16*packno..) on lane */
+void  make_header (struct header_lofar  *h, long  packno, int  lane)
+{
+  long  block, t;
+
+  memset (h, 0, sizeof (*h));
+  h->version= 3;
+  h->source.rsp_id= lane;
+  h->source.is200mhz= clock_mhz==200;
+  h->source.bm= bits==16 ? 0 : bits==8 ? 1 : 2;
+  h->station= station;
+  h->num_beamlets= (packlen-sizeof (*h))/(SLICES*bits/2);
+  h->num_slices= SLICES;
+  block= packno*SLICES;
+  t= block*1024/(clock_mhz*1000000l);
+  while (blocks (t+1)<=block)
+    t++;
+  while (blocks (t)>block)
+    t--;
+  h->timestamp= t;
+  h->sequence= block-blocks (t);
+}
+
+
+/* send the queued packets (all of them, retry if the socket is full; one
+   refused by the destination is dropped) */
+void  flush_batch (int  sock)
+{
+  int  done= 0, n, k;
+
+  if (reorder>0)
+    for (k= 0; k<nqueued; k++)
+      if (drand48 ()<reorder)
+	{
+	  int  j= k+1+lrand48 ()%reorder_depth;
+	  struct header_lofar  h;
+	  void  *p;
+
+	  if (j>=nqueued)
+	    continue;
+	  h= headers[k];
+	  headers[k]= headers[j];
+	  headers[j]= h;
+	  p= iovs[k][1].iov_base;
+	  iovs[k][1].iov_base= iovs[j][1].iov_base;
+	  iovs[j][1].iov_base= p;
+	  p= msgs[k].msg_hdr.msg_name;
+	  msgs[k].msg_hdr.msg_name= msgs[j].msg_hdr.msg_name;
+	  msgs[j].msg_hdr.msg_name= p;
+	  swapped++;
+	}
+  while (done<nqueued)
+    {
+      n= sendmmsg (sock, msgs+done, nqueued-done, 0);
+      if (n<0)
+	{
+	  if (errno==ECONNREFUSED)  /* nobody listening yet, drop */
+	    {
+	      refused++;
+	      done++;
+	      continue;
+	    }
+	  if (errno==EINTR || errno==ENOBUFS || errno==EAGAIN)
+	    {
+	      send_errors++;
+	      continue;
+	    }
+	  perror ("sendmmsg()");
+	  exit (1);
+	}
+      done+= n;
+      sent+= n;
+    }
+  nqueued= 0;
+}
+
+
+int  main (int  argc, char  *argv[])
+{
+  int  c, sock, lane, k;
+  long  packno, first, npacks;
+  double  t0, t, elapsed, interval;
+  struct addrinfo  hints, *res;
+  static struct option  long_options[]=
+    {
+      {"ports",    required_argument, 0, 'p'},
+      {"host",     required_argument, 0, 'H'},
+      {"len",      required_argument, 0, 'l'},
+      {"bitmode",  required_argument, 0, 'b'},
+      {"clock",    required_argument, 0, 'C'},
+      {"rate",     required_argument, 0, 'r'},
+      {"count",    required_argument, 0, 'n'},
+      {"duration", required_argument, 0, 'd'},
+      {"start",    required_argument, 0, 'S'},
+      {"loss",     required_argument, 0, 'L'},
+      {"reorder",  required_argument, 0, 'R'},
+      {"reorder_depth", required_argument, 0, 'D'},
+      {"batch",    required_argument, 0, 'B'},
+      {"sock_bufsize", required_argument, 0, 'k'},
+      {"verbose",  no_argument, 0, 'v'},
+      {"help",     no_argument, 0, 'h'},
+      {0, 0, 0, 0}
+    };
+
+  if (parse_ports ("16011"))
+    abort ();
+  while ((c= getopt_long (argc, argv, "p:H:l:b:C:r:n:d:S:L:R:D:B:k:vh",
+			  long_options, NULL))!=-1)
+    {
+      switch (c)
+	{
+	case 'p':
+	  if (parse_ports (optarg))
+	    {
+	      fprintf (stderr, "problem with ports\n");
+	      c= '?';
+	    }
+	  break;
+	case 'H':
+	  host= optarg;
+	  break;
+	case 'l':
+	  if (sscanf (optarg, "%d", &packlen)!=1 ||
+	      packlen<(int) sizeof (struct header_lofar) || packlen>MAXLEN)
+	    {
+	      fprintf (stderr, "problem with len\n");
+	      c= '?';
+	    }
+	  break;
+	case 'b':
+	  if (sscanf (optarg, "%d", &bits)!=1 ||
+	      (bits!=16 && bits!=8 && bits!=4))
+	    {
+	      fprintf (stderr, "problem with bitmode\n");
+	      c= '?';
+	    }
+	  break;
+	case 'C':
+	  if (sscanf (optarg, "%d", &clock_mhz)!=1 ||
+	      (clock_mhz!=160 && clock_mhz!=200))
+	    {
+	      fprintf (stderr, "problem with clock\n");
+	      c= '?';
+	    }
+	  break;
+	case 'r':
+	  if (sscanf (optarg, "%lf", &rate)!=1 || rate<0)
+	    {
+	      fprintf (stderr, "problem with rate\n");
+	      c= '?';
+	    }
+	  break;
+	case 'n':
+	  if (sscanf (optarg, "%ld", &count)!=1 || count<=0)
+	    {
+	      fprintf (stderr, "problem with count\n");
+	      c= '?';
+	    }
+	  break;
+	case 'd':
+	  if (sscanf (optarg, "%lf", &duration)!=1 || duration<=0)
+	    {
+	      fprintf (stderr, "problem with duration\n");
+	      c= '?';
+	    }
+	  break;
+	case 'S':
+	  if (sscanf (optarg, "%ld", &start_ts)!=1 || start_ts<=0)
+	    {
+	      fprintf (stderr, "problem with start\n");
+	      c= '?';
+	    }
+	  break;
+	case 'L':
+	  if (sscanf (optarg, "%lf", &loss)!=1 || loss<0 || loss>=1)
+	    {
+	      fprintf (stderr, "problem with loss\n");
+	      c= '?';
+	    }
+	  break;
+	case 'R':
+	  if (sscanf (optarg, "%lf", &reorder)!=1 || reorder<0 || reorder>1)
+	    {
+	      fprintf (stderr, "problem with reorder\n");
+	      c= '?';
+	    }
+	  break;
+	case 'D':
+	  if (sscanf (optarg, "%d", &reorder_depth)!=1 || reorder_depth<1)
+	    {
+	      fprintf (stderr, "problem with reorder_depth\n");
+	      c= '?';
+	    }
+	  break;
+	case 'B':
+	  if (sscanf (optarg, "%d", &nbatch)!=1 || nbatch<1 ||
+	      nbatch>MAXBATCH)
+	    {
+	      fprintf (stderr, "problem with batch (1..%d)\n", MAXBATCH);
+	      c= '?';
+	    }
+	  break;
+	case 'k':
+	  if (sscanf (optarg, "%d", &sock_bufsize)!=1)
+	    {
+	      fprintf (stderr, "problem with sock_bufsize\n");
+	      c= '?';
+	    }
+	  break;
+	case 'v':
+	  verbose= 1;
+	  break;
+	}
+      if (c=='h' || c=='?')
+	{
+	  fprintf (stderr,
+		   "usage: %s\n"
+		   "    [--ports/-p list]        one lane per port, e.g. 16011x4\n"
+		   "    [--host/-H host]         destination, current: %s\n"
+		   "    [--len/-l n]             packet size, current: %d\n"
+		   "    [--bitmode/-b n]         16, 8 or 4, current: %d\n"
+		   "    [--clock/-C MHz]         160 or 200, current: %d\n"
+		   "    [--rate/-r pps]          packets per second and lane, 0: as fast\n"
+		   "                             as possible, default: as a station\n"
+		   "    [--count/-n n]           packets per lane\n"
+		   "    [--duration/-d sec]      or run for this long (of packet time)\n"
+		   "    [--start/-S sec]         timestamp of the first packet, default: now\n"
+		   "    [--loss/-L p]            drop packets with this probability\n"
+		   "    [--reorder/-R p]         swap packets with this probability ...\n"
+		   "    [--reorder_depth/-D n]   ... with one of the next n, current: %d\n"
+		   "    [--batch/-B n]           packets per sendmmsg(), current: %d\n"
+		   "    [--sock_bufsize/-k n]    socket send buffer, current: %d\n"
+		   "    [--verbose/-v]\n"
+		   "    [--help/-h]\n",
+		   argv[0], host, packlen, bits, clock_mhz, reorder_depth, nbatch,
+		   sock_bufsize);
+	  exit (c=='?');
+	}
+    }
+  if ((packlen-sizeof (struct header_lofar))%(SLICES*bits/2))
+    {
+      fprintf (stderr, "--len does not fit --bitmode (16+n*%d).\n",
+	       SLICES*bits/2);
+      exit (1);
+    }
+  if ((packlen-sizeof (struct header_lofar))/(SLICES*bits/2)>MAXBEAMLETS)
+    {
+      fprintf (stderr, "--len is more than %d beamlets at --bitmode %d "
+	       "(at most %d bytes).\n", MAXBEAMLETS, bits,
+	       (int) sizeof (struct header_lofar)+MAXBEAMLETS*SLICES*bits/2);
+      exit (1);
+    }
+
+  /* packet time */
+  interval= 1024.*SLICES/(clock_mhz*1e6);
+  if (rate<0)
+    rate= 1/interval;
+  if (count==0)
+    count= duration>0 ? ceil (duration/interval) : 10000;
+  if (start_ts==0)
+    start_ts= time (NULL);
+
+  memset (&hints, 0, sizeof (hints));
+  hints.ai_family= AF_INET;
+  hints.ai_socktype= SOCK_DGRAM;
+  if (getaddrinfo (host, NULL, &hints, &res))
+    {
+      fprintf (stderr, "unknown host %s\n", host);
+      exit (1);
+    }
+  for (lane= 0; lane<nlanes; lane++)
+    {
+      addr[lane]= *(struct sockaddr_in*)res->ai_addr;
+      addr[lane].sin_port= htons (portnos[lane]);
+    }
+  freeaddrinfo (res);
+  sock= socket (AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (sock==-1)
+    {
+      perror ("socket()");
+      exit (1);
+    }
+  if (setsockopt (sock, SOL_SOCKET, SO_SNDBUF, &sock_bufsize,
+		  sizeof (sock_bufsize)) < 0)
+    perror ("setsockopt(SO_SNDBUF)");
+
+  /* values in range for the bit mode (4 bits: both nibbles) */
+  srand48 (1);
+  for (k= 0; k<PATTERN+MAXLEN; k++)
+    pattern[k]= bits==16 ? lrand48 () : bits==8 ? (lrand48 ()%64)-32 :
+      lrand48 ();
+  for (k= 0; k<MAXBATCH; k++)
+    {
+      iovs[k][0].iov_base= &headers[k];
+      iovs[k][0].iov_len= sizeof (struct header_lofar);
+      iovs[k][1].iov_len= packlen-sizeof (struct header_lofar);
+      msgs[k].msg_hdr.msg_iov= iovs[k];
+      msgs[k].msg_hdr.msg_iovlen= 2;
+      msgs[k].msg_hdr.msg_namelen= sizeof (struct sockaddr_in);
+    }
+
+  first= (blocks (start_ts)+SLICES-1)/SLICES;
+  if (verbose)
+    printf ("%d lanes from port %d to %s, %ld packets each of %d bytes, "
+	    "%.1f packets/s per lane\n", nlanes, portnos[0], host, count,
+	    packlen, rate);
+  t0= monotonic ();
+  for (npacks= 0; npacks<count; npacks++)
+    {
+      packno= first+npacks;
+      if (rate>0)  /* send what is due, wait for this packet number */
+	{
+	  t= t0+npacks/rate-monotonic ();
+	  if (t>0)
+	    {
+	      struct timespec  ts;
+
+	      if (nqueued)
+		flush_batch (sock);
+	      t= t0+npacks/rate-monotonic ();
+	      if (t>0)
+		{
+		  ts.tv_sec= t;
+		  ts.tv_nsec= (t-ts.tv_sec)*1e9;
+		  nanosleep (&ts, NULL);
+		}
+	    }
+	}
+      for (lane= 0; lane<nlanes; lane++)
+	{
+	  if (loss>0 && drand48 ()<loss)
+	    {
+	      lost++;
+	      continue;
+	    }
+	  k= nqueued++;
+	  make_header (&headers[k], packno, lane);
+	  iovs[k][1].iov_base= pattern+
+	    ((packno*7919+lane*104729)%PATTERN/8*8);
+	  msgs[k].msg_hdr.msg_name= &addr[lane];
+	  if (nqueued==nbatch)
+	    flush_batch (sock);
+	}
+    }
+  flush_batch (sock);
+  elapsed= monotonic ()-t0;
+
+  printf ("sent %ld packets  %ld bytes  in %.3f s  %.1f packets/s  "
+	  "%.3f Gbit/s\n", sent, sent*packlen, elapsed, sent/elapsed,
+	  sent*packlen*8/elapsed/1e9);
+  printf ("lost %ld  swapped %ld  refused %ld  send errors %ld  "
+	  "packets %ld..%ld\n", lost, swapped, refused, send_errors, first,
+	  first+count-1);
+  return 0;
+}